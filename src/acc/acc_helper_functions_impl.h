@@ -495,7 +495,7 @@ void runBackProjectKernel(
 				BP.mdlX, BP.mdlInitY);
 		LAUNCH_HANDLE_ERROR(cudaGetLastError());
 #else
-	CpuKernels::backproject2D(imageCount, BP_2D_BLOCK_SIZE,
+	CpuKernels::backproject2D(imageCount, cpuKernelSize(CpuTuning::getSizes().bp_block_size, BP_2D_BLOCK_SIZE),
 				d_img_real, d_img_imag,
 				trans_x, trans_y,
 				d_weights, d_Minvsigma2s, d_ctfs,
@@ -522,7 +522,7 @@ void runBackProjectKernel(
 					imgX, imgY, imgZ, imgX*imgY*imgZ,
 					BP.mdlX, BP.mdlY, BP.mdlInitY, 	BP.mdlInitZ);
 #else
-				CpuKernels::backprojectSGD<true>(imageCount, BP_DATA3D_BLOCK_SIZE,
+				CPU_SIMD_DISPATCH(CpuKernels::backprojectSGD<true>(imageCount, cpuKernelSize(CpuTuning::getSizes().bp_block_size, BP_DATA3D_BLOCK_SIZE),
 					projector, d_img_real, d_img_imag,
 					trans_x, trans_y, trans_z,
 					d_weights, d_Minvsigma2s, d_ctfs,
@@ -530,7 +530,7 @@ void runBackProjectKernel(
 					BP.d_mdlReal, BP.d_mdlImag, BP.d_mdlWeight,
 					BP.maxR, BP.maxR2, BP.padding_factor,
 					imgX, imgY, imgZ, (size_t)imgX*(size_t)imgY*(size_t)imgZ,
-					BP.mdlX, BP.mdlY, BP.mdlInitY, 	BP.mdlInitZ, BP.mutexes);
+					BP.mdlX, BP.mdlY, BP.mdlInitY, 	BP.mdlInitZ, BP.mutexes));
 #endif
 			else
 #ifdef CUDA
@@ -544,7 +544,7 @@ void runBackProjectKernel(
 					imgX, imgY, imgZ, imgX*imgY*imgZ,
 					BP.mdlX, BP.mdlY, BP.mdlInitY, 	BP.mdlInitZ);
 #else
-				CpuKernels::backprojectSGD<false>(imageCount, BP_REF3D_BLOCK_SIZE,
+				CPU_SIMD_DISPATCH(CpuKernels::backprojectSGD<false>(imageCount, BP_REF3D_BLOCK_SIZE,
 					projector, d_img_real, d_img_imag,
 					trans_x, trans_y, trans_z,
 					d_weights, d_Minvsigma2s, d_ctfs,
@@ -552,7 +552,7 @@ void runBackProjectKernel(
 					BP.d_mdlReal, BP.d_mdlImag, BP.d_mdlWeight,
 					BP.maxR, BP.maxR2, (XFLOAT)BP.padding_factor,
 					(unsigned)imgX, (unsigned)imgY, (unsigned)imgZ, (size_t)imgX*(size_t)imgY*(size_t)imgZ,
-					(unsigned)BP.mdlX, (unsigned)BP.mdlY, BP.mdlInitY, 	BP.mdlInitZ, BP.mutexes);
+					(unsigned)BP.mdlX, (unsigned)BP.mdlY, BP.mdlInitY, 	BP.mdlInitZ, BP.mutexes));
 #endif
 		}
 		else
@@ -569,7 +569,7 @@ void runBackProjectKernel(
 					imgX, imgY, imgZ, imgX*imgY*imgZ,
 					BP.mdlX, BP.mdlY, BP.mdlInitY, 	BP.mdlInitZ);
 #else
-				CpuKernels::backproject3D<true>(imageCount,BP_DATA3D_BLOCK_SIZE,
+				CPU_SIMD_DISPATCH(CpuKernels::backproject3D<true>(imageCount, cpuKernelSize(CpuTuning::getSizes().bp_block_size, BP_DATA3D_BLOCK_SIZE),
 					d_img_real, d_img_imag,
 					trans_x, trans_y, trans_z,
 					d_weights, d_Minvsigma2s, d_ctfs,
@@ -577,7 +577,7 @@ void runBackProjectKernel(
 					BP.d_mdlReal, BP.d_mdlImag, BP.d_mdlWeight,
 					BP.maxR, BP.maxR2, (XFLOAT)BP.padding_factor,
 					(unsigned)imgX, (unsigned)imgY, (unsigned)imgZ, (size_t)imgX*(size_t)imgY*(size_t)imgZ,
-					(unsigned)BP.mdlX, (unsigned)BP.mdlY, BP.mdlInitY, 	BP.mdlInitZ, BP.mutexes);
+					(unsigned)BP.mdlX, (unsigned)BP.mdlY, BP.mdlInitY, 	BP.mdlInitZ, BP.mutexes));
 #endif
 			else
 #ifdef CUDA
@@ -602,7 +602,7 @@ void runBackProjectKernel(
 					(unsigned)imgX, (unsigned)imgY, (unsigned)imgZ, (size_t)imgX*(size_t)imgY*(size_t)imgZ,
 					(unsigned)BP.mdlX, (unsigned)BP.mdlY, BP.mdlInitY, 	BP.mdlInitZ, BP.mutexes);
 #else
-				CpuKernels::backproject3D<false>(imageCount,BP_REF3D_BLOCK_SIZE,
+				CPU_SIMD_DISPATCH(CpuKernels::backproject3D<false>(imageCount,BP_REF3D_BLOCK_SIZE,
 					d_img_real, d_img_imag,
 					trans_x, trans_y, trans_z,
 					d_weights, d_Minvsigma2s, d_ctfs,
@@ -610,7 +610,7 @@ void runBackProjectKernel(
 					BP.d_mdlReal, BP.d_mdlImag, BP.d_mdlWeight,
 					BP.maxR, BP.maxR2, (XFLOAT)BP.padding_factor,
 					(unsigned)imgX, (unsigned)imgY, (unsigned)imgZ, (size_t)imgX*(size_t)imgY*(size_t)imgZ,
-					(unsigned)BP.mdlX, (unsigned)BP.mdlY, BP.mdlInitY, 	BP.mdlInitZ, BP.mutexes);
+					(unsigned)BP.mdlX, (unsigned)BP.mdlY, BP.mdlInitY, 	BP.mdlInitZ, BP.mutexes));
 #endif
 #endif
 		} // do_sgd is false
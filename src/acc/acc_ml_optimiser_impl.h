@@ -15,6 +15,7 @@ void getFourierTransformsAndCtfs(long int my_ori_particle,
 		int ibody = 0
 		)
 {
+	ProfileScope profile_scope(PROF_EXP_FOURIER_TRANSFORMS);
 		GTIC(accMLO->timer,"getFourierTransformsAndCtfs");
 #ifdef TIMING
 	if (op.my_ori_particle == baseMLO->exp_my_first_ori_particle)
@@ -230,7 +231,7 @@ void getFourierTransformsAndCtfs(long int my_ori_particle,
 				else
 				{
 					CTIC(accMLO->timer,"ParaRead2DImages");
-					img() = baseMLO->exp_imgs[istop];
+					baseMLO->getExpImage(part_id, istop, img());
 					CTOC(accMLO->timer,"ParaRead2DImages");
 				}
 			}
@@ -890,6 +891,7 @@ void getAllSquaredDifferencesCoarse(
 	 	AccPtrFactory ptrFactory,
 	 	int ibody = 0)
 {
+	ProfileScope profile_scope(PROF_EXP_DIFF2);
 
 #ifdef TIMING
 	if (op.my_ori_particle == baseMLO->exp_my_first_ori_particle)
@@ -1165,6 +1167,7 @@ void getAllSquaredDifferencesFine(
 	int ibody,
 	std::vector<AccPtrBundle > &bundleD2)
 {
+	ProfileScope profile_scope(PROF_EXP_DIFF2);
 #ifdef TIMING
 	if (op.my_ori_particle == baseMLO->exp_my_first_ori_particle)
 		baseMLO->timer.tic(baseMLO->TIMING_ESP_DIFF2);
@@ -1346,6 +1349,9 @@ void getAllSquaredDifferencesFine(
 					chunkSize = D2F_CHUNK_DATA3D;
 				else
 					chunkSize = D2F_CHUNK_2D;
+#ifdef ALTCPU
+				chunkSize = cpuKernelSize(CpuTuning::getSizes().fine_chunk_size, chunkSize);
+#endif
 
 				// Do more significance checks on translations and create jobDivision
 				significant_num = makeJobsForDiff2Fine(	op,	sp,												// alot of different type inputs...
@@ -1510,6 +1516,7 @@ void convertAllSquaredDifferencesToWeights(unsigned exp_ipass,
 											AccPtrFactory ptrFactory,
 											int ibody)
 {
+	ProfileScope profile_scope(PROF_EXP_WEIGHTS);
 #ifdef TIMING
 	if (op.my_ori_particle == baseMLO->exp_my_first_ori_particle)
 	{
@@ -2048,6 +2055,7 @@ void storeWeightedSums(OptimisationParamters &op, SamplingParameters &sp,
 						int ibody,
 						std::vector< AccPtrBundle > &bundleSWS)
 {
+	ProfileScope profile_scope(PROF_EXP_WSUM);
 #ifdef TIMING
 	if (op.my_ori_particle == baseMLO->exp_my_first_ori_particle)
 		baseMLO->timer.tic(baseMLO->TIMING_ESP_WSUM);
@@ -2960,6 +2968,7 @@ void storeWeightedSums(OptimisationParamters &op, SamplingParameters &sp,
 template <class MlClass>
 void accDoExpectationOneParticle(MlClass *myInstance, unsigned long my_ori_particle, int thread_id, AccPtrFactory ptrFactory)
 {
+	ProfileScope profile_scope(PROF_EXP_ONE_PARTICLE);
 	SamplingParameters sp;
 	MlOptimiser *baseMLO = myInstance->baseMLO;
 
@@ -5,6 +5,7 @@
 
 #include "src/acc/acc_backprojector.h"
 #include "src/acc/cpu/cpu_kernels/helper.h"
+#include "src/acc/cpu/cpu_kernels/cpu_simd.h"
 
 namespace CpuKernels
 {
@@ -37,7 +38,7 @@ namespace CpuKernels
 		int mdl_inity,
 		tbb::spin_mutex *mutexes);
 #else
-void backproject2D(
+static inline void backproject2D_kernel(
 		unsigned long imageCount,
 		int     block_size,
 		XFLOAT *g_img_real,
@@ -190,6 +191,62 @@ void backproject2D(
 		}  // for tid
 	} // img
 }
+
+// Only defined in cpu_backprojector.cpp, so the instruction set variants are made here rather than at the call
+void backproject2D(
+		unsigned long imageCount,
+		int     block_size,
+		XFLOAT *g_img_real,
+		XFLOAT *g_img_imag,
+		XFLOAT *g_trans_x,
+		XFLOAT *g_trans_y,
+		XFLOAT* g_weights,
+		XFLOAT* g_Minvsigma2s,
+		XFLOAT* g_ctfs,
+		unsigned long translation_num,
+		XFLOAT significant_weight,
+		XFLOAT weight_norm,
+		XFLOAT *g_eulers,
+		XFLOAT *g_model_real,
+		XFLOAT *g_model_imag,
+		XFLOAT *g_model_weight,
+		int max_r,
+		int max_r2,
+		XFLOAT padding_factor,
+		unsigned img_x,
+		unsigned img_y,
+		unsigned img_xy,
+		unsigned mdl_x,
+		int mdl_inity,
+		tbb::spin_mutex *mutexes)
+{
+	CPU_SIMD_DISPATCH(backproject2D_kernel(
+		imageCount,
+		block_size,
+		g_img_real,
+		g_img_imag,
+		g_trans_x,
+		g_trans_y,
+		g_weights,
+		g_Minvsigma2s,
+		g_ctfs,
+		translation_num,
+		significant_weight,
+		weight_norm,
+		g_eulers,
+		g_model_real,
+		g_model_imag,
+		g_model_weight,
+		max_r,
+		max_r2,
+		padding_factor,
+		img_x,
+		img_y,
+		img_xy,
+		mdl_x,
+		mdl_inity,
+		mutexes));
+}
 #endif // CPU_BP_INITIALIZE
 
 template < bool DATA3D >
@@ -495,7 +552,7 @@ void backprojectRef3D(
 		int      mdl_initz,
 		tbb::spin_mutex *mutexes);
 #else
-void backprojectRef3D(
+static inline void backprojectRef3D_kernel(
 		unsigned long imageCount,
 		XFLOAT *g_img_real,
 		XFLOAT *g_img_imag,
@@ -722,6 +779,65 @@ void backprojectRef3D(
 		} // for y direction
 	} // for img
 }
+
+void backprojectRef3D(
+		unsigned long imageCount,
+		XFLOAT *g_img_real,
+		XFLOAT *g_img_imag,
+		XFLOAT *g_trans_x,
+		XFLOAT *g_trans_y,
+		XFLOAT* g_weights,
+		XFLOAT* g_Minvsigma2s,
+		XFLOAT* g_ctfs,
+		unsigned long trans_num,
+		XFLOAT significant_weight,
+		XFLOAT weight_norm,
+		XFLOAT *g_eulers,
+		XFLOAT *g_model_real,
+		XFLOAT *g_model_imag,
+		XFLOAT *g_model_weight,
+		int     max_r,
+		int     max_r2,
+		XFLOAT   padding_factor,
+		unsigned img_x,
+		unsigned img_y,
+		unsigned img_z,
+		size_t   img_xyz,
+		unsigned mdl_x,
+		unsigned mdl_y,
+		int      mdl_inity,
+		int      mdl_initz,
+		tbb::spin_mutex *mutexes)
+{
+	CPU_SIMD_DISPATCH(backprojectRef3D_kernel(
+		imageCount,
+		g_img_real,
+		g_img_imag,
+		g_trans_x,
+		g_trans_y,
+		g_weights,
+		g_Minvsigma2s,
+		g_ctfs,
+		trans_num,
+		significant_weight,
+		weight_norm,
+		g_eulers,
+		g_model_real,
+		g_model_imag,
+		g_model_weight,
+		max_r,
+		max_r2,
+		padding_factor,
+		img_x,
+		img_y,
+		img_z,
+		img_xyz,
+		mdl_x,
+		mdl_y,
+		mdl_inity,
+		mdl_initz,
+		mutexes));
+}
 #endif
 
 template < bool DATA3D >
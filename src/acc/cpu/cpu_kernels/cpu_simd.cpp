@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "src/acc/cpu/cpu_kernels/cpu_simd.h"
+
+namespace CpuKernels
+{
+
+static const char *simd_level_names[NR_SIMD_LEVELS] = {"default", "sse4", "avx2", "avx512"};
+
+static SimdLevel supported_simd_level = SIMD_DEFAULT;
+static SimdLevel simd_level = SIMD_DEFAULT;
+static pthread_once_t simd_level_once = PTHREAD_ONCE_INIT;
+
+static void initialiseSimdLevel()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512cd") &&
+	    __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512dq") &&
+	    __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("fma"))
+		supported_simd_level = SIMD_AVX512;
+	else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		supported_simd_level = SIMD_AVX2;
+	else if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+		supported_simd_level = SIMD_SSE4;
+#endif
+	simd_level = supported_simd_level;
+
+	char *penv = getenv("RELION_CPU_SIMD");
+	if (penv != NULL)
+	{
+		SimdLevel wanted = getSimdLevelFromName(penv);
+		if (wanted < simd_level)
+			simd_level = wanted;
+	}
+}
+
+SimdLevel getSupportedSimdLevel()
+{
+	pthread_once(&simd_level_once, initialiseSimdLevel);
+	return supported_simd_level;
+}
+
+SimdLevel getSimdLevel()
+{
+	pthread_once(&simd_level_once, initialiseSimdLevel);
+	return simd_level;
+}
+
+bool setSimdLevel(SimdLevel level)
+{
+	if (level > getSupportedSimdLevel())
+		return false;
+	simd_level = level;
+	return true;
+}
+
+const char *getSimdLevelName(SimdLevel level)
+{
+	return simd_level_names[level];
+}
+
+SimdLevel getSimdLevelFromName(const char *name)
+{
+	for (int i = 0; i < NR_SIMD_LEVELS; i++)
+		if (strcmp(name, simd_level_names[i]) == 0)
+			return (SimdLevel)i;
+	return SIMD_DEFAULT;
+}
+
+} // end of namespace CpuKernels
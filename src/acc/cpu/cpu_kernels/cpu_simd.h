@@ -0,0 +1,69 @@
+#ifndef CPU_SIMD_H_
+#define CPU_SIMD_H_
+
+namespace CpuKernels
+{
+
+/*
+ * Instruction sets for which the diff2, wavg and backprojection kernels are
+ * compiled, next to the one of the rest of the program. The kernels are
+ * templates in the headers, so every variant is the same source code: the call
+ * is wrapped in CPU_SIMD_DISPATCH, which inlines the whole kernel into a lambda
+ * that is compiled for the instruction set that was selected at run time.
+ *
+ * The level is the best one that the CPU supports (found with CPUID), unless
+ * RELION_CPU_SIMD (default, sse4, avx2 or avx512) asks for a lower one.
+ */
+enum SimdLevel {SIMD_DEFAULT = 0, SIMD_SSE4 = 1, SIMD_AVX2 = 2, SIMD_AVX512 = 3};
+
+#define NR_SIMD_LEVELS 4
+
+// Best level supported by this CPU
+SimdLevel getSupportedSimdLevel();
+
+// Level used by the kernels
+SimdLevel getSimdLevel();
+
+// Use another level from now on (returns false, and does nothing, if the CPU does not support it)
+bool setSimdLevel(SimdLevel level);
+
+const char *getSimdLevelName(SimdLevel level);
+
+// Returns SIMD_DEFAULT for names that are not known
+SimdLevel getSimdLevelFromName(const char *name);
+
+} // end of namespace CpuKernels
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#define CPU_SIMD_TARGET_SSE4   "sse4.2,popcnt"
+#define CPU_SIMD_TARGET_AVX2   "avx2,fma"
+#define CPU_SIMD_TARGET_AVX512 "avx512f,avx512cd,avx512bw,avx512dq,avx512vl,avx2,fma"
+
+#define CPU_SIMD_DISPATCH(...) \
+	do { \
+		switch (CpuKernels::getSimdLevel()) \
+		{ \
+		case CpuKernels::SIMD_AVX512: \
+			[&]() __attribute__((target(CPU_SIMD_TARGET_AVX512), flatten)) { __VA_ARGS__; }(); \
+			break; \
+		case CpuKernels::SIMD_AVX2: \
+			[&]() __attribute__((target(CPU_SIMD_TARGET_AVX2), flatten)) { __VA_ARGS__; }(); \
+			break; \
+		case CpuKernels::SIMD_SSE4: \
+			[&]() __attribute__((target(CPU_SIMD_TARGET_SSE4), flatten)) { __VA_ARGS__; }(); \
+			break; \
+		default: \
+			__VA_ARGS__; \
+		} \
+	} while (0)
+
+#else
+
+// Only the default variant on other architectures and compilers
+#define CPU_SIMD_DISPATCH(...) \
+	do { __VA_ARGS__; } while (0)
+
+#endif
+
+#endif
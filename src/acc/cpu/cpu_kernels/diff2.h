@@ -321,9 +321,11 @@ void diff2_coarse_3D(
 	} // for block
 }
 */
-template<bool REF3D, bool DATA3D, int block_sz, int eulers_per_block, int prefetch_fraction>
+// The number of pixels per block (block_sz) is set at run time, see CpuTuning
+template<bool REF3D, bool DATA3D, int eulers_per_block>
 void diff2_coarse(                    
 		unsigned long     grid_size,
+		int               block_sz,
 		XFLOAT *g_eulers,
 		XFLOAT *trans_x,
 		XFLOAT *trans_y,
@@ -472,6 +474,64 @@ void diff2_coarse(
 		}
 	} // block
 }
+
+// Coarse diff2 for orientation_num orientations in blocks of eulers_per_block
+// (one of 2, 4, 8, 16 or 32) orientations, and the remainder one by one
+template<bool REF3D, bool DATA3D>
+void diff2_coarse_blocks(
+		unsigned long orientation_num,
+		int block_sz,
+		int eulers_per_block,
+		XFLOAT *g_eulers,
+		XFLOAT *trans_x,
+		XFLOAT *trans_y,
+		XFLOAT *trans_z,
+		XFLOAT *g_real,
+		XFLOAT *g_imag,
+		AccProjectorKernel &projector,
+		XFLOAT *g_corr,
+		XFLOAT *g_diff2s,
+		unsigned long translation_num,
+		unsigned long image_size)
+{
+	unsigned long grid_size = orientation_num / eulers_per_block;
+	unsigned long rest = orientation_num % eulers_per_block;
+
+	if (grid_size > 0)
+	{
+		switch (eulers_per_block)
+		{
+		case 2:
+			diff2_coarse<REF3D, DATA3D, 2>(grid_size, block_sz, g_eulers, trans_x, trans_y, trans_z,
+					g_real, g_imag, projector, g_corr, g_diff2s, translation_num, image_size);
+			break;
+		case 4:
+			diff2_coarse<REF3D, DATA3D, 4>(grid_size, block_sz, g_eulers, trans_x, trans_y, trans_z,
+					g_real, g_imag, projector, g_corr, g_diff2s, translation_num, image_size);
+			break;
+		case 8:
+			diff2_coarse<REF3D, DATA3D, 8>(grid_size, block_sz, g_eulers, trans_x, trans_y, trans_z,
+					g_real, g_imag, projector, g_corr, g_diff2s, translation_num, image_size);
+			break;
+		case 16:
+			diff2_coarse<REF3D, DATA3D, 16>(grid_size, block_sz, g_eulers, trans_x, trans_y, trans_z,
+					g_real, g_imag, projector, g_corr, g_diff2s, translation_num, image_size);
+			break;
+		case 32:
+			diff2_coarse<REF3D, DATA3D, 32>(grid_size, block_sz, g_eulers, trans_x, trans_y, trans_z,
+					g_real, g_imag, projector, g_corr, g_diff2s, translation_num, image_size);
+			break;
+		default:
+			grid_size = 0;
+			rest = orientation_num;
+		}
+	}
+
+	unsigned long done = grid_size * eulers_per_block;
+	if (rest > 0)
+		diff2_coarse<REF3D, DATA3D, 1>(rest, block_sz, &g_eulers[9 * done], trans_x, trans_y, trans_z,
+				g_real, g_imag, projector, g_corr, &g_diff2s[translation_num * done], translation_num, image_size);
+}
 	
 template<bool REF3D>
 void diff2_fine_2D(
@@ -66,10 +66,6 @@
 #include "src/acc/acc_ml_optimiser_impl.h"
 
 
-#include <tbb/spin_mutex.h>
-tbb::spin_mutex      mkl_mutex;
-
-
 void MlDataBundle::setup(MlOptimiser *baseMLO)
 {
 	/*======================================================
@@ -0,0 +1,429 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <limits>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include "src/acc/cpu/cuda_stubs.h"
+
+#include "src/acc/acc_ptr.h"
+#include "src/acc/acc_projector.h"
+#include "src/acc/cpu/cpu_settings.h"
+#include "src/acc/cpu/cpu_kernels/helper.h"
+#include "src/acc/cpu/cpu_kernels/diff2.h"
+#include "src/acc/cpu/cpu_kernels/BP.h"
+#include "src/acc/cpu/cpu_kernels/cpu_simd.h"
+#include "src/acc/cpu/cpu_tuning.h"
+#include "src/euler.h"
+
+static CpuKernelSizes cpu_kernel_sizes;
+
+// Candidate sizes of the tuner
+static const int coarse_eulers_candidates[] = {2, 4, 8, 16, 32};
+static const int coarse_block_candidates[] = {32, 64, 128, 256, 512, 1024};
+static const int fine_chunk_candidates[] = {1, 2, 4, 7, 8, 12, 16, 24};
+static const int bp_block_candidates[] = {32, 64, 128, 256, 512, 1024};
+
+#define NR_TUNING_ORIENTATIONS 64
+#define NR_TUNING_TRANSLATIONS 25
+#define NR_TUNING_REPEATS 3
+// Larger boxes of 3D data would make the tuning take minutes
+#define MAX_TUNING_BOX_DATA3D 64
+
+// Synthetic reference and data of the same sizes as in a refinement, to time the kernels on
+class CpuTuningData
+{
+public:
+
+	int ref_dim, data_dim, padding;
+	int mdl_x, mdl_y, mdl_z, mdl_init, img_x, img_y, img_z, max_r;
+	unsigned long image_size, nr_orient, nr_trans;
+	std::vector<std::complex<XFLOAT> > model;
+	std::vector<XFLOAT> eulers, trans_x, trans_y, trans_z, img_real, img_imag, corr, ctfs, weights, diff2s, bp_sums;
+	std::vector<unsigned long> rot_idx, trans_idx, job_idx, job_num;
+	std::vector<tbb::spin_mutex> mutexes;
+
+	CpuTuningData(int box, int _ref_dim, int _data_dim):
+		ref_dim(_ref_dim), data_dim(_data_dim), padding(2),
+		nr_orient(NR_TUNING_ORIENTATIONS), nr_trans(NR_TUNING_TRANSLATIONS)
+	{
+		// As for a Projector of a box-sized map, and the Fourier transform of a box-sized image
+		int pad_size = 2 * (padding * (box / 2) + 1) + 1;
+		mdl_x = pad_size / 2 + 1;
+		mdl_y = pad_size;
+		mdl_z = (ref_dim == 3) ? pad_size : 1;
+		mdl_init = -(pad_size / 2);
+		img_x = box / 2 + 1;
+		img_y = box;
+		img_z = (data_dim == 3) ? box : 1;
+		max_r = box / 2 - 1;
+		image_size = (unsigned long)img_x * img_y * img_z;
+
+		model.resize((size_t)mdl_x * mdl_y * mdl_z);
+		for (size_t n = 0; n < model.size(); n++)
+			model[n] = std::complex<XFLOAT>((XFLOAT)((n * 7) % 13) / 13., (XFLOAT)((n * 5) % 11) / 11. - 0.5);
+
+		eulers.resize(9 * nr_orient);
+		for (unsigned long i = 0; i < nr_orient; i++)
+		{
+			Matrix2D<RFLOAT> A;
+			if (ref_dim == 3)
+				Euler_angles2matrix(fmod(i * 137.508, 360.), fmod(i * 57.2958, 180.), fmod(i * 23.7, 360.), A);
+			else
+				Euler_angles2matrix(0., 0., fmod(i * 23.7, 360.), A);
+			for (int j = 0; j < 9; j++)
+				eulers[9 * i + j] = MAT_ELEM(A, j / 3, j % 3);
+		}
+
+		trans_x.resize(nr_trans);
+		trans_y.resize(nr_trans);
+		trans_z.resize(nr_trans);
+		for (unsigned long i = 0; i < nr_trans; i++)
+		{
+			trans_x[i] = (XFLOAT)(i % 5 - 2) * 2. * PI / box;
+			trans_y[i] = (XFLOAT)(i / 5 - 2) * 2. * PI / box;
+			trans_z[i] = (data_dim == 3) ? trans_x[i] : 0.;
+		}
+
+		img_real.resize(image_size);
+		img_imag.resize(image_size);
+		corr.assign(image_size, 1.);
+		ctfs.resize(image_size);
+		for (unsigned long n = 0; n < image_size; n++)
+		{
+			img_real[n] = (XFLOAT)((n * 3) % 17) / 17.;
+			img_imag[n] = (XFLOAT)((n * 11) % 7) / 7. - 0.5;
+			ctfs[n] = 1. - (XFLOAT)(n % img_x) / img_x;
+		}
+
+		weights.resize(nr_orient * nr_trans);
+		for (unsigned long i = 0; i < weights.size(); i++)
+			weights[i] = (XFLOAT)(i % 3 + 1);
+		diff2s.resize(nr_orient * nr_trans);
+		bp_sums.resize(3 * model.size());
+		mutexes = std::vector<tbb::spin_mutex>(mdl_z * mdl_y);
+	}
+
+	double wallTime()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + 1e-6 * tv.tv_usec;
+	}
+
+	AccProjectorKernel makeProjector()
+	{
+		return AccProjectorKernel(mdl_x, mdl_y, (ref_dim == 3) ? mdl_z : 0, img_x, img_y, img_z,
+				mdl_init, mdl_init, padding, max_r, &model[0]);
+	}
+
+	double timeCoarse(int block_size, int eulers_per_block)
+	{
+		AccProjectorKernel projector = makeProjector();
+		double best = std::numeric_limits<double>::max();
+		for (int irep = 0; irep < NR_TUNING_REPEATS; irep++)
+		{
+			double t0 = wallTime();
+			if (data_dim == 3)
+				CPU_SIMD_DISPATCH(CpuKernels::diff2_coarse_blocks<true, true>(nr_orient, block_size, eulers_per_block,
+						&eulers[0], &trans_x[0], &trans_y[0], &trans_z[0], &img_real[0], &img_imag[0],
+						projector, &corr[0], &diff2s[0], nr_trans, image_size));
+			else if (ref_dim == 3)
+				CPU_SIMD_DISPATCH(CpuKernels::diff2_coarse_blocks<true, false>(nr_orient, block_size, eulers_per_block,
+						&eulers[0], &trans_x[0], &trans_y[0], &trans_z[0], &img_real[0], &img_imag[0],
+						projector, &corr[0], &diff2s[0], nr_trans, image_size));
+			else
+				CPU_SIMD_DISPATCH(CpuKernels::diff2_coarse_blocks<false, false>(nr_orient, block_size, eulers_per_block,
+						&eulers[0], &trans_x[0], &trans_y[0], &trans_z[0], &img_real[0], &img_imag[0],
+						projector, &corr[0], &diff2s[0], nr_trans, image_size));
+			best = XMIPP_MIN(best, wallTime() - t0);
+		}
+		return best;
+	}
+
+	double timeFine(int chunk_size)
+	{
+		AccProjectorKernel projector = makeProjector();
+
+		// Jobs of up to chunk_size translations of one orientation, as made by makeJobsForDiff2Fine()
+		rot_idx.clear();
+		trans_idx.clear();
+		job_idx.clear();
+		job_num.clear();
+		for (unsigned long iorient = 0; iorient < nr_orient; iorient++)
+			for (unsigned long itrans = 0; itrans < nr_trans; itrans++)
+			{
+				if (itrans % chunk_size == 0)
+				{
+					job_idx.push_back(rot_idx.size());
+					job_num.push_back(XMIPP_MIN(chunk_size, nr_trans - itrans));
+				}
+				rot_idx.push_back(iorient);
+				trans_idx.push_back(itrans);
+			}
+
+		double best = std::numeric_limits<double>::max();
+		for (int irep = 0; irep < NR_TUNING_REPEATS; irep++)
+		{
+			double t0 = wallTime();
+			if (data_dim == 3)
+				CPU_SIMD_DISPATCH(CpuKernels::diff2_fine_3D(job_idx.size(), &eulers[0], &img_real[0], &img_imag[0],
+						&trans_x[0], &trans_y[0], &trans_z[0], projector, &corr[0], &diff2s[0], image_size, 0.,
+						&rot_idx[0], &trans_idx[0], &job_idx[0], &job_num[0]));
+			else if (ref_dim == 3)
+				CPU_SIMD_DISPATCH(CpuKernels::diff2_fine_2D<true>(job_idx.size(), &eulers[0], &img_real[0], &img_imag[0],
+						&trans_x[0], &trans_y[0], &trans_z[0], projector, &corr[0], &diff2s[0], image_size, 0.,
+						&rot_idx[0], &trans_idx[0], &job_idx[0], &job_num[0]));
+			else
+				CPU_SIMD_DISPATCH(CpuKernels::diff2_fine_2D<false>(job_idx.size(), &eulers[0], &img_real[0], &img_imag[0],
+						&trans_x[0], &trans_y[0], &trans_z[0], projector, &corr[0], &diff2s[0], image_size, 0.,
+						&rot_idx[0], &trans_idx[0], &job_idx[0], &job_num[0]));
+			best = XMIPP_MIN(best, wallTime() - t0);
+		}
+		return best;
+	}
+
+	// Only the backprojection of 2D references and of 3D data have a block size
+	double timeBackproject(int block_size)
+	{
+		size_t mdl_size = model.size();
+		double best = std::numeric_limits<double>::max();
+		for (int irep = 0; irep < NR_TUNING_REPEATS; irep++)
+		{
+			double t0 = wallTime();
+			if (data_dim == 3)
+				CPU_SIMD_DISPATCH(CpuKernels::backproject3D<true>(nr_orient, block_size, &img_real[0], &img_imag[0],
+						&trans_x[0], &trans_y[0], &trans_z[0], &weights[0], &corr[0], &ctfs[0], nr_trans,
+						0., (XFLOAT)weights.size(), &eulers[0], &bp_sums[0], &bp_sums[mdl_size], &bp_sums[2 * mdl_size],
+						max_r, max_r * max_r, (XFLOAT)padding, img_x, img_y, img_z, image_size,
+						mdl_x, mdl_y, mdl_init, mdl_init, &mutexes[0]));
+			else
+				CpuKernels::backproject2D(nr_orient, block_size, &img_real[0], &img_imag[0],
+						&trans_x[0], &trans_y[0], &weights[0], &corr[0], &ctfs[0], nr_trans,
+						0., (XFLOAT)weights.size(), &eulers[0], &bp_sums[0], &bp_sums[mdl_size], &bp_sums[2 * mdl_size],
+						max_r, max_r * max_r, (XFLOAT)padding, img_x, img_y, image_size,
+						mdl_x, mdl_init, &mutexes[0]);
+			best = XMIPP_MIN(best, wallTime() - t0);
+		}
+		return best;
+	}
+};
+
+// Model name of the CPU from /proc/cpuinfo, without spaces
+static std::string getCpuModelName()
+{
+	std::string name = "unknown";
+	std::ifstream fh("/proc/cpuinfo");
+	std::string line;
+	while (std::getline(fh, line))
+	{
+		if (line.compare(0, 10, "model name") == 0)
+		{
+			size_t colon = line.find(':');
+			if (colon != std::string::npos)
+			{
+				std::stringstream ss(line.substr(colon + 1));
+				std::string word;
+				name = "";
+				while (ss >> word)
+					name += (name == "" ? "" : "_") + word;
+			}
+			break;
+		}
+	}
+	return name;
+}
+
+static std::string getTuningKey(int box_size, int ref_dim, int data_dim)
+{
+	std::stringstream key;
+	key << getCpuModelName() << " " << CpuKernels::getSimdLevelName(CpuKernels::getSimdLevel())
+	    << " " << box_size << " " << ref_dim << " " << data_dim;
+	return key.str();
+}
+
+// The last line for this key counts
+static bool readTuningFile(const std::string &fn, const std::string &key, CpuKernelSizes &sizes)
+{
+	std::ifstream fh(fn.c_str());
+	std::string line;
+	bool found = false;
+	std::stringstream wanted(key);
+	std::vector<std::string> wanted_words;
+	std::string word;
+	while (wanted >> word)
+		wanted_words.push_back(word);
+
+	while (std::getline(fh, line))
+	{
+		if (line.size() == 0 || line[0] == '#')
+			continue;
+		std::stringstream ss(line);
+		bool is_match = true;
+		for (int i = 0; i < wanted_words.size() && is_match; i++)
+			is_match = (ss >> word) && word == wanted_words[i];
+		CpuKernelSizes line_sizes;
+		if (is_match && (ss >> line_sizes.coarse_block_size >> line_sizes.coarse_eulers_per_block
+		                    >> line_sizes.fine_chunk_size >> line_sizes.bp_block_size))
+		{
+			sizes = line_sizes;
+			found = true;
+		}
+	}
+	return found;
+}
+
+static void writeTuningFile(const std::string &fn, const std::string &key, const CpuKernelSizes &sizes)
+{
+	bool is_new = access(fn.c_str(), F_OK) != 0;
+	std::ofstream fh(fn.c_str(), std::ios::app);
+	if (!fh)
+	{
+		std::cerr << " WARNING: cannot write to the CPU tuning file " << fn << std::endl;
+		return;
+	}
+	if (is_new)
+		fh << "# cpu_model instruction_set box_size ref_dim data_dim coarse_block_size coarse_eulers_per_block fine_chunk_size bp_block_size" << std::endl;
+	fh << key << " " << sizes.coarse_block_size << " " << sizes.coarse_eulers_per_block << " "
+	   << sizes.fine_chunk_size << " " << sizes.bp_block_size << std::endl;
+}
+
+const CpuKernelSizes &CpuTuning::getSizes()
+{
+	return cpu_kernel_sizes;
+}
+
+void CpuTuning::setSizes(const CpuKernelSizes &sizes)
+{
+	cpu_kernel_sizes = sizes;
+}
+
+CpuKernelSizes CpuTuning::getDefaultSizes(int ref_dim, int data_dim)
+{
+	CpuKernelSizes sizes;
+	if (data_dim == 3)
+	{
+		sizes.coarse_block_size = D2C_BLOCK_SIZE_DATA3D;
+		sizes.coarse_eulers_per_block = D2C_EULERS_PER_BLOCK_DATA3D;
+		sizes.fine_chunk_size = D2F_CHUNK_DATA3D;
+		sizes.bp_block_size = BP_DATA3D_BLOCK_SIZE;
+	}
+	else if (ref_dim == 3)
+	{
+		sizes.coarse_block_size = D2C_BLOCK_SIZE_REF3D;
+		sizes.coarse_eulers_per_block = D2C_EULERS_PER_BLOCK_REF3D;
+		sizes.fine_chunk_size = D2F_CHUNK_DATA3D; // as in getAllSquaredDifferencesFine()
+		sizes.bp_block_size = BP_REF3D_BLOCK_SIZE;
+	}
+	else
+	{
+		sizes.coarse_block_size = D2C_BLOCK_SIZE_2D;
+		sizes.coarse_eulers_per_block = D2C_EULERS_PER_BLOCK_2D;
+		sizes.fine_chunk_size = D2F_CHUNK_2D;
+		sizes.bp_block_size = BP_2D_BLOCK_SIZE;
+	}
+	return sizes;
+}
+
+std::string CpuTuning::getTuningFileName()
+{
+	char *penv = getenv("RELION_CPU_TUNING");
+	if (penv != NULL)
+		return std::string(penv);
+
+	char hostname[256];
+	if (gethostname(hostname, sizeof(hostname)) != 0)
+		strcpy(hostname, "localhost");
+	hostname[sizeof(hostname) - 1] = '\0';
+
+	penv = getenv("HOME");
+	std::string dir = (penv != NULL) ? std::string(penv) + "/" : "";
+	return dir + ".relion_cpu_tuning_" + hostname;
+}
+
+CpuKernelSizes CpuTuning::tune(int box_size, int ref_dim, int data_dim)
+{
+	int tuning_box = (data_dim == 3) ? XMIPP_MIN(box_size, MAX_TUNING_BOX_DATA3D) : box_size;
+	CpuTuningData data(tuning_box, ref_dim, data_dim);
+	CpuKernelSizes sizes = getDefaultSizes(ref_dim, data_dim);
+
+	// The orientations per block first, and then the pixels per block for the best of those
+	double best = std::numeric_limits<double>::max();
+	for (int i = 0; i < sizeof(coarse_eulers_candidates) / sizeof(int); i++)
+	{
+		double t = data.timeCoarse(sizes.coarse_block_size, coarse_eulers_candidates[i]);
+		if (t < best)
+		{
+			best = t;
+			sizes.coarse_eulers_per_block = coarse_eulers_candidates[i];
+		}
+	}
+	for (int i = 0; i < sizeof(coarse_block_candidates) / sizeof(int); i++)
+	{
+		double t = data.timeCoarse(coarse_block_candidates[i], sizes.coarse_eulers_per_block);
+		if (t < best)
+		{
+			best = t;
+			sizes.coarse_block_size = coarse_block_candidates[i];
+		}
+	}
+
+	best = std::numeric_limits<double>::max();
+	for (int i = 0; i < sizeof(fine_chunk_candidates) / sizeof(int); i++)
+	{
+		double t = data.timeFine(fine_chunk_candidates[i]);
+		if (t < best)
+		{
+			best = t;
+			sizes.fine_chunk_size = fine_chunk_candidates[i];
+		}
+	}
+
+	if (ref_dim == 2 || data_dim == 3)
+	{
+		best = std::numeric_limits<double>::max();
+		for (int i = 0; i < sizeof(bp_block_candidates) / sizeof(int); i++)
+		{
+			double t = data.timeBackproject(bp_block_candidates[i]);
+			if (t < best)
+			{
+				best = t;
+				sizes.bp_block_size = bp_block_candidates[i];
+			}
+		}
+	}
+
+	return sizes;
+}
+
+void CpuTuning::initialise(int box_size, int ref_dim, int data_dim, bool do_force, int verb)
+{
+	std::string fn = getTuningFileName();
+	std::string key = getTuningKey(box_size, ref_dim, data_dim);
+	CpuKernelSizes sizes;
+
+	if (!do_force && readTuningFile(fn, key, sizes))
+	{
+		if (verb > 0)
+			std::cout << " Using the block sizes of the CPU kernels in " << fn << std::endl;
+	}
+	else
+	{
+		if (verb > 0)
+			std::cout << " Tuning the block sizes of the CPU kernels for box size " << box_size << " ..." << std::endl;
+		sizes = tune(box_size, ref_dim, data_dim);
+		writeTuningFile(fn, key, sizes);
+		if (verb > 0)
+			std::cout << " Stored the block sizes of the CPU kernels in " << fn << std::endl;
+	}
+
+	if (verb > 0)
+		std::cout << " + Coarse diff2: " << sizes.coarse_eulers_per_block << " orientations and "
+		          << sizes.coarse_block_size << " pixels per block; fine diff2: " << sizes.fine_chunk_size
+		          << " translations per job; backprojection: " << sizes.bp_block_size << " pixels per block" << std::endl;
+
+	setSizes(sizes);
+}
@@ -0,0 +1,61 @@
+#ifndef CPU_TUNING_H_
+#define CPU_TUNING_H_
+
+#include <string>
+
+// Block sizes of the ALTCPU kernels that are set at run time instead of by
+// the constants in cpu_settings.h. Zero means: use the constant.
+struct CpuKernelSizes
+{
+	int coarse_block_size;        // pixels per block of the coarse diff2 (D2C_BLOCK_SIZE_*)
+	int coarse_eulers_per_block;  // orientations per block of the coarse diff2 (D2C_EULERS_PER_BLOCK_*)
+	int fine_chunk_size;          // translations per job of the fine diff2 (D2F_CHUNK_*)
+	int bp_block_size;            // pixels per block of the 2D and 3D-data backprojection (BP_2D/DATA3D_BLOCK_SIZE)
+
+	CpuKernelSizes():
+		coarse_block_size(0),
+		coarse_eulers_per_block(0),
+		fine_chunk_size(0),
+		bp_block_size(0)
+	{}
+};
+
+// The tuned size if there is one, otherwise the constant
+inline int cpuKernelSize(int tuned_size, int default_size)
+{
+	return (tuned_size > 0) ? tuned_size : default_size;
+}
+
+/*	class CpuTuning:
+ *
+ *	- the best kernel sizes depend on the box size, on the dimensions of the
+ *	  references and the data, and on the caches of the CPU, so they are found
+ *	  by timing the kernels on synthetic data of the same sizes
+ *	- the results are stored in a tuning file per host, one line per CPU model,
+ *	  instruction set (see cpu_simd.h), box size and dimensions, and are read
+ *	  back on later runs: only the first run with a new combination is tuned
+ *	- RELION_CPU_TUNING names the tuning file; by default it is
+ *	  ~/.relion_cpu_tuning_<hostname>
+ */
+class CpuTuning
+{
+public:
+
+	// Sizes used by the kernels
+	static const CpuKernelSizes &getSizes();
+	static void setSizes(const CpuKernelSizes &sizes);
+
+	// The constants of cpu_settings.h for these dimensions
+	static CpuKernelSizes getDefaultSizes(int ref_dim, int data_dim);
+
+	// Read the sizes for this CPU from the tuning file, or (if they are not there, or if do_force)
+	// tune them and add them to the file; then use them in the kernels
+	static void initialise(int box_size, int ref_dim, int data_dim, bool do_force = false, int verb = 0);
+
+	// Time the candidate sizes on synthetic data and return the fastest ones
+	static CpuKernelSizes tune(int box_size, int ref_dim, int data_dim);
+
+	static std::string getTuningFileName();
+};
+
+#endif
@@ -163,10 +163,7 @@ public:
 */
 
 #include <fftw3.h>
-#include <tbb/spin_mutex.h>
-
-
-extern tbb::spin_mutex      mkl_mutex;
+#include "src/fftw_plan_cache.h"
 
 class MklFFT
 {
@@ -261,33 +258,10 @@ public:
 		fouriers.setSize(xFSize * yFSize * zFSize);
 		fouriers.hostAlloc();
 
-		int N[3];  
-		if(dimension == 1)
-			N[0] = xSize;
-		else  if(dimension == 2){
-			N[0] = ySize;  N[1] = xSize;	    
-		}
-		else {
-			N[0] = zSize;  N[1] = ySize; N[2] = xSize;	    
-		}
-
-		{
-			tbb::spin_mutex::scoped_lock lock(mkl_mutex);
-#ifdef ACC_DOUBLE_PRECISION
-			fPlanForward = fftw_plan_dft_r2c(dimension, N,  reals(),
-										 (fftw_complex*) fouriers(), FFTW_ESTIMATE);
-			fPlanBackward = fftw_plan_dft_c2r(dimension, N,
-										  (fftw_complex*) fouriers(),  reals(),
-										  FFTW_ESTIMATE);
-
-#else
-			fPlanForward = fftwf_plan_dft_r2c(dimension, N, reals(),
-										 (fftwf_complex*) fouriers(), FFTW_ESTIMATE);
-			fPlanBackward = fftwf_plan_dft_c2r(dimension, N,
-										  (fftwf_complex*) fouriers(), reals(), FFTW_ESTIMATE);
-#endif
-			planSet = true;
-		}
+		// The plans are shared with all other transformers of the same size (see src/fftw_plan_cache.h)
+		fPlanForward = FftwPlanCache::getPlan(FftwPlanCache::R2C, xSize, ySize, zSize, reals(), (XFLOAT*) fouriers());
+		fPlanBackward = FftwPlanCache::getPlan(FftwPlanCache::C2R, xSize, ySize, zSize, (XFLOAT*) fouriers(), reals());
+		planSet = true;
 	}
 
 	void forward()
@@ -325,19 +299,9 @@ public:
 		reals.freeIfSet();
 		fouriers.freeIfSet();
 	
-		if (planSet)
-		{
-			tbb::spin_mutex::scoped_lock lock(mkl_mutex);        
-#ifdef ACC_DOUBLE_PRECISION
-			fftw_destroy_plan(fPlanForward);
-			fftw_destroy_plan(fPlanBackward);
-#else
-			fftwf_destroy_plan(fPlanForward);
-			fftwf_destroy_plan(fPlanBackward);
-#endif          
-			fPlanForward = fPlanBackward = NULL;
-			planSet = false;
-		}
+		// The plans belong to FftwPlanCache
+		fPlanForward = fPlanBackward = NULL;
+		planSet = false;
 	}
 
 	~MklFFT()
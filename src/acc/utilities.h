@@ -13,6 +13,8 @@
 #include "src/acc/cpu/cpu_kernels/helper.h"
 #include "src/acc/cpu/cpu_kernels/wavg.h"
 #include "src/acc/cpu/cpu_kernels/diff2.h"
+#include "src/acc/cpu/cpu_kernels/cpu_simd.h"
+#include "src/acc/cpu/cpu_tuning.h"
 #endif
 
 void dump_array(char *name, bool *ptr, size_t size);
@@ -580,7 +582,7 @@ void kernel_wavg(
 #else
 	if (DATA3D)
 	{
-		CpuKernels::wavg_3D<REFCTF>(
+		CPU_SIMD_DISPATCH(CpuKernels::wavg_3D<REFCTF>(
 			g_eulers,
 			projector,
 			image_size,
@@ -598,11 +600,11 @@ void kernel_wavg(
 			translation_num,
 			weight_norm,
 			significant_weight,
-			part_scale);
+			part_scale));
 	}
 	else
 	{
-		CpuKernels::wavg_ref3D<REFCTF,REF3D>(
+		CPU_SIMD_DISPATCH(CpuKernels::wavg_ref3D<REFCTF,REF3D>(
 			g_eulers,
 			projector,
 			image_size,
@@ -620,7 +622,7 @@ void kernel_wavg(
 			translation_num,
 			weight_norm,
 			significant_weight,
-			part_scale);
+			part_scale));
 	}
 #endif
 }
@@ -659,8 +661,12 @@ void diff2_coarse(
 			image_size);
 #else
 	#if 1
-		CpuKernels::diff2_coarse<REF3D, DATA3D, block_sz, eulers_per_block, prefetch_fraction>(
-			grid_size,
+		// The block sizes on the CPU are set at run time (see CpuTuning), so the
+		// orientations of the grid are divided into blocks again
+		CPU_SIMD_DISPATCH(CpuKernels::diff2_coarse_blocks<REF3D, DATA3D>(
+			grid_size * eulers_per_block,
+			cpuKernelSize(CpuTuning::getSizes().coarse_block_size, block_sz),
+			cpuKernelSize(CpuTuning::getSizes().coarse_eulers_per_block, eulers_per_block),
 			g_eulers,
 			trans_x,
 			trans_y,
@@ -672,7 +678,7 @@ void diff2_coarse(
 			g_diff2s,
 			translation_num,
 			image_size
-		);
+		));
 	#else
 		if (DATA3D)
 			CpuKernels::diff2_coarse_3D<eulers_per_block>(
@@ -743,7 +749,7 @@ void diff2_CC_coarse(
 			exp_local_sqrtXi2);
 #else
 	if (DATA3D)
-		CpuKernels::diff2_CC_coarse_3D(
+		CPU_SIMD_DISPATCH(CpuKernels::diff2_CC_coarse_3D(
 			grid_size,
 			g_eulers,
 			g_imgs_real,
@@ -756,9 +762,9 @@ void diff2_CC_coarse(
 			g_diff2s,
 			translation_num,
 			image_size,
-			exp_local_sqrtXi2);
+			exp_local_sqrtXi2));
 	else
-		CpuKernels::diff2_CC_coarse_2D<REF3D>(
+		CPU_SIMD_DISPATCH(CpuKernels::diff2_CC_coarse_2D<REF3D>(
 			grid_size,
 			g_eulers,
 			g_imgs_real,
@@ -770,7 +776,7 @@ void diff2_CC_coarse(
 			g_diff2s,
 			translation_num,
 			image_size,
-			exp_local_sqrtXi2);	
+			exp_local_sqrtXi2));	
 #endif	
 }
 
@@ -825,7 +831,7 @@ void diff2_fine(
 		// TODO - make use of orientation_num, translation_num,todo_blocks on
 		// CPU side if CUDA starts to use
 	if (DATA3D)
-		CpuKernels::diff2_fine_3D(
+		CPU_SIMD_DISPATCH(CpuKernels::diff2_fine_3D(
 			grid_size,
 			g_eulers,
 			g_imgs_real,
@@ -841,9 +847,9 @@ void diff2_fine(
 			d_rot_idx,
 			d_trans_idx,
 			d_job_idx,
-			d_job_num);
+			d_job_num));
 	else
-		CpuKernels::diff2_fine_2D<REF3D>(
+		CPU_SIMD_DISPATCH(CpuKernels::diff2_fine_2D<REF3D>(
 			grid_size,
 			g_eulers,
 			g_imgs_real,
@@ -859,7 +865,7 @@ void diff2_fine(
 			d_rot_idx,
 			d_trans_idx,
 			d_job_idx,
-			d_job_num);
+			d_job_num));
 #endif
 }
 
@@ -916,7 +922,7 @@ void diff2_CC_fine(
 		// TODO - Make use of orientation_num, translation_num, todo_blocks on
 		// CPU side if CUDA starts to use
 	if (DATA3D)
-		CpuKernels::diff2_CC_fine_3D(
+		CPU_SIMD_DISPATCH(CpuKernels::diff2_CC_fine_3D(
 			grid_size,
 			g_eulers,
 			g_imgs_real,
@@ -933,9 +939,9 @@ void diff2_CC_fine(
 			d_rot_idx,
 			d_trans_idx,
 			d_job_idx,
-			d_job_num);
+			d_job_num));
 	else
-		CpuKernels::diff2_CC_fine_2D<REF3D>(
+		CPU_SIMD_DISPATCH(CpuKernels::diff2_CC_fine_2D<REF3D>(
 			grid_size,
 			g_eulers,
 			g_imgs_real,
@@ -951,7 +957,7 @@ void diff2_CC_fine(
 			d_rot_idx,
 			d_trans_idx,
 			d_job_idx,
-			d_job_num);
+			d_job_num));
 #endif
 }
 
@@ -0,0 +1,229 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/autopicker.h>
+#include <sys/time.h>
+
+// Plants rotated copies of elongated references in a noisy synthetic micrograph, and times template-matching
+// autopicking of it with different numbers of threads: speed-up, fraction of the planted particles that were
+// found, and whether the picks are the same as with one thread
+class autopick_benchmark_parameters
+{
+	public:
+
+	FileName fn_dir;
+	int mic_size, particle_size, nr_particles, nr_refs;
+	RFLOAT psi_sampling, noise_stddev;
+	std::vector<int> thread_counts;
+	std::vector<RFLOAT> planted_x, planted_y;
+	IOParser parser;
+
+	void usage()
+	{
+		parser.writeUsage(std::cerr);
+	}
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		int general_section = parser.addSection("General options");
+		fn_dir = parser.getOption("--o", "Directory for the synthetic micrograph, references and picks", "autopick_benchmark/");
+		mic_size = textToInteger(parser.getOption("--mic_size", "Size of the (square) micrograph in pixels", "1024"));
+		particle_size = textToInteger(parser.getOption("--particle_size", "Box size of the references in pixels", "64"));
+		nr_particles = textToInteger(parser.getOption("--n", "Number of planted particles", "50"));
+		nr_refs = textToInteger(parser.getOption("--nr_refs", "Number of references", "3"));
+		psi_sampling = textToFloat(parser.getOption("--ang", "In-plane angular sampling (in degrees)", "10"));
+		noise_stddev = textToFloat(parser.getOption("--noise", "Standard deviation of the noise (the references peak at 1)", "1"));
+		std::string threads = parser.getOption("--j", "Comma-separated numbers of threads to test", "1,2,4");
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+
+		std::vector<std::string> words;
+		tokenize(threads, words, ",");
+		for (int i = 0; i < words.size(); i++)
+			thread_counts.push_back(textToInteger(words[i]));
+		if (fn_dir[fn_dir.length() - 1] != '/')
+			fn_dir += "/";
+	}
+
+	double wallTime()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + 1e-6 * tv.tv_usec;
+	}
+
+	// Two Gaussian blobs of different size along X, rotated by psi: a template that is not rotationally symmetric
+	RFLOAT referenceValue(int iref, RFLOAT x, RFLOAT y, RFLOAT psi)
+	{
+		RFLOAT c = cos(DEG2RAD(psi)), s = sin(DEG2RAD(psi));
+		RFLOAT xp = c * x + s * y, yp = -s * x + c * y;
+		RFLOAT d = particle_size * (0.12 + 0.04 * iref);
+		RFLOAT sigma = particle_size / 12.;
+		RFLOAT r1 = (xp - d) * (xp - d) + yp * yp;
+		RFLOAT r2 = (xp + d) * (xp + d) + yp * yp;
+		return exp(-r1 / (2. * sigma * sigma)) + 0.6 * exp(-r2 / (2. * 0.7 * 0.7 * sigma * sigma));
+	}
+
+	void makeData(FileName fn_mic, FileName fn_refs)
+	{
+		init_random_generator(1);
+
+		Image<RFLOAT> Irefs(particle_size, particle_size, 1, nr_refs);
+		for (int iref = 0; iref < nr_refs; iref++)
+			for (int i = 0; i < particle_size; i++)
+				for (int j = 0; j < particle_size; j++)
+					DIRECT_NZYX_ELEM(Irefs(), iref, 0, i, j) = referenceValue(iref, j - particle_size / 2, i - particle_size / 2, 0.);
+		Irefs.setSamplingRateInHeader(1.);
+		Irefs.write(fn_refs);
+
+		Image<RFLOAT> Imic(mic_size, mic_size);
+		Imic().initZeros();
+		int margin = particle_size;
+		int nr_tries = 0;
+		while (planted_x.size() < nr_particles && nr_tries++ < 100 * nr_particles)
+		{
+			RFLOAT x = rnd_unif(margin, mic_size - margin), y = rnd_unif(margin, mic_size - margin);
+			bool is_free = true;
+			for (int ip = 0; ip < planted_x.size(); ip++)
+				if ((x - planted_x[ip]) * (x - planted_x[ip]) + (y - planted_y[ip]) * (y - planted_y[ip]) < particle_size * particle_size)
+					is_free = false;
+			if (!is_free)
+				continue;
+
+			int iref = planted_x.size() % nr_refs;
+			RFLOAT psi = rnd_unif(0., 360.);
+			for (int i = ROUND(y) - particle_size / 2; i < ROUND(y) + particle_size / 2; i++)
+				for (int j = ROUND(x) - particle_size / 2; j < ROUND(x) + particle_size / 2; j++)
+					DIRECT_A2D_ELEM(Imic(), i, j) += referenceValue(iref, j - ROUND(x), i - ROUND(y), psi);
+			planted_x.push_back(ROUND(x));
+			planted_y.push_back(ROUND(y));
+		}
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Imic())
+			DIRECT_MULTIDIM_ELEM(Imic(), n) += rnd_gaus(0., noise_stddev);
+		Imic.setSamplingRateInHeader(1.);
+		Imic.write(fn_mic);
+	}
+
+	double pick(FileName fn_mic, FileName fn_refs, int nr_threads, std::vector<RFLOAT> &xs, std::vector<RFLOAT> &ys)
+	{
+		std::vector<std::string> args;
+		args.push_back("autopick_benchmark");
+		args.push_back("--i"); args.push_back(fn_mic);
+		args.push_back("--ref"); args.push_back(fn_refs);
+		args.push_back("--odir"); args.push_back(fn_dir + "j" + integerToString(nr_threads) + "/");
+		args.push_back("--pickname"); args.push_back("autopick");
+		args.push_back("--angpix"); args.push_back("1");
+		args.push_back("--particle_diameter"); args.push_back(floatToString(0.8 * particle_size));
+		args.push_back("--ang"); args.push_back(floatToString(psi_sampling));
+		args.push_back("--threshold"); args.push_back("0.4");
+		args.push_back("--j"); args.push_back(integerToString(nr_threads));
+		args.push_back("--verb"); args.push_back("0");
+		std::vector<char*> argv;
+		for (int i = 0; i < args.size(); i++)
+			argv.push_back((char*)args[i].c_str());
+
+		AutoPicker picker;
+		picker.read(argv.size(), &argv[0]);
+		picker.initialise();
+
+		double t0 = wallTime();
+		picker.run();
+		double time = wallTime() - t0;
+
+		MetaDataTable MDpicks;
+		MDpicks.read(picker.getOutputRootName(fn_mic) + "_autopick.star");
+		xs.clear();
+		ys.clear();
+		FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDpicks)
+		{
+			RFLOAT x, y;
+			MDpicks.getValue(EMDL_IMAGE_COORD_X, x);
+			MDpicks.getValue(EMDL_IMAGE_COORD_Y, y);
+			xs.push_back(x);
+			ys.push_back(y);
+		}
+		return time;
+	}
+
+	// Number of planted particles with a pick within a quarter of the particle size
+	int countFound(const std::vector<RFLOAT> &xs, const std::vector<RFLOAT> &ys)
+	{
+		RFLOAT max_dist2 = particle_size * particle_size / 16.;
+		int nr_found = 0;
+		for (int ip = 0; ip < planted_x.size(); ip++)
+			for (int i = 0; i < xs.size(); i++)
+				if ((xs[i] - planted_x[ip]) * (xs[i] - planted_x[ip]) + (ys[i] - planted_y[ip]) * (ys[i] - planted_y[ip]) < max_dist2)
+				{
+					nr_found++;
+					break;
+				}
+		return nr_found;
+	}
+
+	void run()
+	{
+		int res = system(("mkdir -p " + fn_dir).c_str());
+		FileName fn_mic = fn_dir + "mic.mrc", fn_refs = fn_dir + "refs.mrcs";
+		makeData(fn_mic, fn_refs);
+		std::cout << " Micrograph of " << mic_size << " x " << mic_size << " pixels with " << planted_x.size() << " particles of "
+		          << nr_refs << " references (box " << particle_size << "), sampling psi every " << psi_sampling << " degrees" << std::endl;
+		std::cout.precision(4);
+
+		std::vector<RFLOAT> xs1, ys1;
+		double time1 = 0.;
+		for (int i = 0; i < thread_counts.size(); i++)
+		{
+			std::vector<RFLOAT> xs, ys;
+			double time = pick(fn_mic, fn_refs, thread_counts[i], xs, ys);
+			if (i == 0)
+			{
+				time1 = time;
+				xs1 = xs;
+				ys1 = ys;
+			}
+			bool is_same = (xs == xs1 && ys == ys1);
+
+			std::cout << "  + " << thread_counts[i] << " thread(s): " << time << " sec, speed-up " << time1 / time
+			          << ", " << xs.size() << " picks, found " << countFound(xs, ys) << " of " << planted_x.size()
+			          << " planted particles, picks " << (is_same ? "identical to" : "DIFFERENT from") << " " << thread_counts[0] << " thread(s)" << std::endl;
+		}
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	autopick_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		prm.usage();
+		exit(1);
+	}
+	return 0;
+}
@@ -0,0 +1,194 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/backprojector.h>
+#include <src/euler.h>
+#include <omp.h>
+#include <sys/time.h>
+
+// Shared backprojectors are locked as in MlOptimiser::storeWeightedSums()
+static pthread_mutex_t backproject_benchmark_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+class backproject_benchmark_parameters
+{
+	public:
+
+	int box, dim, nr_threads;
+	float padding;
+	long int nr_images;
+	MultidimArray<Complex> Fimg;
+	MultidimArray<RFLOAT> Fweight;
+	IOParser parser;
+
+	void usage()
+	{
+		parser.writeUsage(std::cerr);
+	}
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		int general_section = parser.addSection("General options");
+		box = textToInteger(parser.getOption("--box", "Box size of the images", "128"));
+		padding = textToFloat(parser.getOption("--pad", "Padding factor of the reconstructions", "2"));
+		dim = textToInteger(parser.getOption("--dim", "Dimension of the reconstructions (2 or 3)", "3"));
+		nr_images = textToInteger(parser.getOption("--n", "Number of images to backproject per test", "2000"));
+		nr_threads = textToInteger(parser.getOption("--j", "Largest number of threads (tests are run on 1, 2, 4, ... threads)", "1"));
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+		if (dim != 2 && dim != 3)
+			REPORT_ERROR("ERROR: --dim should be 2 or 3");
+	}
+
+	double wallTime()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + 1e-6 * tv.tv_usec;
+	}
+
+	void getOrientation(long int i, Matrix2D<RFLOAT> &A)
+	{
+		// Spread the orientations over the sphere in a reproducible way
+		RFLOAT rot = (dim == 3) ? fmod(i * 137.508, 360.) : 0.;
+		RFLOAT tilt = (dim == 3) ? fmod(i * 57.2958, 180.) : 0.;
+		RFLOAT psi = fmod(i * 23.7, 360.);
+		Euler_angles2matrix(rot, tilt, psi, A);
+	}
+
+	void makeBackProjector(BackProjector &BP)
+	{
+		BP = BackProjector(box, dim, "C1", TRILINEAR, padding);
+		BP.initZeros(box);
+	}
+
+	// All threads backproject into one BackProjector, inside a lock
+	double runShared(int nr_thr, BackProjector &BP)
+	{
+		makeBackProjector(BP);
+		double t0 = wallTime();
+
+		#pragma omp parallel for num_threads(nr_thr)
+		for (long int i = 0; i < nr_images; i++)
+		{
+			Matrix2D<RFLOAT> A;
+			getOrientation(i, A);
+			pthread_mutex_lock(&backproject_benchmark_mutex);
+			BP.set2DFourierTransform(Fimg, A, IS_NOT_INV, &Fweight);
+			pthread_mutex_unlock(&backproject_benchmark_mutex);
+		}
+
+		return wallTime() - t0;
+	}
+
+	// Every thread but the first backprojects into its own copy, and the copies are summed in parallel afterwards
+	double runPrivate(int nr_thr, BackProjector &BP, double &reduce_time)
+	{
+		makeBackProjector(BP);
+		std::vector<BackProjector> copies(nr_thr - 1, BP);
+		double t0 = wallTime();
+
+		#pragma omp parallel for num_threads(nr_thr)
+		for (long int i = 0; i < nr_images; i++)
+		{
+			Matrix2D<RFLOAT> A;
+			getOrientation(i, A);
+			int thread_id = omp_get_thread_num();
+			BackProjector &myBP = (thread_id == 0) ? BP : copies[thread_id - 1];
+			myBP.set2DFourierTransform(Fimg, A, IS_NOT_INV, &Fweight);
+		}
+
+		double t1 = wallTime();
+		if (nr_thr > 1)
+		{
+			std::vector<BackProjector *> others(nr_thr - 1);
+			for (int i = 0; i < nr_thr - 1; i++)
+				others[i] = &copies[i];
+			long int size = NZYXSIZE(BP.data);
+
+			#pragma omp parallel for num_threads(nr_thr)
+			for (int thread_id = 0; thread_id < nr_thr; thread_id++)
+				BP.addTreeSum(others, size * thread_id / nr_thr, size * (thread_id + 1) / nr_thr);
+		}
+		double t2 = wallTime();
+
+		reduce_time = t2 - t1;
+		return t2 - t0;
+	}
+
+	void run()
+	{
+		// The same image for all orientations, with a smooth amplitude fall-off
+		Fimg.initZeros(box, box / 2 + 1);
+		Fweight.initZeros(box, box / 2 + 1);
+		FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM2D(Fimg)
+		{
+			RFLOAT r = sqrt((RFLOAT)(ip * ip + jp * jp)) / box;
+			DIRECT_A2D_ELEM(Fimg, i, j) = Complex(1. - r, 0.5 - r);
+			DIRECT_A2D_ELEM(Fweight, i, j) = 1. + r;
+		}
+
+		BackProjector BP_shared, BP_private;
+		makeBackProjector(BP_shared);
+		double Mb = 2. * (sizeof(Complex) + sizeof(RFLOAT)) * NZYXSIZE(BP_shared.data) / (1024. * 1024.);
+
+		std::cout << " Box " << box << " (" << dim << "D, padding " << padding << "), " << nr_images
+		          << " images, " << Mb << " Mb per copy of the reconstruction" << std::endl;
+
+		std::cout.precision(4);
+		for (int nr_thr = 1; nr_thr <= nr_threads; nr_thr = (nr_thr * 2 > nr_threads && nr_thr < nr_threads) ? nr_threads : nr_thr * 2)
+		{
+			double reduce_time;
+			double shared_time = runShared(nr_thr, BP_shared);
+			double private_time = runPrivate(nr_thr, BP_private, reduce_time);
+
+			RFLOAT max_diff = 0.;
+			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(BP_shared.weight)
+			{
+				max_diff = XMIPP_MAX(max_diff, ABS(DIRECT_MULTIDIM_ELEM(BP_shared.weight, n) - DIRECT_MULTIDIM_ELEM(BP_private.weight, n)));
+				max_diff = XMIPP_MAX(max_diff, abs(DIRECT_MULTIDIM_ELEM(BP_shared.data, n) - DIRECT_MULTIDIM_ELEM(BP_private.data, n)));
+			}
+
+			std::cout << "  + " << nr_thr << " threads: shared " << nr_images / shared_time << " images/sec, private copies "
+			          << nr_images / private_time << " images/sec (of which " << reduce_time << " sec reduction), largest difference "
+			          << max_diff << std::endl;
+		}
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	backproject_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		prm.usage();
+		exit(1);
+	}
+	return 0;
+}
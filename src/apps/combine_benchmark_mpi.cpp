@@ -0,0 +1,174 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/mpi.h>
+#include <algorithm>
+
+// Times the combination of the weighted sums of MlOptimiserMpi::combineAllWeightedSums() for 2, 3, ... slaves:
+// passing the sums from slave to slave (--serial_combine) versus MpiNode::relion_MPI_Allreduce_sum
+class combine_benchmark_parameters
+{
+	public:
+
+	MpiNode *node;
+	RFLOAT size_Mb;
+	int nr_repeats, segment_size;
+	std::vector<RFLOAT> values;
+	IOParser parser;
+
+	void usage()
+	{
+		parser.writeUsage(std::cerr);
+	}
+
+	void read(int argc, char **argv)
+	{
+		node = new MpiNode(argc, argv);
+		parser.setCommandLine(argc, argv);
+
+		int general_section = parser.addSection("General options");
+		size_Mb = textToFloat(parser.getOption("--size", "Size of the weighted sums of each slave (in Mb)", "256"));
+		nr_repeats = textToInteger(parser.getOption("--n", "Number of times each combination is timed", "3"));
+		segment_size = textToInteger(parser.getOption("--segment", "Number of values per message segment of relion_MPI_Allreduce_sum", "1048576"));
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+		if (node->size < 3)
+			REPORT_ERROR("ERROR: run this program with at least 3 MPI processes (a master and two slaves)");
+	}
+
+	void fillValues()
+	{
+		for (long int n = 0; n < values.size(); n++)
+			values[n] = (RFLOAT)((n * 7 + node->rank) % 13) / 13.;
+	}
+
+	// As in combineAllWeightedSums(): a chain through all slaves, and then back from the first to all others
+	void serialCombine(const std::vector<int> &ranks)
+	{
+		std::vector<RFLOAT> sum(values);
+		MPI_Status status;
+		int nr_ranks = ranks.size();
+		for (int i = 0; i < nr_ranks; i++)
+		{
+			int next = (i + 1) % nr_ranks;
+			if (node->rank == ranks[i])
+				node->relion_MPI_Send(&sum[0], sum.size(), MY_MPI_DOUBLE, ranks[next], MPITAG_PACK, MPI_COMM_WORLD);
+			else if (node->rank == ranks[next])
+			{
+				node->relion_MPI_Recv(&sum[0], sum.size(), MY_MPI_DOUBLE, ranks[i], MPITAG_PACK, MPI_COMM_WORLD, status);
+				if (next != 0)
+					for (long int n = 0; n < sum.size(); n++)
+						sum[n] += values[n];
+			}
+		}
+		for (int i = 0; i < nr_ranks - 2; i++)
+		{
+			if (node->rank == ranks[i])
+				node->relion_MPI_Send(&sum[0], sum.size(), MY_MPI_DOUBLE, ranks[i + 1], MPITAG_PACK, MPI_COMM_WORLD);
+			else if (node->rank == ranks[i + 1])
+				node->relion_MPI_Recv(&sum[0], sum.size(), MY_MPI_DOUBLE, ranks[i], MPITAG_PACK, MPI_COMM_WORLD, status);
+		}
+		values.swap(sum);
+	}
+
+	// Time one combination over the given slaves; returns the largest time over all of them
+	double timeCombine(const std::vector<int> &ranks, bool do_serial, RFLOAT &max_error)
+	{
+		bool is_in = std::find(ranks.begin(), ranks.end(), node->rank) != ranks.end();
+		double my_time = 0.;
+		max_error = 0.;
+		for (int irep = 0; irep < nr_repeats; irep++)
+		{
+			fillValues();
+			MPI_Barrier(MPI_COMM_WORLD);
+			double t0 = MPI_Wtime();
+			if (is_in)
+			{
+				if (do_serial)
+					serialCombine(ranks);
+				else
+					node->relion_MPI_Allreduce_sum(&values[0], values.size(), ranks, MPITAG_PACK, MPI_COMM_WORLD, segment_size);
+			}
+			my_time += MPI_Wtime() - t0;
+
+			// Check the sums
+			if (is_in)
+			{
+				for (long int n = 0; n < values.size(); n++)
+				{
+					RFLOAT expected = 0.;
+					for (int i = 0; i < ranks.size(); i++)
+						expected += (RFLOAT)((n * 7 + ranks[i]) % 13) / 13.;
+					max_error = XMIPP_MAX(max_error, ABS(values[n] - expected));
+				}
+			}
+		}
+		my_time /= nr_repeats;
+
+		double max_time;
+		RFLOAT my_error = max_error;
+		MPI_Allreduce(&my_time, &max_time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+		MPI_Allreduce(&my_error, &max_error, 1, MY_MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+		return max_time;
+	}
+
+	void run()
+	{
+		values.resize((long int)(size_Mb * 1024 * 1024 / sizeof(RFLOAT)));
+
+		if (node->isMaster())
+		{
+			std::cout << " Combining " << size_Mb << " Mb of weighted sums per slave, averaged over " << nr_repeats << " runs" << std::endl;
+			std::cout.precision(4);
+		}
+
+		std::vector<int> ranks(1, 1);
+		for (int slave = 2; slave < node->size; slave++)
+		{
+			ranks.push_back(slave);
+			RFLOAT error_serial, error_allreduce;
+			double t_serial = timeCombine(ranks, true, error_serial);
+			double t_allreduce = timeCombine(ranks, false, error_allreduce);
+			if (node->isMaster())
+				std::cout << "  + " << ranks.size() << " slaves: serial " << t_serial << " sec, allreduce " << t_allreduce
+				          << " sec (largest errors " << error_serial << " and " << error_allreduce << ")" << std::endl;
+		}
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	combine_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		prm.usage();
+		MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+	}
+	delete prm.node;
+	return 0;
+}
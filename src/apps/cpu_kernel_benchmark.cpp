@@ -0,0 +1,279 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/euler.h>
+#include <sys/time.h>
+
+#ifdef ALTCPU
+#include <limits>
+#include "src/acc/cpu/cuda_stubs.h"
+#include "src/acc/acc_ptr.h"
+#include "src/acc/acc_projector.h"
+#include "src/acc/cpu/cpu_kernels/helper.h"
+#include "src/acc/cpu/cpu_kernels/diff2.h"
+#include "src/acc/cpu/cpu_kernels/wavg.h"
+#include "src/acc/cpu/cpu_kernels/BP.h"
+#include "src/acc/cpu/cpu_kernels/cpu_simd.h"
+
+// Times the ALTCPU kernels of a 3D refinement (a 3D reference and 2D images) on synthetic data,
+// for each of the instruction sets that CPU_SIMD_DISPATCH can select on this CPU.
+// The GFLOP/s are for nominal counts of the arithmetic in the innermost loops of the kernels:
+//  - coarse diff2:   7 flops per pixel, orientation and translation
+//  - fine diff2:    18 flops per pixel, orientation and translation
+//  - wavg:          29 flops per pixel, orientation and translation
+//  - backprojection 21 flops per pixel, orientation and translation, and 70 per pixel and orientation
+class cpu_kernel_benchmark_parameters
+{
+	public:
+
+	int box, padding, nr_repeats;
+	long int nr_orient, nr_trans;
+	IOParser parser;
+
+	// Synthetic reference and image
+	int mdl_x, mdl_y, mdl_z, mdl_init, img_x, img_y, max_r;
+	unsigned long image_size;
+	std::vector<std::complex<XFLOAT> > model;
+	std::vector<XFLOAT> eulers, trans_x, trans_y, trans_z, img_real, img_imag, corr, ctfs, weights;
+
+	void usage()
+	{
+		parser.writeUsage(std::cerr);
+	}
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		int general_section = parser.addSection("General options");
+		box = textToInteger(parser.getOption("--box", "Box size of the images", "128"));
+		padding = textToInteger(parser.getOption("--pad", "Padding factor of the reference", "2"));
+		nr_orient = textToInteger(parser.getOption("--orient", "Number of orientations per kernel call", "256"));
+		nr_trans = textToInteger(parser.getOption("--trans", "Number of translations per orientation", "21"));
+		nr_repeats = textToInteger(parser.getOption("--n", "Number of times each kernel is timed", "3"));
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+
+		// The coarse kernel treats the orientations in blocks
+		nr_orient = D2C_EULERS_PER_BLOCK_REF3D * XMIPP_MAX(1, nr_orient / D2C_EULERS_PER_BLOCK_REF3D);
+	}
+
+	double wallTime()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + 1e-6 * tv.tv_usec;
+	}
+
+	void makeData()
+	{
+		// As for a Projector of a box-sized map, and the Fourier transform of a box-sized image
+		int pad_size = 2 * (padding * (box / 2) + 1) + 1;
+		mdl_x = pad_size / 2 + 1;
+		mdl_y = mdl_z = pad_size;
+		mdl_init = -(pad_size / 2);
+		img_x = box / 2 + 1;
+		img_y = box;
+		max_r = box / 2 - 1;
+		image_size = (unsigned long)img_x * img_y;
+
+		model.resize((size_t)mdl_x * mdl_y * mdl_z);
+		for (size_t n = 0; n < model.size(); n++)
+			model[n] = std::complex<XFLOAT>((XFLOAT)((n * 7) % 13) / 13., (XFLOAT)((n * 5) % 11) / 11. - 0.5);
+
+		eulers.resize(9 * nr_orient);
+		for (long int i = 0; i < nr_orient; i++)
+		{
+			Matrix2D<RFLOAT> A;
+			Euler_angles2matrix(fmod(i * 137.508, 360.), fmod(i * 57.2958, 180.), fmod(i * 23.7, 360.), A);
+			for (int j = 0; j < 9; j++)
+				eulers[9 * i + j] = MAT_ELEM(A, j / 3, j % 3);
+		}
+
+		trans_x.resize(nr_trans);
+		trans_y.resize(nr_trans);
+		trans_z.assign(nr_trans, 0.);
+		for (long int i = 0; i < nr_trans; i++)
+		{
+			trans_x[i] = (XFLOAT)(i % 5 - 2) * 2. * PI / box;
+			trans_y[i] = (XFLOAT)(i / 5 - 2) * 2. * PI / box;
+		}
+
+		img_real.resize(image_size);
+		img_imag.resize(image_size);
+		corr.assign(image_size, 1.);
+		ctfs.resize(image_size);
+		for (unsigned long n = 0; n < image_size; n++)
+		{
+			img_real[n] = (XFLOAT)((n * 3) % 17) / 17.;
+			img_imag[n] = (XFLOAT)((n * 11) % 7) / 7. - 0.5;
+			ctfs[n] = 1. - (XFLOAT)(n % img_x) / img_x;
+		}
+
+		weights.resize(nr_orient * nr_trans);
+		for (long int i = 0; i < weights.size(); i++)
+			weights[i] = (XFLOAT)(i % 3 + 1);
+	}
+
+	AccProjectorKernel makeProjector()
+	{
+		return AccProjectorKernel(mdl_x, mdl_y, mdl_z, img_x, img_y, 1, mdl_init, mdl_init, padding, max_r, &model[0]);
+	}
+
+	double runCoarse(std::vector<XFLOAT> &diff2s)
+	{
+		AccProjectorKernel projector = makeProjector();
+		diff2s.assign(nr_orient * nr_trans, 0.);
+		CPU_SIMD_DISPATCH(CpuKernels::diff2_coarse<true, false, D2C_EULERS_PER_BLOCK_REF3D>(
+			nr_orient / D2C_EULERS_PER_BLOCK_REF3D, D2C_BLOCK_SIZE_REF3D, &eulers[0], &trans_x[0], &trans_y[0], &trans_z[0],
+			&img_real[0], &img_imag[0], projector, &corr[0], &diff2s[0], nr_trans, image_size));
+		return 7. * image_size * nr_orient * nr_trans;
+	}
+
+	double runFine(std::vector<XFLOAT> &diff2s)
+	{
+		AccProjectorKernel projector = makeProjector();
+
+		// Jobs of up to D2F_CHUNK_REF3D translations of one orientation, as in the fine search
+		std::vector<unsigned long> rot_idx, trans_idx, job_idx, job_num;
+		for (long int iorient = 0; iorient < nr_orient; iorient++)
+			for (long int itrans = 0; itrans < nr_trans; itrans++)
+			{
+				if (itrans % D2F_CHUNK_REF3D == 0)
+				{
+					job_idx.push_back(rot_idx.size());
+					job_num.push_back(XMIPP_MIN(D2F_CHUNK_REF3D, nr_trans - itrans));
+				}
+				rot_idx.push_back(iorient);
+				trans_idx.push_back(itrans);
+			}
+
+		diff2s.assign(nr_orient * nr_trans, 0.);
+		CPU_SIMD_DISPATCH(CpuKernels::diff2_fine_2D<true>(
+			job_idx.size(), &eulers[0], &img_real[0], &img_imag[0], &trans_x[0], &trans_y[0], &trans_z[0],
+			projector, &corr[0], &diff2s[0], image_size, 0., &rot_idx[0], &trans_idx[0], &job_idx[0], &job_num[0]));
+		return 18. * image_size * nr_orient * nr_trans;
+	}
+
+	double runWavg(std::vector<XFLOAT> &sums)
+	{
+		AccProjectorKernel projector = makeProjector();
+		sums.assign(3 * image_size, 0.);
+		CPU_SIMD_DISPATCH(CpuKernels::wavg_ref3D<true, true>(
+			&eulers[0], projector, image_size, nr_orient, &img_real[0], &img_imag[0],
+			&trans_x[0], &trans_y[0], &trans_z[0], &weights[0], &ctfs[0],
+			&sums[0], &sums[image_size], &sums[2 * image_size], nr_trans, (XFLOAT)weights.size(), 0., 1.));
+		return 29. * image_size * nr_orient * nr_trans;
+	}
+
+	double runBackproject(std::vector<XFLOAT> &sums)
+	{
+		// backprojectRef3D() makes its own instruction set variants
+		std::vector<tbb::spin_mutex> mutexes(mdl_z * mdl_y);
+		size_t mdl_size = (size_t)mdl_x * mdl_y * mdl_z;
+		sums.assign(3 * mdl_size, 0.);
+		CpuKernels::backprojectRef3D(nr_orient, &img_real[0], &img_imag[0], &trans_x[0], &trans_y[0],
+			&weights[0], &corr[0], &ctfs[0], nr_trans, 0., (XFLOAT)weights.size(), &eulers[0],
+			&sums[0], &sums[mdl_size], &sums[2 * mdl_size], max_r, max_r * max_r, (XFLOAT)padding,
+			img_x, img_y, 1, image_size, mdl_x, mdl_y, mdl_init, mdl_init, &mutexes[0]);
+		return 21. * image_size * nr_orient * nr_trans + 70. * image_size * nr_orient;
+	}
+
+	// Largest difference relative to the largest value of the results of the default variant
+	RFLOAT relativeDifference(const std::vector<XFLOAT> &ref, const std::vector<XFLOAT> &result)
+	{
+		RFLOAT max_ref = 0., max_diff = 0.;
+		for (size_t n = 0; n < ref.size(); n++)
+		{
+			max_ref = XMIPP_MAX(max_ref, ABS(ref[n]));
+			max_diff = XMIPP_MAX(max_diff, ABS(ref[n] - result[n]));
+		}
+		return (max_ref > 0.) ? max_diff / max_ref : max_diff;
+	}
+
+	void run()
+	{
+		makeData();
+
+		const char *kernel_names[4] = {"coarse diff2", "fine diff2", "wavg", "backprojection"};
+		std::vector<std::vector<XFLOAT> > reference(4);
+
+		CpuKernels::SimdLevel supported = CpuKernels::getSupportedSimdLevel();
+		std::cout << " Box " << box << " (padding " << padding << "), " << nr_orient << " orientations and "
+		          << nr_trans << " translations per call, best instruction set of this CPU: "
+		          << CpuKernels::getSimdLevelName(supported) << std::endl;
+
+		std::cout.precision(4);
+		for (int level = CpuKernels::SIMD_DEFAULT; level <= supported; level++)
+		{
+			CpuKernels::setSimdLevel((CpuKernels::SimdLevel)level);
+			std::cout << "  + " << CpuKernels::getSimdLevelName((CpuKernels::SimdLevel)level) << ":" << std::endl;
+			for (int kernel = 0; kernel < 4; kernel++)
+			{
+				std::vector<XFLOAT> result;
+				double flops = 0., time = 0.;
+				for (int irep = 0; irep < nr_repeats; irep++)
+				{
+					double t0 = wallTime();
+					switch (kernel)
+					{
+					case 0: flops = runCoarse(result); break;
+					case 1: flops = runFine(result); break;
+					case 2: flops = runWavg(result); break;
+					case 3: flops = runBackproject(result); break;
+					}
+					time += wallTime() - t0;
+				}
+				time /= nr_repeats;
+
+				if (level == CpuKernels::SIMD_DEFAULT)
+					reference[kernel] = result;
+				std::cout << "     " << kernel_names[kernel] << ": " << 1e-9 * flops / time << " GFLOP/s ("
+				          << time << " sec), largest relative difference with default: "
+				          << relativeDifference(reference[kernel], result) << std::endl;
+			}
+		}
+	}
+};
+#endif // ALTCPU
+
+int main(int argc, char *argv[])
+{
+#ifdef ALTCPU
+	cpu_kernel_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		prm.usage();
+		exit(1);
+	}
+#else
+	std::cerr << "ERROR: relion_cpu_kernel_benchmark only works in a build with ALTCPU=ON" << std::endl;
+	exit(1);
+#endif
+	return 0;
+}
@@ -0,0 +1,248 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/fftw.h>
+#include <src/fftw_plan_cache.h>
+#include <omp.h>
+#include <sys/time.h>
+
+// The former FourierTransformer::setReal(): a new pair of plans for every new array, made under one global lock
+static pthread_mutex_t fft_benchmark_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+class fft_benchmark_parameters
+{
+	public:
+
+	int box, dim, nr_threads, batch_size;
+	long int nr_transforms;
+	std::string effort;
+	IOParser parser;
+
+	void usage()
+	{
+		parser.writeUsage(std::cerr);
+	}
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		int general_section = parser.addSection("General options");
+		box = textToInteger(parser.getOption("--box", "Box size of the arrays", "256"));
+		dim = textToInteger(parser.getOption("--dim", "Dimension of the arrays (2 or 3)", "2"));
+		nr_transforms = textToInteger(parser.getOption("--n", "Number of forward and backward transforms per test", "2000"));
+		nr_threads = textToInteger(parser.getOption("--j", "Number of threads", "1"));
+		batch_size = textToInteger(parser.getOption("--batch", "Number of arrays per batched transform", "64"));
+		effort = parser.getOption("--planner", "Planning effort of the plan cache (estimate, measure or patient; overrides RELION_FFTW_PLANNER)", "");
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+	}
+
+	double wallTime()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + 1e-6 * tv.tv_usec;
+	}
+
+	void makeArray(MultidimArray<RFLOAT> &img, long int seed)
+	{
+		if (dim == 3)
+			img.resize(box, box, box);
+		else
+			img.resize(box, box);
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(img)
+			DIRECT_MULTIDIM_ELEM(img, n) = (RFLOAT)((n * 7 + seed) % 13) - 6.;
+	}
+
+	// Every transform on a new array, as in the expectation step: returns the time spent planning
+	double runOld(double &total_time)
+	{
+		double plan_time = 0.;
+		double t0 = wallTime();
+
+		#pragma omp parallel for num_threads(nr_threads) reduction(+:plan_time)
+		for (long int i = 0; i < nr_transforms; i++)
+		{
+			MultidimArray<RFLOAT> img;
+			MultidimArray<Complex> Fimg;
+			makeArray(img, i);
+			Fimg.resize(ZSIZE(img), YSIZE(img), XSIZE(img) / 2 + 1);
+
+			int N[3] = {(int)ZSIZE(img), (int)YSIZE(img), (int)XSIZE(img)};
+			int ndim = (dim == 3) ? 3 : 2;
+			int *n = (dim == 3) ? N : N + 1;
+
+			double tp = wallTime();
+			pthread_mutex_lock(&fft_benchmark_mutex);
+#ifdef RELION_SINGLE_PRECISION
+			fftwf_plan forward = fftwf_plan_dft_r2c(ndim, n, MULTIDIM_ARRAY(img), (fftwf_complex*) MULTIDIM_ARRAY(Fimg), FFTW_ESTIMATE);
+			fftwf_plan backward = fftwf_plan_dft_c2r(ndim, n, (fftwf_complex*) MULTIDIM_ARRAY(Fimg), MULTIDIM_ARRAY(img), FFTW_ESTIMATE);
+#else
+			fftw_plan forward = fftw_plan_dft_r2c(ndim, n, MULTIDIM_ARRAY(img), (fftw_complex*) MULTIDIM_ARRAY(Fimg), FFTW_ESTIMATE);
+			fftw_plan backward = fftw_plan_dft_c2r(ndim, n, (fftw_complex*) MULTIDIM_ARRAY(Fimg), MULTIDIM_ARRAY(img), FFTW_ESTIMATE);
+#endif
+			pthread_mutex_unlock(&fft_benchmark_mutex);
+			plan_time += wallTime() - tp;
+
+#ifdef RELION_SINGLE_PRECISION
+			fftwf_execute_dft_r2c(forward, MULTIDIM_ARRAY(img), (fftwf_complex*) MULTIDIM_ARRAY(Fimg));
+			fftwf_execute_dft_c2r(backward, (fftwf_complex*) MULTIDIM_ARRAY(Fimg), MULTIDIM_ARRAY(img));
+#else
+			fftw_execute_dft_r2c(forward, MULTIDIM_ARRAY(img), (fftw_complex*) MULTIDIM_ARRAY(Fimg));
+			fftw_execute_dft_c2r(backward, (fftw_complex*) MULTIDIM_ARRAY(Fimg), MULTIDIM_ARRAY(img));
+#endif
+
+			tp = wallTime();
+			pthread_mutex_lock(&fft_benchmark_mutex);
+#ifdef RELION_SINGLE_PRECISION
+			fftwf_destroy_plan(forward);
+			fftwf_destroy_plan(backward);
+#else
+			fftw_destroy_plan(forward);
+			fftw_destroy_plan(backward);
+#endif
+			pthread_mutex_unlock(&fft_benchmark_mutex);
+			plan_time += wallTime() - tp;
+		}
+
+		total_time = wallTime() - t0;
+		return plan_time;
+	}
+
+	double runCached(double &total_time)
+	{
+		double plan_time = 0.;
+		double t0 = wallTime();
+
+		#pragma omp parallel for num_threads(nr_threads) reduction(+:plan_time)
+		for (long int i = 0; i < nr_transforms; i++)
+		{
+			MultidimArray<RFLOAT> img;
+			MultidimArray<Complex> Fimg;
+			makeArray(img, i);
+
+			FourierTransformer transformer;
+			double tp = wallTime();
+			transformer.setReal(img);
+			plan_time += wallTime() - tp;
+
+			transformer.FourierTransform();
+			transformer.inverseFourierTransform();
+		}
+
+		total_time = wallTime() - t0;
+		return plan_time;
+	}
+
+	// The same transforms in stacks of batch_size arrays: returns the largest difference with FourierTransformer
+	double runBatched(double &total_time)
+	{
+		double max_diff = 0.;
+		double t0 = wallTime();
+
+		BatchFourierTransformer batch_transformer(nr_threads);
+		MultidimArray<RFLOAT> stack;
+		MultidimArray<Complex> Fstack;
+		for (long int first = 0; first < nr_transforms; first += batch_size)
+		{
+			long int nr_arrays = XMIPP_MIN(batch_size, nr_transforms - first);
+			if (dim == 3)
+				stack.reshape(nr_arrays, box, box, box);
+			else
+				stack.reshape(nr_arrays, 1, box, box);
+			long int size = ZSIZE(stack) * YSIZE(stack) * XSIZE(stack);
+			for (long int i = 0; i < nr_arrays; i++)
+				for (long int n = 0; n < size; n++)
+					DIRECT_MULTIDIM_ELEM(stack, i * size + n) = (RFLOAT)((n * 7 + first + i) % 13) - 6.;
+
+			batch_transformer.FourierTransform(stack, Fstack);
+
+			// Compare the first array of the first batch with FourierTransformer
+			if (first == 0)
+			{
+				MultidimArray<RFLOAT> img;
+				MultidimArray<Complex> Fimg;
+				FourierTransformer transformer;
+				makeArray(img, 0);
+				transformer.FourierTransform(img, Fimg, false);
+				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Fimg)
+					max_diff = XMIPP_MAX(max_diff, abs(DIRECT_MULTIDIM_ELEM(Fimg, n) - DIRECT_MULTIDIM_ELEM(Fstack, n)));
+			}
+
+			batch_transformer.inverseFourierTransform(Fstack, stack);
+		}
+
+		total_time = wallTime() - t0;
+		return max_diff;
+	}
+
+	void run()
+	{
+		if (effort != "")
+			setenv("RELION_FFTW_PLANNER", effort.c_str(), 1);
+
+		std::cout << " Box " << box << (dim == 3 ? " (3D)" : " (2D)") << ", " << nr_transforms
+		          << " forward and backward transforms on " << nr_threads << " threads" << std::endl;
+
+		double total_old, total_cached, total_warm, total_batched;
+		double plan_old = runOld(total_old);
+
+		// The first run with the cache makes the plans, the second one only looks them up
+		double plan_cached = runCached(total_cached);
+		double plan_warm = runCached(total_warm);
+		double max_diff = runBatched(total_batched);
+
+		long int nr_plans, nr_lookups;
+		double cache_planning_time;
+		FftwPlanCache::getStatistics(nr_plans, nr_lookups, cache_planning_time);
+
+		std::cout.precision(4);
+		std::cout << "  + Plan per array:        " << nr_transforms / total_old << " transforms/sec, "
+		          << 1000. * plan_old / nr_transforms << " ms planning per transform (summed over threads)" << std::endl;
+		std::cout << "  + Plan cache (cold):     " << nr_transforms / total_cached << " transforms/sec, "
+		          << 1000. * plan_cached / nr_transforms << " ms planning per transform" << std::endl;
+		std::cout << "  + Plan cache (warm):     " << nr_transforms / total_warm << " transforms/sec, "
+		          << 1000. * plan_warm / nr_transforms << " ms planning per transform" << std::endl;
+		std::cout << "  + Batched transforms:    " << nr_transforms / total_batched << " transforms/sec in batches of " << batch_size
+		          << ", largest difference with single transforms: " << max_diff << std::endl;
+		std::cout << "  + Plan cache made " << nr_plans << " plans in " << cache_planning_time << " sec for "
+		          << nr_lookups << " requests" << std::endl;
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	fft_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		prm.usage();
+		exit(1);
+	}
+	return 0;
+}
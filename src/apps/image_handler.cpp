@@ -24,6 +24,7 @@
 #include <src/fftw.h>
 #include <src/time.h>
 #include <src/symmetries.h>
+#include <src/movie_reader.h>
 
 #include <map>
 
@@ -760,12 +761,30 @@ class image_handler_parameters
 			}
 			else if (do_average_all_frames)
 			{
-				Iin.read(fn_img);
-				for (int n = 0; n < ndim; n++)
+				if (zdim == 1)
 				{
-					FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY3D(avg_ampl)
+					// Read the movie frame by frame, rather than all of it at once
+					MovieReader movie;
+					movie.open(fn_img);
+					MultidimArray<float> Iframe;
+					for (int n = 0; n < ndim; n++)
 					{
-						DIRECT_A3D_ELEM(avg_ampl, k, i, j) +=  DIRECT_NZYX_ELEM(Iin(), n, k, i, j);
+						movie.readFrame(n, Iframe);
+						FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(avg_ampl)
+						{
+							DIRECT_A2D_ELEM(avg_ampl, i, j) += DIRECT_A2D_ELEM(Iframe, i, j);
+						}
+					}
+				}
+				else
+				{
+					Iin.read(fn_img);
+					for (int n = 0; n < ndim; n++)
+					{
+						FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY3D(avg_ampl)
+						{
+							DIRECT_A3D_ELEM(avg_ampl, k, i, j) +=  DIRECT_NZYX_ELEM(Iin(), n, k, i, j);
+						}
 					}
 				}
 			}
@@ -786,28 +805,33 @@ class image_handler_parameters
 				if (NSIZE(Iavg()) > 1 && ( fn_ext.contains("mrc") && !fn_ext.contains("mrcs") ) )
 					REPORT_ERROR("ERROR: trying to write a stack into an MRC image. Use .mrcs extensions for stacks!");
 
+				// Only read the frames that are needed, on a thread of their own, and add them up as they come in
+				std::vector<int> avg_frames;
 				for (long int nn = 0; nn < ndim; nn++)
 				{
-					Iin.read(fn_img, true, nn);
-					if (bin_avg > 0)
-					{
-						int myframe = nn / bin_avg;
-						if (myframe < avgndim)
-						{
-							FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(Iin())
-							{
-								DIRECT_NZYX_ELEM(Iavg(),myframe,0,i,j) += DIRECT_A2D_ELEM(Iin(), i, j); // just store sum
-							}
-						}
-					}
-					else if (avg_first >= 0 && avg_last >= 0 && nn+1 >= avg_first && nn+1 <= avg_last) // add one to start counting at 1
+					if ((bin_avg > 0 && nn / bin_avg < avgndim) ||
+					    (bin_avg <= 0 && nn+1 >= avg_first && nn+1 <= avg_last)) // add one to start counting at 1
+						avg_frames.push_back(nn);
+				}
+				std::vector<MultidimArray<float> > Iframes(avg_frames.size());
+				std::vector<MultidimArray<float>*> frame_data(avg_frames.size());
+				for (int iframe = 0; iframe < avg_frames.size(); iframe++)
+					frame_data[iframe] = &Iframes[iframe];
+
+				MovieReader movie;
+				movie.open(fn_img);
+				movie.startReading(avg_frames, frame_data, 1);
+				for (int iframe = 0; iframe < avg_frames.size(); iframe++)
+				{
+					movie.waitForFrame(iframe);
+					int myframe = (bin_avg > 0) ? avg_frames[iframe] / bin_avg : 0;
+					FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(Iframes[iframe])
 					{
-						FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Iin())
-						{
-							DIRECT_MULTIDIM_ELEM(Iavg(), n) += DIRECT_MULTIDIM_ELEM(Iin(), n); // just store sum
-						}
+						DIRECT_NZYX_ELEM(Iavg(),myframe,0,i,j) += DIRECT_A2D_ELEM(Iframes[iframe], i, j); // just store sum
 					}
+					Iframes[iframe].clear();
 				}
+				movie.finishReading();
 				Iavg.write(fn_out);
 			}
 			else
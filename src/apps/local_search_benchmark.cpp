@@ -0,0 +1,141 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/healpix_sampling.h>
+#include <sys/time.h>
+
+// Times HealpixSampling::selectOrientationsWithNonZeroPriorProbability per particle, as in local angular searches,
+// once with the search over the HEALPix neighbours of the prior and once with the loop over all directions
+class local_search_benchmark_parameters
+{
+	public:
+
+	int min_order, max_order;
+	long int nr_particles;
+	RFLOAT sigma_steps, sigma_cutoff;
+	FileName fn_sym;
+	IOParser parser;
+
+	void usage()
+	{
+		parser.writeUsage(std::cerr);
+	}
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		int general_section = parser.addSection("General options");
+		min_order = textToInteger(parser.getOption("--min_order", "Lowest HEALPix order", "4"));
+		max_order = textToInteger(parser.getOption("--max_order", "Highest HEALPix order", "8"));
+		fn_sym = parser.getOption("--sym", "Symmetry group", "C1");
+		nr_particles = textToInteger(parser.getOption("--n", "Number of particles (i.e. priors) per order", "20"));
+		sigma_steps = textToFloat(parser.getOption("--sigma", "Standard deviation of the priors on the angles, in angular sampling steps", "2"));
+		sigma_cutoff = textToFloat(parser.getOption("--cutoff", "Only directions within this many standard deviations have a non-zero prior", "3"));
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+	}
+
+	double wallTime()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + 1e-6 * tv.tv_usec;
+	}
+
+	// Returns the time per particle, and the selected directions and their priors of all particles
+	double runSelection(HealpixSampling &sampling, RFLOAT sigma, std::vector<int> &all_dirs, std::vector<RFLOAT> &all_priors)
+	{
+		std::vector<int> pointer_dir_nonzeroprior, pointer_psi_nonzeroprior;
+		std::vector<RFLOAT> directions_prior, psi_prior;
+		all_dirs.clear();
+		all_priors.clear();
+
+		double t0 = wallTime();
+		for (long int ipart = 0; ipart < nr_particles; ipart++)
+		{
+			// Spread the priors over the sphere
+			RFLOAT rot = fmod(ipart * 137.508, 360.) - 180.;
+			RFLOAT tilt = ACOSD(1. - 2. * (ipart + 0.5) / nr_particles);
+			RFLOAT psi = fmod(ipart * 57.2958, 360.);
+			sampling.selectOrientationsWithNonZeroPriorProbability(rot, tilt, psi, sigma, sigma, sigma,
+					pointer_dir_nonzeroprior, directions_prior, pointer_psi_nonzeroprior, psi_prior, false, sigma_cutoff);
+			all_dirs.insert(all_dirs.end(), pointer_dir_nonzeroprior.begin(), pointer_dir_nonzeroprior.end());
+			all_priors.insert(all_priors.end(), directions_prior.begin(), directions_prior.end());
+		}
+
+		return (wallTime() - t0) / nr_particles;
+	}
+
+	void run()
+	{
+		std::cout << " Symmetry " << fn_sym << ", " << nr_particles << " particles, priors with sigma= "
+		          << sigma_steps << " sampling steps and a cutoff of " << sigma_cutoff << " sigma" << std::endl;
+
+		for (int order = min_order; order <= max_order; order++)
+		{
+			HealpixSampling sampling;
+			sampling.clear();
+			sampling.healpix_order = order;
+			sampling.fn_sym = fn_sym;
+			sampling.limit_tilt = -91.;
+			sampling.psi_step = -1.;
+			sampling.offset_range = sampling.offset_step = 1.;
+			sampling.initialise(NOPRIOR, 3);
+			RFLOAT sigma = sigma_steps * sampling.getAngularSampling();
+
+			std::vector<int> dirs_near, dirs_all;
+			std::vector<RFLOAT> priors_near, priors_all;
+			double time_near = runSelection(sampling, sigma, dirs_near, priors_near);
+
+			// Without the HEALPix pixel of each direction, all directions are checked
+			sampling.idir_of_ipix.clear();
+			double time_all = runSelection(sampling, sigma, dirs_all, priors_all);
+
+			bool is_same = (dirs_near == dirs_all) && (priors_near == priors_all);
+
+			std::cout.precision(4);
+			std::cout << "  + Order " << order << ": " << sampling.NrDirections() << " directions, "
+			          << (RFLOAT)dirs_near.size() / nr_particles << " with a non-zero prior per particle; "
+			          << 1000. * time_near << " ms per particle with the neighbour search, "
+			          << 1000. * time_all << " ms with the loop over all directions"
+			          << (is_same ? "" : " (WARNING: the selected directions differ!)") << std::endl;
+		}
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	local_search_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		prm.usage();
+		exit(1);
+	}
+	return 0;
+}
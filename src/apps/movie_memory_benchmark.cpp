@@ -0,0 +1,227 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/movie_reader.h>
+#include <sys/time.h>
+
+// Compares the memory used by the frames of a synthetic counting movie (4-bit or 8-bit MRC), and the time
+// to read them, apply the gain reference and sum them, when the frames are kept in float (as motion correction
+// used to do) and when they are kept in the data type of the movie and converted only where they are used
+class movie_memory_benchmark_parameters
+{
+	public:
+
+	FileName fn_movie;
+	int box, nr_frames, bits, nr_threads;
+	RFLOAT dose;
+	bool keep_movie;
+	IOParser parser;
+
+	void usage()
+	{
+		parser.writeUsage(std::cerr);
+	}
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		int general_section = parser.addSection("General options");
+		fn_movie = parser.getOption("--o", "Name of the synthetic movie", "movie_memory_benchmark.mrcs");
+		box = textToInteger(parser.getOption("--box", "Width and height of the frames", "2048"));
+		nr_frames = textToInteger(parser.getOption("--n", "Number of frames", "40"));
+		bits = textToInteger(parser.getOption("--bits", "Bits per pixel of the movie (4 or 8)", "4"));
+		dose = textToFloat(parser.getOption("--counts", "Average number of counts per pixel per frame", "1"));
+		nr_threads = textToInteger(parser.getOption("--j", "Number of threads", "1"));
+		keep_movie = parser.checkOption("--keep", "Do not delete the synthetic movie at the end");
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+		if (bits != 4 && bits != 8)
+			REPORT_ERROR("--bits should be 4 or 8");
+		if (box % 2 != 0)
+			REPORT_ERROR("--box should be even");
+	}
+
+	double wallTime()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + 1e-6 * tv.tv_usec;
+	}
+
+	int poisson(RFLOAT mean)
+	{
+		RFLOAT limit = exp(-mean), p = rnd_unif();
+		int k = 0;
+		while (p > limit)
+		{
+			p *= rnd_unif();
+			k++;
+		}
+		return k;
+	}
+
+	// Mode 101 (4-bit, SerialEM) or mode 0 (8-bit) MRC stack of Poisson-distributed counts
+	void writeMovie()
+	{
+		std::vector<char> header(1024, 0);
+		int *ihead = (int*)&header[0];
+		float *fhead = (float*)&header[0];
+		ihead[0] = ihead[7] = box;
+		ihead[1] = ihead[8] = box;
+		ihead[2] = ihead[9] = nr_frames;
+		ihead[3] = (bits == 4) ? 101 : 0;
+		fhead[10] = fhead[11] = box;
+		fhead[12] = nr_frames;
+		ihead[16] = 1;
+		ihead[17] = 2;
+		ihead[18] = 3;
+		memcpy(&header[208], "MAP ", 4);
+		header[212] = header[213] = 0x44;
+
+		std::ofstream fh(fn_movie.c_str(), std::ios::binary);
+		if (!fh)
+			REPORT_ERROR("Cannot write " + fn_movie);
+		fh.write(&header[0], header.size());
+
+		const int max_count = (1 << bits) - 1;
+		size_t nr_pixels = (size_t)box * box;
+		std::vector<unsigned char> page((bits == 4) ? nr_pixels / 2 : nr_pixels);
+		for (int iframe = 0; iframe < nr_frames; iframe++)
+		{
+			for (size_t n = 0; n < nr_pixels; n++)
+			{
+				unsigned char count = XMIPP_MIN(max_count, poisson(dose));
+				if (bits == 8)
+					page[n] = count;
+				else if (n % 2 == 0)
+					page[n / 2] = count;
+				else
+					page[n / 2] |= count << 4;
+			}
+			fh.write((char*)&page[0], page.size());
+		}
+	}
+
+	void run()
+	{
+		init_random_generator(1);
+		std::cout << " Writing a " << bits << "-bit synthetic movie of " << nr_frames << " frames of " << box << " x " << box << " pixels to " << fn_movie << " ..." << std::endl;
+		writeMovie();
+
+		MovieReader movie;
+		movie.open(fn_movie);
+		std::vector<int> frames(nr_frames);
+		for (int iframe = 0; iframe < nr_frames; iframe++)
+			frames[iframe] = iframe;
+
+		MultidimArray<float> gain(box, box);
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(gain)
+			DIRECT_MULTIDIM_ELEM(gain, n) = rnd_unif(0.9, 1.1);
+
+		std::cout.precision(4);
+
+		// Frames in float, gain applied as soon as a frame has been read
+		double t0 = wallTime();
+		std::vector<MultidimArray<float> > Iframes(nr_frames);
+		std::vector<MultidimArray<float>*> frame_data(nr_frames);
+		for (int iframe = 0; iframe < nr_frames; iframe++)
+			frame_data[iframe] = &Iframes[iframe];
+		movie.startReading(frames, frame_data, nr_threads);
+		MultidimArray<float> Isum(box, box);
+		Isum.initZeros();
+		size_t float_memory = 0;
+		for (int iframe = 0; iframe < nr_frames; iframe++)
+		{
+			movie.waitForFrame(iframe);
+			#pragma omp parallel for num_threads(nr_threads)
+			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Isum)
+			{
+				DIRECT_MULTIDIM_ELEM(Iframes[iframe], n) *= DIRECT_MULTIDIM_ELEM(gain, n);
+				DIRECT_MULTIDIM_ELEM(Isum, n) += DIRECT_MULTIDIM_ELEM(Iframes[iframe], n);
+			}
+			float_memory += MULTIDIM_SIZE(Iframes[iframe]) * sizeof(float);
+		}
+		movie.finishReading();
+		double float_time = wallTime() - t0;
+		Iframes.clear();
+
+		// Packed frames, gain applied while summing, and again when each frame is converted to float (as before its FFT)
+		t0 = wallTime();
+		std::vector<PackedFrame> Pframes(nr_frames);
+		std::vector<PackedFrame*> packed_data(nr_frames);
+		for (int iframe = 0; iframe < nr_frames; iframe++)
+			packed_data[iframe] = &Pframes[iframe];
+		movie.startReading(frames, packed_data, nr_threads);
+		MultidimArray<float> Psum(box, box);
+		Psum.initZeros();
+		size_t packed_memory = 0;
+		for (int iframe = 0; iframe < nr_frames; iframe++)
+		{
+			movie.waitForFrame(iframe);
+			Pframes[iframe].addTo(Psum, &gain, nr_threads);
+			packed_memory += Pframes[iframe].getMemory();
+		}
+		movie.finishReading();
+		double packed_time = wallTime() - t0;
+
+		t0 = wallTime();
+		#pragma omp parallel for num_threads(nr_threads)
+		for (int iframe = 0; iframe < nr_frames; iframe++)
+		{
+			MultidimArray<float> Iframe;
+			Pframes[iframe].unpack(Iframe, &gain);
+		}
+		double unpack_time = wallTime() - t0;
+
+		RFLOAT max_diff = 0.;
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Isum)
+			max_diff = XMIPP_MAX(max_diff, ABS(DIRECT_MULTIDIM_ELEM(Isum, n) - DIRECT_MULTIDIM_ELEM(Psum, n)));
+
+		std::cout << "  + frames in float:  " << float_memory / (1024. * 1024.) << " Mb, read, gain and sum "
+		          << float_time << " sec (" << 3600. / float_time << " movies/hour)" << std::endl;
+		std::cout << "  + frames as read:   " << packed_memory / (1024. * 1024.) << " Mb (" << (double)float_memory / packed_memory
+		          << " times less), read, gain and sum " << packed_time << " sec (" << 3600. / packed_time << " movies/hour), "
+		          << "conversion to float with gain before the FFTs " << unpack_time << " sec" << std::endl;
+		std::cout << "  + largest difference between the sums: " << max_diff << std::endl;
+
+		if (!keep_movie)
+			remove(fn_movie.c_str());
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	movie_memory_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		prm.usage();
+		exit(1);
+	}
+	return 0;
+}
@@ -0,0 +1,237 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/backprojector.h>
+#include <src/euler.h>
+#include <sys/time.h>
+
+// Compares projections and backprojections with the references (--projector_precision) and
+// the sums of the backprojections (--backprojector_precision) in lower precision to those in RFLOAT:
+// memory per class, time, and the Fourier shell correlation with the RFLOAT results
+class precision_benchmark_parameters
+{
+	public:
+
+	FileName fn_map;
+	int box;
+	float padding;
+	long int nr_images;
+	bool do_cpu;
+	MultidimArray<RFLOAT> vol;
+	IOParser parser;
+
+	void usage()
+	{
+		parser.writeUsage(std::cerr);
+	}
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		int general_section = parser.addSection("General options");
+		fn_map = parser.getOption("--i", "Input map (by default a phantom of random Gaussian blobs)", "");
+		box = textToInteger(parser.getOption("--box", "Box size of the phantom", "64"));
+		padding = textToFloat(parser.getOption("--pad", "Padding factor of the references and reconstructions", "2"));
+		nr_images = textToInteger(parser.getOption("--n", "Number of projections", "1000"));
+		do_cpu = parser.checkOption("--cpu", "Only run the combinations that relion_refine accepts with --cpu or --gpu");
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+	}
+
+	double wallTime()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + 1e-6 * tv.tv_usec;
+	}
+
+	void getOrientation(long int i, Matrix2D<RFLOAT> &A)
+	{
+		// Spread the orientations over the sphere in a reproducible way
+		RFLOAT rot = fmod(i * 137.508, 360.);
+		RFLOAT tilt = ACOSD(1. - 2. * (i + 0.5) / nr_images);
+		RFLOAT psi = fmod(i * 23.7, 360.);
+		Euler_angles2matrix(rot, tilt, psi, A);
+	}
+
+	void makePhantom()
+	{
+		vol.initZeros(box, box, box);
+		vol.setXmippOrigin();
+		init_random_generator(1);
+		for (int iblob = 0; iblob < 30; iblob++)
+		{
+			RFLOAT x0 = rnd_unif(-box / 5., box / 5.);
+			RFLOAT y0 = rnd_unif(-box / 5., box / 5.);
+			RFLOAT z0 = rnd_unif(-box / 5., box / 5.);
+			RFLOAT sigma = rnd_unif(1., box / 16.);
+			RFLOAT height = rnd_unif(0.5, 1.);
+			FOR_ALL_ELEMENTS_IN_ARRAY3D(vol)
+			{
+				RFLOAT r2 = (j - x0) * (j - x0) + (i - y0) * (i - y0) + (k - z0) * (k - z0);
+				A3D_ELEM(vol, k, i, j) += height * exp(-r2 / (2. * sigma * sigma));
+			}
+		}
+	}
+
+	// Fourier shell correlation between the data arrays of two BackProjectors, worst shell (within r_max)
+	RFLOAT getMinimumFSC(BackProjector &BP1, BackProjector &BP2)
+	{
+		int nr_shells = BP1.r_max + 1;
+		std::vector<double> num(nr_shells, 0.), den1(nr_shells, 0.), den2(nr_shells, 0.);
+		FOR_ALL_ELEMENTS_IN_ARRAY3D(BP1.data)
+		{
+			int ires = ROUND(sqrt((RFLOAT)(k * k + i * i + j * j)) / padding);
+			if (ires >= nr_shells)
+				continue;
+			Complex z1 = A3D_ELEM(BP1.data, k, i, j);
+			Complex z2 = A3D_ELEM(BP2.data, k, i, j);
+			num[ires] += z1.real * z2.real + z1.imag * z2.imag;
+			den1[ires] += norm(z1);
+			den2[ires] += norm(z2);
+		}
+
+		RFLOAT min_fsc = 1.;
+		for (int ires = 0; ires < nr_shells; ires++)
+			if (den1[ires] > 0. && den2[ires] > 0.)
+				min_fsc = XMIPP_MIN(min_fsc, num[ires] / sqrt(den1[ires] * den2[ires]));
+		return min_fsc;
+	}
+
+	RFLOAT getMaximumRelativeError(MultidimArray<RFLOAT> &weight1, MultidimArray<RFLOAT> &weight2)
+	{
+		RFLOAT max_err = 0.;
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(weight1)
+			if (DIRECT_MULTIDIM_ELEM(weight1, n) > 0.)
+				max_err = XMIPP_MAX(max_err, ABS(DIRECT_MULTIDIM_ELEM(weight2, n) - DIRECT_MULTIDIM_ELEM(weight1, n)) / DIRECT_MULTIDIM_ELEM(weight1, n));
+		return max_err;
+	}
+
+	// Backproject all projections of PP into BP (summed in bp_precision), and return the time spent projecting
+	double run(Projector &PP, BackProjector &BP, int bp_precision, double &bp_time, size_t &bp_memory)
+	{
+		int current_size = box;
+		BP = BackProjector(box, 3, "C1", TRILINEAR, padding);
+		BP.initZeros(current_size);
+		BP.setDataPrecision(bp_precision);
+		bp_memory = BP.getDataMemory();
+
+		MultidimArray<Complex> Fimg(current_size, current_size / 2 + 1);
+		MultidimArray<RFLOAT> Fweight(current_size, current_size / 2 + 1);
+		Fweight.initConstant(1.);
+		Matrix2D<RFLOAT> A;
+
+		double project_time = 0.;
+		bp_time = 0.;
+		for (long int i = 0; i < nr_images; i++)
+		{
+			getOrientation(i, A);
+			double t0 = wallTime();
+			Fimg.initZeros();
+			PP.get2DFourierTransform(Fimg, A, IS_NOT_INV);
+			double t1 = wallTime();
+			BP.set2DFourierTransform(Fimg, A, IS_NOT_INV, &Fweight);
+			bp_time += wallTime() - t1;
+			project_time += t1 - t0;
+		}
+
+		BP.setDataPrecision(PRECISION_RFLOAT);
+		return project_time;
+	}
+
+	void run()
+	{
+		if (fn_map != "")
+		{
+			Image<RFLOAT> img;
+			img.read(fn_map);
+			vol = img();
+			box = XSIZE(vol);
+		}
+		else
+			makePhantom();
+		vol.setXmippOrigin();
+
+		Projector PPref(box, TRILINEAR, padding, 10, 2);
+		MultidimArray<RFLOAT> dummy;
+		PPref.computeFourierTransformMap(vol, dummy, box);
+
+		std::cout << " Box " << box << " (padding " << padding << "), " << nr_images << " projections" << std::endl;
+		if (do_cpu)
+			std::cout << " With --cpu or --gpu the backprojections are summed in the arrays of the accelerators, so only in double here" << std::endl;
+		std::cout.precision(4);
+
+		const char *names[3] = {"double", "float", "half"};
+		BackProjector BPref;
+		double ref_project_time = 0.;
+		for (int pp_precision = PRECISION_RFLOAT; pp_precision <= PRECISION_HALF; pp_precision++)
+		{
+			Projector PP(PPref);
+			PP.setDataPrecision(pp_precision);
+			double pp_Mb = Projector::getElementSize(pp_precision) * PP.getSize() / (1024. * 1024.);
+
+			int max_bp_precision = (do_cpu) ? PRECISION_RFLOAT : PRECISION_FLOAT;
+			for (int bp_precision = PRECISION_RFLOAT; bp_precision <= max_bp_precision; bp_precision++)
+			{
+				BackProjector BP;
+				double bp_time;
+				size_t bp_memory;
+				double project_time = run(PP, BP, bp_precision, bp_time, bp_memory);
+				double bp_Mb = bp_memory / (1024. * 1024.);
+
+				if (pp_precision == PRECISION_RFLOAT && bp_precision == PRECISION_RFLOAT)
+				{
+					BPref = BP;
+					ref_project_time = project_time;
+					std::cout << "  + projector double, backprojector double: " << pp_Mb + bp_Mb << " Mb per class ("
+					          << pp_Mb << " + " << bp_Mb << "), " << nr_images / project_time << " projections/sec, "
+					          << nr_images / bp_time << " backprojections/sec" << std::endl;
+					continue;
+				}
+
+				std::cout << "  + projector " << names[pp_precision] << ", backprojector " << names[bp_precision] << ": "
+				          << pp_Mb + bp_Mb << " Mb per class (" << pp_Mb << " + " << bp_Mb << "), "
+				          << nr_images / project_time << " projections/sec, " << nr_images / bp_time << " backprojections/sec; "
+				          << "1 - FSC with double in the worst shell " << 1. - getMinimumFSC(BPref, BP)
+				          << ", largest relative error in the weights " << getMaximumRelativeError(BPref.weight, BP.weight) << std::endl;
+			}
+		}
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	precision_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		prm.usage();
+		exit(1);
+	}
+	return 0;
+}
@@ -36,7 +36,8 @@ int main(int argc, char **argv)
 		optimiser.initialise();
 
 		// Do the real work
-		optimiser.iterate();
+		if (!optimiser.do_tune_only)
+			optimiser.iterate();
 	}
 	catch (RelionError XE)
 	{
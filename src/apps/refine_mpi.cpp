@@ -42,7 +42,8 @@ int main(int argc, char **argv)
 			optimiser.initialise();
 
 			// Iterate
-			optimiser.iterate();
+			if (!optimiser.do_tune_only)
+				optimiser.iterate();
 		}
 
 	}
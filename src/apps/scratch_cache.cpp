@@ -0,0 +1,119 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/scratch_cache.h>
+#include <src/args.h>
+#include <src/error.h>
+
+class scratch_cache_parameters
+{
+	public:
+	FileName fn_dir;
+	RFLOAT max_Gb, evict_Gb;
+	bool do_stats, do_clear, do_reset;
+	// I/O Parser
+	IOParser parser;
+
+
+	void usage()
+	{
+		parser.writeUsage(std::cerr);
+	}
+
+	void read(int argc, char **argv)
+	{
+
+		parser.setCommandLine(argc, argv);
+
+		int general_section = parser.addSection("Options");
+		fn_dir = parser.getOption("--dir", "Directory of the scratch cache (default: $RELION_SCRATCH_CACHE)", "");
+		max_Gb = textToFloat(parser.getOption("--max_size", "Maximum size of the cache in Gb (default: $RELION_SCRATCH_CACHE_GB, or all free space but 10 Gb)", "-1"));
+		evict_Gb = textToFloat(parser.getOption("--evict_to", "Remove least recently used stacks until the cache is at most this many Gb", "-1"));
+		do_stats = parser.checkOption("--stats", "Only print the size and the statistics of the cache (which is also done after the options below)");
+		do_clear = parser.checkOption("--clear", "Remove all stacks from the cache");
+		do_reset = parser.checkOption("--reset_statistics", "Set the statistics of the cache to zero");
+
+		// Check for errors in the command-line option
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line (see above), exiting...");
+	}
+
+	void run()
+	{
+		if (fn_dir == "")
+		{
+			char *penv = getenv("RELION_SCRATCH_CACHE");
+			if (penv == NULL || penv[0] == '\0')
+				REPORT_ERROR("ERROR: provide the cache directory with --dir, or through the environment variable RELION_SCRATCH_CACHE");
+			fn_dir = (std::string)penv;
+		}
+		if (max_Gb <= 0.)
+		{
+			char *penv = getenv("RELION_SCRATCH_CACHE_GB");
+			if (penv != NULL && penv[0] != '\0')
+				max_Gb = textToFloat(penv);
+		}
+
+		ScratchCache cache(fn_dir, max_Gb);
+
+		if (do_clear)
+			cache.evict(0.);
+		else if (evict_Gb >= 0.)
+			cache.evict(evict_Gb * 1024. * 1024. * 1024.);
+
+		// Add the evictions above to the statistics file
+		cache.shutDown(false);
+
+		if (do_reset)
+			cache.resetStatistics();
+
+		const double Gb = 1024. * 1024. * 1024.;
+		long int nr_entries;
+		double size = cache.getSize(nr_entries);
+		ScratchCache::Statistics stats = cache.readStatistics();
+		long int nr_lookups = stats.nr_hits + stats.nr_misses;
+
+		std::cout << " Scratch cache in " << fn_dir << std::endl;
+		std::cout << "  + Stacks in the cache: " << nr_entries << " (" << size / Gb << " of at most " << cache.getMaxSize() / Gb << " Gb)" << std::endl;
+		std::cout << "  + Hits: " << stats.nr_hits << ", misses: " << stats.nr_misses;
+		if (nr_lookups > 0)
+			std::cout << " (hit rate " << 100. * stats.nr_hits / nr_lookups << "%)";
+		std::cout << std::endl;
+		std::cout << "  + Stacks copied: " << stats.nr_copies << " (" << stats.bytes_copied / Gb << " Gb)" << std::endl;
+		std::cout << "  + Stacks evicted: " << stats.nr_evictions << " (" << stats.bytes_evicted / Gb << " Gb)" << std::endl;
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	scratch_cache_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		prm.usage();
+		exit(1);
+	}
+	return 0;
+}
@@ -0,0 +1,309 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/memory.h>
+#include <src/time.h>
+#include <src/metadata_table.h>
+#include <omp.h>
+#include <sys/time.h>
+
+// Layout of a row in the former row-oriented MetaDataTable, kept here to compare against
+class RowStoreContainer
+{
+	public:
+
+	MetaDataTable* table;
+	std::vector<double> doubles;
+	std::vector<long> ints;
+	std::vector<bool> bools;
+	std::vector<std::string> strings;
+
+	RowStoreContainer(long doubleCount, long intCount, long boolCount, long stringCount)
+	: table(NULL), doubles(doubleCount, 0), ints(intCount, 0), bools(boolCount, false), strings(stringCount, "")
+	{}
+};
+
+class star_benchmark_parameters
+{
+	public:
+
+	FileName fn_out, fn_tmp;
+	long int nr_particles, nr_per_mic;
+	bool skip_rowstore, do_read;
+	IOParser parser;
+
+	std::vector<EMDLabel> double_labels, int_labels, string_labels;
+
+	void usage()
+	{
+		parser.writeUsage(std::cerr);
+	}
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		int general_section = parser.addSection("General options");
+		nr_particles = textToInteger(parser.getOption("--n", "Number of synthetic particles", "1000000"));
+		nr_per_mic = textToInteger(parser.getOption("--per_mic", "Number of particles per micrograph", "200"));
+		fn_out = parser.getOption("--o", "Write the synthetic table to this STAR file", "");
+		skip_rowstore = parser.checkOption("--skip_rowstore", "Do not measure the memory of the former row-oriented layout");
+		do_read = parser.checkOption("--read", "Measure the STAR parsing throughput on files with n/100, n/10 and n particles");
+		fn_tmp = parser.getOption("--tmp", "Temporary STAR file for the parsing benchmark", "star_benchmark_tmp.star");
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+	}
+
+	void initialiseLabels()
+	{
+		// The columns of a typical refinement _data.star
+		EMDLabel dl[] = {EMDL_IMAGE_COORD_X, EMDL_IMAGE_COORD_Y, EMDL_ORIENT_ROT, EMDL_ORIENT_TILT, EMDL_ORIENT_PSI,
+		                 EMDL_ORIENT_ORIGIN_X, EMDL_ORIENT_ORIGIN_Y, EMDL_CTF_DEFOCUSU, EMDL_CTF_DEFOCUSV,
+		                 EMDL_CTF_DEFOCUS_ANGLE, EMDL_CTF_VOLTAGE, EMDL_CTF_CS, EMDL_CTF_Q0, EMDL_CTF_MAGNIFICATION,
+		                 EMDL_CTF_DETECTOR_PIXEL_SIZE, EMDL_CTF_BFACTOR, EMDL_CTF_SCALEFACTOR, EMDL_CTF_PHASESHIFT,
+		                 EMDL_PARTICLE_AUTOPICK_FOM, EMDL_PARTICLE_PMAX,
+		                 EMDL_PARTICLE_DLL, EMDL_IMAGE_NORM_CORRECTION};
+		EMDLabel il[] = {EMDL_PARTICLE_CLASS, EMDL_MLMODEL_GROUP_NO, EMDL_PARTICLE_RANDOM_SUBSET, EMDL_PARTICLE_NR_SIGNIFICANT_SAMPLES};
+		EMDLabel sl[] = {EMDL_IMAGE_NAME, EMDL_MICROGRAPH_NAME, EMDL_IMAGE_ORI_NAME, EMDL_MLMODEL_GROUP_NAME};
+
+		double_labels.assign(dl, dl + sizeof(dl) / sizeof(EMDLabel));
+		int_labels.assign(il, il + sizeof(il) / sizeof(EMDLabel));
+		string_labels.assign(sl, sl + sizeof(sl) / sizeof(EMDLabel));
+	}
+
+	std::string stringValue(int ilabel, long int ipart)
+	{
+		const long int imic = ipart / nr_per_mic;
+		std::string fn_mic = "MotionCorr/job003/Movies/mic" + integerToString(imic, 6) + ".mrc";
+
+		switch (ilabel)
+		{
+		case 0:
+			return integerToString(ipart % nr_per_mic + 1, 6) + "@Extract/job010/Movies/mic" + integerToString(imic, 6) + ".mrcs";
+		case 1:
+			return fn_mic;
+		case 2:
+			return integerToString(ipart % nr_per_mic + 1, 6) + "@Polish/job020/Movies/mic" + integerToString(imic, 6) + ".mrcs";
+		default:
+			return "group_" + integerToString(imic / 50, 3);
+		}
+	}
+
+	RFLOAT doubleValue(int ilabel, long int ipart)
+	{
+		return (ilabel == 5 || ilabel == 6) ? (RFLOAT)((ipart * 7 + ilabel) % 11) - 5. : (RFLOAT)(ipart % 4096) + 0.25 * ilabel;
+	}
+
+	void fillTable(MetaDataTable &MD)
+	{
+		MD.clear();
+		// Define all columns before reserving, as when reading a STAR file
+		for (int i = 0; i < double_labels.size(); i++)
+			MD.addLabel(double_labels[i]);
+		for (int i = 0; i < int_labels.size(); i++)
+			MD.addLabel(int_labels[i]);
+		for (int i = 0; i < string_labels.size(); i++)
+			MD.addLabel(string_labels[i]);
+		MD.reserve(nr_particles);
+		for (long int ipart = 0; ipart < nr_particles; ipart++)
+		{
+			MD.addObject();
+			for (int i = 0; i < double_labels.size(); i++)
+				MD.setValue(double_labels[i], doubleValue(i, ipart));
+			for (int i = 0; i < int_labels.size(); i++)
+				MD.setValue(int_labels[i], (long)(ipart % (7 + i)));
+			for (int i = 0; i < string_labels.size(); i++)
+				MD.setValue(string_labels[i], stringValue(i, ipart));
+		}
+	}
+
+	void fillRowStore(std::vector<RowStoreContainer*> &rows)
+	{
+		rows.reserve(nr_particles);
+		for (long int ipart = 0; ipart < nr_particles; ipart++)
+		{
+			RowStoreContainer* row = new RowStoreContainer(double_labels.size(), int_labels.size(), 0, string_labels.size());
+			for (int i = 0; i < double_labels.size(); i++)
+				row->doubles[i] = doubleValue(i, ipart);
+			for (int i = 0; i < int_labels.size(); i++)
+				row->ints[i] = ipart % (7 + i);
+			for (int i = 0; i < string_labels.size(); i++)
+				row->strings[i] = stringValue(i, ipart);
+			rows.push_back(row);
+		}
+	}
+
+	// Time reading a STAR file of nr_particles rows, with one and with all threads
+	void runRead()
+	{
+		MetaDataTable MD;
+		fillTable(MD);
+		MD.write(fn_tmp);
+		MD.clear();
+
+		const RFLOAT megabytes = (RFLOAT)fn_tmp.getFileSize() / (1024 * 1024);
+		const int max_threads = omp_get_max_threads();
+
+		for (int nr_threads = 1; ; nr_threads = max_threads)
+		{
+			omp_set_num_threads(nr_threads);
+
+			// Read once to have the file in the page cache
+			MD.read(fn_tmp);
+
+			timeval t0, t1;
+			gettimeofday(&t0, NULL);
+			MD.read(fn_tmp);
+			gettimeofday(&t1, NULL);
+			RFLOAT seconds = (t1.tv_sec - t0.tv_sec) + 1e-6 * (t1.tv_usec - t0.tv_usec);
+
+			if (MD.numberOfObjects() != nr_particles)
+				REPORT_ERROR("star_benchmark: read " + integerToString(MD.numberOfObjects()) + " instead of " + integerToString(nr_particles) + " particles");
+
+			std::cout << "  " << std::setw(9) << nr_particles << " particles, " << std::setw(8) << megabytes << " MB, "
+			          << std::setw(3) << nr_threads << " thread(s): " << std::setw(8) << seconds << " s, "
+			          << std::setw(10) << (long int)(nr_particles / seconds) << " rows/s, "
+			          << std::setw(8) << megabytes / seconds << " MB/s" << std::endl;
+
+			if (nr_threads == max_threads)
+				break;
+		}
+
+		omp_set_num_threads(max_threads);
+		remove(fn_tmp.c_str());
+	}
+
+	void run()
+	{
+		initialiseLabels();
+
+		if (do_read)
+		{
+			std::cout << " Parsing throughput:" << std::endl;
+			const long int nr_total = nr_particles;
+			for (long int n = XMIPP_MAX(1000, nr_total / 100); n <= nr_total; n *= 10)
+			{
+				nr_particles = n;
+				runRead();
+			}
+			nr_particles = nr_total;
+			return;
+		}
+
+		Timer timer;
+		int TIMING_FILL = timer.setNew("fill table");
+		int TIMING_SORT = timer.setNew("sort (double)");
+		int TIMING_NEWSORT = timer.setNew("newSort (string)");
+		int TIMING_NEWSORT_AT = timer.setNew("newSort (string after @)");
+		int TIMING_APPEND = timer.setNew("append");
+		int TIMING_SUBSET = timer.setNew("subsetMetaDataTable");
+		int TIMING_DUPLICATES = timer.setNew("removeDuplicatedParticles");
+		int TIMING_WRITE = timer.setNew("write");
+
+		std::cout << " Number of particles: " << nr_particles << " (" << nr_per_mic << " per micrograph)" << std::endl;
+		std::cout << " Number of columns: " << double_labels.size() << " double, " << int_labels.size() << " int, "
+		          << string_labels.size() << " string" << std::endl;
+
+		// Memory of the former row store
+		if (!skip_rowstore)
+		{
+			releaseFreeMemory();
+			size_t rss0 = getCurrentRSS();
+			std::vector<RowStoreContainer*> rows;
+			fillRowStore(rows);
+			size_t rss1 = getCurrentRSS();
+			for (long int i = 0; i < rows.size(); i++)
+				delete rows[i];
+			rows.clear();
+			std::cout << " Row store:    " << (RFLOAT)(rss1 - rss0) / nr_particles << " bytes per particle (RSS)" << std::endl;
+		}
+
+		// Memory of the column store
+		MetaDataTable MD;
+		releaseFreeMemory();
+		size_t rss0 = getCurrentRSS();
+		timer.tic(TIMING_FILL);
+		fillTable(MD);
+		timer.toc(TIMING_FILL);
+		size_t rss1 = getCurrentRSS();
+		std::cout << " Column store: " << (RFLOAT)(rss1 - rss0) / nr_particles << " bytes per particle (RSS), "
+		          << (RFLOAT)MD.memoryUsage() / nr_particles << " bytes per particle (MetaDataTable::memoryUsage)" << std::endl;
+
+		timer.tic(TIMING_SORT);
+		MD.sort(EMDL_CTF_DEFOCUSU);
+		timer.toc(TIMING_SORT);
+
+		timer.tic(TIMING_NEWSORT);
+		MD.newSort(EMDL_MICROGRAPH_NAME);
+		timer.toc(TIMING_NEWSORT);
+
+		timer.tic(TIMING_NEWSORT_AT);
+		MD.newSort(EMDL_IMAGE_NAME, false, true);
+		timer.toc(TIMING_NEWSORT_AT);
+
+		{
+			MetaDataTable MDa = MD;
+			timer.tic(TIMING_APPEND);
+			MDa.append(MD);
+			timer.toc(TIMING_APPEND);
+		}
+
+		{
+			timer.tic(TIMING_SUBSET);
+			MetaDataTable MDs = subsetMetaDataTable(MD, EMDL_CTF_DEFOCUSU, 100., 2000.);
+			timer.toc(TIMING_SUBSET);
+		}
+
+		{
+			timer.tic(TIMING_DUPLICATES);
+			MetaDataTable MDd = removeDuplicatedParticles(MD, EMDL_MICROGRAPH_NAME, 2.);
+			timer.toc(TIMING_DUPLICATES);
+		}
+
+		if (fn_out != "")
+		{
+			timer.tic(TIMING_WRITE);
+			MD.write(fn_out);
+			timer.toc(TIMING_WRITE);
+		}
+
+		timer.printTimes(false);
+		std::cout << " Peak RSS: " << getPeakRSS() / (1024 * 1024) << " MB" << std::endl;
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	star_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		exit(1);
+	}
+
+	return 0;
+}
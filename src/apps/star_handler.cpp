@@ -31,7 +31,7 @@ class star_handler_parameters
 	FileName fn_check, fn_operate, fn_operate2, fn_operate3, fn_set;
 	std::string remove_col_label, add_col_label, add_col_value, add_col_from, hist_col_label, select_include_str, select_exclude_str;
 	RFLOAT eps, select_minval, select_maxval, multiply_by, add_to, center_X, center_Y, center_Z, hist_min, hist_max;
-	bool do_combine, do_split, do_center, do_random_order, show_frac, show_cumulative, do_discard;
+	bool do_combine, do_split, do_center, do_random_order, show_frac, show_cumulative, do_discard, do_to_binary, do_to_star;
 	long int nr_split, size_split, nr_bin;
 	RFLOAT discard_sigma, duplicate_threshold, extract_angpix;
 	// I/O Parser
@@ -112,6 +112,10 @@ class star_handler_parameters
 		duplicate_threshold = textToFloat(parser.getOption("--remove_duplicates","Remove duplicated particles within this distance [Angstrom]. Negative values disable this.", "-1"));
 		extract_angpix = textToFloat(parser.getOption("--image_angpix", "For down-sampled particles, specify the pixel size [A/pix] of the original images used in the Extract job", "-1"));
 
+		int convert_section = parser.addSection("Convert options");
+		do_to_binary = parser.checkOption("--to_binary", "Convert all data blocks of the input STAR file into a binary metadata file (the extension of --o becomes .bstar)");
+		do_to_star = parser.checkOption("--to_star", "Convert all data blocks of the input binary metadata file into a STAR file (the extension of --o becomes .star)");
+
 		// Check for errors in the command-line option
 		if (parser.checkForErrors())
 			REPORT_ERROR("Errors encountered on the command line, exiting...");
@@ -132,9 +136,11 @@ class star_handler_parameters
 		if (add_col_label != "") c++;
 		if (hist_col_label != "") c++;
 		if (duplicate_threshold > 0) c++;
+		if (do_to_binary) c++;
+		if (do_to_star) c++;
 		if (c != 1)
 		{
-			REPORT_ERROR("ERROR: specify (only and at least) one of the following options: --compare, --select, --select_by_str, --combine, --split, --operate, --center, --remove_column, --add_column, --hist_column or --remove_duplicates.");
+			REPORT_ERROR("ERROR: specify (only and at least) one of the following options: --compare, --select, --select_by_str, --combine, --split, --operate, --center, --remove_column, --add_column, --hist_column, --remove_duplicates, --to_binary or --to_star.");
 		}
 
 		if (fn_out == "" && hist_col_label == "")
@@ -152,6 +158,7 @@ class star_handler_parameters
 		if (add_col_label!= "") add_column();
 		if (hist_col_label != "") hist_column();
 		if (duplicate_threshold > 0) remove_duplicate();
+		if (do_to_binary || do_to_star) convert();
 
 		std::cout << " Done!" << std::endl;
 	}
@@ -283,6 +290,7 @@ class star_handler_parameters
 		std::cout << " [ Average , stddev ] of the stddev  Image value = [ " << sum_stddev<< " , " << sum2_stddev << " ] "  << std::endl;
 
 		long int i = 0, nr_discard = 0;
+		std::vector<long> selected;
 		FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDin)
 		{
 			if (avgs[i] > sum_avg - discard_sigma * sum2_avg &&
@@ -290,7 +298,7 @@ class star_handler_parameters
 				stddevs[i] > sum_stddev - discard_sigma * sum2_stddev &&
 				stddevs[i] < sum_stddev + discard_sigma * sum2_stddev)
 			{
-				MDout.addObject(MDin.getObject(current_object));
+				selected.push_back(current_object);
 			}
 			else
 			{
@@ -298,6 +306,7 @@ class star_handler_parameters
 			}
 			i++;
 		}
+		MDout.addObjects(MDin, selected);
 
 		std::cout << " Discarded " << nr_discard << " Images because of too large or too small average/stddev values " << std::endl;
 
@@ -335,27 +344,21 @@ class star_handler_parameters
 			if (!MDout.containsLabel(label))
 				REPORT_ERROR("ERROR: the output file does not contain the label to check for duplicates. Is it present in all input files?");
 
-			/// Don't want to mess up original order, so make a MDsort with only that label...
-			FileName fn_this, fn_prev = "";
-			MetaDataTable MDsort;
-			FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDout)
-			{
-				MDout.getValue(label, fn_this);
-				MDsort.addObject();
-				MDsort.setValue(label, fn_this);
-			}
-			// sort on the label
-			MDsort.newSort(label);
+			// Count the rows of every distinct value: all but the first one are duplicates
+			std::vector<MetaDataAggregate> counts(1, MetaDataAggregate(AGGREGATE_COUNT, label, EMDL_MLMODEL_GROUP_NR_PARTICLES));
+			MetaDataTable MDcount = groupMetaDataTable(MDout, std::vector<EMDLabel>(1, label), counts);
 			long int nr_duplicates = 0;
-			FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDsort)
+			FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDcount)
 			{
-				MDsort.getValue(label, fn_this);
-				if (fn_this == fn_prev)
+				int count;
+				MDcount.getValue(EMDL_MLMODEL_GROUP_NR_PARTICLES, count);
+				if (count > 1)
 				{
-					nr_duplicates++;
-					std::cerr << " WARNING: duplicate entry: " << fn_this << std::endl;
+					FileName fn_this;
+					MDcount.getValue(label, fn_this);
+					nr_duplicates += count - 1;
+					std::cerr << " WARNING: duplicate entry: " << fn_this << " (" << count << " times)" << std::endl;
 				}
-				fn_prev = fn_this;
 			}
 
 			if (nr_duplicates > 0)
@@ -401,19 +404,14 @@ class star_handler_parameters
 		std::vector<MetaDataTable > MDouts;
 		MDouts.resize(nr_split);
 
-		long int n = 0;
-		FOR_ALL_OBJECTS_IN_METADATA_TABLE(MD)
+		for (int my_split = 0; my_split < nr_split; my_split++)
 		{
-			int my_split = n / size_split;
-			if (my_split < nr_split)
+			std::vector<long> objectIDs;
+			for (long int n = my_split * size_split; n < (my_split + 1) * size_split && n < n_obj; n++)
 			{
-				MDouts[my_split].addObject(MD.getObject(current_object));
+				objectIDs.push_back(n);
 			}
-			else
-			{
-				break;
-			}
-			n++;
+			MDouts[my_split].addObjects(MD, objectIDs);
 		}
 
 		// We have to write split001 the last. Otherwise the pipeliner might think
@@ -734,6 +732,39 @@ class star_handler_parameters
 		MDout.write(fn_out);
 		std::cout << " Written: " << fn_out << std::endl;
 	}
+
+	void convert()
+	{
+		FileName fn_conv = fn_out.withoutExtension() + ((do_to_binary) ? ".bstar" : ".star");
+		std::vector<std::string> block_names = getMetaDataBlockNames(fn_in);
+
+		std::ofstream fh;
+		if (do_to_binary)
+		{
+			fh.open(fn_conv.c_str(), std::ios::out | std::ios::binary);
+		}
+		else
+		{
+			fh.open(fn_conv.c_str(), std::ios::out);
+			fh << "# RELION; version " << RELION_VERSION << std::endl;
+		}
+		if (!fh)
+			REPORT_ERROR("ERROR: cannot write to file: " + fn_conv);
+
+		for (int i = 0; i < block_names.size(); i++)
+		{
+			MetaDataTable MD;
+			MD.read(fn_in, block_names[i]);
+
+			if (do_to_binary)
+				MD.writeBinary(fh);
+			else
+				MD.write(fh);
+		}
+		fh.close();
+
+		std::cout << " Written " << block_names.size() << " data block(s) to: " << fn_conv << std::endl;
+	}
 };
 
 
@@ -0,0 +1,372 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/projector.h>
+#include <src/fftw.h>
+#include <src/args.h>
+#include <src/ctf.h>
+#include <src/funcs.h>
+#include <src/euler.h>
+#include <src/time.h>
+#include <src/image.h>
+#include <src/metadata_table.h>
+#include <src/mask.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// A benchmark of relion_refine, relion_reconstruct and relion_postprocess that needs no input data:
+// particles are made by projecting a phantom of Gaussian blobs, with CTFs and white noise,
+// and the wall time, peak memory use and throughput of each stage are written to a JSON file
+class synthetic_benchmark_parameters
+{
+public:
+
+	FileName fn_out, fn_json, bin_dir, extra_args;
+	int box, nr_particles, nr_classes, nr_iter, nr_threads, nr_mpi, random_seed;
+	RFLOAT angpix, snr, particle_diameter;
+	IOParser parser;
+
+	// One entry per stage
+	Timer timer;
+	std::vector<long int> stage_peak_rss; // in kB
+	std::vector<long int> stage_nr_images; // images processed (summed over iterations), for the throughput
+	std::vector<int> stage_status;
+
+	void usage()
+	{
+		parser.writeUsage(std::cerr);
+	}
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		int general_section = parser.addSection("General options");
+		fn_out = parser.getOption("--o", "Output directory", "Benchmark/");
+		fn_json = parser.getOption("--json", "Output JSON file with the results (default: benchmark.json in the output directory)", "");
+		bin_dir = parser.getOption("--bin_dir", "Directory with the RELION programs (default: the directory of this program)", "");
+		nr_threads = textToInteger(parser.getOption("--j", "Number of threads for relion_refine", "1"));
+		nr_mpi = textToInteger(parser.getOption("--mpi", "Number of MPI processes for relion_refine (more than 1 runs relion_refine_mpi through $RELION_MPIRUN or mpirun)", "1"));
+		extra_args = parser.getOption("--refine_args", "Additional arguments for relion_refine, e.g. \"--gpu\"", "");
+
+		int data_section = parser.addSection("Synthetic data");
+		box = textToInteger(parser.getOption("--box", "Box size of the particles (in pixels)", "64"));
+		angpix = textToFloat(parser.getOption("--angpix", "Pixel size (in Angstroms)", "3.5"));
+		nr_particles = textToInteger(parser.getOption("--n", "Number of particles", "1000"));
+		snr = textToFloat(parser.getOption("--snr", "Signal-to-noise ratio (variance of the projections over that of the noise)", "0.1"));
+		random_seed = textToInteger(parser.getOption("--random_seed", "Seed for the random number generator", "1993"));
+
+		int stage_section = parser.addSection("Stages");
+		nr_classes = textToInteger(parser.getOption("--K", "Number of classes in the 2D classification", "4"));
+		nr_iter = textToInteger(parser.getOption("--iter", "Number of iterations of the 2D classification and the 3D refinement", "5"));
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line (see above), exiting...");
+
+		if (fn_out[fn_out.length() - 1] != '/')
+			fn_out += "/";
+		if (fn_json == "")
+			fn_json = fn_out + "benchmark.json";
+		if (bin_dir == "")
+		{
+			char exe[4096];
+			ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+			if (len > 0)
+			{
+				exe[len] = '\0';
+				bin_dir = FileName(exe).beforeLastOf("/");
+			}
+		}
+		if (bin_dir != "" && bin_dir[bin_dir.length() - 1] != '/')
+			bin_dir += "/";
+
+		// The blobs of the phantom lie within 0.3 box sizes from the centre
+		particle_diameter = 0.75 * box * angpix;
+	}
+
+	void makePhantom(MultidimArray<RFLOAT> &vol)
+	{
+		vol.initZeros(box, box, box);
+		vol.setXmippOrigin();
+
+		// Blobs of different sizes and weights, so that there is no symmetry
+		int nr_blobs = 40;
+		RFLOAT max_r = 0.3 * box;
+		for (int iblob = 0; iblob < nr_blobs; iblob++)
+		{
+			RFLOAT x, y, z;
+			do
+			{
+				x = rnd_unif(-max_r, max_r);
+				y = rnd_unif(-max_r, max_r);
+				z = rnd_unif(-max_r, max_r);
+			}
+			while (x*x + y*y + z*z > max_r * max_r);
+			RFLOAT sigma = rnd_unif(0.02, 0.05) * box;
+			RFLOAT weight = rnd_unif(0.5, 1.);
+			FOR_ALL_ELEMENTS_IN_ARRAY3D(vol)
+			{
+				RFLOAT r2 = (k - z) * (k - z) + (i - y) * (i - y) + (j - x) * (j - x);
+				if (r2 < 9. * sigma * sigma)
+					A3D_ELEM(vol, k, i, j) += weight * exp(-0.5 * r2 / (sigma * sigma));
+			}
+		}
+	}
+
+	// Project the phantom in random orientations, apply random CTFs and add white noise
+	void synthesise()
+	{
+		init_random_generator(random_seed);
+
+		Image<RFLOAT> vol, img;
+		makePhantom(vol());
+		vol.setSamplingRateInHeader(angpix);
+		vol.write(fn_out + "phantom.mrc");
+
+		// A soft spherical mask around the blobs, for the post-processing
+		Image<RFLOAT> mask;
+		mask().resize(box, box, box);
+		raisedCosineMask(mask(), 0.35 * box, 0.45 * box, 0, 0, 0);
+		mask.setSamplingRateInHeader(angpix);
+		mask.write(fn_out + "mask.mrc");
+
+		MultidimArray<RFLOAT> dummy, Fctf;
+		MultidimArray<Complex> F2D;
+		FourierTransformer transformer;
+		Projector projector(box, TRILINEAR, 2, 10, 2);
+		projector.computeFourierTransformMap(vol(), dummy, box);
+
+		img().resize(box, box);
+		transformer.setReal(img());
+		transformer.getFourierAlias(F2D);
+		Fctf.resize(F2D);
+
+		// 50 particles per micrograph, with the same defocus
+		MetaDataTable MD;
+		RFLOAT noise_stddev = -1., defU = 0., defV = 0., defAng = 0.;
+		for (long int ipart = 0; ipart < nr_particles; ipart++)
+		{
+			RFLOAT rot = rnd_unif(-180., 180.);
+			RFLOAT tilt = ACOSD(rnd_unif(-1., 1.));
+			RFLOAT psi = rnd_unif(-180., 180.);
+			RFLOAT xoff = rnd_gaus(0., 2.);
+			RFLOAT yoff = rnd_gaus(0., 2.);
+			if (ipart % 50 == 0)
+			{
+				defU = rnd_unif(10000., 30000.);
+				defV = defU - rnd_unif(0., 500.);
+				defAng = rnd_unif(0., 180.);
+			}
+
+			Matrix2D<RFLOAT> A;
+			Euler_rotation3DMatrix(rot, tilt, psi, A);
+			F2D.initZeros();
+			projector.get2DFourierTransform(F2D, A, IS_NOT_INV);
+			shiftImageInFourierTransform(F2D, F2D, box, -xoff, -yoff);
+
+			CTF ctf;
+			ctf.setValues(defU, defV, defAng, 300., 2.7, 0.1, 0.);
+			ctf.getFftwImage(Fctf, box, box, angpix);
+			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(F2D)
+				DIRECT_MULTIDIM_ELEM(F2D, n) *= DIRECT_MULTIDIM_ELEM(Fctf, n);
+
+			transformer.inverseFourierTransform();
+			CenterFFT(img(), false);
+
+			// The noise level follows from the signal in the first image
+			if (noise_stddev < 0.)
+			{
+				RFLOAT avg, stddev, minval, maxval;
+				img().computeStats(avg, stddev, minval, maxval);
+				noise_stddev = stddev / sqrt(snr);
+			}
+			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(img())
+				DIRECT_MULTIDIM_ELEM(img(), n) += rnd_gaus(0., noise_stddev);
+
+			FileName fn_img;
+			fn_img.compose(ipart + 1, fn_out + "particles.mrcs");
+			img.setSamplingRateInHeader(angpix);
+			img.write(fn_img, -1, false, (ipart == 0) ? WRITE_OVERWRITE : WRITE_APPEND);
+
+			MD.addObject();
+			MD.setValue(EMDL_IMAGE_NAME, fn_img);
+			MD.setValue(EMDL_MICROGRAPH_NAME, fn_out + "mic" + integerToString(ipart / 50 + 1, 4) + ".mrc");
+			MD.setValue(EMDL_CTF_DEFOCUSU, defU);
+			MD.setValue(EMDL_CTF_DEFOCUSV, defV);
+			MD.setValue(EMDL_CTF_DEFOCUS_ANGLE, defAng);
+			MD.setValue(EMDL_CTF_VOLTAGE, 300.);
+			MD.setValue(EMDL_CTF_CS, 2.7);
+			MD.setValue(EMDL_CTF_Q0, 0.1);
+			MD.setValue(EMDL_CTF_MAGNIFICATION, 10000.);
+			MD.setValue(EMDL_CTF_DETECTOR_PIXEL_SIZE, angpix);
+			MD.setValue(EMDL_ORIENT_ROT, rot);
+			MD.setValue(EMDL_ORIENT_TILT, tilt);
+			MD.setValue(EMDL_ORIENT_PSI, psi);
+			MD.setValue(EMDL_ORIENT_ORIGIN_X, xoff);
+			MD.setValue(EMDL_ORIENT_ORIGIN_Y, yoff);
+			MD.setValue(EMDL_PARTICLE_RANDOM_SUBSET, (int)(ipart % 2 + 1));
+		}
+		MD.write(fn_out + "particles.star");
+	}
+
+	// Run a stage as a separate process, and keep its wall time, peak memory use and exit status
+	void runStage(std::string name, std::string command, long int nr_images)
+	{
+		FileName fn_log = fn_out + name + ".log";
+		command += " > " + fn_log + " 2>&1";
+		std::cout << " + " << name << ": " << command << std::endl;
+
+		int itimer = timer.setNew(name);
+		timer.tic(itimer);
+
+		int status = -1;
+		struct rusage usage;
+		usage.ru_maxrss = 0;
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			execl("/bin/sh", "sh", "-c", command.c_str(), (char *)NULL);
+			_exit(127);
+		}
+		else if (pid < 0 || wait4(pid, &status, 0, &usage) < 0)
+			status = -1;
+
+		timer.toc(itimer);
+
+		// wait4 includes the children of the shell, i.e. the programs it ran
+		stage_peak_rss.push_back(usage.ru_maxrss);
+		stage_nr_images.push_back(nr_images);
+		stage_status.push_back((status >= 0 && WIFEXITED(status)) ? WEXITSTATUS(status) : -1);
+		if (stage_status.back() != 0)
+			std::cerr << " WARNING: " << name << " failed, see " << fn_log << std::endl;
+	}
+
+	std::string refineCommand()
+	{
+		std::string mpirun = "mpirun";
+		char *penv = getenv("RELION_MPIRUN");
+		if (penv != NULL)
+			mpirun = penv;
+		std::string command = (nr_mpi > 1) ? mpirun + " -n " + integerToString(nr_mpi) + " " + bin_dir + "relion_refine_mpi" : bin_dir + "relion_refine";
+		return command + " --i " + fn_out + "particles.star --angpix " + floatToString(angpix) +
+				" --particle_diameter " + floatToString(particle_diameter) + " --iter " + integerToString(nr_iter) +
+				" --ctf --flatten_solvent --zero_mask --norm --scale --oversampling 1 --offset_range 5 --offset_step 2" +
+				" --random_seed " + integerToString(random_seed) + " --j " + integerToString(nr_threads) +
+				" --pool 30 --pad 2 --dont_combine_weights_via_disc " + extra_args;
+	}
+
+	void writeJson()
+	{
+		char hostname[256];
+		if (gethostname(hostname, sizeof(hostname)) != 0)
+			strcpy(hostname, "localhost");
+		hostname[sizeof(hostname) - 1] = '\0';
+		time_t now = time(NULL);
+		char date[64];
+		strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+		std::ofstream fh(fn_json.c_str());
+		if (!fh)
+			REPORT_ERROR("synthetic_benchmark ERROR: cannot write to " + fn_json);
+
+		fh << "{" << std::endl;
+		fh << "  \"relion_version\": \"" << RELION_VERSION << "\"," << std::endl;
+		fh << "  \"host\": \"" << hostname << "\"," << std::endl;
+		fh << "  \"date\": \"" << date << "\"," << std::endl;
+		fh << "  \"parameters\": {\"box\": " << box << ", \"angpix\": " << angpix << ", \"particles\": " << nr_particles
+		   << ", \"snr\": " << snr << ", \"classes_2d\": " << nr_classes << ", \"iterations\": " << nr_iter
+		   << ", \"threads\": " << nr_threads << ", \"mpi\": " << nr_mpi << ", \"random_seed\": " << random_seed << "}," << std::endl;
+		fh << "  \"stages\": [" << std::endl;
+		for (int i = 0; i < timer.tags.size(); i++)
+		{
+			double wall_time = timer.times[i] / 1e6;
+			fh << "    {\"name\": \"" << timer.tags[i] << "\", \"exit_status\": " << stage_status[i]
+			   << ", \"wall_time_sec\": " << wall_time << ", \"peak_rss_mb\": " << stage_peak_rss[i] / 1024.;
+			if (stage_nr_images[i] > 0 && wall_time > 0.)
+				fh << ", \"particles_per_sec\": " << stage_nr_images[i] / wall_time;
+			fh << "}" << ((i + 1 < timer.tags.size()) ? "," : "") << std::endl;
+		}
+		fh << "  ]" << std::endl;
+		fh << "}" << std::endl;
+	}
+
+	void run()
+	{
+		if (mktree(fn_out) != 0 && !exists(fn_out))
+			REPORT_ERROR("synthetic_benchmark ERROR: cannot make the output directory " + fn_out);
+
+		std::cout << " Synthesising " << nr_particles << " particles of " << box << " pixels in " << fn_out << " ..." << std::endl;
+		int itimer = timer.setNew("synthesis");
+		timer.tic(itimer);
+		synthesise();
+		timer.toc(itimer);
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		stage_peak_rss.push_back(usage.ru_maxrss);
+		stage_nr_images.push_back(nr_particles);
+		stage_status.push_back(0);
+
+		mktree(fn_out + "Class2D");
+		runStage("class2d", refineCommand() + " --o " + fn_out + "Class2D/run --K " + integerToString(nr_classes) +
+				" --tau2_fudge 2 --psi_step 10", (long int)nr_particles * nr_iter);
+
+		// A fixed number of iterations: one class, rather than --auto_refine (which runs until convergence)
+		mktree(fn_out + "Refine3D");
+		runStage("refine3d", refineCommand() + " --o " + fn_out + "Refine3D/run --K 1 --ref " + fn_out + "phantom.mrc" +
+				" --ini_high 30 --sym C1 --tau2_fudge 4 --healpix_order 2", (long int)nr_particles * nr_iter);
+
+		// Half-maps from the true orientations, for the post-processing
+		std::string reconstruct = bin_dir + "relion_reconstruct --i " + fn_out + "particles.star --angpix " + floatToString(angpix) + " --ctf";
+		runStage("reconstruct", reconstruct + " --subset 1 --o " + fn_out + "reconstruct_half1.mrc && " +
+				reconstruct + " --subset 2 --o " + fn_out + "reconstruct_half2.mrc", nr_particles);
+
+		runStage("postprocess", bin_dir + "relion_postprocess --i " + fn_out + "reconstruct_half1.mrc --o " + fn_out + "postprocess" +
+				" --angpix " + floatToString(angpix) + " --mask " + fn_out + "mask.mrc --adhoc_bfac -50", 0);
+
+		writeJson();
+
+		std::cout << " Wall times:" << std::endl;
+		timer.printTimes(false);
+		std::cout << " Written " << fn_json << std::endl;
+
+		for (int i = 0; i < stage_status.size(); i++)
+			if (stage_status[i] != 0)
+				REPORT_ERROR("synthetic_benchmark ERROR: stage " + timer.tags[i] + " failed");
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	synthetic_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		prm.usage();
+		exit(1);
+	}
+	return 0;
+}
@@ -0,0 +1,171 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include "src/autopick_reference_bank.h"
+
+AutopickReferenceBank::AutopickReferenceBank()
+{
+	initialise(0, 0, 0.);
+}
+
+void AutopickReferenceBank::initialise(int _nr_refs, size_t _max_memory, RFLOAT _defocus_tolerance)
+{
+	nr_refs = _nr_refs;
+	max_memory = _max_memory;
+	defocus_tolerance = _defocus_tolerance;
+	memory_used = 0;
+	groups.clear();
+	nr_lookups = nr_reused = nr_calculated = nr_forgotten = 0;
+}
+
+RFLOAT AutopickReferenceBank::getDefocusDifference(const CTF &ctf1, const CTF &ctf2)
+{
+	// The defocus in direction a is the average defocus plus dev * cos(2(a - azimuth)), with dev half the astigmatism.
+	// The largest difference over all directions is the difference of the averages plus the length of the
+	// difference of the vectors dev * (cos(2 azimuth), sin(2 azimuth))
+	RFLOAT avg1 = 0.5 * (ctf1.DeltafU + ctf1.DeltafV), dev1 = 0.5 * (ctf1.DeltafU - ctf1.DeltafV);
+	RFLOAT avg2 = 0.5 * (ctf2.DeltafU + ctf2.DeltafV), dev2 = 0.5 * (ctf2.DeltafU - ctf2.DeltafV);
+	RFLOAT dx = dev1 * cos(2. * DEG2RAD(ctf1.azimuthal_angle)) - dev2 * cos(2. * DEG2RAD(ctf2.azimuthal_angle));
+	RFLOAT dy = dev1 * sin(2. * DEG2RAD(ctf1.azimuthal_angle)) - dev2 * sin(2. * DEG2RAD(ctf2.azimuthal_angle));
+	return ABS(avg1 - avg2) + sqrt(dx * dx + dy * dy);
+}
+
+int AutopickReferenceBank::addGroup()
+{
+	Group group;
+	group.has_ctf = false;
+	group.last_used = 0;
+	group.is_complete.resize(nr_refs, false);
+	group.refs.resize(nr_refs);
+	group.centres.resize(nr_refs);
+	groups.push_back(group);
+	return groups.size() - 1;
+}
+
+int AutopickReferenceBank::findGroup(CTF &ctf)
+{
+	int igroup = -1;
+	for (int i = 0; i < groups.size(); i++)
+	{
+		const CTF &gctf = groups[i].ctf;
+		if (groups[i].has_ctf && gctf.kV == ctf.kV && gctf.Cs == ctf.Cs && gctf.Q0 == ctf.Q0 &&
+			gctf.Bfac == ctf.Bfac && gctf.scale == ctf.scale && gctf.phase_shift == ctf.phase_shift &&
+			getDefocusDifference(gctf, ctf) <= defocus_tolerance)
+		{
+			igroup = i;
+			break;
+		}
+	}
+
+	if (igroup < 0)
+	{
+		igroup = addGroup();
+		groups[igroup].has_ctf = true;
+		groups[igroup].ctf = ctf;
+	}
+	else
+		ctf = groups[igroup].ctf;
+
+	groups[igroup].last_used = ++nr_lookups;
+	return igroup;
+}
+
+int AutopickReferenceBank::findGroup()
+{
+	if (groups.size() == 0)
+		addGroup();
+
+	groups[0].last_used = ++nr_lookups;
+	return 0;
+}
+
+bool AutopickReferenceBank::hasReferences(int igroup, int iref)
+{
+	if (groups[igroup].is_complete[iref])
+	{
+		nr_reused++;
+		return true;
+	}
+	return false;
+}
+
+void AutopickReferenceBank::forgetReferences(int igroup, int iref)
+{
+	std::vector<MultidimArray<Complex> > &refs = groups[igroup].refs[iref];
+	for (int ipsi = 0; ipsi < refs.size(); ipsi++)
+		memory_used -= MULTIDIM_SIZE(refs[ipsi]) * sizeof(Complex);
+	std::vector<MultidimArray<Complex> >().swap(refs);
+	memory_used -= MULTIDIM_SIZE(groups[igroup].centres[iref]) * sizeof(RFLOAT);
+	groups[igroup].centres[iref].clear();
+	groups[igroup].is_complete[iref] = false;
+}
+
+bool AutopickReferenceBank::reserveReferences(int igroup, int iref, int nr_psis, int size, int box_size)
+{
+	forgetReferences(igroup, iref);
+
+	size_t memory_needed = (size_t)nr_psis * size * (size/2 + 1) * sizeof(Complex) + (size_t)box_size * box_size * sizeof(RFLOAT);
+	if (memory_needed > max_memory)
+		return false;
+
+	// Forget all references of the least recently used other group, until there is enough room
+	while (memory_used + memory_needed > max_memory)
+	{
+		int ioldest = -1;
+		for (int i = 0; i < groups.size(); i++)
+		{
+			if (i == igroup)
+				continue;
+			bool has_refs = false;
+			for (int j = 0; j < nr_refs; j++)
+				has_refs = has_refs || groups[i].refs[j].size() > 0;
+			if (has_refs && (ioldest < 0 || groups[i].last_used < groups[ioldest].last_used))
+				ioldest = i;
+		}
+		if (ioldest < 0)
+			return false;
+
+		for (int j = 0; j < nr_refs; j++)
+			forgetReferences(ioldest, j);
+		nr_forgotten++;
+	}
+
+	std::vector<MultidimArray<Complex> > &refs = groups[igroup].refs[iref];
+	refs.resize(nr_psis);
+	for (int ipsi = 0; ipsi < nr_psis; ipsi++)
+		refs[ipsi].resize(size, size/2 + 1);
+	groups[igroup].centres[iref].resize(box_size, box_size);
+	memory_used += memory_needed;
+	return true;
+}
+
+void AutopickReferenceBank::setComplete(int igroup, int iref)
+{
+	groups[igroup].is_complete[iref] = true;
+	nr_calculated++;
+}
+
+void AutopickReferenceBank::printStatistics(std::ostream &out) const
+{
+	out << " + Reference bank: " << groups.size() << " CTF group(s), " << memory_used / (1024 * 1024) << " Mb in use; the rotated references were reused "
+	    << nr_reused << " times and calculated " << nr_calculated << " times";
+	if (nr_forgotten > 0)
+		out << "; the references of " << nr_forgotten << " group(s) were forgotten to stay within the memory limit";
+	out << std::endl;
+}
@@ -0,0 +1,121 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef AUTOPICK_REFERENCE_BANK_H
+#define AUTOPICK_REFERENCE_BANK_H
+
+#include <iostream>
+#include <vector>
+#include "src/multidim_array.h"
+#include "src/complex.h"
+#include "src/ctf.h"
+
+/*	class AutopickReferenceBank:
+ *
+ *	- keeps the Fourier transforms of the rotated (and CTF-modulated) references
+ *	  of template-matching autopicking in memory from one micrograph to the next,
+ *	  so that they are calculated once per CTF group instead of once per micrograph
+ *	- micrographs are put in CTF groups: a micrograph joins the first group whose
+ *	  CTF has the same voltage, Cs, Q0, B-factor, scale and phase shift, and whose
+ *	  defocus differs by at most defocus_tolerance (in Angstrom) in any direction;
+ *	  otherwise it starts a new group. The references of a micrograph are modulated
+ *	  with the CTF of its group. Without CTF correction there is a single group
+ *	- the references are stored per (group, reference, psi) at the size of the
+ *	  cross-correlation, with the central box of the first rotation of every
+ *	  reference in real space (for its statistics under the particle mask);
+ *	  when the total exceeds max_memory, the references of the least recently
+ *	  used groups are forgotten
+ *	- the references of one reference in one group are filled by reserveReferences(),
+ *	  filling of all psi's (possibly from several threads, each psi from one thread)
+ *	  and setComplete()
+ */
+class AutopickReferenceBank
+{
+public:
+
+	AutopickReferenceBank();
+
+	// Forget all references and groups; a max_memory of zero switches the bank off
+	void initialise(int nr_refs, size_t max_memory, RFLOAT defocus_tolerance);
+
+	bool isEnabled() const
+	{
+		return max_memory > 0;
+	}
+
+	// Group of a micrograph with this CTF (a new one if no group is close enough); ctf is replaced by the CTF of the group
+	int findGroup(CTF &ctf);
+
+	// Group of a micrograph without CTF correction
+	int findGroup();
+
+	// Have all rotations of reference iref in group igroup been stored?
+	bool hasReferences(int igroup, int iref);
+
+	// Make room for nr_psis rotations of reference iref in group igroup, of size x size/2+1 each, and for its
+	// central box of box_size x box_size pixels, forgetting the references of the least recently used groups if needed;
+	// false if they do not fit
+	bool reserveReferences(int igroup, int iref, int nr_psis, int size, int box_size);
+
+	// Rotation ipsi of reference iref in group igroup, to be filled after reserveReferences() or read after hasReferences()
+	MultidimArray<Complex>& getReference(int igroup, int iref, int ipsi)
+	{
+		return groups[igroup].refs[iref][ipsi];
+	}
+
+	// Central box (in real space) of the first rotation of reference iref in group igroup
+	MultidimArray<RFLOAT>& getCentralReference(int igroup, int iref)
+	{
+		return groups[igroup].centres[iref];
+	}
+
+	// All rotations of reference iref in group igroup have been filled
+	void setComplete(int igroup, int iref);
+
+	// Number of groups, memory in use, and how often the references were reused
+	void printStatistics(std::ostream &out) const;
+
+private:
+
+	struct Group
+	{
+		bool has_ctf;
+		CTF ctf;
+		long int last_used;
+		std::vector<char> is_complete;
+		std::vector<std::vector<MultidimArray<Complex> > > refs;
+		std::vector<MultidimArray<RFLOAT> > centres;
+	};
+
+	// Largest difference in defocus (in any direction) between two CTFs
+	static RFLOAT getDefocusDifference(const CTF &ctf1, const CTF &ctf2);
+
+	int addGroup();
+
+	// Forget reference iref of group igroup
+	void forgetReferences(int igroup, int iref);
+
+	int nr_refs;
+	size_t max_memory, memory_used;
+	RFLOAT defocus_tolerance;
+	std::vector<Group> groups;
+	long int nr_lookups, nr_reused, nr_calculated, nr_forgotten;
+};
+
+#endif
@@ -108,6 +108,7 @@ void AutoPicker::read(int argc, char **argv)
 	do_only_unfinished = parser.checkOption("--only_do_unfinished", "Only autopick those micrographs for which the coordinate file does not yet exist");
 	do_gpu = parser.checkOption("--gpu", "Use GPU acceleration when availiable");
 	gpu_ids = parser.getOption("--gpu", "Device ids for each MPI-thread","default");
+	nr_threads = textToInteger(parser.getOption("--j", "Number of threads for template matching on the CPU", "1"));
 #ifndef CUDA
 	if(do_gpu)
 	{
@@ -124,6 +125,8 @@ void AutoPicker::read(int argc, char **argv)
 	highpass = textToFloat(parser.getOption("--highpass", "Highpass filter in Angstroms for the micrographs","-1"));
 	do_ctf = parser.checkOption("--ctf", "Perform CTF correction on the references?");
 	intact_ctf_first_peak = parser.checkOption("--ctf_intact_first_peak", "Ignore CTFs until their first peak?");
+	ref_bank_memory = textToFloat(parser.getOption("--ref_bank_memory", "Keep the rotated references in at most this many Mb of memory, to reuse them for the next micrographs (0 = recalculate them for every micrograph)", "1024"));
+	ref_bank_defocus_tolerance = textToFloat(parser.getOption("--ref_bank_defocus_tol", "With --ctf: reuse the references of micrographs whose defocus differs by at most this many Angstroms (0 = never reuse CTF-corrected references)", "0"));
 	gauss_max_value = textToFloat(parser.getOption("--gauss_max", "Value of the peak in the Gaussian blob reference","0.1"));
 	healpix_order = textToInteger(parser.getOption("--healpix_order", "Healpix order for projecting a 3D reference (hp0=60deg; hp1=30deg; hp2=15deg)", "1"));
 	symmetry = parser.getOption("--sym", "Symmetry point group for a 3D reference","C1");
@@ -868,6 +871,10 @@ void AutoPicker::initialise()
 		if (verb > 0)
 			progress_bar(Mrefs.size());
 
+		// CTF-corrected references are only kept if micrographs with a different defocus may share them
+		size_t bank_memory = (do_ctf && ref_bank_defocus_tolerance <= 0.) ? 0 : (size_t)(ref_bank_memory * 1024. * 1024.);
+		ref_bank.initialise(Mrefs.size(), bank_memory, ref_bank_defocus_tolerance);
+
 	}
 #ifdef TIMING
 	timer.toc(TIMING_A4);
@@ -943,7 +950,11 @@ void AutoPicker::run()
 	}
 
 	if (verb > 0)
+	{
 		progress_bar(fn_micrographs.size());
+		if (ref_bank.isEnabled())
+			ref_bank.printStatistics(std::cout);
+	}
 }
 
 void AutoPicker::generatePDFLogfile()
@@ -2837,7 +2848,7 @@ void AutoPicker::autoPickLoGOneMicrograph(FileName &fn_mic, long int imic)
 void AutoPicker::autoPickOneMicrograph(FileName &fn_mic, long int imic)
 {
 	Image<RFLOAT> Imic;
-	MultidimArray<Complex > Faux, Faux2, Fmic;
+	MultidimArray<Complex > Faux, Faux2, Fmic, Fmic_work;
 	MultidimArray<RFLOAT> Maux, Mstddev, Mmean, Mstddev2, Mavg, Mdiff2, MsumX2, Mccf_best, Mpsi_best, Fctf, Mccf_best_combined, Mpsi_best_combined;
 	MultidimArray<int> Mclass_best_combined;
 	FourierTransformer transformer;
@@ -2916,6 +2927,8 @@ void AutoPicker::autoPickOneMicrograph(FileName &fn_mic, long int imic)
 	timer.tic(TIMING_A8);
 #endif
 	// Read in the CTF information if needed
+	// With the reference bank, the references are modulated with the CTF of the group of this micrograph
+	int ref_bank_group = -1;
 	if (do_ctf)
 	{
 		// Search for this micrograph in the metadata table
@@ -2927,6 +2940,8 @@ void AutoPicker::autoPickOneMicrograph(FileName &fn_mic, long int imic)
 			if (fn_tmp==fn_mic)
 			{
 				ctf.read(MDmic, MDmic);
+				if (ref_bank.isEnabled() && !do_read_fom_maps)
+					ref_bank_group = ref_bank.findGroup(ctf);
 				Fctf.resize(downsize_mic, downsize_mic/2 + 1);
 				ctf.getFftwImage(Fctf, micrograph_size, micrograph_size, angpix, false, false, intact_ctf_first_peak, true);
 				found = true;
@@ -2942,6 +2957,8 @@ void AutoPicker::autoPickOneMicrograph(FileName &fn_mic, long int imic)
 		Ictf.write("Mmic_ctf.spi");
 #endif
 	}
+	else if (ref_bank.isEnabled() && !do_read_fom_maps)
+		ref_bank_group = ref_bank.findGroup();
 #ifdef TIMING
 	timer.toc(TIMING_A8);
 #endif
@@ -3047,6 +3064,9 @@ void AutoPicker::autoPickOneMicrograph(FileName &fn_mic, long int imic)
 		windowFourierTransform(Fmic, Faux, downsize_mic);
 		Fmic = Faux;
 
+		// The cross-correlations are calculated at workSize
+		windowFourierTransform(Fmic, Fmic_work, workSize);
+
 	}// end if do_read_fom_maps
 #ifdef TIMING
 	timer.toc(TIMING_B1);
@@ -3128,69 +3148,48 @@ void AutoPicker::autoPickOneMicrograph(FileName &fn_mic, long int imic)
 			timer.tic(TIMING_B3);
 #endif
 			Mccf_best.initConstant(-LARGE_NUMBER);
-			bool is_first_psi = true;
+			std::vector<RFLOAT> psis;
 			for (RFLOAT psi = 0. ; psi < 360.; psi+=psi_sampling)
-			{
-				// Get the Euler matrix
-				Matrix2D<RFLOAT> A(3,3);
-				Euler_angles2matrix(0., 0., psi, A);
-
-				// Now get the FT of the rotated (non-ctf-corrected) template
-				Faux.initZeros(downsize_mic, downsize_mic/2 + 1);
-				PPref[iref].get2DFourierTransform(Faux, A, IS_NOT_INV);
+				psis.push_back(psi);
 
-#ifdef DEBUG
-				std::cerr << " psi= " << psi << std::endl;
-				windowFourierTransform(Faux, Faux2, micrograph_size);
-				tt().resize(micrograph_size, micrograph_size);
-				transformer.inverseFourierTransform(Faux2, tt());
-				CenterFFT(tt(), false);
-				tt.write("Mref_rot.spi");
-
-				windowFourierTransform(Fmic, Faux2, micrograph_size);
-				transformer.inverseFourierTransform(Faux2, tt());
-				CenterFFT(tt(), false);
-				tt.write("Mmic.spi");
+			// Take the rotated references from the bank, or calculate them (and store them in the bank if they fit)
+			bool is_in_bank = false, do_fill_bank = false;
+			if (ref_bank_group >= 0)
+			{
+				is_in_bank = ref_bank.hasReferences(ref_bank_group, iref);
+				if (!is_in_bank)
+					do_fill_bank = ref_bank.reserveReferences(ref_bank_group, iref, psis.size(), workSize, particle_size);
+			}
 
-#endif
 #ifdef TIMING
-	timer.tic(TIMING_B4);
+			timer.tic(TIMING_B5);
 #endif
-				// Apply the CTF on-the-fly (so same PPref can be used for many different micrographs)
-				if (do_ctf)
+			// Calculate the expected ratio of probabilities for this CTF-corrected reference
+			// and the sum_ref_under_circ_mask and sum_ref2_under_circ_mask from the first rotation,
+			// before the rotations are divided over the threads
+			// Do this also if we're not recalculating the fom maps...
+			// This calculation needs to be done on an "non-shrinked" micrograph, in order to get the correct I^2 statistics
+			{
+				// Central box of the first rotation in real space
+				MultidimArray<RFLOAT> Mctfref(particle_size, particle_size);
+				if (is_in_bank)
 				{
-					FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Faux)
+					Mctfref = ref_bank.getCentralReference(ref_bank_group, iref);
+				}
+				else
+				{
+					Matrix2D<RFLOAT> A(3,3);
+					Euler_angles2matrix(0., 0., psis[0], A);
+					Faux.initZeros(downsize_mic, downsize_mic/2 + 1);
+					PPref[iref].get2DFourierTransform(Faux, A, IS_NOT_INV);
+					if (do_ctf)
 					{
-						DIRECT_MULTIDIM_ELEM(Faux, n) *= DIRECT_MULTIDIM_ELEM(Fctf, n);
+						FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Faux)
+						{
+							DIRECT_MULTIDIM_ELEM(Faux, n) *= DIRECT_MULTIDIM_ELEM(Fctf, n);
+						}
 					}
-#ifdef TIMING
-	timer.toc(TIMING_B4);
-#endif
-#ifdef DEBUG
-				MultidimArray<RFLOAT> ttt(micrograph_size, micrograph_size);
-				windowFourierTransform(Faux, Faux2, micrograph_size);
-				transformer.inverseFourierTransform(Faux2, ttt);
-				CenterFFT(ttt, false);
-				ttt.setXmippOrigin();
-				tt().resize(particle_size, particle_size);
-				tt().setXmippOrigin();
-				FOR_ALL_ELEMENTS_IN_ARRAY2D(tt())
-				{
-					A2D_ELEM(tt(), i, j) = A2D_ELEM(ttt, i, j);
-				}
-				tt.write("Mref_rot_ctf.spi");
-#endif
-				}
 
-				if (is_first_psi)
-				{
-#ifdef TIMING
-	timer.tic(TIMING_B5);
-#endif
-					// Calculate the expected ratio of probabilities for this CTF-corrected reference
-					// and the sum_ref_under_circ_mask and sum_ref_under_circ_mask2
-					// Do this also if we're not recalculating the fom maps...
-					// This calculation needs to be done on an "non-shrinked" micrograph, in order to get the correct I^2 statistics
 					windowFourierTransform(Faux, Faux2, micrograph_size);
 					Maux.resize(micrograph_size, micrograph_size);
 					transformer.inverseFourierTransform(Faux2, Maux);
@@ -3201,103 +3200,169 @@ void AutoPicker::autoPickOneMicrograph(FileName &fn_mic, long int imic)
 					ttt()=Maux;
 					ttt.write("Maux.spi");
 #endif
-					sum_ref_under_circ_mask = 0.;
-					sum_ref2_under_circ_mask = 0.;
-					RFLOAT suma2 = 0.;
-					RFLOAT sumn = 1.;
-					MultidimArray<RFLOAT> Mctfref(particle_size, particle_size);
 					Mctfref.setXmippOrigin();
-					FOR_ALL_ELEMENTS_IN_ARRAY2D(Mctfref) // only loop over smaller Mctfref, but take values from large Maux!
+					FOR_ALL_ELEMENTS_IN_ARRAY2D(Mctfref) // only keep smaller Mctfref, but take values from large Maux!
 					{
-						if (i*i + j*j < particle_radius2)
-						{
-							suma2 += A2D_ELEM(Maux, i, j) * A2D_ELEM(Maux, i, j);
-							suma2 += 2. * A2D_ELEM(Maux, i, j) * rnd_gaus(0., 1.);
-							sum_ref_under_circ_mask += A2D_ELEM(Maux, i, j);
-							sum_ref2_under_circ_mask += A2D_ELEM(Maux, i, j) * A2D_ELEM(Maux, i, j);
-							sumn += 1.;
-						}
-#ifdef DEBUG
 						A2D_ELEM(Mctfref, i, j) = A2D_ELEM(Maux, i, j);
-#endif
 					}
-					sum_ref_under_circ_mask /= sumn;
-					sum_ref2_under_circ_mask /= sumn;
-					expected_Pratio = exp(suma2 / (2. * sumn));
+					if (do_fill_bank)
+						ref_bank.getCentralReference(ref_bank_group, iref) = Mctfref;
+				}
+
+				sum_ref_under_circ_mask = 0.;
+				sum_ref2_under_circ_mask = 0.;
+				RFLOAT suma2 = 0.;
+				RFLOAT sumn = 1.;
+				FOR_ALL_ELEMENTS_IN_ARRAY2D(Mctfref)
+				{
+					if (i*i + j*j < particle_radius2)
+					{
+						suma2 += A2D_ELEM(Mctfref, i, j) * A2D_ELEM(Mctfref, i, j);
+						suma2 += 2. * A2D_ELEM(Mctfref, i, j) * rnd_gaus(0., 1.);
+						sum_ref_under_circ_mask += A2D_ELEM(Mctfref, i, j);
+						sum_ref2_under_circ_mask += A2D_ELEM(Mctfref, i, j) * A2D_ELEM(Mctfref, i, j);
+						sumn += 1.;
+					}
+				}
+				sum_ref_under_circ_mask /= sumn;
+				sum_ref2_under_circ_mask /= sumn;
+				expected_Pratio = exp(suma2 / (2. * sumn));
 #ifdef DEBUG
-					std::cerr << " expected_Pratio["<<iref<<"]= " << expected_Pratio << std::endl;
-					tt()=Mctfref;
-					tt.write("Mctfref.spi");
-					std::cerr << "suma2 " << suma2<< " sumn " << sumn << " suma2/2sumn="<< suma2 / (2. * sumn) << std::endl;
-					std::cerr << " nr_pixels_under_mask= " << nr_pixels_circular_mask << " nr_pixels_under_invmask= " << nr_pixels_circular_invmask << std::endl;
-					std::cerr << "sum_ref_under_circ_mask " << sum_ref_under_circ_mask << std::endl;
-					std::cerr << "sum_ref2_under_circ_mask " << sum_ref2_under_circ_mask << std::endl;
-					std::cerr << "expected_Pratio " << expected_Pratio << std::endl;
+				std::cerr << " expected_Pratio["<<iref<<"]= " << expected_Pratio << std::endl;
+				tt()=Mctfref;
+				tt.write("Mctfref.spi");
+				std::cerr << "suma2 " << suma2<< " sumn " << sumn << " suma2/2sumn="<< suma2 / (2. * sumn) << std::endl;
+				std::cerr << " nr_pixels_under_mask= " << nr_pixels_circular_mask << " nr_pixels_under_invmask= " << nr_pixels_circular_invmask << std::endl;
+				std::cerr << "sum_ref_under_circ_mask " << sum_ref_under_circ_mask << std::endl;
+				std::cerr << "sum_ref2_under_circ_mask " << sum_ref2_under_circ_mask << std::endl;
+				std::cerr << "expected_Pratio " << expected_Pratio << std::endl;
 #endif
-
-					// Maux goes back to the workSize
-					Maux.resize(workSize, workSize);
+			}
 #ifdef TIMING
-					timer.toc(TIMING_B5);
+			timer.toc(TIMING_B5);
 #endif
-				}
 
 #ifdef TIMING
-				timer.tic(TIMING_B6);
+			timer.tic(TIMING_B6);
 #endif
-				// Now multiply template and micrograph to calculate the cross-correlation
-				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Faux)
+			// The rotations are divided over the threads in batches of at most AUTOPICK_PSI_BATCH,
+			// whose cross-correlations are inverse Fourier transformed together
+			const int psi_batch_size = XMIPP_MIN(AUTOPICK_PSI_BATCH, ((int)psis.size() + nr_threads - 1) / nr_threads);
+			const int nr_psi_batches = ((int)psis.size() + psi_batch_size - 1) / psi_batch_size;
+			#pragma omp parallel num_threads(nr_threads)
+			{
+				// Workspaces and best values of this thread
+				BatchFourierTransformer batch_transformer;
+				MultidimArray<Complex > Fref, Fref2, Fccf_stack;
+				MultidimArray<RFLOAT> Mccf, Mccf_stack, Mccf_thread_best(workSize, workSize), Mpsi_thread_best(workSize, workSize);
+				Mccf_thread_best.initConstant(-LARGE_NUMBER);
+				Matrix2D<RFLOAT> A(3,3);
+
+				#pragma omp for schedule(dynamic)
+				for (int ibatch = 0; ibatch < nr_psi_batches; ibatch++)
 				{
-					DIRECT_MULTIDIM_ELEM(Faux, n) = conj(DIRECT_MULTIDIM_ELEM(Faux, n)) * DIRECT_MULTIDIM_ELEM(Fmic, n);
-				}
+					int ipsi_batch = ibatch * psi_batch_size;
+					int nr_psi_batch = XMIPP_MIN(psi_batch_size, (int)psis.size() - ipsi_batch);
+					Fccf_stack.reshape(nr_psi_batch, 1, workSize, workSize/2 + 1);
+					Mccf_stack.reshape(nr_psi_batch, 1, workSize, workSize);
 
-				// If we're not doing shrink, then Faux is bigger than Faux2!
-				windowFourierTransform(Faux, Faux2, workSize);
-				transformer.inverseFourierTransform(Faux2, Maux);
-				CenterFFT(Maux, false);
-#ifdef DEBUG
-				tt()=Maux*normfft;
-				tt.write("Mcc.spi");
-#endif
+					for (int ipsi = 0; ipsi < nr_psi_batch; ipsi++)
+					{
+						int ipsi_all = ipsi_batch + ipsi;
+						RFLOAT psi = psis[ipsi_all];
+						Complex *Fccf = MULTIDIM_ARRAY(Fccf_stack) + ipsi * MULTIDIM_SIZE(Fmic_work);
+
+						if (is_in_bank)
+						{
+							const MultidimArray<Complex> &Fbank = ref_bank.getReference(ref_bank_group, iref, ipsi_all);
+							FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Fmic_work)
+							{
+								Fccf[n] = conj(DIRECT_MULTIDIM_ELEM(Fbank, n)) * DIRECT_MULTIDIM_ELEM(Fmic_work, n);
+							}
+							continue;
+						}
+
+						// Now get the FT of the rotated (non-ctf-corrected) template
+						Euler_angles2matrix(0., 0., psi, A);
+						Fref.initZeros(downsize_mic, downsize_mic/2 + 1);
+						PPref[iref].get2DFourierTransform(Fref, A, IS_NOT_INV);
+
+						// Apply the CTF on-the-fly (so same PPref can be used for many different micrographs)
+						if (do_ctf)
+						{
+							FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Fref)
+							{
+								DIRECT_MULTIDIM_ELEM(Fref, n) *= DIRECT_MULTIDIM_ELEM(Fctf, n);
+							}
+						}
 
-				// Calculate ratio of prabilities P(ref)/P(zero)
-				// Keep track of the best values and their corresponding iref and psi
+						// If we're not doing shrink, then Fref is bigger than Fref2!
+						windowFourierTransform(Fref, Fref2, workSize);
+						if (do_fill_bank)
+							ref_bank.getReference(ref_bank_group, iref, ipsi_all) = Fref2;
 
-				// So now we already had precalculated: Mdiff2 = 1/sig*Sum(X^2) - 2/sig*Sum(X) + mu^2/sig*Sum(1)
-				// Still to do (per reference): - 2/sig*Sum(AX) + 2*mu/sig*Sum(A) + Sum(A^2)
-				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Maux)
+						// Multiply template and micrograph to calculate the cross-correlation
+						FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Fmic_work)
+						{
+							Fccf[n] = conj(DIRECT_MULTIDIM_ELEM(Fref2, n)) * DIRECT_MULTIDIM_ELEM(Fmic_work, n);
+						}
+					}
+
+					batch_transformer.inverseFourierTransform(Fccf_stack, Mccf_stack);
+
+					for (int ipsi = 0; ipsi < nr_psi_batch; ipsi++)
+					{
+						RFLOAT psi = psis[ipsi_batch + ipsi];
+						Mccf.reshape(workSize, workSize);
+						memcpy(MULTIDIM_ARRAY(Mccf), MULTIDIM_ARRAY(Mccf_stack) + ipsi * MULTIDIM_SIZE(Mccf), MULTIDIM_SIZE(Mccf) * sizeof(RFLOAT));
+						CenterFFT(Mccf, false);
+
+						// Calculate ratio of prabilities P(ref)/P(zero)
+						// Keep track of the best values and their corresponding iref and psi
+
+						// So now we already had precalculated: Mdiff2 = 1/sig*Sum(X^2) - 2/sig*Sum(X) + mu^2/sig*Sum(1)
+						// Still to do (per reference): - 2/sig*Sum(AX) + 2*mu/sig*Sum(A) + Sum(A^2)
+						FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Mccf)
+						{
+							RFLOAT diff2 = - 2. * normfft * DIRECT_MULTIDIM_ELEM(Mccf, n);
+							diff2 += 2. * DIRECT_MULTIDIM_ELEM(Mmean, n) * sum_ref_under_circ_mask;
+							if (DIRECT_MULTIDIM_ELEM(Mstddev, n) > 1E-10)
+								diff2 /= DIRECT_MULTIDIM_ELEM(Mstddev, n);
+							diff2 += sum_ref2_under_circ_mask;
+							diff2 = exp(- diff2 / 2.); // exponentiate to reflect the Gaussian error model. sigma=1 after normalization, 0.4=1/sqrt(2pi)
+
+							// Store fraction of (1 - probability-ratio) wrt  (1 - expected Pratio)
+							diff2 = (diff2 - 1.) / (expected_Pratio - 1.);
+							if (diff2 > DIRECT_MULTIDIM_ELEM(Mccf_thread_best, n))
+							{
+								DIRECT_MULTIDIM_ELEM(Mccf_thread_best, n) = diff2;
+								DIRECT_MULTIDIM_ELEM(Mpsi_thread_best, n) = psi;
+							}
+						}
+					}
+				} // end for psi batches
+
+				// Of equal values, keep the smallest psi, as if all rotations had been done in order
+				#pragma omp critical(autopicker_best_ccf)
 				{
-					RFLOAT diff2 = - 2. * normfft * DIRECT_MULTIDIM_ELEM(Maux, n);
-					diff2 += 2. * DIRECT_MULTIDIM_ELEM(Mmean, n) * sum_ref_under_circ_mask;
-					if (DIRECT_MULTIDIM_ELEM(Mstddev, n) > 1E-10)
-						diff2 /= DIRECT_MULTIDIM_ELEM(Mstddev, n);
-					diff2 += sum_ref2_under_circ_mask;
-					diff2 = exp(- diff2 / 2.); // exponentiate to reflect the Gaussian error model. sigma=1 after normalization, 0.4=1/sqrt(2pi)
-
-					// Store fraction of (1 - probability-ratio) wrt  (1 - expected Pratio)
-					diff2 = (diff2 - 1.) / (expected_Pratio - 1.);
-#ifdef DEBUG
-					DIRECT_MULTIDIM_ELEM(Maux, n) = diff2;
-#endif
-					if (diff2 > DIRECT_MULTIDIM_ELEM(Mccf_best, n))
+					FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Mccf_best)
 					{
-						DIRECT_MULTIDIM_ELEM(Mccf_best, n) = diff2;
-						DIRECT_MULTIDIM_ELEM(Mpsi_best, n) = psi;
+						RFLOAT ccf = DIRECT_MULTIDIM_ELEM(Mccf_thread_best, n);
+						RFLOAT best_ccf = DIRECT_MULTIDIM_ELEM(Mccf_best, n);
+						if (ccf > best_ccf || (ccf == best_ccf && ccf > -LARGE_NUMBER &&
+						                       DIRECT_MULTIDIM_ELEM(Mpsi_thread_best, n) < DIRECT_MULTIDIM_ELEM(Mpsi_best, n)))
+						{
+							DIRECT_MULTIDIM_ELEM(Mccf_best, n) = ccf;
+							DIRECT_MULTIDIM_ELEM(Mpsi_best, n) = DIRECT_MULTIDIM_ELEM(Mpsi_thread_best, n);
+						}
 					}
 				}
-#ifdef DEBUG
-				std::cerr << " Maux.computeMax()= " << Maux.computeMax() << std::endl;
-				tt()=Maux;
-				tt.write("Mccf.spi");
-			    std::cerr << " Press any key to continue... "  << std::endl;
-			    char c;
-			    std::cin >> c;
-#endif
-			    is_first_psi = false;
+			}
+			if (do_fill_bank)
+				ref_bank.setComplete(ref_bank_group, iref);
 #ifdef TIMING
-	timer.toc(TIMING_B6);
+			timer.toc(TIMING_B6);
 #endif
-			} // end for psi
 #ifdef TIMING
 	timer.toc(TIMING_B3);
 #endif
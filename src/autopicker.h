@@ -19,6 +19,7 @@
 #include "src/mask.h"
 #include "src/macros.h"
 #include "src/helix.h"
+#include "src/autopick_reference_bank.h"
 #ifdef CUDA
 #include "src/acc/cuda/cuda_mem_utils.h"
 #include "src/acc/acc_projector.h"
@@ -30,6 +31,9 @@
 //#define OUTPUT_STDDEV_MAP_ONLY 2
 //#define OUTPUT_BOTH_MEAN_AND_STDDEV_MAPS 3
 
+// Number of rotations of a template whose cross-correlations with the micrograph are inverse Fourier transformed in one batch
+#define AUTOPICK_PSI_BATCH 8
+
 //#define TIMING
 class ccfPixel
 {
@@ -211,9 +215,17 @@ public:
 	// Which GPU devices to use?
 	std::string gpu_ids;
 
+	// Number of threads for template matching on the CPU
+	int nr_threads;
+
 	// Keep the CTFs unchanged until the first peak?
 	bool intact_ctf_first_peak;
 
+	// Rotated (and CTF-modulated) references kept from one micrograph to the next, with their memory limit (in Mb)
+	// and the largest difference in defocus (in Angstroms) between a micrograph and the CTF of its references
+	AutopickReferenceBank ref_bank;
+	RFLOAT ref_bank_memory, ref_bank_defocus_tolerance;
+
 	// Are the templates 2D helical segments? If so, in-plane rotation angles (psi) are estimated for the references.
 	bool autopick_helical_segments;
 
@@ -114,7 +114,11 @@ void AutoPickerMpi::run()
 			autoPickOneMicrograph(fn_micrographs[imic], imic);
 	}
 	if (verb > 0)
+	{
 		progress_bar(my_nr_micrographs);
+		if (ref_bank.isEnabled())
+			ref_bank.printStatistics(std::cout);
+	}
 
 
 }
@@ -25,6 +25,8 @@
  */
 
 #include "src/backprojector.h"
+#include "src/profiler.h"
+#include "src/fftw_plan_cache.h"
 
 #ifdef TIMING
 	#define RCTIC(timer,label) (timer.tic(label))
@@ -41,6 +43,7 @@ void BackProjector::initialiseDataAndWeight(int current_size)
 
 	initialiseData(current_size);
 	weight.resize(data);
+	weight_float.clear();
 
 }
 
@@ -52,7 +55,59 @@ void BackProjector::initZeros(int current_size)
 	weight.initZeros();
 }
 
-void BackProjector::backproject2Dto3D(const MultidimArray<Complex > &f2d,
+// Let array take the shape of model, with its values in a new (zero-filled) memory-mapped file in dir instead of in RAM
+template <typename T>
+static void mapArray(MultidimArray<T> &array, const MultidimArray<T> &model, MappedScratchFile &file, const FileName &dir)
+{
+	array.clear();
+	array.copyShape(model);
+	file.create(dir, MULTIDIM_SIZE(model) * sizeof(T));
+	array.data = (T*)file.begin();
+	array.nzyxdimAlloc = MULTIDIM_SIZE(model);
+	// The file owns the memory
+	array.destroyData = false;
+}
+
+void BackProjector::mapDataAndWeight(MappedScratchFile &data_file, MappedScratchFile &weight_file)
+{
+	if (ooc_dir == "")
+		REPORT_ERROR("BackProjector::mapDataAndWeight ERROR: no directory for the memory-mapped files");
+
+	MultidimArray<Complex> data_shape;
+	MultidimArray<RFLOAT> weight_shape;
+	data_shape.copyShape(data);
+	weight_shape.copyShape(weight);
+	mapArray(data, data_shape, data_file, ooc_dir);
+	mapArray(weight, weight_shape, weight_file, ooc_dir);
+}
+
+void BackProjector::setDataPrecision(int precision)
+{
+	if (precision == data_precision)
+		return;
+	if (precision == PRECISION_HALF)
+		REPORT_ERROR("BackProjector::setDataPrecision ERROR: half precision is too coarse to sum backprojections");
+
+	if (precision == PRECISION_FLOAT)
+	{
+		weight_float.resize(weight);
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(weight)
+			DIRECT_MULTIDIM_ELEM(weight_float, n) = DIRECT_MULTIDIM_ELEM(weight, n);
+		weight.clear();
+	}
+	else
+	{
+		weight.resize(weight_float);
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(weight_float)
+			DIRECT_MULTIDIM_ELEM(weight, n) = DIRECT_MULTIDIM_ELEM(weight_float, n);
+		weight_float.clear();
+	}
+	Projector::setDataPrecision(precision);
+}
+
+template <typename TD, typename TW>
+void BackProjector::backproject2Dto3D(MultidimArray<TD> &data, MultidimArray<TW> &weight,
+		                        const MultidimArray<Complex > &f2d,
 		                        const Matrix2D<RFLOAT> &A, bool inv,
 		                        const MultidimArray<RFLOAT> *Mweight,
 								RFLOAT r_ewald_sphere, bool is_positive_curvature)
@@ -253,7 +308,9 @@ void BackProjector::backproject2Dto3D(const MultidimArray<Complex > &f2d,
 	} // endif y-loop
 }
 
-void BackProjector::backproject1Dto2D(const MultidimArray<Complex > &f1d,
+template <typename TD, typename TW>
+void BackProjector::backproject1Dto2D(MultidimArray<TD> &data, MultidimArray<TW> &weight,
+		                        const MultidimArray<Complex > &f1d,
 		                        const Matrix2D<RFLOAT> &A, bool inv,
 		                        const MultidimArray<RFLOAT> *Mweight)
 {
@@ -369,7 +426,9 @@ void BackProjector::backproject1Dto2D(const MultidimArray<Complex > &f1d,
 
 }
 
-void BackProjector::backrotate2D(const MultidimArray<Complex > &f2d,
+template <typename TD, typename TW>
+void BackProjector::backrotate2D(MultidimArray<TD> &data, MultidimArray<TW> &weight,
+		                        const MultidimArray<Complex > &f2d,
 		                         const Matrix2D<RFLOAT> &A, bool inv,
 		                         const MultidimArray<RFLOAT> *Mweight)
 {
@@ -522,7 +581,9 @@ void BackProjector::backrotate2D(const MultidimArray<Complex > &f2d,
 	} // endif y-loop
 }
 
-void BackProjector::backrotate3D(const MultidimArray<Complex > &f3d,
+template <typename TD, typename TW>
+void BackProjector::backrotate3D(MultidimArray<TD> &data, MultidimArray<TW> &weight,
+		                        const MultidimArray<Complex > &f3d,
 		                         const Matrix2D<RFLOAT> &A, bool inv,
 		                         const MultidimArray<RFLOAT> *Mweight)
 {
@@ -715,6 +776,47 @@ void BackProjector::backrotate3D(const MultidimArray<Complex > &f3d,
 	} // endif z-loop
 }
 
+void BackProjector::backproject2Dto3D(const MultidimArray<Complex > &f2d,
+		                        const Matrix2D<RFLOAT> &A, bool inv,
+		                        const MultidimArray<RFLOAT> *Mweight,
+								RFLOAT r_ewald_sphere, bool is_positive_curvature)
+{
+	if (data_precision == PRECISION_FLOAT)
+		backproject2Dto3D(data_float, weight_float, f2d, A, inv, Mweight, r_ewald_sphere, is_positive_curvature);
+	else
+		backproject2Dto3D(data, weight, f2d, A, inv, Mweight, r_ewald_sphere, is_positive_curvature);
+}
+
+void BackProjector::backproject1Dto2D(const MultidimArray<Complex > &f1d,
+		                        const Matrix2D<RFLOAT> &A, bool inv,
+		                        const MultidimArray<RFLOAT> *Mweight)
+{
+	if (data_precision == PRECISION_FLOAT)
+		backproject1Dto2D(data_float, weight_float, f1d, A, inv, Mweight);
+	else
+		backproject1Dto2D(data, weight, f1d, A, inv, Mweight);
+}
+
+void BackProjector::backrotate2D(const MultidimArray<Complex > &f2d,
+		                         const Matrix2D<RFLOAT> &A, bool inv,
+		                         const MultidimArray<RFLOAT> *Mweight)
+{
+	if (data_precision == PRECISION_FLOAT)
+		backrotate2D(data_float, weight_float, f2d, A, inv, Mweight);
+	else
+		backrotate2D(data, weight, f2d, A, inv, Mweight);
+}
+
+void BackProjector::backrotate3D(const MultidimArray<Complex > &f3d,
+		                         const Matrix2D<RFLOAT> &A, bool inv,
+		                         const MultidimArray<RFLOAT> *Mweight)
+{
+	if (data_precision == PRECISION_FLOAT)
+		backrotate3D(data_float, weight_float, f3d, A, inv, Mweight);
+	else
+		backrotate3D(data, weight, f3d, A, inv, Mweight);
+}
+
 void BackProjector::getLowResDataAndWeight(MultidimArray<Complex > &lowres_data, MultidimArray<RFLOAT> &lowres_weight,
 		int lowres_r_max)
 {
@@ -792,6 +894,77 @@ void BackProjector::setLowResDataAndWeight(MultidimArray<Complex > &lowres_data,
 	}
 }
 
+// The tree sum of BackProjector::addTreeSum, for the data and weight arrays in either precision
+template <typename TD, typename TW>
+static void addTreeSumOfArrays(MultidimArray<TD> &data, MultidimArray<TW> &weight,
+		std::vector<MultidimArray<TD> *> &others_data, std::vector<MultidimArray<TW> *> &others_weight,
+		long int first, long int last)
+{
+	int nr_others = others_data.size();
+	for (int i = 0; i < nr_others; i++)
+		if (!(others_data[i])->sameShape(data) || !(others_weight[i])->sameShape(weight))
+			REPORT_ERROR("BackProjector::addTreeSum%%ERROR: the BackProjectors do not have the same size");
+	last = XMIPP_MIN(last, NZYXSIZE(data));
+
+	for (int step = 1; step < nr_others; step *= 2)
+	{
+		for (int i = 0; i + step < nr_others; i += 2 * step)
+		{
+			TD *my_data = MULTIDIM_ARRAY(*others_data[i]);
+			TW *my_weight = MULTIDIM_ARRAY(*others_weight[i]);
+			TD *other_data = MULTIDIM_ARRAY(*others_data[i + step]);
+			TW *other_weight = MULTIDIM_ARRAY(*others_weight[i + step]);
+			for (long int n = first; n < last; n++)
+			{
+				my_data[n] += other_data[n];
+				my_weight[n] += other_weight[n];
+			}
+		}
+	}
+
+	TD *sum_data = MULTIDIM_ARRAY(*others_data[0]);
+	TW *sum_weight = MULTIDIM_ARRAY(*others_weight[0]);
+	for (long int n = first; n < last; n++)
+	{
+		DIRECT_MULTIDIM_ELEM(data, n) += sum_data[n];
+		DIRECT_MULTIDIM_ELEM(weight, n) += sum_weight[n];
+	}
+}
+
+void BackProjector::addTreeSum(std::vector<BackProjector *> &others, long int first, long int last)
+{
+	int nr_others = others.size();
+	if (nr_others == 0)
+		return;
+
+	for (int i = 0; i < nr_others; i++)
+		if (others[i]->data_precision != data_precision)
+			REPORT_ERROR("BackProjector::addTreeSum%%ERROR: the BackProjectors do not have the same precision");
+
+	if (data_precision == PRECISION_FLOAT)
+	{
+		std::vector<MultidimArray<FloatComplex> *> others_data(nr_others);
+		std::vector<MultidimArray<float> *> others_weight(nr_others);
+		for (int i = 0; i < nr_others; i++)
+		{
+			others_data[i] = &(others[i]->data_float);
+			others_weight[i] = &(others[i]->weight_float);
+		}
+		addTreeSumOfArrays(data_float, weight_float, others_data, others_weight, first, last);
+	}
+	else
+	{
+		std::vector<MultidimArray<Complex> *> others_data(nr_others);
+		std::vector<MultidimArray<RFLOAT> *> others_weight(nr_others);
+		for (int i = 0; i < nr_others; i++)
+		{
+			others_data[i] = &(others[i]->data);
+			others_weight[i] = &(others[i]->weight);
+		}
+		addTreeSumOfArrays(data, weight, others_data, others_weight, first, last);
+	}
+}
+
 void BackProjector::getDownsampledAverage(MultidimArray<Complex>& avg, bool divide) const
 {
     MultidimArray<RFLOAT> down_weight;
@@ -919,6 +1092,15 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
                                 bool printTimes,
 								bool do_fsc0999)
 {
+	ProfileScope profile_scope(PROF_RECONSTRUCT);
+
+	// Keep the Fourier-space arrays of 3D reconstructions on disc
+	if (ooc_dir != "" && ref_dim == 3)
+	{
+		reconstructOutOfCore(vol_out, max_iter_preweight, do_map, tau2_fudge, tau2_io, sigma2_out, data_vs_prior_out,
+				fourier_coverage_out, fsc, normalise, update_tau2_with_fsc, is_whole_instead_of_half, minres_map, do_fsc0999);
+		return;
+	}
 
 #ifdef TIMING
 	Timer ReconTimer;
@@ -1471,6 +1653,438 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
     fourier_coverage_out = fourier_coverage;
 }
 
+// Loop over the z-planes k0 <= k < k1 of a Fourier transform in FFTW format with zdim x ydim x xdim complex values (zdim = ydim),
+// with n the index of element (k, i, j) in the array
+#define FOR_ALL_ELEMENTS_IN_FFTW_SLAB(k0, k1, zdim, ydim, xdim) \
+	for (long int k = k0, kp = (k < xdim) ? k : k - zdim, n = k0 * ydim * xdim; k < k1; k++, kp = (k < xdim) ? k : k - zdim) \
+		for (long int i = 0, ip = 0; i < ydim; i++, ip = (i < xdim) ? i : i - ydim) \
+			for (long int j = 0, jp = 0; j < xdim; j++, jp = j, n++)
+
+// FFTs along z of the zdim x ydim x xdim complex values in Fvol, in blocks of y-rows:
+// the values along z of each (i, j) of a block are copied next to each other into a buffer
+// The forward transform is normalised, as in the FourierTransformer
+static void transformAlongZ(MappedScratchFile &Fvol, long int zdim, long int ydim, long int xdim, bool forward, size_t max_bytes)
+{
+	// The buffer and the pages of the file that are touched take about the same amount of memory,
+	// plus as much again for the scratch array with which FftwPlanCache plans with more effort than FFTW_ESTIMATE
+	int nr_copies = (FftwPlanCache::getEffort() & FFTW_ESTIMATE) ? 2 : 3;
+	long int block_ydim = max_bytes / (nr_copies * zdim * xdim * sizeof(Complex));
+	block_ydim = XMIPP_MAX(1, XMIPP_MIN(ydim, block_ydim));
+
+	MultidimArray<Complex> buffer;
+	buffer.resize(block_ydim * xdim * zdim);
+	Complex *buf = MULTIDIM_ARRAY(buffer);
+	Complex *vol = (Complex*)Fvol.begin();
+	FftwPlanCache::Kind kind = (forward) ? FftwPlanCache::C2C_FORWARD : FftwPlanCache::C2C_BACKWARD;
+	RFLOAT scale = (forward) ? 1. / zdim : 1.;
+
+	for (long int i0 = 0; i0 < ydim; i0 += block_ydim)
+	{
+		long int ncols = XMIPP_MIN(block_ydim, ydim - i0) * xdim;
+		for (long int k = 0; k < zdim; k++)
+		{
+			Complex *row = vol + (k * ydim + i0) * xdim;
+			for (long int n = 0; n < ncols; n++)
+				buf[n * zdim + k] = row[n];
+		}
+
+#ifdef RELION_SINGLE_PRECISION
+		fftwf_plan plan = FftwPlanCache::getManyPlan(kind, zdim, 1, 1, ncols, (RFLOAT*)buf, (RFLOAT*)buf);
+		fftwf_execute_dft(plan, (fftwf_complex*)buf, (fftwf_complex*)buf);
+#else
+		fftw_plan plan = FftwPlanCache::getManyPlan(kind, zdim, 1, 1, ncols, (RFLOAT*)buf, (RFLOAT*)buf);
+		fftw_execute_dft(plan, (fftw_complex*)buf, (fftw_complex*)buf);
+#endif
+
+		for (long int k = 0; k < zdim; k++)
+		{
+			Complex *row = vol + (k * ydim + i0) * xdim;
+			for (long int n = 0; n < ncols; n++)
+				row[n] = buf[n * zdim + k] * scale;
+			Fvol.release((k * ydim + i0) * xdim * sizeof(Complex), ncols * sizeof(Complex));
+		}
+	}
+}
+
+// Inverse 2D FFT of a z-plane (after transformAlongZ) into the real image Mplane (not normalised, as in the FourierTransformer)
+// Note that the plane is overwritten by FFTW
+static void inverseTransformPlane(Complex *plane, MultidimArray<RFLOAT> &Mplane)
+{
+#ifdef RELION_SINGLE_PRECISION
+	fftwf_plan plan = FftwPlanCache::getPlan(FftwPlanCache::C2R, XSIZE(Mplane), YSIZE(Mplane), 1, (RFLOAT*)plane, MULTIDIM_ARRAY(Mplane));
+	fftwf_execute_dft_c2r(plan, (fftwf_complex*)plane, MULTIDIM_ARRAY(Mplane));
+#else
+	fftw_plan plan = FftwPlanCache::getPlan(FftwPlanCache::C2R, XSIZE(Mplane), YSIZE(Mplane), 1, (RFLOAT*)plane, MULTIDIM_ARRAY(Mplane));
+	fftw_execute_dft_c2r(plan, (fftw_complex*)plane, MULTIDIM_ARRAY(Mplane));
+#endif
+}
+
+// Forward 2D FFT of the real image Mplane into a z-plane, normalised by its size
+static void forwardTransformPlane(MultidimArray<RFLOAT> &Mplane, Complex *plane)
+{
+#ifdef RELION_SINGLE_PRECISION
+	fftwf_plan plan = FftwPlanCache::getPlan(FftwPlanCache::R2C, XSIZE(Mplane), YSIZE(Mplane), 1, MULTIDIM_ARRAY(Mplane), (RFLOAT*)plane);
+	fftwf_execute_dft_r2c(plan, MULTIDIM_ARRAY(Mplane), (fftwf_complex*)plane);
+#else
+	fftw_plan plan = FftwPlanCache::getPlan(FftwPlanCache::R2C, XSIZE(Mplane), YSIZE(Mplane), 1, MULTIDIM_ARRAY(Mplane), (RFLOAT*)plane);
+	fftw_execute_dft_r2c(plan, MULTIDIM_ARRAY(Mplane), (fftw_complex*)plane);
+#endif
+	long int plane_size = YSIZE(Mplane) * (XSIZE(Mplane) / 2 + 1);
+	RFLOAT scale = 1. / (XSIZE(Mplane) * YSIZE(Mplane));
+	for (long int n = 0; n < plane_size; n++)
+		plane[n] *= scale;
+}
+
+void BackProjector::reconstructOutOfCore(MultidimArray<RFLOAT> &vol_out,
+                                int max_iter_preweight,
+                                bool do_map,
+                                RFLOAT tau2_fudge,
+                                MultidimArray<RFLOAT> &tau2_io, // can be input/output
+                                MultidimArray<RFLOAT> &sigma2_out,
+                                MultidimArray<RFLOAT> &data_vs_prior_out,
+                                MultidimArray<RFLOAT> &fourier_coverage_out,
+                                const MultidimArray<RFLOAT> &fsc, // only input
+                                RFLOAT normalise,
+                                bool update_tau2_with_fsc,
+                                bool is_whole_instead_of_half,
+                                int minres_map,
+								bool do_fsc0999)
+{
+	// The steps below are those of reconstruct() for ref_dim == 3, see the comments there
+	if (ref_dim != 3)
+		REPORT_ERROR("BackProjector::reconstructOutOfCore ERROR: only for 3D reconstructions");
+
+	MultidimArray<RFLOAT> sigma2, data_vs_prior, fourier_coverage, counter;
+	MultidimArray<RFLOAT> tau2 = tau2_io;
+
+	// Size of the padded Fourier transform
+	long int zdim = pad_size, ydim = pad_size, xdim = pad_size / 2 + 1;
+	long int plane_size = ydim * xdim;
+	int max_r2 = ROUND(r_max * padding_factor) * ROUND(r_max * padding_factor);
+	RFLOAT oversampling_correction = padding_factor * padding_factor * padding_factor;
+	size_t max_bytes = (size_t)(ooc_max_ram * 1024. * 1024. * 1024.);
+
+	// Number of z-planes of Fweight, Fnewweight and Fconv that are processed at a time
+	long int slab_zdim = max_bytes / (plane_size * (sizeof(RFLOAT) + sizeof(double) + sizeof(Complex)));
+	slab_zdim = XMIPP_MAX(1, XMIPP_MIN(zdim, slab_zdim));
+
+	// Fnewweight can become too large for a float: always keep this one in double-precision
+	MappedScratchFile Fweight_file, Fnewweight_file, Fconv_file;
+	Fweight_file.create(ooc_dir, zdim * plane_size * sizeof(RFLOAT));
+	if (!skip_gridding)
+	{
+		Fnewweight_file.create(ooc_dir, zdim * plane_size * sizeof(double));
+		Fconv_file.create(ooc_dir, zdim * plane_size * sizeof(Complex));
+	}
+	RFLOAT *Fweight = (RFLOAT*)Fweight_file.begin();
+	double *Fnewweight = (double*)Fnewweight_file.begin();
+	Complex *Fconv = (Complex*)Fconv_file.begin();
+
+	// Go from projector-centered to FFTW-uncentered,
+	// and calculate the radial average of the (inverse of the) power of the noise in the reconstruction
+	sigma2.initZeros(ori_size/2 + 1);
+	counter.initZeros(ori_size/2 + 1);
+	for (long int k0 = 0; k0 < zdim; k0 += slab_zdim)
+	{
+		long int k1 = XMIPP_MIN(zdim, k0 + slab_zdim);
+		FOR_ALL_ELEMENTS_IN_FFTW_SLAB(k0, k1, zdim, ydim, xdim)
+		{
+			int r2 = kp * kp + ip * ip + jp * jp;
+			if (r2 <= max_r2)
+				Fweight[n] = A3D_ELEM(weight, kp, ip, jp);
+			if (r2 < max_r2)
+			{
+				int ires = ROUND( sqrt((RFLOAT)r2) / padding_factor );
+				DIRECT_A1D_ELEM(sigma2, ires) += oversampling_correction * Fweight[n];
+				DIRECT_A1D_ELEM(counter, ires) += 1.;
+			}
+		}
+		Fweight_file.release(k0 * plane_size * sizeof(RFLOAT), (k1 - k0) * plane_size * sizeof(RFLOAT));
+	}
+
+	FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY1D(sigma2)
+	{
+		if (DIRECT_A1D_ELEM(sigma2, i) > 1e-10)
+			DIRECT_A1D_ELEM(sigma2, i) = DIRECT_A1D_ELEM(counter, i) / DIRECT_A1D_ELEM(sigma2, i);
+		else if (DIRECT_A1D_ELEM(sigma2, i) == 0)
+			DIRECT_A1D_ELEM(sigma2, i) = 0.;
+		else
+			REPORT_ERROR("BackProjector::reconstructOutOfCore: ERROR: unexpectedly small, yet non-zero sigma2 value, this should not happen...");
+	}
+
+	if (update_tau2_with_fsc)
+	{
+		tau2.reshape(ori_size/2 + 1);
+		data_vs_prior.initZeros(ori_size/2 + 1);
+		if (!fsc.sameShape(sigma2) || !fsc.sameShape(tau2))
+			REPORT_ERROR("ERROR BackProjector::reconstructOutOfCore: sigma2, tau2 and fsc have different sizes");
+		FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY1D(sigma2)
+		{
+			RFLOAT myfsc = XMIPP_MAX(0.001, DIRECT_A1D_ELEM(fsc, i));
+			if (is_whole_instead_of_half)
+				myfsc = sqrt(2. * myfsc / (myfsc + 1.));
+			myfsc = XMIPP_MIN(0.999, myfsc);
+			RFLOAT myssnr = tau2_fudge * myfsc / (1. - myfsc);
+			DIRECT_A1D_ELEM(tau2, i) = myssnr * DIRECT_A1D_ELEM(sigma2, i);
+			DIRECT_A1D_ELEM(data_vs_prior, i) = myssnr;
+		}
+	}
+
+	// Add the MAP term (or 1/1000th of sigma2) to Fweight, and initialise the gridding iterations
+	if (do_map)
+	{
+		if (!update_tau2_with_fsc)
+			data_vs_prior.initZeros(ori_size/2 + 1);
+		fourier_coverage.initZeros(ori_size/2 + 1);
+		counter.initZeros(ori_size/2 + 1);
+	}
+	for (long int k0 = 0; k0 < zdim; k0 += slab_zdim)
+	{
+		long int k1 = XMIPP_MIN(zdim, k0 + slab_zdim);
+		FOR_ALL_ELEMENTS_IN_FFTW_SLAB(k0, k1, zdim, ydim, xdim)
+		{
+			int r2 = kp * kp + ip * ip + jp * jp;
+			if (r2 < max_r2 && (do_map || do_fsc0999))
+			{
+				int ires = ROUND( sqrt((RFLOAT)r2) / padding_factor );
+				if (do_map)
+				{
+					RFLOAT invw = Fweight[n];
+					RFLOAT invtau2;
+					if (DIRECT_A1D_ELEM(tau2, ires) > 0.)
+						invtau2 = 1. / (oversampling_correction * tau2_fudge * DIRECT_A1D_ELEM(tau2, ires));
+					else if (DIRECT_A1D_ELEM(tau2, ires) == 0.)
+						invtau2 = 1./ ( 0.001 * invw);
+					else
+						REPORT_ERROR("ERROR BackProjector::reconstructOutOfCore: Negative or zero values encountered for tau2 spectrum!");
+
+					if (!update_tau2_with_fsc)
+						DIRECT_A1D_ELEM(data_vs_prior, ires) += invw / invtau2;
+					if (invw / invtau2 >= 1.)
+						DIRECT_A1D_ELEM(fourier_coverage, ires) += 1.;
+					DIRECT_A1D_ELEM(counter, ires) += 1.;
+					if (ires >= minres_map)
+						Fweight[n] = invw + invtau2;
+				}
+				else if (ires >= minres_map)
+				{
+					Fweight[n] += 1./(999. * DIRECT_A1D_ELEM(sigma2, ires));
+				}
+			}
+
+			if (!skip_gridding)
+			{
+				// Divide Fweight (and data below) by the normalisation factor to prevent FFTs with very large values
+				Fweight[n] /= normalise;
+				// Initialise Fnewweight with 1's and 0's
+				Fnewweight[n] = (r2 < max_r2) ? 1. : 0.;
+			}
+		}
+		Fweight_file.release(k0 * plane_size * sizeof(RFLOAT), (k1 - k0) * plane_size * sizeof(RFLOAT));
+		Fnewweight_file.release(k0 * plane_size * sizeof(double), (k1 - k0) * plane_size * sizeof(double));
+	}
+
+	if (do_map)
+	{
+		if (!update_tau2_with_fsc)
+		{
+			FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY1D(data_vs_prior)
+			{
+				if (i > r_max)
+					DIRECT_A1D_ELEM(data_vs_prior, i) = 0.;
+				else if (DIRECT_A1D_ELEM(counter, i) < 0.001)
+					DIRECT_A1D_ELEM(data_vs_prior, i) = 999.;
+				else
+					DIRECT_A1D_ELEM(data_vs_prior, i) /= DIRECT_A1D_ELEM(counter, i);
+			}
+		}
+		FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY1D(fourier_coverage)
+		{
+			if (DIRECT_A1D_ELEM(counter, i) > 0.)
+				DIRECT_A1D_ELEM(fourier_coverage, i) /= DIRECT_A1D_ELEM(counter, i);
+		}
+	}
+
+	if (!skip_gridding)
+	{
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(data)
+		{
+			DIRECT_MULTIDIM_ELEM(data, n) /= normalise;
+		}
+		// As in reconstruct(), the weight array is overwritten by the initial Fnewweight
+		FOR_ALL_ELEMENTS_IN_ARRAY3D(weight)
+		{
+			A3D_ELEM(weight, k, i, j) = (k * k + i * i + j * j < max_r2) ? 1. : 0.;
+		}
+
+		// Iterative algorithm as in  Eq. [14] in Pipe & Menon (1999), see reconstruct()
+		RFLOAT normftblob = tab_ftblob(0.);
+		int padhdim = pad_size / 2;
+		MultidimArray<RFLOAT> Mplane;
+		Mplane.resize(pad_size, pad_size);
+		for (int iter = 0; iter < max_iter_preweight; iter++)
+		{
+			for (long int k0 = 0; k0 < zdim; k0 += slab_zdim)
+			{
+				long int k1 = XMIPP_MIN(zdim, k0 + slab_zdim);
+				for (long int n = k0 * plane_size; n < k1 * plane_size; n++)
+					Fconv[n] = Fnewweight[n] * Fweight[n];
+				Fweight_file.release(k0 * plane_size * sizeof(RFLOAT), (k1 - k0) * plane_size * sizeof(RFLOAT));
+				Fnewweight_file.release(k0 * plane_size * sizeof(double), (k1 - k0) * plane_size * sizeof(double));
+				Fconv_file.release(k0 * plane_size * sizeof(Complex), (k1 - k0) * plane_size * sizeof(Complex));
+			}
+
+			// Convolute with the blob as in convoluteBlobRealSpace(), by multiplication with its FT in real space,
+			// one z-plane of the real-space map at a time
+			transformAlongZ(Fconv_file, zdim, ydim, xdim, false, max_bytes);
+			for (long int k = 0; k < zdim; k++)
+			{
+				Complex *plane = Fconv + k * plane_size;
+				inverseTransformPlane(plane, Mplane);
+				int kp = (k < padhdim) ? k : k - pad_size;
+				FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(Mplane)
+				{
+					int ip = (i < padhdim) ? i : i - pad_size;
+					int jp = (j < padhdim) ? j : j - pad_size;
+					RFLOAT rval = sqrt ( (RFLOAT)(kp * kp + ip * ip + jp * jp) ) / (ori_size * padding_factor);
+					DIRECT_A2D_ELEM(Mplane, i, j) *= (tab_ftblob(rval) / normftblob);
+				}
+				forwardTransformPlane(Mplane, plane);
+				Fconv_file.release(k * plane_size * sizeof(Complex), plane_size * sizeof(Complex));
+			}
+			transformAlongZ(Fconv_file, zdim, ydim, xdim, true, max_bytes);
+
+			for (long int k0 = 0; k0 < zdim; k0 += slab_zdim)
+			{
+				long int k1 = XMIPP_MIN(zdim, k0 + slab_zdim);
+				FOR_ALL_ELEMENTS_IN_FFTW_SLAB(k0, k1, zdim, ydim, xdim)
+				{
+					if (kp * kp + ip * ip + jp * jp < max_r2)
+						Fnewweight[n] /= XMIPP_MAX(1e-6, abs(Fconv[n]));
+				}
+				Fnewweight_file.release(k0 * plane_size * sizeof(double), (k1 - k0) * plane_size * sizeof(double));
+				Fconv_file.release(k0 * plane_size * sizeof(Complex), (k1 - k0) * plane_size * sizeof(Complex));
+			}
+		}
+
+		Fweight_file.close();
+		Fconv_file.close();
+	}
+
+	// Apply the weights to the data array and window the Fourier transform to the padded original size in one go,
+	// as in windowToOridimRealSpace() (and windowFourierTransform())
+	long int padoridim = ROUND(padding_factor * ori_size);
+	padoridim += padoridim%2;
+	long int win_xdim = padoridim / 2 + 1;
+	long int win_plane_size = padoridim * win_xdim;
+	MappedScratchFile Fwin_file;
+	Fwin_file.create(ooc_dir, padoridim * win_plane_size * sizeof(Complex));
+	Complex *Fwin = (Complex*)Fwin_file.begin();
+
+	// If the window is larger, loop over the elements of the padded transform (within its sphere), otherwise over those of the window
+	bool is_larger = (win_xdim > xdim);
+	long int loop_zdim = (is_larger) ? zdim : padoridim;
+	long int loop_xdim = (is_larger) ? xdim : win_xdim;
+	long int max_win_r2 = (xdim - 1) * (xdim - 1);
+	for (long int k = 0; k < loop_zdim; k++)
+	{
+		long int kp = (k < loop_xdim) ? k : k - loop_zdim;
+		long int k_in = (kp < 0) ? kp + zdim : kp;
+		long int kp_in = (k_in < xdim) ? k_in : k_in - zdim;
+		for (long int i = 0; i < loop_zdim; i++)
+		{
+			long int ip = (i < loop_xdim) ? i : i - loop_zdim;
+			long int i_in = (ip < 0) ? ip + ydim : ip;
+			long int ip_in = (i_in < xdim) ? i_in : i_in - ydim;
+			Complex *out = Fwin + ((kp < 0) ? kp + padoridim : kp) * win_plane_size + ((ip < 0) ? ip + padoridim : ip) * win_xdim;
+			for (long int jp = 0; jp < loop_xdim; jp++)
+			{
+				if (is_larger && kp * kp + ip * ip + jp * jp > max_win_r2)
+					continue;
+				if (kp_in * kp_in + ip_in * ip_in + jp * jp > max_r2)
+					continue;
+				long int n = (k_in * ydim + i_in) * xdim + jp;
+				Complex val = A3D_ELEM(data, kp_in, ip_in, jp);
+				if (skip_gridding)
+				{
+					if (Fweight[n] > 0.)
+						val /= Fweight[n];
+				}
+				else
+				{
+					double w = Fnewweight[n];
+#ifdef  RELION_SINGLE_PRECISION
+					// Prevent numerical instabilities in single-precision reconstruction with very unevenly sampled orientations
+					if (w > 1e20)
+						w = 1e20;
+#endif
+					val *= w;
+				}
+				out[jp] = val;
+			}
+		}
+		Fweight_file.release(k_in * plane_size * sizeof(RFLOAT), plane_size * sizeof(RFLOAT));
+		Fnewweight_file.release(k_in * plane_size * sizeof(double), plane_size * sizeof(double));
+		Fwin_file.release(((kp < 0) ? kp + padoridim : kp) * win_plane_size * sizeof(Complex), win_plane_size * sizeof(Complex));
+	}
+	Fweight_file.close();
+	Fnewweight_file.close();
+
+	// Inverse FFT, one z-plane at a time, and keep only the central ori_size^3 voxels of the (centered) map
+	transformAlongZ(Fwin_file, padoridim, padoridim, win_xdim, false, max_bytes);
+	RFLOAT normfft = (data_dim == 3) ? oversampling_correction : oversampling_correction * ori_size;
+	vol_out.reshape(ori_size, ori_size, ori_size);
+	vol_out.setXmippOrigin();
+	MultidimArray<RFLOAT> Mplane;
+	Mplane.resize(padoridim, padoridim);
+	for (long int k = STARTINGZ(vol_out); k <= FINISHINGZ(vol_out); k++)
+	{
+		long int kk = (k + padoridim) % padoridim;
+		inverseTransformPlane(Fwin + kk * win_plane_size, Mplane);
+		for (long int i = STARTINGY(vol_out); i <= FINISHINGY(vol_out); i++)
+			for (long int j = STARTINGX(vol_out); j <= FINISHINGX(vol_out); j++)
+				A3D_ELEM(vol_out, k, i, j) = DIRECT_A2D_ELEM(Mplane, (i + padoridim) % padoridim, (j + padoridim) % padoridim) / normfft;
+		Fwin_file.release(kk * win_plane_size * sizeof(Complex), win_plane_size * sizeof(Complex));
+	}
+	Fwin_file.close();
+
+	// Mask out corners to prevent aliasing artefacts
+	softMaskOutsideMap(vol_out);
+
+	// Correct for the linear/nearest-neighbour interpolation that led to the data array
+	griddingCorrect(vol_out);
+
+	// If the tau-values were calculated based on the FSC, then now re-calculate the power spectrum of the actual reconstruction
+	if (update_tau2_with_fsc)
+	{
+		MultidimArray<RFLOAT> spectrum, count;
+		MultidimArray<Complex> Fvol;
+		FourierTransformer transformer;
+		transformer.FourierTransform(vol_out, Fvol, false);
+		spectrum.initZeros(XSIZE(vol_out));
+		count.initZeros(XSIZE(vol_out));
+		FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(Fvol)
+		{
+			long int idx = ROUND(sqrt(kp*kp + ip*ip + jp*jp));
+			spectrum(idx) += norm(dAkij(Fvol, k, i, j));
+			count(idx) += 1.;
+		}
+		spectrum /= count;
+
+		RFLOAT normfft = (data_dim == 2) ? (RFLOAT)(ori_size * ori_size) : 1.;
+		spectrum *= normfft / 2.;
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(data_vs_prior)
+		{
+			DIRECT_MULTIDIM_ELEM(tau2, n) =  tau2_fudge * DIRECT_MULTIDIM_ELEM(spectrum, n);
+		}
+	}
+
+	tau2_io = tau2;
+	sigma2_out = sigma2;
+	data_vs_prior_out = data_vs_prior;
+	fourier_coverage_out = fourier_coverage;
+}
+
 void BackProjector::symmetrise(int nr_helical_asu, RFLOAT helical_twist, RFLOAT helical_rise)
 {
 	// First make sure the input arrays are obeying Hermitian symmetry,
@@ -1520,6 +2134,14 @@ void BackProjector::applyHelicalSymmetry(int nr_helical_asu, RFLOAT helical_twis
 	RFLOAT dd000, dd001, dd010, dd011, dd100, dd101, dd110, dd111;
 	RFLOAT ddx00, ddx01, ddx10, ddx11, ddxy0, ddxy1;
 
+	// For out-of-core reconstructions, the sums are not kept in RAM either
+	MappedScratchFile sum_weight_file, sum_data_file;
+	if (ooc_dir != "")
+	{
+		mapArray(sum_weight, weight, sum_weight_file, ooc_dir);
+		mapArray(sum_data, data, sum_data_file, ooc_dir);
+	}
+
     // First symmetry operator (not stored in SL) is the identity matrix
 	sum_weight = weight;
 	sum_data = data;
@@ -1687,6 +2309,14 @@ void BackProjector::applyPointGroupSymmetry()
     	RFLOAT dd000, dd001, dd010, dd011, dd100, dd101, dd110, dd111;
     	RFLOAT ddx00, ddx01, ddx10, ddx11, ddxy0, ddxy1;
 
+		// For out-of-core reconstructions, the sums are not kept in RAM either
+		MappedScratchFile sum_weight_file, sum_data_file;
+		if (ooc_dir != "")
+		{
+			mapArray(sum_weight, weight, sum_weight_file, ooc_dir);
+			mapArray(sum_data, data, sum_data_file, ooc_dir);
+		}
+
         // First symmetry operator (not stored in SL) is the identity matrix
 		sum_weight = weight;
 		sum_data = data;
@@ -32,6 +32,7 @@
 #include "src/mask.h"
 #include "src/tabfuncs.h"
 #include "src/symmetries.h"
+#include "src/mapped_file.h"
 
 class BackProjector: public Projector
 {
@@ -39,6 +40,9 @@ public:
 	// For backward projection: sum of weights
 	MultidimArray<RFLOAT> weight;
 
+	// The sum of weights while data_precision is PRECISION_FLOAT (weight is then empty)
+	MultidimArray<float> weight_float;
+
 	// Tabulated blob values
 	TabFtBlob tab_ftblob;
 
@@ -57,6 +61,12 @@ public:
     // Skip the iterative gridding part of the reconstruction
     bool skip_gridding;
 
+    // Directory for the memory-mapped files of out-of-core 3D reconstructions (empty: reconstruct in RAM)
+    FileName ooc_dir;
+
+    // Maximum amount of RAM (in Gb) for the slabs of out-of-core reconstructions
+    RFLOAT ooc_max_ram;
+
 
 public:
 
@@ -86,6 +96,10 @@ public:
     	// Skip gridding
     	skip_gridding = _skip_gridding;
 
+    	// Reconstruct in RAM
+    	ooc_dir = "";
+    	ooc_max_ram = 1.;
+
     	// Set the symmetry object
     	SL.read_sym_file(fn_sym);
 
@@ -139,9 +153,16 @@ public:
         	padding_factor = op.padding_factor;
         	ref_dim = op.ref_dim;
         	data_dim = op.data_dim;
+        	data_precision = op.data_precision;
+        	data_float = op.data_float;
+        	data_half = op.data_half;
+        	half_scale = op.half_scale;
         	skip_gridding = op.skip_gridding;
+        	ooc_dir = op.ooc_dir;
+        	ooc_max_ram = op.ooc_max_ram;
         	// BackProjector stuff
         	weight = op.weight;
+        	weight_float = op.weight_float;
         	tab_ftblob = op.tab_ftblob;
         	SL = op.SL;
         }
@@ -165,6 +186,7 @@ public:
 	{
 		skip_gridding = false;
 		weight.clear();
+		weight_float.clear();
 		Projector::clear();
 	}
 
@@ -174,6 +196,26 @@ public:
 	// Initialise data and weight arrays to the given size and set all values to zero
 	void initZeros(int current_size = -1);
 
+	/* Keep the (zero) data and weight arrays of initZeros() in memory-mapped files in ooc_dir instead of in RAM,
+	 * for 3D reconstructions that do not fit in RAM. The pages of the files are written back to disc by the kernel
+	 * when memory is short. The files must stay open as long as the arrays are used, and the arrays must not be resized.
+	 */
+	void mapDataAndWeight(MappedScratchFile &data_file, MappedScratchFile &weight_file);
+
+	/*
+	 * Keep the data and weight arrays in PRECISION_RFLOAT or PRECISION_FLOAT (as data_float and weight_float)
+	 * Only the backprojection and addTreeSum work in PRECISION_FLOAT, for everything else
+	 * (e.g. reconstruct) the arrays have to be converted back to PRECISION_RFLOAT first.
+	 */
+	void setDataPrecision(int precision);
+
+	// Memory (in bytes) of the data and weight arrays in their current precision
+	size_t getDataMemory()
+	{
+		return MULTIDIM_SIZE(data) * sizeof(Complex) + MULTIDIM_SIZE(weight) * sizeof(RFLOAT) +
+				MULTIDIM_SIZE(data_float) * sizeof(FloatComplex) + MULTIDIM_SIZE(weight_float) * sizeof(float);
+	}
+
 	/*
 	* Set a 2D Fourier Transform back into the 2D or 3D data array
 	* Depending on the dimension of the map, this will be a backprojection or a rotation operation
@@ -261,6 +303,13 @@ public:
 	void setLowResDataAndWeight(MultidimArray<Complex > &lowres_data, MultidimArray<RFLOAT> &lowres_weight,
 			int lowres_r_max);
 
+	/*
+	 * Add the data and weight of other BackProjectors of the same size to this one, for elements first until last-1
+	 * The others are summed pairwise (as a tree) into others[0] first, so that different threads can each reduce
+	 * their own range of elements. This leaves others[0] (and some of the others) modified.
+	 */
+	void addTreeSum(std::vector<BackProjector *> &others, long int first, long int last);
+
 	/*
 	 *  Get complex array at the original size as the straightforward average
 	 *  padding_factor*padding_factor*padding_factor voxels
@@ -296,6 +345,27 @@ public:
                      bool printTimes= false,
 					 bool do_fsc0999 = false);
 
+	/* The same as reconstruct() for 3D maps, called by it when ooc_dir is set
+	 * The Fourier-space arrays of the gridding iterations and of the final inverse FFT are kept
+	 * in memory-mapped files in ooc_dir, and are processed in slabs of z-planes (and blocks of
+	 * y-rows for the FFTs along z) that fit in ooc_max_ram. The data and weight arrays are not part of
+	 * ooc_max_ram: they stay in RAM, unless they were put in files by mapDataAndWeight().
+	 */
+	void reconstructOutOfCore(MultidimArray<RFLOAT> &vol_out,
+                     int max_iter_preweight,
+                     bool do_map,
+                     RFLOAT tau2_fudge,
+                     MultidimArray<RFLOAT> &tau2_io,
+                     MultidimArray<RFLOAT> &sigma2_out,
+                     MultidimArray<RFLOAT> &evidence_vs_prior_out,
+                     MultidimArray<RFLOAT> &fourier_coverage_out,
+                     const MultidimArray<RFLOAT>& fsc,
+                     RFLOAT normalise = 1.,
+                     bool update_tau2_with_fsc = false,
+                     bool is_whole_instead_of_half = false,
+                     int minres_map = -1,
+					 bool do_fsc0999 = false);
+
 
 	/*  Enforce Hermitian symmetry, apply helical symmetry as well as point-group symmetry
 	 */
@@ -360,6 +430,34 @@ public:
    }
 #endif
 
+private:
+
+	/*
+	 * The backprojections above, into data and weight arrays in either precision
+	 */
+	template <typename TD, typename TW>
+	void backrotate2D(MultidimArray<TD> &data, MultidimArray<TW> &weight,
+			          const MultidimArray<Complex > &img_in,
+			          const Matrix2D<RFLOAT> &A, bool inv,
+			          const MultidimArray<RFLOAT> *Mweight);
+	template <typename TD, typename TW>
+	void backrotate3D(MultidimArray<TD> &data, MultidimArray<TW> &weight,
+			          const MultidimArray<Complex > &img_in,
+			          const Matrix2D<RFLOAT> &A, bool inv,
+			          const MultidimArray<RFLOAT> *Mweight);
+	template <typename TD, typename TW>
+	void backproject2Dto3D(MultidimArray<TD> &data, MultidimArray<TW> &weight,
+			         const MultidimArray<Complex > &img_in,
+			         const Matrix2D<RFLOAT> &A, bool inv,
+			         const MultidimArray<RFLOAT> *Mweight,
+					 RFLOAT r_ewald_sphere,
+					 bool is_positive_curvature);
+	template <typename TD, typename TW>
+	void backproject1Dto2D(MultidimArray<TD> &data, MultidimArray<TW> &weight,
+			         const MultidimArray<Complex > &img_in,
+			         const Matrix2D<RFLOAT> &A, bool inv,
+			         const MultidimArray<RFLOAT> *Mweight);
+
 };
 
 #endif /* BACKPROJECTOR_H_ */
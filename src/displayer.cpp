@@ -63,7 +63,7 @@ void DisplayBox::draw()
 	//fl_pop_clip();
 }
 
-void DisplayBox::setData(MultidimArray<RFLOAT> &img, MetaDataContainer *MDCin, int _ipos,
+void DisplayBox::setData(MultidimArray<RFLOAT> &img, const MetaDataContainer &MDCin, int _ipos,
                          RFLOAT _minval, RFLOAT _maxval, RFLOAT _scale, bool do_relion_scale)
 {
 
@@ -940,6 +940,31 @@ void Experiment::read(FileName fn_exp, bool do_ignore_original_particle_name,
 		// allocate 1 block of memory
 		particles.reserve(MDimg.numberOfObjects());
 
+		// Look up groups and original particles by name through hash indices on the (sorted) MDimg,
+		// rather than searching the groups and ori_particles for every particle
+		bool have_group_name = MDimg.containsLabel(EMDL_MLMODEL_GROUP_NAME);
+		bool have_ori_name = MDimg.containsLabel(EMDL_PARTICLE_ORI_NAME);
+		// Only the key of every row is kept: the indices refer to MDimg, which is modified below
+		std::vector<long int> group_key_of_row, ori_key_of_row;
+		std::vector<long int> group_of_key, ori_particle_of_key;
+		std::map<std::string, long int> group_of_name;
+		if (star_contains_micname && !do_ignore_group_name && have_group_name)
+		{
+			MetaDataIndex group_index(MDimg, EMDL_MLMODEL_GROUP_NAME);
+			group_of_key.resize(group_index.numberOfKeys(), -1);
+			group_key_of_row.resize(MDimg.numberOfObjects());
+			for (long int i = 0; i < group_key_of_row.size(); i++)
+				group_key_of_row[i] = group_index.getKey(i);
+		}
+		if (have_ori_name && !do_ignore_original_particle_name)
+		{
+			MetaDataIndex ori_index(MDimg, EMDL_PARTICLE_ORI_NAME);
+			ori_particle_of_key.resize(ori_index.numberOfKeys(), -1);
+			ori_key_of_row.resize(MDimg.numberOfObjects());
+			for (long int i = 0; i < ori_key_of_row.size(); i++)
+				ori_key_of_row[i] = ori_index.getKey(i);
+		}
+
 		// Now Loop over all objects in the metadata file and fill the logical tree of the experiment
 		long int last_oripart_idx = -1;
 		FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDimg)
@@ -980,31 +1005,29 @@ void Experiment::read(FileName fn_exp, bool do_ignore_original_particle_name,
 				// For example in particle_polishing the groups are not needed...
 				if (!do_ignore_group_name)
 				{
-					std::string group_name;
 					// Check whether there is a group label, if not use a group for each micrograph
-					if (MDimg.containsLabel(EMDL_MLMODEL_GROUP_NAME))
+					if (have_group_name)
 					{
-						MDimg.getValue(EMDL_MLMODEL_GROUP_NAME, group_name);
+						// If this group did not exist yet, add it to the experiment
+						long int key = group_key_of_row[current_object];
+						if (group_of_key[key] < 0)
+						{
+							std::string group_name;
+							MDimg.getValue(EMDL_MLMODEL_GROUP_NAME, group_name);
+							group_of_key[key] = addGroup(group_name);
+						}
+						group_id = group_of_key[key];
 					}
 					else
 					{
 						FileName fn_pre, fn_jobnr, fn_post;
 						decomposePipelineFileName(mic_name, fn_pre, fn_jobnr, fn_post);
-						group_name = fn_post;
-					}
 
-					// If this group did not exist yet, add it to the experiment
-					group_id = -1;
-					for (long int i = groups.size() - 1; i >= 0; i--) // search backwards to find match faster
-					{
-						if (groups[i].name == group_name)
-						{
-							group_id = groups[i].id;
-							break;
-						}
+						std::map<std::string, long int>::iterator it = group_of_name.find(fn_post);
+						if (it == group_of_name.end())
+							it = group_of_name.insert(std::make_pair(fn_post, addGroup(fn_post))).first;
+						group_id = it->second;
 					}
-					if (group_id < 0)
-						group_id = addGroup(group_name);
 				}
 
 #ifdef DEBUG_READ
@@ -1056,17 +1079,12 @@ void Experiment::read(FileName fn_exp, bool do_ignore_original_particle_name,
 			else
 				MDimg.getValue(EMDL_IMAGE_NAME, ori_part_name);
 
-			if (MDimg.containsLabel(EMDL_PARTICLE_ORI_NAME) && !do_ignore_original_particle_name)
+			if (!ori_key_of_row.empty())
 			{
-				// Only search ori_particles for the last (original) micrograph
-				for (long int i = last_oripart_idx; i < ori_particles.size(); i++)
-				{
-					if (ori_particles[i].name == ori_part_name)
-					{
-						ori_part_id = i;
-						break;
-					}
-				}
+				// Only consider ori_particles of the last (original) micrograph
+				long int key = ori_key_of_row[current_object];
+				if (ori_particle_of_key[key] >= 0 && ori_particle_of_key[key] >= last_oripart_idx)
+					ori_part_id = ori_particle_of_key[key];
 			}
 
 			// If no OriginalParticles with this name was found,
@@ -1075,6 +1093,8 @@ void Experiment::read(FileName fn_exp, bool do_ignore_original_particle_name,
 			if (ori_part_id < 0)
 			{
 				ori_part_id = addOriginalParticle(ori_part_name, my_random_subset);
+				if (!ori_key_of_row.empty())
+					ori_particle_of_key[ori_key_of_row[current_object]] = ori_part_id;
 				// Also add this original_particle to an original_micrograph (only for movies)
 				if (is_mic_a_movie)
 				{
@@ -1248,23 +1268,32 @@ void Experiment::read(FileName fn_exp, bool do_ignore_original_particle_name,
 }
 
 // Write to file
-void Experiment::write(FileName fn_root)
+void Experiment::write(FileName fn_root, bool do_binary)
 {
 
 	std::ofstream  fh;
-	FileName fn_tmp = fn_root+"_data.star";
-	fh.open((fn_tmp).c_str(), std::ios::out);
+	FileName fn_tmp = fn_root + ((do_binary) ? "_data.bstar" : "_data.star");
+	if (do_binary)
+		fh.open((fn_tmp).c_str(), std::ios::out | std::ios::binary);
+	else
+		fh.open((fn_tmp).c_str(), std::ios::out);
 	if (!fh)
 		REPORT_ERROR( (std::string)"Experiment::write: Cannot write file: " + fn_tmp);
 
 	// Always write MDimg
-	MDimg.write(fh);
+	if (do_binary)
+		MDimg.writeBinary(fh);
+	else
+		MDimg.write(fh);
 
 	if (nr_bodies > 1)
 	{
 		for (int ibody = 0; ibody < nr_bodies; ibody++)
 		{
-			MDbodies[ibody].write(fh);
+			if (do_binary)
+				MDbodies[ibody].writeBinary(fh);
+			else
+				MDbodies[ibody].write(fh);
 		}
 	}
 
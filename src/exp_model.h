@@ -387,8 +387,8 @@ public:
 			bool do_ignore_group_name = false, bool do_preread_images = false,
 			bool need_tiltpsipriors_for_helical_refine = false);
 
-	// Write
-	void write(FileName fn_root);
+	// Write to fn_root_data.star (or with do_binary to fn_root_data.bstar, in the binary metadata format)
+	void write(FileName fn_root, bool do_binary = false);
 
 
 
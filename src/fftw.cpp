@@ -46,11 +46,11 @@
 #include "src/macros.h"
 #include "src/fftw.h"
 #include "src/args.h"
+#include "src/fftw_plan_cache.h"
+#include "src/profiler.h"
 #include <string.h>
 #include <math.h>
 
-static pthread_mutex_t fftw_plan_mutex = PTHREAD_MUTEX_INITIALIZER;
-
 //#define TIMING_FFTW
 #ifdef TIMING_FFTW
 	#define RCTIC(label) (timer_fftw.tic(label))
@@ -120,13 +120,8 @@ void FourierTransformer::cleanup()
 {
 	// First clear object and destroy plans
     clear();
-    // Then clean up all the junk fftw keeps lying around
-    // SOMEHOW THE FOLLOWING IS NOT ALLOWED WHEN USING MULTPLE TRANSFORMER OBJECTS....
-#ifdef RELION_SINGLE_PRECISION
-    fftwf_cleanup();
-#else
-    fftw_cleanup();
-#endif
+    // fftw_cleanup() is not called anymore: it would invalidate the plans in FftwPlanCache,
+    // which are shared by all transformer objects
 
 #ifdef DEBUG_PLANS
     std::cerr << "CLEANED-UP this= "<<this<< std::endl;
@@ -136,23 +131,10 @@ void FourierTransformer::cleanup()
 
 void FourierTransformer::destroyPlans()
 {
-    // Anything to do with plans has to be protected for threads!
-    pthread_mutex_lock(&fftw_plan_mutex);
-
-    if (plans_are_set)
-    {
-#ifdef RELION_SINGLE_PRECISION
-    	fftwf_destroy_plan(fPlanForward);
-    	fftwf_destroy_plan(fPlanBackward);
-#else
-    	fftw_destroy_plan(fPlanForward);
-    	fftw_destroy_plan(fPlanBackward);
-#endif
-    	plans_are_set = false;
-    }
-
-    pthread_mutex_unlock(&fftw_plan_mutex);
-
+    // The plans belong to FftwPlanCache, only forget about them
+    fPlanForward = NULL;
+    fPlanBackward = NULL;
+    plans_are_set = false;
 }
 
 // Initialization ----------------------------------------------------------
@@ -184,62 +166,19 @@ void FourierTransformer::setReal(MultidimArray<RFLOAT> &input)
 		fFourier.reshape(ZSIZE(input),YSIZE(input),XSIZE(input)/2+1);
 		fReal=&input;
 
-        int ndim=3;
-        if (ZSIZE(input)==1)
-        {
-            ndim=2;
-            if (YSIZE(input)==1)
-                ndim=1;
-        }
-        int *N = new int[ndim];
-        switch (ndim)
-        {
-        case 1:
-            N[0]=XSIZE(input);
-            break;
-        case 2:
-            N[0]=YSIZE(input);
-            N[1]=XSIZE(input);
-            break;
-        case 3:
-            N[0]=ZSIZE(input);
-            N[1]=YSIZE(input);
-            N[2]=XSIZE(input);
-            break;
-        }
-
-        // Destroy both forward and backward plans if they already exist
-        destroyPlans();
-
-        // Make new plans
-        plans_are_set = true;
-
+        // Plans for arrays of this size and alignment are made only once for the whole program
 	RCTIC(TIMING_FFTW_PLAN);
-        pthread_mutex_lock(&fftw_plan_mutex);
-#ifdef RELION_SINGLE_PRECISION
-        fPlanForward = fftwf_plan_dft_r2c(ndim, N, MULTIDIM_ARRAY(*fReal),
-                                         (fftwf_complex*) MULTIDIM_ARRAY(fFourier), FFTW_ESTIMATE);
-        fPlanBackward = fftwf_plan_dft_c2r(ndim, N,
-                                          (fftwf_complex*) MULTIDIM_ARRAY(fFourier), MULTIDIM_ARRAY(*fReal),
-                                          FFTW_ESTIMATE);
-#else
-        fPlanForward = fftw_plan_dft_r2c(ndim, N, MULTIDIM_ARRAY(*fReal),
-                                         (fftw_complex*) MULTIDIM_ARRAY(fFourier), FFTW_ESTIMATE);
-        fPlanBackward = fftw_plan_dft_c2r(ndim, N,
-                                          (fftw_complex*) MULTIDIM_ARRAY(fFourier), MULTIDIM_ARRAY(*fReal),
-                                          FFTW_ESTIMATE);
-#endif
-        pthread_mutex_unlock(&fftw_plan_mutex);
+        fPlanForward = FftwPlanCache::getPlan(FftwPlanCache::R2C, XSIZE(input), YSIZE(input), ZSIZE(input),
+                                              MULTIDIM_ARRAY(*fReal), (RFLOAT*) MULTIDIM_ARRAY(fFourier));
+        fPlanBackward = FftwPlanCache::getPlan(FftwPlanCache::C2R, XSIZE(input), YSIZE(input), ZSIZE(input),
+                                               (RFLOAT*) MULTIDIM_ARRAY(fFourier), MULTIDIM_ARRAY(*fReal));
+        plans_are_set = true;
 	RCTOC(TIMING_FFTW_PLAN);
 
-        if (fPlanForward == NULL || fPlanBackward == NULL)
-            REPORT_ERROR("FFTW plans cannot be created");
-
 #ifdef DEBUG_PLANS
         std::cerr << " SETREAL fPlanForward= " << fPlanForward << " fPlanBackward= " << fPlanBackward  <<" this= "<<this<< std::endl;
 #endif
 
-        delete [] N;
         dataPtr=MULTIDIM_ARRAY(*fReal);
 		complexDataPtr = MULTIDIM_ARRAY(fFourier);
 
@@ -261,55 +200,14 @@ void FourierTransformer::setReal(MultidimArray<Complex > &input)
 
     if (recomputePlan)
     {
-        int ndim=3;
-        if (ZSIZE(input)==1)
-        {
-            ndim=2;
-            if (YSIZE(input)==1)
-                ndim=1;
-        }
-        int *N = new int[ndim];
-        switch (ndim)
-        {
-        case 1:
-            N[0]=XSIZE(input);
-            break;
-        case 2:
-            N[0]=YSIZE(input);
-            N[1]=XSIZE(input);
-            break;
-        case 3:
-            N[0]=ZSIZE(input);
-            N[1]=YSIZE(input);
-            N[2]=XSIZE(input);
-            break;
-        }
-
-        // Destroy both forward and backward plans if they already exist
-        destroyPlans();
-
-        plans_are_set = true;
-
 	RCTIC(TIMING_FFTW_PLAN);
-        pthread_mutex_lock(&fftw_plan_mutex);
-#ifdef RELION_SINGLE_PRECISION
-        fPlanForward = fftwf_plan_dft(ndim, N, (fftwf_complex*) MULTIDIM_ARRAY(*fComplex),
-                                     (fftwf_complex*) MULTIDIM_ARRAY(fFourier), FFTW_FORWARD, FFTW_ESTIMATE);
-        fPlanBackward = fftwf_plan_dft(ndim, N, (fftwf_complex*) MULTIDIM_ARRAY(fFourier),
-                                      (fftwf_complex*) MULTIDIM_ARRAY(*fComplex), FFTW_BACKWARD, FFTW_ESTIMATE);
-#else
-        fPlanForward = fftw_plan_dft(ndim, N, (fftw_complex*) MULTIDIM_ARRAY(*fComplex),
-                                     (fftw_complex*) MULTIDIM_ARRAY(fFourier), FFTW_FORWARD, FFTW_ESTIMATE);
-        fPlanBackward = fftw_plan_dft(ndim, N, (fftw_complex*) MULTIDIM_ARRAY(fFourier),
-                                      (fftw_complex*) MULTIDIM_ARRAY(*fComplex), FFTW_BACKWARD, FFTW_ESTIMATE);
-#endif
-        pthread_mutex_unlock(&fftw_plan_mutex);
+        fPlanForward = FftwPlanCache::getPlan(FftwPlanCache::C2C_FORWARD, XSIZE(input), YSIZE(input), ZSIZE(input),
+                                              (RFLOAT*) MULTIDIM_ARRAY(*fComplex), (RFLOAT*) MULTIDIM_ARRAY(fFourier));
+        fPlanBackward = FftwPlanCache::getPlan(FftwPlanCache::C2C_BACKWARD, XSIZE(input), YSIZE(input), ZSIZE(input),
+                                               (RFLOAT*) MULTIDIM_ARRAY(fFourier), (RFLOAT*) MULTIDIM_ARRAY(*fComplex));
+        plans_are_set = true;
 	RCTOC(TIMING_FFTW_PLAN);
 
-        if (fPlanForward == NULL || fPlanBackward == NULL)
-            REPORT_ERROR("FFTW plans cannot be created");
-
-        delete [] N;
         complexDataPtr=MULTIDIM_ARRAY(*fComplex);
     }
 }
@@ -325,6 +223,8 @@ void FourierTransformer::setFourier(const MultidimArray<Complex> &inputFourier)
 // Transform ---------------------------------------------------------------
 void FourierTransformer::Transform(int sign)
 {
+    ProfileScope profile_scope(PROF_FFT);
+
     if (sign == FFTW_FORWARD)
     {
 	RCTIC(TIMING_FFTW_EXECUTE);
@@ -431,6 +331,78 @@ void FourierTransformer::enforceHermitianSymmetry()
     }
 }
 
+// Batched transforms ------------------------------------------------------
+BatchFourierTransformer::BatchFourierTransformer(int _nr_threads):
+		nr_threads(_nr_threads)
+{
+}
+
+void BatchFourierTransformer::FourierTransform(MultidimArray<RFLOAT> &stack, MultidimArray<Complex> &Fstack)
+{
+    Fstack.reshape(NSIZE(stack), ZSIZE(stack), YSIZE(stack), XSIZE(stack)/2+1);
+    transform(stack, Fstack, true);
+
+    // Normalisation of the transform, as in FourierTransformer
+    RFLOAT size = ZSIZE(stack) * YSIZE(stack) * XSIZE(stack);
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Fstack)
+        DIRECT_MULTIDIM_ELEM(Fstack, n) /= size;
+}
+
+void BatchFourierTransformer::inverseFourierTransform(MultidimArray<Complex> &Fstack, MultidimArray<RFLOAT> &stack)
+{
+    if (NSIZE(Fstack) != NSIZE(stack) || ZSIZE(Fstack) != ZSIZE(stack) ||
+        YSIZE(Fstack) != YSIZE(stack) || XSIZE(Fstack) != XSIZE(stack)/2+1)
+        REPORT_ERROR("BatchFourierTransformer::inverseFourierTransform: the stack does not have the size of the transforms");
+
+    transform(stack, Fstack, false);
+}
+
+void BatchFourierTransformer::transform(MultidimArray<RFLOAT> &stack, MultidimArray<Complex> &Fstack, bool forward)
+{
+    long int nr_images = NSIZE(stack);
+    if (nr_images == 0)
+        return;
+
+    ProfileScope profile_scope(PROF_FFT);
+
+    // Each thread transforms one part of the stack, so there are at most two different batch sizes
+    int nr_parts = (nr_threads < nr_images) ? nr_threads : nr_images;
+    if (nr_parts < 1)
+        nr_parts = 1;
+    long int real_size = ZSIZE(stack) * YSIZE(stack) * XSIZE(stack);
+    long int complex_size = ZSIZE(Fstack) * YSIZE(Fstack) * XSIZE(Fstack);
+
+    #pragma omp parallel for num_threads(nr_parts)
+    for (int ipart = 0; ipart < nr_parts; ipart++)
+    {
+        long int first = ipart * (nr_images / nr_parts) + std::min((long int)ipart, nr_images % nr_parts);
+        int howmany = nr_images / nr_parts + ((ipart < nr_images % nr_parts) ? 1 : 0);
+        RFLOAT *real = MULTIDIM_ARRAY(stack) + first * real_size;
+        RFLOAT *fourier = (RFLOAT*)(MULTIDIM_ARRAY(Fstack) + first * complex_size);
+
+        if (forward)
+        {
+#ifdef RELION_SINGLE_PRECISION
+            fftwf_plan plan = FftwPlanCache::getManyPlan(FftwPlanCache::R2C, XSIZE(stack), YSIZE(stack), ZSIZE(stack), howmany, real, fourier);
+            fftwf_execute_dft_r2c(plan, real, (fftwf_complex*) fourier);
+#else
+            fftw_plan plan = FftwPlanCache::getManyPlan(FftwPlanCache::R2C, XSIZE(stack), YSIZE(stack), ZSIZE(stack), howmany, real, fourier);
+            fftw_execute_dft_r2c(plan, real, (fftw_complex*) fourier);
+#endif
+        }
+        else
+        {
+#ifdef RELION_SINGLE_PRECISION
+            fftwf_plan plan = FftwPlanCache::getManyPlan(FftwPlanCache::C2R, XSIZE(stack), YSIZE(stack), ZSIZE(stack), howmany, fourier, real);
+            fftwf_execute_dft_c2r(plan, (fftwf_complex*) fourier, real);
+#else
+            fftw_plan plan = FftwPlanCache::getManyPlan(FftwPlanCache::C2R, XSIZE(stack), YSIZE(stack), ZSIZE(stack), howmany, fourier, real);
+            fftw_execute_dft_c2r(plan, (fftw_complex*) fourier, real);
+#endif
+        }
+    }
+}
+
 
 void randomizePhasesBeyond(MultidimArray<RFLOAT> &v, int index)
 {
@@ -337,11 +337,11 @@ public:
     /** Clear object */
     void clear();
 
-    /** This calls fftw_cleanup.
+    /** Same as clear() (fftw_cleanup would invalidate the plans in FftwPlanCache).
     */
     void cleanup();
 
-    /** Destroy both forward and backward fftw planes (mutex locked */
+    /** Forget both forward and backward fftw plans (they belong to FftwPlanCache) */
     void destroyPlans();
 
     /** Computes the transform, specified in Init() function
@@ -378,6 +378,48 @@ public:
     void setFourier(const MultidimArray<Complex> &imgFourier);
 };
 
+/** Batched Fourier transforms of a stack of images.
+ * @ingroup FourierW
+ *
+ * All NSIZE images (or volumes) of a stack are transformed with a single
+ * FFTW plan (fftw_plan_many_dft_r2c), instead of one call to a
+ * FourierTransformer per image. With more than one thread the stack is
+ * split into equal parts, which are transformed at the same time.
+ * As in FourierTransformer, the forward transform is normalised and the
+ * inverse one is not.
+ * Every call looks up its plans in the process-wide plan cache (under its
+ * mutex), so for one or two images a FourierTransformer that is kept by the
+ * caller is cheaper: use this class for real batches only.
+ *
+ * @code
+ * MultidimArray<RFLOAT> stack(nr_images, ydim, xdim);
+ * MultidimArray<Complex> Fstack;
+ * BatchFourierTransformer transformer(nr_threads);
+ * transformer.FourierTransform(stack, Fstack);
+ * @endcode
+ */
+class BatchFourierTransformer
+{
+public:
+    /** Number of threads for the transforms */
+    int nr_threads;
+
+    /** Constructor */
+    BatchFourierTransformer(int nr_threads = 1);
+
+    /** Forward transforms of all images in stack.
+        Fstack is resized to NSIZE(stack) half-complex transforms. */
+    void FourierTransform(MultidimArray<RFLOAT> &stack, MultidimArray<Complex> &Fstack);
+
+    /** Inverse transforms of all half-complex images in Fstack.
+        The stack must already have the size of the real images, and
+        Fstack is overwritten (as in a backward FourierTransformer). */
+    void inverseFourierTransform(MultidimArray<Complex> &Fstack, MultidimArray<RFLOAT> &stack);
+
+private:
+    void transform(MultidimArray<RFLOAT> &stack, MultidimArray<Complex> &Fstack, bool forward);
+};
+
 // Randomize phases beyond the given F-space shell (index) of R-space input image
 void randomizePhasesBeyond(MultidimArray<RFLOAT> &I, int index);
 
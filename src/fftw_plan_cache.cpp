@@ -0,0 +1,437 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <iostream>
+#include "src/fftw_plan_cache.h"
+#include "src/error.h"
+
+	struct FftwPlanKey
+	{
+		int kind, is_double, xdim, ydim, zdim, howmany, nr_threads;
+		bool in_place, is_unaligned;
+		unsigned flags;
+
+		bool operator<(const FftwPlanKey &other) const
+		{
+			if (kind != other.kind) return kind < other.kind;
+			if (is_double != other.is_double) return is_double < other.is_double;
+			if (xdim != other.xdim) return xdim < other.xdim;
+			if (ydim != other.ydim) return ydim < other.ydim;
+			if (zdim != other.zdim) return zdim < other.zdim;
+			if (howmany != other.howmany) return howmany < other.howmany;
+			if (nr_threads != other.nr_threads) return nr_threads < other.nr_threads;
+			if (in_place != other.in_place) return in_place < other.in_place;
+			if (is_unaligned != other.is_unaligned) return is_unaligned < other.is_unaligned;
+			return flags < other.flags;
+		}
+	};
+
+	// Serialises all calls to the FFTW planner, which is not thread-safe
+	// (when both are needed, it is taken before fftw_plan_cache_mutex)
+	static pthread_mutex_t fftw_planner_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+	// Everything below is protected by fftw_plan_cache_mutex
+	static pthread_mutex_t fftw_plan_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+	static std::map<FftwPlanKey, void*> fftw_plan_cache;
+	static bool fftw_plan_cache_is_configured = false;
+	static unsigned fftw_plan_cache_effort = FFTW_ESTIMATE;
+	static std::string fftw_plan_cache_wisdom = "";
+	static bool fftw_plan_cache_has_new_wisdom = false;
+	static int fftw_plan_cache_nr_threads = 1;
+	static long int fftw_plan_cache_nr_plans = 0, fftw_plan_cache_nr_lookups = 0;
+	static double fftw_plan_cache_time = 0.;
+
+	static double fftwPlanCacheWallTime()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + 1e-6 * tv.tv_usec;
+	}
+
+	// The FFTW functions for either precision
+	template <typename T> struct FftwApi;
+
+	template <> struct FftwApi<double>
+	{
+		typedef fftw_plan Plan;
+		typedef fftw_complex Complex;
+
+		static int alignmentOf(double *p) { return fftw_alignment_of(p); }
+		static void* allocate(size_t n) { return fftw_malloc(n); }
+		static void deallocate(void *p) { fftw_free(p); }
+		static Plan planR2C(int rank, const int *n, double *in, Complex *out, unsigned flags) { return fftw_plan_dft_r2c(rank, n, in, out, flags); }
+		static Plan planC2R(int rank, const int *n, Complex *in, double *out, unsigned flags) { return fftw_plan_dft_c2r(rank, n, in, out, flags); }
+		static Plan planC2C(int rank, const int *n, Complex *in, Complex *out, int sign, unsigned flags) { return fftw_plan_dft(rank, n, in, out, sign, flags); }
+		static Plan planManyR2C(int rank, const int *n, int howmany, double *in, int idist, Complex *out, int odist, unsigned flags)
+		{ return fftw_plan_many_dft_r2c(rank, n, howmany, in, NULL, 1, idist, out, NULL, 1, odist, flags); }
+		static Plan planManyC2R(int rank, const int *n, int howmany, Complex *in, int idist, double *out, int odist, unsigned flags)
+		{ return fftw_plan_many_dft_c2r(rank, n, howmany, in, NULL, 1, idist, out, NULL, 1, odist, flags); }
+		static Plan planManyC2C(int rank, const int *n, int howmany, Complex *in, int idist, Complex *out, int odist, int sign, unsigned flags)
+		{ return fftw_plan_many_dft(rank, n, howmany, in, NULL, 1, idist, out, NULL, 1, odist, sign, flags); }
+		static int importWisdom(const std::string &fn) { return fftw_import_wisdom_from_filename(fn.c_str()); }
+		static int exportWisdom(const std::string &fn) { return fftw_export_wisdom_to_filename(fn.c_str()); }
+		static std::string wisdomFile(const std::string &fn) { return fn; }
+	};
+
+	template <> struct FftwApi<float>
+	{
+		typedef fftwf_plan Plan;
+		typedef fftwf_complex Complex;
+
+		static int alignmentOf(float *p) { return fftwf_alignment_of(p); }
+		static void* allocate(size_t n) { return fftwf_malloc(n); }
+		static void deallocate(void *p) { fftwf_free(p); }
+		static Plan planR2C(int rank, const int *n, float *in, Complex *out, unsigned flags) { return fftwf_plan_dft_r2c(rank, n, in, out, flags); }
+		static Plan planC2R(int rank, const int *n, Complex *in, float *out, unsigned flags) { return fftwf_plan_dft_c2r(rank, n, in, out, flags); }
+		static Plan planC2C(int rank, const int *n, Complex *in, Complex *out, int sign, unsigned flags) { return fftwf_plan_dft(rank, n, in, out, sign, flags); }
+		static Plan planManyR2C(int rank, const int *n, int howmany, float *in, int idist, Complex *out, int odist, unsigned flags)
+		{ return fftwf_plan_many_dft_r2c(rank, n, howmany, in, NULL, 1, idist, out, NULL, 1, odist, flags); }
+		static Plan planManyC2R(int rank, const int *n, int howmany, Complex *in, int idist, float *out, int odist, unsigned flags)
+		{ return fftwf_plan_many_dft_c2r(rank, n, howmany, in, NULL, 1, idist, out, NULL, 1, odist, flags); }
+		static Plan planManyC2C(int rank, const int *n, int howmany, Complex *in, int idist, Complex *out, int odist, int sign, unsigned flags)
+		{ return fftwf_plan_many_dft(rank, n, howmany, in, NULL, 1, idist, out, NULL, 1, odist, sign, flags); }
+		static int importWisdom(const std::string &fn) { return fftwf_import_wisdom_from_filename(fn.c_str()); }
+		static int exportWisdom(const std::string &fn) { return fftwf_export_wisdom_to_filename(fn.c_str()); }
+		static std::string wisdomFile(const std::string &fn) { return fn + ".single"; }
+	};
+
+#ifndef MKLFFT
+	// Add the wisdom of this process to the wisdom file (other processes may do the same at the same time)
+	template <typename T>
+	static void saveFftwWisdom()
+	{
+		std::string fn_wisdom = FftwApi<T>::wisdomFile(fftw_plan_cache_wisdom);
+		std::string fn_lock = fn_wisdom + ".lock";
+		char pid[32];
+		snprintf(pid, sizeof(pid), "%d", (int)getpid());
+		std::string fn_tmp = fn_wisdom + ".tmp" + pid;
+
+		int fd = open(fn_lock.c_str(), O_RDWR | O_CREAT, 0666);
+		if (fd < 0 || flock(fd, LOCK_EX) != 0)
+		{
+			std::cerr << " WARNING: cannot lock " << fn_lock << ", FFTW wisdom was not saved" << std::endl;
+			if (fd >= 0)
+				close(fd);
+			return;
+		}
+
+		// Merge what was added to the file since this process read it
+		FftwApi<T>::importWisdom(fn_wisdom);
+		if (!FftwApi<T>::exportWisdom(fn_tmp) || rename(fn_tmp.c_str(), fn_wisdom.c_str()) != 0)
+		{
+			remove(fn_tmp.c_str());
+			std::cerr << " WARNING: cannot write FFTW wisdom to " << fn_wisdom << std::endl;
+		}
+
+		flock(fd, LOCK_UN);
+		close(fd);
+	}
+
+	static void saveFftwWisdomAtExit()
+	{
+		pthread_mutex_lock(&fftw_planner_mutex);
+		pthread_mutex_lock(&fftw_plan_cache_mutex);
+		if (fftw_plan_cache_has_new_wisdom)
+		{
+			saveFftwWisdom<double>();
+			saveFftwWisdom<float>();
+		}
+		pthread_mutex_unlock(&fftw_plan_cache_mutex);
+		pthread_mutex_unlock(&fftw_planner_mutex);
+	}
+#endif
+
+	// Read the environment and the wisdom (the cache must be locked)
+	static void configureFftwPlanCache()
+	{
+		if (fftw_plan_cache_is_configured)
+			return;
+		fftw_plan_cache_is_configured = true;
+
+		char *penv;
+#ifndef MKLFFT
+		// MKL's FFTW interface has no wisdom
+		penv = getenv("RELION_FFTW_WISDOM");
+		if (penv != NULL && penv[0] != '\0')
+		{
+			fftw_plan_cache_wisdom = (std::string)penv;
+			FftwApi<double>::importWisdom(FftwApi<double>::wisdomFile(fftw_plan_cache_wisdom));
+			FftwApi<float>::importWisdom(FftwApi<float>::wisdomFile(fftw_plan_cache_wisdom));
+			fftw_plan_cache_effort = FFTW_MEASURE;
+			atexit(saveFftwWisdomAtExit);
+		}
+#endif
+
+		penv = getenv("RELION_FFTW_PLANNER");
+		if (penv != NULL && penv[0] != '\0')
+		{
+			std::string effort = (std::string)penv;
+			if (effort == "estimate")
+				fftw_plan_cache_effort = FFTW_ESTIMATE;
+			else if (effort == "measure")
+				fftw_plan_cache_effort = FFTW_MEASURE;
+			else if (effort == "patient")
+				fftw_plan_cache_effort = FFTW_PATIENT;
+			else if (effort == "exhaustive")
+				fftw_plan_cache_effort = FFTW_EXHAUSTIVE;
+			else
+				std::cerr << " WARNING: ignoring unknown value of RELION_FFTW_PLANNER: " << effort << std::endl;
+		}
+	}
+
+	template <typename T>
+	static typename FftwApi<T>::Plan getCachedPlan(FftwPlanCache::Kind kind, int xdim, int ydim, int zdim, int howmany, T *in, T *out, unsigned flags)
+	{
+		typedef typename FftwApi<T>::Plan Plan;
+		typedef typename FftwApi<T>::Complex Complex;
+
+		// The arrays of a batch follow each other without padding, which does not work in place for real transforms
+		if (howmany > 1 && in != NULL && in == out && (kind == FftwPlanCache::R2C || kind == FftwPlanCache::C2R))
+			REPORT_ERROR("FftwPlanCache ERROR: batched real transforms cannot be done in place");
+
+		pthread_mutex_lock(&fftw_plan_cache_mutex);
+
+		configureFftwPlanCache();
+
+		if (flags & FFTW_ESTIMATE)
+			flags = (flags & ~FFTW_ESTIMATE) | fftw_plan_cache_effort;
+
+		FftwPlanKey key;
+		key.kind = kind;
+		key.is_double = (sizeof(T) == sizeof(double));
+		key.xdim = xdim;
+		key.ydim = ydim;
+		key.zdim = zdim;
+		key.howmany = howmany;
+		// Only the double-precision planner is used with threads (see setNumberOfThreads)
+		key.nr_threads = key.is_double ? fftw_plan_cache_nr_threads : 1;
+		key.in_place = (in != NULL && in == out);
+#ifdef MKLFFT
+		// MKL's FFTW interface does not look at the alignment
+		key.is_unaligned = (flags & FFTW_UNALIGNED);
+#else
+		key.is_unaligned = (flags & FFTW_UNALIGNED)
+				|| (in != NULL && FftwApi<T>::alignmentOf(in) != 0)
+				|| (out != NULL && FftwApi<T>::alignmentOf(out) != 0);
+#endif
+		if (key.is_unaligned)
+			flags |= FFTW_UNALIGNED;
+		key.flags = flags;
+
+		fftw_plan_cache_nr_lookups++;
+
+		std::map<FftwPlanKey, void*>::iterator it = fftw_plan_cache.find(key);
+		if (it != fftw_plan_cache.end())
+		{
+			Plan plan = (Plan)it->second;
+			pthread_mutex_unlock(&fftw_plan_cache_mutex);
+			return plan;
+		}
+
+		pthread_mutex_unlock(&fftw_plan_cache_mutex);
+
+		int N[3];
+		int ndim = 3;
+		if (zdim == 1)
+		{
+			ndim = 2;
+			if (ydim == 1)
+				ndim = 1;
+		}
+		switch (ndim)
+		{
+		case 1:
+			N[0] = xdim;
+			break;
+		case 2:
+			N[0] = ydim;
+			N[1] = xdim;
+			break;
+		case 3:
+			N[0] = zdim;
+			N[1] = ydim;
+			N[2] = xdim;
+			break;
+		}
+
+		size_t nr_reals = (size_t)xdim * ydim * zdim;
+		size_t nr_complex = (kind == FftwPlanCache::C2C_FORWARD || kind == FftwPlanCache::C2C_BACKWARD) ?
+				nr_reals : (size_t)(xdim / 2 + 1) * ydim * zdim;
+
+		// FFTW_ESTIMATE does not touch the arrays, so it plans on those of the caller. Planning with more effort
+		// overwrites them, so that is done on scratch arrays, which are allocated without holding any lock.
+		// Scratch arrays are also needed when the caller has none (NULL would be taken for an in-place transform).
+		void *scratch_in = NULL, *scratch_out = NULL;
+		void *plan_in = in, *plan_out = out;
+		bool use_scratch = !(flags & FFTW_ESTIMATE) || in == NULL || out == NULL;
+		if (use_scratch)
+		{
+			size_t nr_bytes_in = howmany * ((kind == FftwPlanCache::R2C) ? nr_reals * sizeof(T) : nr_complex * sizeof(Complex));
+			size_t nr_bytes_out = howmany * ((kind == FftwPlanCache::C2R) ? nr_reals * sizeof(T) : nr_complex * sizeof(Complex));
+			if (key.in_place)
+				scratch_in = scratch_out = FftwApi<T>::allocate(std::max(nr_bytes_in, nr_bytes_out));
+			else
+			{
+				scratch_in = FftwApi<T>::allocate(nr_bytes_in);
+				scratch_out = FftwApi<T>::allocate(nr_bytes_out);
+			}
+			if (scratch_in == NULL || scratch_out == NULL)
+				REPORT_ERROR("FftwPlanCache ERROR: cannot allocate memory for planning");
+			plan_in = scratch_in;
+			plan_out = scratch_out;
+		}
+
+		// The FFTW planner is not thread-safe. It has its own lock, so that the plans that are already in the cache
+		// can still be looked up while a new one is made.
+		pthread_mutex_lock(&fftw_planner_mutex);
+
+		// Another thread may have made the same plan in the meantime
+		pthread_mutex_lock(&fftw_plan_cache_mutex);
+		key.nr_threads = key.is_double ? fftw_plan_cache_nr_threads : 1;
+		it = fftw_plan_cache.find(key);
+		Plan plan = (it != fftw_plan_cache.end()) ? (Plan)it->second : NULL;
+		pthread_mutex_unlock(&fftw_plan_cache_mutex);
+
+		if (plan == NULL)
+		{
+			double t0 = fftwPlanCacheWallTime();
+
+			if (howmany == 1)
+			{
+				switch (kind)
+				{
+				case FftwPlanCache::R2C:
+					plan = FftwApi<T>::planR2C(ndim, N, (T*)plan_in, (Complex*)plan_out, flags);
+					break;
+				case FftwPlanCache::C2R:
+					plan = FftwApi<T>::planC2R(ndim, N, (Complex*)plan_in, (T*)plan_out, flags);
+					break;
+				case FftwPlanCache::C2C_FORWARD:
+					plan = FftwApi<T>::planC2C(ndim, N, (Complex*)plan_in, (Complex*)plan_out, FFTW_FORWARD, flags);
+					break;
+				case FftwPlanCache::C2C_BACKWARD:
+					plan = FftwApi<T>::planC2C(ndim, N, (Complex*)plan_in, (Complex*)plan_out, FFTW_BACKWARD, flags);
+					break;
+				}
+			}
+			else
+			{
+				switch (kind)
+				{
+				case FftwPlanCache::R2C:
+					plan = FftwApi<T>::planManyR2C(ndim, N, howmany, (T*)plan_in, nr_reals, (Complex*)plan_out, nr_complex, flags);
+					break;
+				case FftwPlanCache::C2R:
+					plan = FftwApi<T>::planManyC2R(ndim, N, howmany, (Complex*)plan_in, nr_complex, (T*)plan_out, nr_reals, flags);
+					break;
+				case FftwPlanCache::C2C_FORWARD:
+					plan = FftwApi<T>::planManyC2C(ndim, N, howmany, (Complex*)plan_in, nr_complex, (Complex*)plan_out, nr_complex, FFTW_FORWARD, flags);
+					break;
+				case FftwPlanCache::C2C_BACKWARD:
+					plan = FftwApi<T>::planManyC2C(ndim, N, howmany, (Complex*)plan_in, nr_complex, (Complex*)plan_out, nr_complex, FFTW_BACKWARD, flags);
+					break;
+				}
+			}
+
+			if (plan != NULL)
+			{
+				pthread_mutex_lock(&fftw_plan_cache_mutex);
+				fftw_plan_cache[key] = (void*)plan;
+				fftw_plan_cache_nr_plans++;
+				fftw_plan_cache_time += fftwPlanCacheWallTime() - t0;
+				if (!(flags & FFTW_ESTIMATE))
+					fftw_plan_cache_has_new_wisdom = true;
+				pthread_mutex_unlock(&fftw_plan_cache_mutex);
+			}
+		}
+
+		pthread_mutex_unlock(&fftw_planner_mutex);
+
+		if (use_scratch)
+		{
+			FftwApi<T>::deallocate(scratch_in);
+			if (!key.in_place)
+				FftwApi<T>::deallocate(scratch_out);
+		}
+
+		if (plan == NULL)
+			REPORT_ERROR("FFTW plans cannot be created");
+
+		return plan;
+	}
+
+fftw_plan FftwPlanCache::getPlan(Kind kind, int xdim, int ydim, int zdim, double *in, double *out, unsigned flags)
+{
+	return getCachedPlan<double>(kind, xdim, ydim, zdim, 1, in, out, flags);
+}
+
+fftwf_plan FftwPlanCache::getPlan(Kind kind, int xdim, int ydim, int zdim, float *in, float *out, unsigned flags)
+{
+	return getCachedPlan<float>(kind, xdim, ydim, zdim, 1, in, out, flags);
+}
+
+fftw_plan FftwPlanCache::getManyPlan(Kind kind, int xdim, int ydim, int zdim, int howmany, double *in, double *out, unsigned flags)
+{
+	return getCachedPlan<double>(kind, xdim, ydim, zdim, howmany, in, out, flags);
+}
+
+fftwf_plan FftwPlanCache::getManyPlan(Kind kind, int xdim, int ydim, int zdim, int howmany, float *in, float *out, unsigned flags)
+{
+	return getCachedPlan<float>(kind, xdim, ydim, zdim, howmany, in, out, flags);
+}
+
+void FftwPlanCache::setNumberOfThreads(int nr_threads)
+{
+	pthread_mutex_lock(&fftw_planner_mutex);
+	pthread_mutex_lock(&fftw_plan_cache_mutex);
+	fftw_plan_with_nthreads(nr_threads);
+	fftw_plan_cache_nr_threads = nr_threads;
+	pthread_mutex_unlock(&fftw_plan_cache_mutex);
+	pthread_mutex_unlock(&fftw_planner_mutex);
+}
+
+void FftwPlanCache::getStatistics(long int &nr_plans, long int &nr_lookups, double &planning_time)
+{
+	pthread_mutex_lock(&fftw_plan_cache_mutex);
+	nr_plans = fftw_plan_cache_nr_plans;
+	nr_lookups = fftw_plan_cache_nr_lookups;
+	planning_time = fftw_plan_cache_time;
+	pthread_mutex_unlock(&fftw_plan_cache_mutex);
+}
+
+unsigned FftwPlanCache::getEffort()
+{
+	pthread_mutex_lock(&fftw_plan_cache_mutex);
+	configureFftwPlanCache();
+	unsigned effort = fftw_plan_cache_effort;
+	pthread_mutex_unlock(&fftw_plan_cache_mutex);
+
+	return effort;
+}
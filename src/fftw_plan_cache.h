@@ -0,0 +1,74 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef FFTW_PLAN_CACHE_H
+#define FFTW_PLAN_CACHE_H
+
+#include <fftw3.h>
+
+/*	class FftwPlanCache:
+ *
+ *	- one cache of FFTW plans for the whole process, used by FourierTransformer,
+ *	  BatchFourierTransformer, ParFourierTransformer, NewFFT and the ALTCPU transformer:
+ *	  a plan is made only once, and the global planner lock is no longer taken for
+ *	  every new array
+ *	- plans are keyed by the kind of transform, the precision, the dimensions, the
+ *	  batch size, in-place or not, the alignment of the arrays, the planner flags and
+ *	  the number of threads
+ *	- plans with FFTW_ESTIMATE are made on the arrays of the caller, which the planner
+ *	  does not touch; plans with more effort are made on scratch arrays (so that planning
+ *	  never overwrites the data of the caller), and without blocking the lookup of the
+ *	  plans that are already in the cache
+ *	- plans must be executed with the new-array functions (fftw_execute_dft_r2c() etc.)
+ *	  on arrays with the same alignment as the ones passed to getPlan()
+ *	- cached plans stay valid until the end of the program: never destroy them
+ *	- RELION_FFTW_PLANNER (estimate, measure, patient or exhaustive) sets the planning
+ *	  effort for all plans that are requested with FFTW_ESTIMATE
+ *	- RELION_FFTW_WISDOM names a wisdom file (with single-precision wisdom in the same
+ *	  name plus ".single") that is read before the first plan is made, and to which the
+ *	  new wisdom is added when the program ends; with a wisdom file the default effort
+ *	  is measure, as the plans are then the same for every run
+ */
+class FftwPlanCache
+{
+public:
+
+	enum Kind {R2C, C2R, C2C_FORWARD, C2C_BACKWARD};
+
+	// Plan for a transform of xdim*ydim*zdim (ydim=zdim=1 in 1D, zdim=1 in 2D) real or complex
+	// values (the complex half of a real transform has xdim/2+1 columns) from in to out
+	static fftw_plan getPlan(Kind kind, int xdim, int ydim, int zdim, double *in, double *out, unsigned flags = FFTW_ESTIMATE);
+	static fftwf_plan getPlan(Kind kind, int xdim, int ydim, int zdim, float *in, float *out, unsigned flags = FFTW_ESTIMATE);
+
+	// Plan for howmany of the transforms above in one go, on arrays that follow each other in memory
+	// (as in a stack of images); real transforms of a batch cannot be done in place
+	static fftw_plan getManyPlan(Kind kind, int xdim, int ydim, int zdim, int howmany, double *in, double *out, unsigned flags = FFTW_ESTIMATE);
+	static fftwf_plan getManyPlan(Kind kind, int xdim, int ydim, int zdim, int howmany, float *in, float *out, unsigned flags = FFTW_ESTIMATE);
+
+	// Use instead of fftw_plan_with_nthreads(), so that plans for another number of threads are not mixed up
+	static void setNumberOfThreads(int nr_threads);
+
+	// Number of plans made, number of plans returned, and the time (in seconds) spent making them
+	static void getStatistics(long int &nr_plans, long int &nr_lookups, double &planning_time);
+
+	// Planner flags for the effort set by RELION_FFTW_PLANNER, instead of FFTW_ESTIMATE
+	static unsigned getEffort();
+};
+
+#endif
@@ -331,7 +331,7 @@ bool FileName::isStarFile() const
         return false;
 
     FileName ext = getFileFormat();
-    if (ext=="star")
+    if (ext=="star" || ext=="bstar")
     {
         return true;
     }
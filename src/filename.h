@@ -373,7 +373,7 @@ public:
 
     /** Is this file a MetaData file?
      * Returns false if the filename contains "@", ":" or "#"
-     * Returns true if the get_file_format extension == "star"
+     * Returns true if the get_file_format extension == "star" (or "bstar" for binary metadata)
      */
     bool isStarFile() const;
 
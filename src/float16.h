@@ -0,0 +1,92 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef FLOAT16_H
+#define FLOAT16_H
+
+#include <cstring>
+#include <cmath>
+
+// Conversions between float and IEEE 754 half precision (binary16), stored in an unsigned short
+
+// Round to the nearest half (ties to even); too large values become infinity
+inline unsigned short floatToHalf(float f)
+{
+	unsigned int u;
+	memcpy(&u, &f, 4);
+
+	unsigned int sign = (u >> 16) & 0x8000;
+	int exponent = (int)((u >> 23) & 0xff) - 127 + 15;
+	unsigned int mantissa = u & 0x7fffff;
+
+	// Infinity and NaN
+	if (((u >> 23) & 0xff) == 0xff)
+		return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+
+	// Too large: infinity
+	if (exponent >= 31)
+		return sign | 0x7c00;
+
+	// Too small for a normal half: subnormal or zero
+	if (exponent <= 0)
+	{
+		if (exponent < -10)
+			return sign;
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		unsigned int half = mantissa >> shift;
+		unsigned int remainder = mantissa & ((1u << shift) - 1);
+		unsigned int halfway = 1u << (shift - 1);
+		if (remainder > halfway || (remainder == halfway && (half & 1)))
+			half++;
+		return sign | half;
+	}
+
+	// Round to nearest even, a carry into the exponent is correct (also when it overflows to infinity)
+	unsigned int half = sign | (exponent << 10) | (mantissa >> 13);
+	unsigned int remainder = mantissa & 0x1fff;
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+		half++;
+	return half;
+}
+
+inline float halfToFloat(unsigned short h)
+{
+	unsigned int sign = (unsigned int)(h & 0x8000) << 16;
+	unsigned int exponent = (h >> 10) & 0x1f;
+	unsigned int mantissa = h & 0x3ff;
+	unsigned int u;
+
+	if (exponent == 0)
+	{
+		// Zero or subnormal
+		float f = ldexpf((float)mantissa, -24);
+		return (sign) ? -f : f;
+	}
+	else if (exponent == 31)
+		u = sign | 0x7f800000 | (mantissa << 13);
+	else
+		u = sign | ((exponent + 112) << 23) | (mantissa << 13);
+
+	float f;
+	memcpy(&f, &u, 4);
+	return f;
+}
+
+#endif
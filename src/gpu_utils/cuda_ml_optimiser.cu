@@ -186,7 +186,7 @@ void getFourierTransformsAndCtfs(long int my_ori_particle,
 				else
 				{
 					CTIC(cudaMLO->timer,"ParaRead2DImages");
-					img() = baseMLO->exp_imgs[istop];
+					baseMLO->getExpImage(part_id, istop, img());
 					CTOC(cudaMLO->timer,"ParaRead2DImages");
 				}
 			}
@@ -18,6 +18,9 @@
  * author citations must be preserved.
  ***************************************************************************/
 #include "src/healpix_sampling.h"
+#include <unistd.h>
+#include <pthread.h>
+#include "src/Healpix_2.15a/arr.h"
 //#define DEBUG_SAMPLING
 //#define DEBUG_CHECKSIZES
 //#define DEBUG_HELICAL_ORIENTATIONAL_SEARCH
@@ -32,6 +35,7 @@ void HealpixSampling::clear()
 	helical_offset_step = -1.;
 	orientational_prior_mode = NOPRIOR;
 	directions_ipix.clear();
+	idir_of_ipix.clear();
 	rot_angles.clear();
 	tilt_angles.clear();
 	psi_angles.clear();
@@ -436,6 +440,7 @@ void HealpixSampling::setOrientations(int _order, RFLOAT _psi_step)
 
 	// Initialise
 	directions_ipix.clear();
+	idir_of_ipix.clear();
 	rot_angles.clear();
 	tilt_angles.clear();
 	psi_angles.clear();
@@ -451,38 +456,52 @@ void HealpixSampling::setOrientations(int _order, RFLOAT _psi_step)
 	// 3D directions
 	if (is_3D)
 	{
-		RFLOAT rot, tilt;
-		for (long int ipix = 0; ipix < healpix_base.Npix(); ipix++)
+		// The symmetry reduction takes a while for fine samplings and large point groups:
+		// re-use the directions of an earlier run with the same order, symmetry and tilt limits
+		FileName fn_cache = getDirectionsCacheFileName();
+		if (fn_cache == "" || !readDirectionsCache(fn_cache))
 		{
-			getDirectionFromHealPix(ipix, rot, tilt);
+			RFLOAT rot, tilt;
+			for (long int ipix = 0; ipix < healpix_base.Npix(); ipix++)
+			{
+				getDirectionFromHealPix(ipix, rot, tilt);
 
-			// Push back as Matrix1D's in the vectors
-			rot_angles.push_back(rot);
-			tilt_angles.push_back(tilt);
-			directions_ipix.push_back(ipix);
+				// Push back as Matrix1D's in the vectors
+				rot_angles.push_back(rot);
+				tilt_angles.push_back(tilt);
+				directions_ipix.push_back(ipix);
 
 
-		}
+			}
 //#define DEBUG_SAMPLING
 #ifdef  DEBUG_SAMPLING
-		writeAllOrientationsToBild("orients_all.bild", "1 0 0 ", 0.020);
+			writeAllOrientationsToBild("orients_all.bild", "1 0 0 ", 0.020);
 #endif
-		// Now remove symmetry-related pixels
-		// TODO check size of healpix_base.max_pixrad
-		removeSymmetryEquivalentPoints(0.5 * RAD2DEG(healpix_base.max_pixrad()));
+			// Now remove symmetry-related pixels
+			// TODO check size of healpix_base.max_pixrad
+			removeSymmetryEquivalentPoints(0.5 * RAD2DEG(healpix_base.max_pixrad()));
 
 #ifdef  DEBUG_SAMPLING
-		writeAllOrientationsToBild("orients_sym.bild", "0 1 0 ", 0.021);
+			writeAllOrientationsToBild("orients_sym.bild", "0 1 0 ", 0.021);
 #endif
 
-		// Also remove limited tilt angles
-		removePointsOutsideLimitedTiltAngles();
+			// Also remove limited tilt angles
+			removePointsOutsideLimitedTiltAngles();
 
 #ifdef  DEBUG_SAMPLING
-		if (ABS(limit_tilt) < 90.)
-			writeAllOrientationsToBild("orients_tilt.bild", "1 1 0 ", 0.022);
+			if (ABS(limit_tilt) < 90.)
+				writeAllOrientationsToBild("orients_tilt.bild", "1 1 0 ", 0.022);
 #endif
 
+			if (fn_cache != "")
+				writeDirectionsCache(fn_cache);
+		}
+
+		// For the local searches in selectOrientationsWithNonZeroPriorProbability
+		idir_of_ipix.assign(healpix_base.Npix(), -1);
+		for (long int idir = 0; idir < directions_ipix.size(); idir++)
+			idir_of_ipix[directions_ipix[idir]] = idir;
+
 	}
 	else
 	{
@@ -516,6 +535,9 @@ void HealpixSampling::setOrientations(int _order, RFLOAT _psi_step)
 /* Set only a single orientation */
 void HealpixSampling::addOneOrientation(RFLOAT rot, RFLOAT tilt, RFLOAT psi, bool do_clear)
 {
+	// These directions are not HEALPix pixels
+	idir_of_ipix.clear();
+
 	if (do_clear)
 	{
 		directions_ipix.clear();
@@ -619,6 +641,106 @@ RFLOAT HealpixSampling::calculateDeltaRot(Matrix1D<RFLOAT> my_direction, RFLOAT
 	return fabs(ASIND(my_rot_direction(1)));
 }
 
+// Work space of findDirectionsNearPrior: one per thread, so that it is not re-allocated for every particle
+struct DirectionSearchBuffers
+{
+	std::vector<long int> idirs;
+	std::vector<int> ipix_todo, ipix_seen;
+};
+
+static pthread_key_t direction_search_key;
+static pthread_once_t direction_search_once = PTHREAD_ONCE_INIT;
+
+static void deleteDirectionSearchBuffers(void *buffers)
+{
+	delete (DirectionSearchBuffers *)buffers;
+}
+
+static void createDirectionSearchKey()
+{
+	pthread_key_create(&direction_search_key, deleteDirectionSearchBuffers);
+}
+
+static DirectionSearchBuffers &getDirectionSearchBuffers()
+{
+	pthread_once(&direction_search_once, createDirectionSearchKey);
+	DirectionSearchBuffers *buffers = (DirectionSearchBuffers *)pthread_getspecific(direction_search_key);
+	if (buffers == NULL)
+	{
+		buffers = new DirectionSearchBuffers;
+		pthread_setspecific(direction_search_key, buffers);
+	}
+	return *buffers;
+}
+
+bool HealpixSampling::findDirectionsNearPrior(RFLOAT prior_rot, RFLOAT prior_tilt, RFLOAT max_ang, std::vector<long int> &idirs)
+{
+	idirs.clear();
+
+	// Not for setOrientations samplings (e.g. after addOneOrientation)
+	if (idir_of_ipix.size() != healpix_base.Npix())
+		return false;
+
+	// Every pixel that overlaps with a disc of max_ang around a mate has its centre within search_ang of it,
+	// and these pixels are all connected to the pixel of the mate itself
+	double search_ang = DEG2RAD(max_ang) + healpix_base.max_pixrad();
+	if (search_ang >= PI)
+		return false;
+
+	// Only worth it if the discs around all mates have fewer pixels than there are directions
+	double nr_pixels = 0.5 * (1. - cos(search_ang)) * healpix_base.Npix() * R_repository.size();
+	if (nr_pixels > rot_angles.size())
+		return false;
+
+	double cos_search_ang = cos(search_ang);
+	DirectionSearchBuffers &buffers = getDirectionSearchBuffers();
+	Matrix1D<RFLOAT> prior_direction, mate_direction;
+	Euler_angles2direction(prior_rot, prior_tilt, prior_direction);
+	for (int j = 0; j < R_repository.size(); j++)
+	{
+		// A direction is brought onto the prior by a symmetry operator (see selectOrientationsWithNonZeroPriorProbability)
+		// if it is near the prior transformed by the inverse of that operator
+		mate_direction = R_repository[j] * (L_repository[j].transpose() * prior_direction);
+		vec3 mate(XX(mate_direction), YY(mate_direction), ZZ(mate_direction));
+		mate.Normalize();
+
+		int ipix = healpix_base.vec2pix(mate);
+		buffers.ipix_todo.assign(1, ipix);
+		buffers.ipix_seen.assign(1, ipix);
+		while (buffers.ipix_todo.size() > 0)
+		{
+			ipix = buffers.ipix_todo.back();
+			buffers.ipix_todo.pop_back();
+			if (idir_of_ipix[ipix] >= 0)
+				idirs.push_back(idir_of_ipix[ipix]);
+
+			fix_arr<int, 8> neighbours;
+			healpix_base.neighbors(ipix, neighbours);
+			for (int n = 0; n < 8; n++)
+			{
+				// Some pixels have only 7 neighbours
+				if (neighbours[n] < 0)
+					continue;
+
+				// ipix_seen is kept sorted
+				std::vector<int>::iterator it = std::lower_bound(buffers.ipix_seen.begin(), buffers.ipix_seen.end(), neighbours[n]);
+				if (it != buffers.ipix_seen.end() && *it == neighbours[n])
+					continue;
+				buffers.ipix_seen.insert(it, neighbours[n]);
+
+				if (dotprod(healpix_base.pix2vec(neighbours[n]), mate) >= cos_search_ang)
+					buffers.ipix_todo.push_back(neighbours[n]);
+			}
+		}
+	}
+
+	// Directions near more than one mate are only checked once, and all in the same order as in the loop over all directions
+	std::sort(idirs.begin(), idirs.end());
+	idirs.erase(std::unique(idirs.begin(), idirs.end()), idirs.end());
+
+	return idirs.size() > 0;
+}
+
 void HealpixSampling::selectOrientationsWithNonZeroPriorProbability(
 		RFLOAT prior_rot, RFLOAT prior_tilt, RFLOAT prior_psi,
 		RFLOAT sigma_rot, RFLOAT sigma_tilt, RFLOAT sigma_psi,
@@ -645,8 +767,14 @@ void HealpixSampling::selectOrientationsWithNonZeroPriorProbability(
 		// Keep track of the closest distance to prevent 0 orientations
 		RFLOAT best_ang = 9999.;
 		long int best_idir = -999;
-		for (long int idir = 0; idir < rot_angles.size(); idir++)
+
+		// With a prior on both rot and tilt, only the directions near the prior (or near one of its symmetry mates) need to be checked
+		std::vector<long int> &idirs_near_prior = getDirectionSearchBuffers().idirs;
+		bool is_sparse = (sigma_rot > 0.) && (sigma_tilt > 0.) &&
+				findDirectionsNearPrior(prior_rot, prior_tilt, sigma_cutoff * XMIPP_MAX(sigma_rot, sigma_tilt), idirs_near_prior);
+		for (long int i = 0; i < ((is_sparse) ? idirs_near_prior.size() : rot_angles.size()); i++)
 		{
+			long int idir = (is_sparse) ? idirs_near_prior[i] : i;
 			bool is_nonzero_pdf = false;
 
 			// Any prior involving BOTH rot and tilt.
@@ -827,6 +955,15 @@ void HealpixSampling::selectOrientationsWithNonZeroPriorProbability(
 				}
 			}
 
+			// If none of the directions near the prior is selected, the nearest of all directions is needed below: check them all
+			if (is_sparse && i + 1 == idirs_near_prior.size() && directions_prior.size() == 0)
+			{
+				is_sparse = false;
+				sumprior = sumprior_withsigmafromzero = 0.;
+				best_ang = 9999.;
+				best_idir = -999;
+				i = -1;
+			}
 
 		} // end for idir
 
@@ -1937,6 +2074,95 @@ void HealpixSampling::writeBildFileOrientationalDistribution(MultidimArray<RFLOA
 
 ///////// PRIVATE STUFF
 
+FileName HealpixSampling::getDirectionsCacheFileName()
+{
+	// Nothing to gain without symmetry; and a symmetry file (rather than a group name) may change between runs
+	int group, order;
+	SymList SL;
+	if (R_repository.size() < 2 || !SL.isSymmetryGroup(fn_sym, group, order))
+		return "";
+
+	// An empty RELION_HEALPIX_CACHE switches the cache off
+	FileName fn_dir;
+	char *penv = getenv("RELION_HEALPIX_CACHE");
+	if (penv != NULL)
+		fn_dir = penv;
+	else if ((penv = getenv("HOME")) != NULL)
+		fn_dir = std::string(penv) + "/.relion_healpix_cache";
+	if (fn_dir == "")
+		return "";
+
+	FileName fn_cache = fn_dir + "/directions_order" + integerToString(healpix_order) + "_" + fn_sym;
+	if (ABS(limit_tilt) < 90.)
+		fn_cache += "_tilt" + floatToString(limit_tilt);
+	return fn_cache + ".txt";
+}
+
+// The first line of a cache file has all the parameters that the directions depend on
+static std::string directionsCacheHeader(int healpix_order, long int npix, const FileName &fn_sym, long int nr_sym, RFLOAT limit_tilt)
+{
+	std::stringstream header;
+	header << "# relion_healpix_directions order= " << healpix_order << " npix= " << npix << " sym= " << fn_sym
+	       << " nr_sym= " << nr_sym << " limit_tilt= " << ((ABS(limit_tilt) < 90.) ? limit_tilt : 90.);
+	return header.str();
+}
+
+bool HealpixSampling::readDirectionsCache(const FileName &fn_cache)
+{
+	std::ifstream fh(fn_cache.c_str());
+	if (!fh)
+		return false;
+
+	std::string header;
+	long int nr_directions;
+	if (!std::getline(fh, header) ||
+		header != directionsCacheHeader(healpix_order, healpix_base.Npix(), fn_sym, R_repository.size(), limit_tilt) ||
+		!(fh >> nr_directions) || nr_directions <= 0 || nr_directions > healpix_base.Npix())
+		return false;
+
+	std::vector<int> ipixs(nr_directions);
+	for (long int idir = 0; idir < nr_directions; idir++)
+		if (!(fh >> ipixs[idir]) || ipixs[idir] < 0 || ipixs[idir] >= healpix_base.Npix())
+			return false;
+
+	// The angles are recalculated exactly as in setOrientations
+	RFLOAT rot, tilt;
+	for (long int idir = 0; idir < nr_directions; idir++)
+	{
+		getDirectionFromHealPix(ipixs[idir], rot, tilt);
+		rot_angles.push_back(rot);
+		tilt_angles.push_back(tilt);
+		directions_ipix.push_back(ipixs[idir]);
+	}
+
+	return true;
+}
+
+void HealpixSampling::writeDirectionsCache(const FileName &fn_cache)
+{
+	// Several MPI processes may write the same file: write a temporary file and rename it
+	FileName fn_tmp = fn_cache + ".tmp" + integerToString(getpid());
+	mktree(fn_cache.beforeLastOf("/"));
+	std::ofstream fh(fn_tmp.c_str());
+	if (!fh)
+	{
+		std::cerr << " WARNING: cannot write to the cache of HEALPix directions " << fn_cache << std::endl;
+		return;
+	}
+
+	fh << directionsCacheHeader(healpix_order, healpix_base.Npix(), fn_sym, R_repository.size(), limit_tilt) << std::endl;
+	fh << directions_ipix.size() << std::endl;
+	for (long int idir = 0; idir < directions_ipix.size(); idir++)
+		fh << directions_ipix[idir] << std::endl;
+	fh.close();
+
+	if (!fh || rename(fn_tmp.c_str(), fn_cache.c_str()) != 0)
+	{
+		std::cerr << " WARNING: cannot write to the cache of HEALPix directions " << fn_cache << std::endl;
+		remove(fn_tmp.c_str());
+	}
+}
+
 void HealpixSampling::removePointsOutsideLimitedTiltAngles()
 {
 
@@ -1971,6 +2197,13 @@ void HealpixSampling::removePointsOutsideLimitedTiltAngles()
 }
 
 
+// Index of the cube along one axis for a coordinate of a unit vector
+static inline long int getDirectionCube(RFLOAT coordinate, RFLOAT cube_size, long int nr_cubes)
+{
+	long int cube = FLOOR((coordinate + 1.) / cube_size);
+	return XMIPP_MAX(0, XMIPP_MIN(nr_cubes - 1, cube));
+}
+
 // The way symmetry is handled was copied from Xmipp.
 // The original disclaimer is copied below
 /***************************************************************************
@@ -2024,47 +2257,67 @@ void HealpixSampling::removeSymmetryEquivalentPoints(RFLOAT max_ang)
     // For large numbers, the sampling is very fine and the probability distributions are probably delta functions anyway
     // Large numbers take long times to calculate...
     // Only a small fraction of the points at the border of the AU is thrown away anyway...
+    // (The limit is kept although the search below is fast now, as it sets the number of directions of existing runs)
     if (rot_angles.size() < 4000)
     {
     	// Create no_redundant vectors
-		std::vector <Matrix1D<RFLOAT> > no_redundant_directions_vector;
 		std::vector <RFLOAT> no_redundant_rot_angles;
 		std::vector <RFLOAT> no_redundant_tilt_angles;
 		std::vector <int> no_redundant_directions_ipix;
 
-		// Then check all points versus each other
+		// The symmetry mates of all points that are kept are sorted into a grid of cubes
+		// that are at least as large as the distance between two directions that are max_ang apart.
+		// Each new point then only needs to be compared with the mates in the 3x3x3 cubes around it,
+		// rather than with all mates of all points that were kept before it.
+		RFLOAT cube_size = 1.01 * 2. * sin(0.5 * DEG2RAD(max_ang));
+		long int nr_cubes = CEIL(2. / cube_size);
+		std::map<long int, std::vector<Matrix1D<RFLOAT> > > cube_mates;
+
+		// Then check all points versus the mates near them
 		for (long int i = 0; i < rot_angles.size(); i++)
 		{
 
 			direction1=directions_vector[i];
 			bool uniq = true;
 
-			//for (long int k = 0; k < no_redundant_directions_vector.size(); k++)
-			// i is probably closer to latest additions: loop backwards over k....
-			for (long int k = no_redundant_directions_vector.size() -1; k >= 0; k--)
+			long int cube_x = getDirectionCube(XX(direction1), cube_size, nr_cubes);
+			long int cube_y = getDirectionCube(YY(direction1), cube_size, nr_cubes);
+			long int cube_z = getDirectionCube(ZZ(direction1), cube_size, nr_cubes);
+			for (long int z = XMIPP_MAX(0, cube_z - 1); z <= XMIPP_MIN(nr_cubes - 1, cube_z + 1) && uniq; z++)
+			for (long int y = XMIPP_MAX(0, cube_y - 1); y <= XMIPP_MIN(nr_cubes - 1, cube_y + 1) && uniq; y++)
+			for (long int x = XMIPP_MAX(0, cube_x - 1); x <= XMIPP_MIN(nr_cubes - 1, cube_x + 1) && uniq; x++)
 			{
-				for (int j = 0; j < R_repository.size(); j++)
+				std::map<long int, std::vector<Matrix1D<RFLOAT> > >::const_iterator it = cube_mates.find((z * nr_cubes + y) * nr_cubes + x);
+				if (it == cube_mates.end())
+					continue;
+				for (long int k = 0; k < it->second.size(); k++)
 				{
-					direction =  L_repository[j] *
-						(no_redundant_directions_vector[k].transpose() *
-						 R_repository[j]).transpose();
 					//Calculate distance
-					my_dotProduct = dotProduct(direction,direction1);
+					my_dotProduct = dotProduct(it->second[k],direction1);
 					if (my_dotProduct > cos_max_ang)
 					{
 						uniq = false;
 						break;
 					}
-				}// for j
-				if (!uniq) break;
-			} // for k
+				}// for k
+			}
 
 			if (uniq)
 			{
-				no_redundant_directions_vector.push_back(directions_vector[i]);
 				no_redundant_rot_angles.push_back(rot_angles[i]);
 				no_redundant_tilt_angles.push_back(tilt_angles[i]);
 				no_redundant_directions_ipix.push_back(directions_ipix[i]);
+
+				for (int j = 0; j < R_repository.size(); j++)
+				{
+					direction =  L_repository[j] *
+						(directions_vector[i].transpose() *
+						 R_repository[j]).transpose();
+					long int cube = (getDirectionCube(ZZ(direction), cube_size, nr_cubes) * nr_cubes +
+					                 getDirectionCube(YY(direction), cube_size, nr_cubes)) * nr_cubes +
+					                 getDirectionCube(XX(direction), cube_size, nr_cubes);
+					cube_mates[cube].push_back(direction);
+				}// for j
 			}
 		} // for i
 
@@ -87,6 +87,9 @@ public:
     /** vector with the original pixel number in the healpix object */
     std::vector<int> directions_ipix;
 
+    /** vector with the index in rot_angles and tilt_angles of each pixel in the healpix object (-1 for removed pixels) */
+    std::vector<int> idir_of_ipix;
+
     /** vector with sampling points described by angles */
     std::vector<RFLOAT > rot_angles, tilt_angles;
 
@@ -394,6 +397,29 @@ private:
     */
     void removeSymmetryEquivalentPoints(RFLOAT max_ang);
 
+    /* The directions after symmetry reduction and tilt limits are cached on disk,
+     * one file per order, symmetry group and tilt limit, in $RELION_HEALPIX_CACHE
+     * (by default ~/.relion_healpix_cache; an empty value switches the cache off).
+     * Only the HEALPix pixel numbers are stored: the angles are recalculated from them.
+     * Returns an empty name if these directions are not cached (i.e. for C1 or for symmetry files)
+     */
+    FileName getDirectionsCacheFileName();
+
+    /* Fill directions_ipix, rot_angles and tilt_angles from the cache file
+     * Returns false (and leaves them empty) if the file does not exist or does not match this sampling
+     */
+    bool readDirectionsCache(const FileName &fn_cache);
+
+    /* Store directions_ipix in the cache file (only a warning is given if this fails) */
+    void writeDirectionsCache(const FileName &fn_cache);
+
+    /* Find the directions within max_ang degrees of (prior_rot, prior_tilt) or of one of its symmetry mates,
+     * by walking over the neighbours of the HEALPix pixels of the prior and its mates.
+     * The result (idirs, in ascending order) may contain some directions that are a bit further away.
+     * Returns false (and leaves idirs empty) if this would not be faster than checking all directions
+     */
+    bool findDirectionsNearPrior(RFLOAT prior_rot, RFLOAT prior_tilt, RFLOAT max_ang, std::vector<long int> &idirs);
+
     /* eliminate symmetry-related points based on simple geometrical considerations,
         symmetry group, symmetry order */
     void removeSymmetryEquivalentPointsGeometric(const int symmetry, int sym_order,
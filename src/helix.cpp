@@ -2124,9 +2124,9 @@ void addPriorsToParticleDataFile(
 	std::string str_img_name;
 	RFLOAT x1, y1, x2, y2, rot, tilt, psi, xoff, yoff, tube_len, psi_flip_ratio;
 	int tube_id;
-	std::map<std::string, MetaDataContainer*> priors_list;
-	std::map<std::string, MetaDataContainer*>::iterator prior_iterator;
-	MetaDataContainer* aux;
+	std::map<std::string, MetaDataContainer> priors_list;
+	std::map<std::string, MetaDataContainer>::iterator prior_iterator;
+	MetaDataContainer aux;
 
 	if ( (fn_priors.getFileFormat() != "star") || (fn_data.getFileFormat() != "star") || (fn_out.getFileFormat() != "star") )
 		REPORT_ERROR("helix.cpp::combineParticlePriorsWithClass2DDataStar(): MetaDataTable should have .star extension.");
@@ -2191,7 +2191,7 @@ void addPriorsToParticleDataFile(
 	{
 		aux = MD_priors.getObject();
 		MD_priors.getValue(EMDL_IMAGE_NAME, str_img_name);
-		priors_list.insert(std::pair<std::string, MetaDataContainer*>(str_img_name, aux));
+		priors_list.insert(std::pair<std::string, MetaDataContainer>(str_img_name, aux));
 	}
 
 	FOR_ALL_OBJECTS_IN_METADATA_TABLE(MD_data)
@@ -2202,8 +2202,8 @@ void addPriorsToParticleDataFile(
 		{
 			aux = prior_iterator->second;
 
-			aux->getValue(EMDL_IMAGE_COORD_X, x1);
-			aux->getValue(EMDL_IMAGE_COORD_Y, y1);
+			aux.getValue(EMDL_IMAGE_COORD_X, x1);
+			aux.getValue(EMDL_IMAGE_COORD_Y, y1);
 			MD_data.getValue(EMDL_IMAGE_COORD_X, x2);
 			MD_data.getValue(EMDL_IMAGE_COORD_Y, y2);
 			if ( (fabs(x1 - x2) > 1.) || (fabs(y1 - y2) > 1.) )
@@ -2212,42 +2212,42 @@ void addPriorsToParticleDataFile(
 			{
 				if (have_rot)
 				{
-					aux->getValue(EMDL_ORIENT_ROT_PRIOR, rot);
+					aux.getValue(EMDL_ORIENT_ROT_PRIOR, rot);
 					MD_data.setValue(EMDL_ORIENT_ROT_PRIOR, rot);
 				}
 				if (have_tilt)
 				{
-					aux->getValue(EMDL_ORIENT_TILT_PRIOR, tilt);
+					aux.getValue(EMDL_ORIENT_TILT_PRIOR, tilt);
 					MD_data.setValue(EMDL_ORIENT_TILT_PRIOR, tilt);
 				}
 				if (have_psi)
 				{
-					aux->getValue(EMDL_ORIENT_PSI_PRIOR, psi);
+					aux.getValue(EMDL_ORIENT_PSI_PRIOR, psi);
 					MD_data.setValue(EMDL_ORIENT_PSI_PRIOR, psi);
 				}
 				if (have_xoff)
 				{
-					aux->getValue(EMDL_ORIENT_ORIGIN_X_PRIOR, xoff);
+					aux.getValue(EMDL_ORIENT_ORIGIN_X_PRIOR, xoff);
 					MD_data.setValue(EMDL_ORIENT_ORIGIN_X_PRIOR, xoff);
 				}
 				if (have_yoff)
 				{
-					aux->getValue(EMDL_ORIENT_ORIGIN_Y_PRIOR, yoff);
+					aux.getValue(EMDL_ORIENT_ORIGIN_Y_PRIOR, yoff);
 					MD_data.setValue(EMDL_ORIENT_ORIGIN_Y_PRIOR, yoff);
 				}
 				if (have_tube_id)
 				{
-					aux->getValue(EMDL_PARTICLE_HELICAL_TUBE_ID, tube_id);
+					aux.getValue(EMDL_PARTICLE_HELICAL_TUBE_ID, tube_id);
 					MD_data.setValue(EMDL_PARTICLE_HELICAL_TUBE_ID, tube_id);
 				}
 				if (have_tube_len)
 				{
-					aux->getValue(EMDL_PARTICLE_HELICAL_TRACK_LENGTH, tube_len);
+					aux.getValue(EMDL_PARTICLE_HELICAL_TRACK_LENGTH, tube_len);
 					MD_data.setValue(EMDL_PARTICLE_HELICAL_TRACK_LENGTH, tube_len);
 				}
 				if (have_psi_flip_ratio)
 				{
-					aux->getValue(EMDL_ORIENT_PSI_PRIOR_FLIP_RATIO, psi_flip_ratio);
+					aux.getValue(EMDL_ORIENT_PSI_PRIOR_FLIP_RATIO, psi_flip_ratio);
 					MD_data.setValue(EMDL_ORIENT_PSI_PRIOR_FLIP_RATIO, psi_flip_ratio);
 				}
 			}
@@ -58,6 +58,7 @@
 #include <tiffio.h>
 #endif
 #include "src/funcs.h"
+#include "src/scratch_cache.h"
 #include "src/memory.h"
 #include "src/filename.h"
 #include "src/multidim_array.h"
@@ -208,8 +209,17 @@ public:
 		if (isTiff && mode != WRITE_READONLY)
 			REPORT_ERROR((std::string)"TIFF is supported only for reading");
 
+		// Read particle stacks from the node-local scratch cache when they are in there (see src/scratch_cache.h)
+		fimg = NULL;
+		if (mode == WRITE_READONLY && !isTiff && headName == "")
+		{
+			FileName fn_cached = ScratchCache::lookup(fileName);
+			if (fn_cached != fileName)
+				fimg = fopen(fn_cached.c_str(), "r");
+		}
+
 		// Open image file
-		if ((!isTiff && ((fimg  = fopen(fileName.c_str(), wmChar.c_str())) == NULL))
+		if ((!isTiff && fimg == NULL && ((fimg  = fopen(fileName.c_str(), wmChar.c_str())) == NULL))
 #ifdef HAVE_TIFF
 		    || (isTiff && ((ftiff = TIFFOpen(fileName.c_str(), "r")) == NULL))
 #endif
@@ -1068,6 +1078,20 @@ public:
 		return dummy;
 	}
 
+	/** Offset (in bytes) of the first image in the file, as read from the header
+	 */
+	unsigned long dataOffset() const
+	{
+		return offset;
+	}
+
+	/** Are the data in the file byte-swapped? (as read from the header)
+	 */
+	int dataSwap() const
+	{
+		return swap;
+	}
+
 	/** Sampling RateX
 	*
 	* @code
@@ -22,13 +22,11 @@
 
 #include "src/macros.h"
 #include "src/fftw.h"
+#include "src/fftw_plan_cache.h"
 #include "src/args.h"
 #include <string.h>
 #include <math.h>
 
-pthread_mutex_t NewFFT::fftw_plan_mutex_new = PTHREAD_MUTEX_INITIALIZER;
-
-
 void NewFFT::FourierTransform(
 		MultidimArray<double>& src,
 		MultidimArray<dComplex>& dest,
@@ -352,38 +350,8 @@ NewFFT::DoublePlan::DoublePlan(int w, int h, int d, unsigned int flags)
 	realPtr(0), 
 	complexPtr(0)
 {
-	MultidimArray<double> realDummy(d,h,w);
-	MultidimArray<dComplex> complexDummy(d,h,w/2+1);
-	
-	std::vector<int> N(0);
-	if (d > 1) N.push_back(d);
-	if (h > 1) N.push_back(h);
-	           N.push_back(w);
-	
-	const int ndim = N.size();
-	
-	pthread_mutex_lock(&fftw_plan_mutex_new);
-	
-	fftw_plan planForward = fftw_plan_dft_r2c(
-			ndim, &N[0],
-			MULTIDIM_ARRAY(realDummy),
-			(fftw_complex*) MULTIDIM_ARRAY(complexDummy),
-			FFTW_UNALIGNED | flags);
-	
-	fftw_plan planBackward = fftw_plan_dft_c2r(
-			ndim, &N[0],
-			(fftw_complex*) MULTIDIM_ARRAY(complexDummy),
-			MULTIDIM_ARRAY(realDummy),
-			FFTW_UNALIGNED | flags);
-	
-	pthread_mutex_unlock(&fftw_plan_mutex_new);
-	
-	if (planForward == NULL || planBackward == NULL)
-	{
-		REPORT_ERROR("FFTW plans cannot be created");
-	}
-	
-	plan = std::shared_ptr<Plan>(new Plan(planForward, planBackward));
+	forward = FftwPlanCache::getPlan(FftwPlanCache::R2C, w, h, d, (double*)NULL, (double*)NULL, FFTW_UNALIGNED | flags);
+	backward = FftwPlanCache::getPlan(FftwPlanCache::C2R, w, h, d, (double*)NULL, (double*)NULL, FFTW_UNALIGNED | flags);
 }
 
 NewFFT::DoublePlan::DoublePlan(
@@ -396,35 +364,9 @@ NewFFT::DoublePlan::DoublePlan(
 	realPtr(MULTIDIM_ARRAY(real)), 
 	complexPtr((double*)MULTIDIM_ARRAY(complex))
 {
-	std::vector<int> N(0);
-	if (d > 1) N.push_back(d);
-	if (h > 1) N.push_back(h);
-	           N.push_back(w);
-	
-	const int ndim = N.size();
-	
-	pthread_mutex_lock(&fftw_plan_mutex_new);
-	
-	fftw_plan planForward = fftw_plan_dft_r2c(
-			ndim, &N[0],
-			MULTIDIM_ARRAY(real),
-			(fftw_complex*) MULTIDIM_ARRAY(complex),
-			flags);
-	
-	fftw_plan planBackward = fftw_plan_dft_c2r(
-			ndim, &N[0],
-			(fftw_complex*) MULTIDIM_ARRAY(complex),
-			MULTIDIM_ARRAY(real),
-			flags);
-	
-	pthread_mutex_unlock(&fftw_plan_mutex_new);
-	
-	if (planForward == NULL || planBackward == NULL)
-	{
-		REPORT_ERROR("FFTW plans cannot be created");
-	}
-	
-	plan = std::shared_ptr<Plan>(new Plan(planForward, planBackward));
+	// The cache plans on its own arrays, so real and complex are not overwritten by FFTW_MEASURE
+	forward = FftwPlanCache::getPlan(FftwPlanCache::R2C, w, h, d, realPtr, complexPtr, flags);
+	backward = FftwPlanCache::getPlan(FftwPlanCache::C2R, w, h, d, complexPtr, realPtr, flags);
 }
 
 NewFFT::FloatPlan::FloatPlan(int w, int h, int d, unsigned int flags)
@@ -433,38 +375,8 @@ NewFFT::FloatPlan::FloatPlan(int w, int h, int d, unsigned int flags)
 	realPtr(0), 
 	complexPtr(0)
 {
-	MultidimArray<float> realDummy(d,h,w);
-	MultidimArray<fComplex> complexDummy(d,h,w/2+1);
-	
-	std::vector<int> N(0);
-	if (d > 1) N.push_back(d);
-	if (h > 1) N.push_back(h);
-	           N.push_back(w);
-	
-	const int ndim = N.size();
-	
-	pthread_mutex_lock(&fftw_plan_mutex_new);
-	
-	fftwf_plan planForward = fftwf_plan_dft_r2c(
-			ndim, &N[0],
-			MULTIDIM_ARRAY(realDummy),
-			(fftwf_complex*) MULTIDIM_ARRAY(complexDummy),
-			FFTW_UNALIGNED | flags);
-	
-	fftwf_plan planBackward = fftwf_plan_dft_c2r(
-			ndim, &N[0],
-			(fftwf_complex*) MULTIDIM_ARRAY(complexDummy),
-			MULTIDIM_ARRAY(realDummy),
-			FFTW_UNALIGNED | flags);
-	
-	pthread_mutex_unlock(&fftw_plan_mutex_new);
-	
-	if (planForward == NULL || planBackward == NULL)
-	{
-		REPORT_ERROR("FFTW plans cannot be created");
-	}
-	
-	plan = std::shared_ptr<Plan>(new Plan(planForward, planBackward));
+	forward = FftwPlanCache::getPlan(FftwPlanCache::R2C, w, h, d, (float*)NULL, (float*)NULL, FFTW_UNALIGNED | flags);
+	backward = FftwPlanCache::getPlan(FftwPlanCache::C2R, w, h, d, (float*)NULL, (float*)NULL, FFTW_UNALIGNED | flags);
 }
 
 NewFFT::FloatPlan::FloatPlan(
@@ -477,33 +389,6 @@ NewFFT::FloatPlan::FloatPlan(
 	realPtr(MULTIDIM_ARRAY(real)), 
 	complexPtr((float*)MULTIDIM_ARRAY(complex))
 {
-	std::vector<int> N(0);
-	if (d > 1) N.push_back(d);
-	if (h > 1) N.push_back(h);
-	           N.push_back(w);
-	
-	const int ndim = N.size();
-	
-	pthread_mutex_lock(&fftw_plan_mutex_new);
-	
-	fftwf_plan planForward = fftwf_plan_dft_r2c(
-			ndim, &N[0],
-			MULTIDIM_ARRAY(real),
-			(fftwf_complex*) MULTIDIM_ARRAY(complex),
-			flags);
-	
-	fftwf_plan planBackward = fftwf_plan_dft_c2r(
-			ndim, &N[0],
-			(fftwf_complex*) MULTIDIM_ARRAY(complex),
-			MULTIDIM_ARRAY(real),
-			flags);
-	
-	pthread_mutex_unlock(&fftw_plan_mutex_new);
-	
-	if (planForward == NULL || planBackward == NULL)
-	{
-		REPORT_ERROR("FFTW plans cannot be created");
-	}
-	
-	plan = std::shared_ptr<Plan>(new Plan(planForward, planBackward));
+	forward = FftwPlanCache::getPlan(FftwPlanCache::R2C, w, h, d, realPtr, complexPtr, flags);
+	backward = FftwPlanCache::getPlan(FftwPlanCache::C2R, w, h, d, complexPtr, realPtr, flags);
 }
@@ -22,8 +22,6 @@
 #define NEW_FFTW_H
 
 #include <fftw3.h>
-#include <pthread.h>
-#include <memory>
 #include "src/multidim_array.h"
 #include "src/jaz/t_complex.h"
 
@@ -210,9 +208,9 @@ class NewFFT
 
         /* These plan classes can be copied freely.
            The corresponding pairs of fftw_plan instances
-           will be automatically deallocated using fftw_destroy_plan()
-           when no instance of Double/FloatPlan points to them.
-           (note the std::shared_ptr<Plan> 'plan') */
+           belong to FftwPlanCache (src/fftw_plan_cache.h), which
+           makes each of them only once and keeps them until the
+           program ends. */
         class DoublePlan
         {
             public:
@@ -237,12 +235,12 @@ class NewFFT
 
                 fftw_plan getForward() const
                 {
-                    return plan.get()->forward;
+                    return forward;
                 }
 
                 fftw_plan getBackward() const
                 {
-                    return plan.get()->backward;
+                    return backward;
                 }
 
                 bool isCompatible(const MultidimArray<double>& real) const
@@ -264,31 +262,10 @@ class NewFFT
 
             private:
 
-                class Plan
-                {
-                    public:
-
-                        Plan(fftw_plan forward, fftw_plan backward)
-                        :   forward(forward), backward(backward)
-                        {}
-
-                        ~Plan()
-                        {
-                            pthread_mutex_lock(&fftw_plan_mutex_new);
-
-                            fftw_destroy_plan(forward);
-                            fftw_destroy_plan(backward);
-
-                            pthread_mutex_unlock(&fftw_plan_mutex_new);
-                        }
-
-                        fftw_plan forward, backward;
-                };
-
 				bool reusable;
                 int w, h, d;
 				double *realPtr, *complexPtr;
-                std::shared_ptr<Plan> plan;
+                fftw_plan forward, backward;
         };
 
         class FloatPlan
@@ -304,12 +281,12 @@ class NewFFT
 
                 fftwf_plan getForward() const
                 {
-                    return plan.get()->forward;
+                    return forward;
                 }
 
                 fftwf_plan getBackward() const
                 {
-                    return plan.get()->backward;
+                    return backward;
                 }
 
                 bool isCompatible(const MultidimArray<float>& real) const
@@ -333,34 +310,12 @@ class NewFFT
 
             private:
 
-                class Plan
-                {
-                    public:
-
-                        Plan(fftwf_plan forward, fftwf_plan backward)
-                        :   forward(forward), backward(backward)
-                        {}
-
-                        ~Plan()
-                        {
-                            pthread_mutex_lock(&fftw_plan_mutex_new);
-
-                            fftwf_destroy_plan(forward);
-                            fftwf_destroy_plan(backward);
-
-                            pthread_mutex_unlock(&fftw_plan_mutex_new);
-                        }
-
-                        fftwf_plan forward, backward;
-                };
 				
 				bool reusable;
                 int w, h, d;
 				float *realPtr, *complexPtr;
-                std::shared_ptr<Plan> plan;
+                fftwf_plan forward, backward;
         };
-
-        static pthread_mutex_t fftw_plan_mutex_new;
 };
 
 #endif
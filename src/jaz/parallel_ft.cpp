@@ -23,11 +23,10 @@
 #include "src/jaz/parallel_ft.h"
 #include "src/fftw.h"
 #include "src/args.h"
+#include "src/fftw_plan_cache.h"
 #include <string.h>
 #include <math.h>
 
-static pthread_mutex_t fftw_plan_mutex_par = PTHREAD_MUTEX_INITIALIZER;
-
 //#define DEBUG_PLANS
 
 // Constructors and destructors --------------------------------------------
@@ -82,13 +81,8 @@ void ParFourierTransformer::cleanup()
 {
     // First clear object and destroy plans
     clear();
-    // Then clean up all the junk fftw keeps lying around
-    // SOMEHOW THE FOLLOWING IS NOT ALLOWED WHEN USING MULTPLE TRANSFORMER OBJECTS....
-#ifdef RELION_SINGLE_PRECISION
-    fftwf_cleanup();
-#else
-    fftw_cleanup();
-#endif
+    // fftw_cleanup() is not called anymore: it would invalidate the plans in FftwPlanCache,
+    // which are shared by all transformer objects
 
 #ifdef DEBUG_PLANS
     std::cerr << "CLEANED-UP this= "<<this<< std::endl;
@@ -98,23 +92,10 @@ void ParFourierTransformer::cleanup()
 
 void ParFourierTransformer::destroyPlans()
 {
-    // Anything to do with plans has to be protected for threads!
-    pthread_mutex_lock(&fftw_plan_mutex_par);
-
-    if (plans_are_set)
-    {
-#ifdef RELION_SINGLE_PRECISION
-        fftwf_destroy_plan(fPlanForward);
-        fftwf_destroy_plan(fPlanBackward);
-#else
-        fftw_destroy_plan(fPlanForward);
-        fftw_destroy_plan(fPlanBackward);
-#endif
-        plans_are_set = false;
-    }
-
-    pthread_mutex_unlock(&fftw_plan_mutex_par);
-
+    // The plans belong to FftwPlanCache, only forget about them
+    fPlanForward = NULL;
+    fPlanBackward = NULL;
+    plans_are_set = false;
 }
 
 // Initialization ----------------------------------------------------------
@@ -144,60 +125,16 @@ void ParFourierTransformer::setReal(MultidimArray<RFLOAT> &input)
 
     if (recomputePlan)
     {
-        int ndim=3;
-        if (ZSIZE(input)==1)
-        {
-            ndim=2;
-            if (YSIZE(input)==1)
-                ndim=1;
-        }
-        int *N = new int[ndim];
-        switch (ndim)
-        {
-        case 1:
-            N[0]=XSIZE(input);
-            break;
-        case 2:
-            N[0]=YSIZE(input);
-            N[1]=XSIZE(input);
-            break;
-        case 3:
-            N[0]=ZSIZE(input);
-            N[1]=YSIZE(input);
-            N[2]=XSIZE(input);
-            break;
-        }
-
-        // Destroy both forward and backward plans if they already exist
-        destroyPlans();
-
-        // Make new plans
+        fPlanForward = FftwPlanCache::getPlan(FftwPlanCache::R2C, XSIZE(input), YSIZE(input), ZSIZE(input),
+                                              MULTIDIM_ARRAY(*fReal), (RFLOAT*) MULTIDIM_ARRAY(fFourier));
+        fPlanBackward = FftwPlanCache::getPlan(FftwPlanCache::C2R, XSIZE(input), YSIZE(input), ZSIZE(input),
+                                               (RFLOAT*) MULTIDIM_ARRAY(fFourier), MULTIDIM_ARRAY(*fReal));
         plans_are_set = true;
 
-        pthread_mutex_lock(&fftw_plan_mutex_par);
-#ifdef RELION_SINGLE_PRECISION
-        fPlanForward = fftwf_plan_dft_r2c(ndim, N, MULTIDIM_ARRAY(*fReal),
-                                         (fftwf_complex*) MULTIDIM_ARRAY(fFourier), FFTW_ESTIMATE);
-        fPlanBackward = fftwf_plan_dft_c2r(ndim, N,
-                                          (fftwf_complex*) MULTIDIM_ARRAY(fFourier), MULTIDIM_ARRAY(*fReal),
-                                          FFTW_ESTIMATE);
-#else
-        fPlanForward = fftw_plan_dft_r2c(ndim, N, MULTIDIM_ARRAY(*fReal),
-                                         (fftw_complex*) MULTIDIM_ARRAY(fFourier), FFTW_ESTIMATE);
-        fPlanBackward = fftw_plan_dft_c2r(ndim, N,
-                                          (fftw_complex*) MULTIDIM_ARRAY(fFourier), MULTIDIM_ARRAY(*fReal),
-                                          FFTW_ESTIMATE);
-#endif
-        pthread_mutex_unlock(&fftw_plan_mutex_par);
-
-        if (fPlanForward == NULL || fPlanBackward == NULL)
-            REPORT_ERROR("FFTW plans cannot be created");
-
 #ifdef DEBUG_PLANS
         std::cerr << " SETREAL fPlanForward= " << fPlanForward << " fPlanBackward= " << fPlanBackward  <<" this= "<<this<< std::endl;
 #endif
 
-        delete [] N;
         dataPtr=MULTIDIM_ARRAY(*fReal);
     }
 }
@@ -217,53 +154,12 @@ void ParFourierTransformer::setReal(MultidimArray<Complex > &input)
 
     if (recomputePlan)
     {
-        int ndim=3;
-        if (ZSIZE(input)==1)
-        {
-            ndim=2;
-            if (YSIZE(input)==1)
-                ndim=1;
-        }
-        int *N = new int[ndim];
-        switch (ndim)
-        {
-        case 1:
-            N[0]=XSIZE(input);
-            break;
-        case 2:
-            N[0]=YSIZE(input);
-            N[1]=XSIZE(input);
-            break;
-        case 3:
-            N[0]=ZSIZE(input);
-            N[1]=YSIZE(input);
-            N[2]=XSIZE(input);
-            break;
-        }
-
-        // Destroy both forward and backward plans if they already exist
-        destroyPlans();
-
+        fPlanForward = FftwPlanCache::getPlan(FftwPlanCache::C2C_FORWARD, XSIZE(input), YSIZE(input), ZSIZE(input),
+                                              (RFLOAT*) MULTIDIM_ARRAY(*fComplex), (RFLOAT*) MULTIDIM_ARRAY(fFourier));
+        fPlanBackward = FftwPlanCache::getPlan(FftwPlanCache::C2C_BACKWARD, XSIZE(input), YSIZE(input), ZSIZE(input),
+                                               (RFLOAT*) MULTIDIM_ARRAY(fFourier), (RFLOAT*) MULTIDIM_ARRAY(*fComplex));
         plans_are_set = true;
 
-        pthread_mutex_lock(&fftw_plan_mutex_par);
-#ifdef RELION_SINGLE_PRECISION
-        fPlanForward = fftwf_plan_dft(ndim, N, (fftwf_complex*) MULTIDIM_ARRAY(*fComplex),
-                                     (fftwf_complex*) MULTIDIM_ARRAY(fFourier), FFTW_FORWARD, FFTW_ESTIMATE);
-        fPlanBackward = fftwf_plan_dft(ndim, N, (fftwf_complex*) MULTIDIM_ARRAY(fFourier),
-                                      (fftwf_complex*) MULTIDIM_ARRAY(*fComplex), FFTW_BACKWARD, FFTW_ESTIMATE);
-#else
-        fPlanForward = fftw_plan_dft(ndim, N, (fftw_complex*) MULTIDIM_ARRAY(*fComplex),
-                                     (fftw_complex*) MULTIDIM_ARRAY(fFourier), FFTW_FORWARD, FFTW_ESTIMATE);
-        fPlanBackward = fftw_plan_dft(ndim, N, (fftw_complex*) MULTIDIM_ARRAY(fFourier),
-                                      (fftw_complex*) MULTIDIM_ARRAY(*fComplex), FFTW_BACKWARD, FFTW_ESTIMATE);
-#endif
-        pthread_mutex_unlock(&fftw_plan_mutex_par);
-
-        if (fPlanForward == NULL || fPlanBackward == NULL)
-            REPORT_ERROR("FFTW plans cannot be created");
-
-        delete [] N;
         complexDataPtr=MULTIDIM_ARRAY(*fComplex);
     }
 }
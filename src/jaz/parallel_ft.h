@@ -241,11 +241,11 @@ public:
     /** Clear object */
     void clear();
 
-    /** This calls fftw_cleanup.
+    /** Same as clear() (fftw_cleanup would invalidate the plans in FftwPlanCache).
     */
     void cleanup();
 
-    /** Destroy both forward and backward fftw planes (mutex locked */
+    /** Forget both forward and backward fftw plans (they belong to FftwPlanCache) */
     void destroyPlans();
 
     /** Computes the transform, specified in Init() function
@@ -30,6 +30,7 @@
 #include <src/micrograph_model.h>
 #include <src/jaz/resampling_helper.h>
 #include <src/jaz/parallel_ft.h>
+#include <src/movie_reader.h>
 
 #include <omp.h>
 
@@ -642,23 +643,21 @@ std::vector<std::vector<Image<Complex>>> StackHelper::extractMovieStackFS(
 	std::vector<std::vector<Image<Complex>>> out(mdt->numberOfObjects());
 	const long pc = mdt->numberOfObjects();
 	
-	Image<float> mgStack;
-	mgStack.read(movieFn, false);
+	// open the movie only once (for TIFF, this also indexes the frames)
+	MovieReader movie;
+	movie.open(movieFn);
 	
 	if (verbose)
 	{
 		std::cout << "size: "
-				  << mgStack().xdim << "x"
-				  << mgStack().ydim << "x"
-				  << mgStack().zdim << "x"
-				  << mgStack().ndim << "\n";
+				  << movie.getWidth() << "x"
+				  << movie.getHeight() << "x"
+				  << movie.getNumberOfFrames() << "\n";
 	}
 	
-	const bool dataInZ = mgStack.data.zdim > 1;
-	
-	const int w0 = mgStack.data.xdim;
-	const int h0 = mgStack.data.ydim;
-	const int fcM = dataInZ? mgStack.data.zdim : mgStack.data.ndim;
+	const int w0 = movie.getWidth();
+	const int h0 = movie.getHeight();
+	const int fcM = movie.getNumberOfFrames();
 	const int fc = lastFrame > 0? lastFrame - firstFrame + 1 : fcM - firstFrame;
 	
 	if (fcM <= lastFrame)
@@ -674,9 +673,6 @@ std::vector<std::vector<Image<Complex>>> StackHelper::extractMovieStackFS(
 	
 	if (verbose)
 	{
-		if (dataInZ) std::cout << "data in Z\n";
-		else std::cout << "data in N\n";
-		
 		std::cout << "frame count in movie = " << fcM << "\n";
 		std::cout << "frame count to load  = " << fc << "\n";
 		
@@ -722,7 +718,7 @@ std::vector<std::vector<Image<Complex>>> StackHelper::extractMovieStackFS(
 		int tf = omp_get_thread_num();
 		
 		Image<float> muGraph;
-		muGraph.read(movieFn, true, f+firstFrame, false, true);
+		movie.readFrame(f+firstFrame, muGraph());
 		
 		if (verbose) std::cout << (f+1) << "/" << fc << "\n";
 		
@@ -0,0 +1,146 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+
+#include "src/mapped_file.h"
+#include "src/error.h"
+#include "src/strings.h"
+#include <algorithm>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+MappedFile::MappedFile()
+:	data(NULL),
+	length(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const FileName& fn)
+{
+	close();
+
+	int fd = ::open(fn.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	void* ptr = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping stays valid after closing the file descriptor
+	::close(fd);
+
+	if (ptr == MAP_FAILED)
+		return false;
+
+#ifdef MADV_SEQUENTIAL
+	madvise(ptr, info.st_size, MADV_SEQUENTIAL);
+#endif
+
+	data = (const char*)ptr;
+	length = info.st_size;
+
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (data != NULL)
+	{
+		munmap((void*)data, length);
+		data = NULL;
+		length = 0;
+	}
+}
+
+MappedScratchFile::MappedScratchFile()
+:	data(NULL),
+	length(0)
+{
+}
+
+MappedScratchFile::~MappedScratchFile()
+{
+	close();
+}
+
+void MappedScratchFile::create(const FileName& dir, size_t size)
+{
+	close();
+	if (size == 0)
+		return;
+
+	std::string fn = dir + "/relion_scratch_XXXXXX";
+	std::vector<char> fn_template(fn.begin(), fn.end());
+	fn_template.push_back('\0');
+
+	int fd = mkstemp(&fn_template[0]);
+	if (fd < 0)
+		REPORT_ERROR("MappedScratchFile::create ERROR: cannot create a file in directory " + dir);
+	unlink(&fn_template[0]);
+
+	// The file is sparse: its pages read as zeros until they are written
+	if (ftruncate(fd, size) != 0)
+	{
+		::close(fd);
+		REPORT_ERROR("MappedScratchFile::create ERROR: cannot make a file of " + floatToString(size / (1024. * 1024. * 1024.)) + " Gb in directory " + dir);
+	}
+
+	void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (ptr == MAP_FAILED)
+		REPORT_ERROR("MappedScratchFile::create ERROR: cannot map a file of " + floatToString(size / (1024. * 1024. * 1024.)) + " Gb in directory " + dir);
+
+	data = (char*)ptr;
+	length = size;
+}
+
+void MappedScratchFile::close()
+{
+	if (data != NULL)
+	{
+		munmap(data, length);
+		data = NULL;
+		length = 0;
+	}
+}
+
+void MappedScratchFile::release(size_t offset, size_t size)
+{
+	// Whole pages only, including those that are partly outside the range:
+	// the pages of a shared mapping are read back from the file when needed
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t first = (offset / page) * page;
+	size_t last = std::min(offset + size, length);
+	if (data == NULL || last <= first)
+		return;
+	madvise(data + first, last - first, MADV_DONTNEED);
+}
@@ -0,0 +1,120 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include "src/filename.h"
+
+/*	class MappedFile:
+ *
+ *	- read-only memory map of an entire file
+ *	- the mapping is released when the object goes out of scope
+ */
+class MappedFile
+{
+public:
+
+	MappedFile();
+	~MappedFile();
+
+	// Map the file, return false if it cannot be opened or mapped
+	bool open(const FileName& fn);
+
+	// Release the mapping
+	void close();
+
+	bool isOpen() const
+	{
+		return data != NULL;
+	}
+
+	const char* begin() const
+	{
+		return data;
+	}
+
+	const char* end() const
+	{
+		return data + length;
+	}
+
+	size_t size() const
+	{
+		return length;
+	}
+
+private:
+
+	// Not copyable
+	MappedFile(const MappedFile&);
+	MappedFile& operator = (const MappedFile&);
+
+	const char* data;
+	size_t length;
+};
+
+/*	class MappedScratchFile:
+ *
+ *	- writable, zero-filled memory map of a new file in a given directory, for
+ *	  arrays that do not fit in RAM
+ *	- the file is removed as soon as it is mapped, so it disappears with the
+ *	  mapping, also when the program crashes
+ *	- release() drops pages from the memory of the process: they are written back
+ *	  to the file, and read again when they are accessed next
+ */
+class MappedScratchFile
+{
+public:
+
+	MappedScratchFile();
+	~MappedScratchFile();
+
+	// Create and map a file of the given size in directory dir
+	void create(const FileName& dir, size_t size);
+
+	// Release the mapping and the disc space
+	void close();
+
+	char* begin() const
+	{
+		return data;
+	}
+
+	size_t size() const
+	{
+		return length;
+	}
+
+	// Drop the pages of bytes [offset, offset + size) from memory
+	void release(size_t offset, size_t size);
+
+private:
+
+	// Not copyable
+	MappedScratchFile(const MappedScratchFile&);
+	MappedScratchFile& operator = (const MappedScratchFile&);
+
+	char* data;
+	size_t length;
+};
+
+#endif
@@ -18,6 +18,12 @@
  * author citations must be preserved.
  ***************************************************************************/
 #include "src/memory.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#if !defined(__APPLE__)
+#include <malloc.h>
+#endif
 
 char*  askMemory(unsigned long memsize) 
 { 
@@ -54,3 +60,38 @@ int  freeMemory(void* ptr, unsigned long memsize)
     return(0);
 }
 
+size_t getCurrentRSS()
+{
+    FILE* fh = fopen("/proc/self/statm", "r");
+    if (fh == NULL)
+        return 0;
+
+    long pages_total, pages_resident;
+    int n = fscanf(fh, "%ld %ld", &pages_total, &pages_resident);
+    fclose(fh);
+
+    if (n != 2)
+        return 0;
+
+    return (size_t)pages_resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+size_t getPeakRSS()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+
+#if defined(__APPLE__)
+    return (size_t)usage.ru_maxrss;
+#else
+    return (size_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+void releaseFreeMemory()
+{
+#if !defined(__APPLE__)
+    malloc_trim(0);
+#endif
+}
@@ -184,6 +184,19 @@ char* askMemory(unsigned long size);
 */
 int freeMemory(void* ptr, unsigned long memsize);
 
+/** Resident set size of this process in bytes.
+ *
+ * Reads /proc/self/statm; returns 0 where that is not available.
+ */
+size_t getCurrentRSS();
+
+/** Peak resident set size of this process in bytes (from getrusage). */
+size_t getPeakRSS();
+
+/** Return freed heap memory to the operating system (where supported),
+ * so that subsequent getCurrentRSS() calls are meaningful. */
+void releaseFreeMemory();
+
 //@}
 #endif
 
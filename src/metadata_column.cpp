@@ -0,0 +1,269 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include "src/metadata_column.h"
+
+MetaDataStringColumn::MetaDataStringColumn()
+:	ids(0),
+	chars(0),
+	offsets(0),
+	buckets(0)
+{
+}
+
+void MetaDataStringColumn::set(long row, const std::string& value)
+{
+	ids[row] = intern(value.c_str(), value.length());
+}
+
+void MetaDataStringColumn::push_back(const std::string& value)
+{
+	ids.push_back(intern(value.c_str(), value.length()));
+}
+
+void MetaDataStringColumn::push_back(const char* value, size_t length)
+{
+	ids.push_back(intern(value, length));
+}
+
+void MetaDataStringColumn::resize(size_t n, const std::string& value)
+{
+	if (n > ids.size())
+	{
+		ids.resize(n, intern(value.c_str(), value.length()));
+	}
+	else
+	{
+		ids.resize(n);
+	}
+}
+
+void MetaDataStringColumn::reserve(size_t n)
+{
+	ids.reserve(n);
+}
+
+void MetaDataStringColumn::clear()
+{
+	ids.clear();
+	chars.clear();
+	offsets.clear();
+	buckets.clear();
+}
+
+void MetaDataStringColumn::append(const MetaDataStringColumn& src, const std::vector<long>& rows)
+{
+	ids.reserve(ids.size() + rows.size());
+
+	if (&src == this)
+	{
+		// Appending from itself: no new strings, just repeat the ids
+		for (long i = 0; i < rows.size(); i++)
+		{
+			ids.push_back(ids[rows[i]]);
+		}
+		return;
+	}
+
+	// Translate the ids of src into ids of this pool only once per distinct string
+	std::vector<int> translation(src.offsets.size(), -1);
+
+	for (long i = 0; i < rows.size(); i++)
+	{
+		const int sid = src.ids[rows[i]];
+
+		if (translation[sid] < 0)
+		{
+			const char* str = src.getString(sid);
+			translation[sid] = intern(str, strlen(str));
+		}
+
+		ids.push_back(translation[sid]);
+	}
+}
+
+void MetaDataStringColumn::append(const MetaDataStringColumn& src)
+{
+	ids.reserve(ids.size() + src.ids.size());
+
+	// Translate the whole pool of src at once
+	std::vector<int> translation(src.offsets.size());
+
+	for (long id = 0; id < src.offsets.size(); id++)
+	{
+		const char* str = src.getString(id);
+		translation[id] = intern(str, strlen(str));
+	}
+
+	for (long i = 0; i < src.ids.size(); i++)
+	{
+		ids.push_back(translation[src.ids[i]]);
+	}
+}
+
+void MetaDataStringColumn::permute(const std::vector<long>& order)
+{
+	std::vector<int> newIds(order.size());
+
+	for (long i = 0; i < order.size(); i++)
+	{
+		newIds[i] = ids[order[i]];
+	}
+
+	ids.swap(newIds);
+}
+
+void MetaDataStringColumn::erase(long row)
+{
+	ids.erase(ids.begin() + row);
+}
+
+void MetaDataStringColumn::compact()
+{
+	std::vector<int> translation(offsets.size(), -1);
+	std::vector<char> newChars;
+	std::vector<size_t> newOffsets;
+
+	for (long i = 0; i < ids.size(); i++)
+	{
+		const int id = ids[i];
+
+		if (translation[id] < 0)
+		{
+			const char* str = getString(id);
+			translation[id] = newOffsets.size();
+			newOffsets.push_back(newChars.size());
+			newChars.insert(newChars.end(), str, str + strlen(str) + 1);
+		}
+
+		ids[i] = translation[id];
+	}
+
+	chars.swap(newChars);
+	offsets.swap(newOffsets);
+	rehash(buckets.size());
+}
+
+size_t MetaDataStringColumn::memoryUsage() const
+{
+	return ids.capacity() * sizeof(int)
+	     + chars.capacity() * sizeof(char)
+	     + offsets.capacity() * sizeof(size_t)
+	     + buckets.capacity() * sizeof(int);
+}
+
+bool MetaDataStringColumn::assign(const int* rowIds, size_t nr_rows, const char* pool, size_t pool_size)
+{
+	clear();
+
+	if (pool_size > 0 && pool[pool_size - 1] != '\0')
+		return false;
+
+	chars.assign(pool, pool + pool_size);
+
+	for (size_t i = 0; i < pool_size; i += strlen(pool + i) + 1)
+	{
+		offsets.push_back(i);
+	}
+
+	ids.assign(rowIds, rowIds + nr_rows);
+
+	for (size_t i = 0; i < nr_rows; i++)
+	{
+		if (ids[i] < 0 || ids[i] >= offsets.size())
+		{
+			clear();
+			return false;
+		}
+	}
+
+	size_t nr_buckets = 16;
+	while (nr_buckets < 2 * offsets.size()) nr_buckets *= 2;
+	rehash(nr_buckets);
+
+	return true;
+}
+
+int MetaDataStringColumn::intern(const char* value, size_t length)
+{
+	// Keep the load factor of the hash table below 1/2
+	if (2 * (offsets.size() + 1) > buckets.size())
+	{
+		rehash(buckets.size() < 16 ? 16 : 2 * buckets.size());
+	}
+
+	const size_t mask = buckets.size() - 1;
+	size_t b = hashString(value, length) & mask;
+
+	while (buckets[b] >= 0)
+	{
+		const char* str = getString(buckets[b]);
+
+		if (strncmp(str, value, length) == 0 && str[length] == '\0')
+		{
+			return buckets[b];
+		}
+
+		b = (b + 1) & mask;
+	}
+
+	const int id = offsets.size();
+	offsets.push_back(chars.size());
+	chars.insert(chars.end(), value, value + length);
+	chars.push_back('\0');
+	buckets[b] = id;
+
+	return id;
+}
+
+void MetaDataStringColumn::rehash(size_t nr_buckets)
+{
+	buckets.assign(nr_buckets, -1);
+
+	if (nr_buckets == 0) return;
+
+	const size_t mask = nr_buckets - 1;
+
+	for (long id = 0; id < offsets.size(); id++)
+	{
+		const char* str = getString(id);
+		size_t b = hashString(str, strlen(str)) & mask;
+
+		while (buckets[b] >= 0)
+		{
+			b = (b + 1) & mask;
+		}
+
+		buckets[b] = id;
+	}
+}
+
+size_t MetaDataStringColumn::hashString(const char* value, size_t length)
+{
+	// FNV-1a
+	size_t hash = 2166136261u;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		hash ^= (unsigned char)value[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
@@ -0,0 +1,140 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef METADATA_COLUMN_H
+#define METADATA_COLUMN_H
+
+#include <vector>
+#include <string>
+#include <cstring>
+
+/*	class MetaDataStringColumn:
+ *
+ *	- stores one string-valued column of a MetaDataTable
+ *	- every distinct string is stored only once (interned), back to back in
+ *	  a single character buffer, so there is no allocation per string
+ *	- each row only holds the index of its string inside the pool,
+ *	  so two rows hold the same string if and only if their ids are equal
+ *	- strings that are no longer referenced stay in the pool until the
+ *	  column is compacted
+ */
+class MetaDataStringColumn
+{
+public:
+
+	MetaDataStringColumn();
+
+	size_t size() const
+	{
+		return ids.size();
+	}
+
+	std::string get(long row) const
+	{
+		return std::string(c_str(row));
+	}
+
+	const char* c_str(long row) const
+	{
+		return &chars[offsets[ids[row]]];
+	}
+
+	// Index of the (unique) string in this row
+	long getId(long row) const
+	{
+		return ids[row];
+	}
+
+	// String corresponding to an id returned by getId()
+	const char* getString(long id) const
+	{
+		return &chars[offsets[id]];
+	}
+
+	// Number of distinct strings in the pool
+	long numberOfUniqueValues() const
+	{
+		return offsets.size();
+	}
+
+	void set(long row, const std::string& value);
+	void push_back(const std::string& value);
+	void push_back(const char* value, size_t length);
+	void resize(size_t n, const std::string& value);
+	void reserve(size_t n);
+	void clear();
+
+	// Append the given rows of 'src' (which may be this column itself)
+	void append(const MetaDataStringColumn& src, const std::vector<long>& rows);
+
+	// Append all rows of 'src' (which must be another column)
+	void append(const MetaDataStringColumn& src);
+
+	// Reorder the rows such that new row i is old row order[i]
+	// ('order' may also select a subset of the rows)
+	void permute(const std::vector<long>& order);
+
+	// Remove a single row
+	void erase(long row);
+
+	// Remove strings from the pool that are not referenced anymore
+	void compact();
+
+	// Approximate number of bytes in use
+	size_t memoryUsage() const;
+
+	// Raw storage, for binary I/O: the per-row ids and the '\0'-terminated strings of the pool
+	const std::vector<int>& getIds() const
+	{
+		return ids;
+	}
+
+	const std::vector<char>& getPool() const
+	{
+		return chars;
+	}
+
+	// Replace the contents by nr_rows ids into a pool as returned by getIds() and getPool()
+	// Returns false if the data is inconsistent
+	bool assign(const int* rowIds, size_t nr_rows, const char* pool, size_t pool_size);
+
+private:
+
+	// Return the id of value, add it to the pool if necessary
+	int intern(const char* value, size_t length);
+
+	// Rebuild the hash table with the given number of buckets (a power of two)
+	void rehash(size_t nr_buckets);
+
+	static size_t hashString(const char* value, size_t length);
+
+	// Per-row index into the pool
+	std::vector<int> ids;
+
+	// All distinct strings, each terminated by '\0'
+	std::vector<char> chars;
+
+	// Start of each distinct string in chars
+	std::vector<size_t> offsets;
+
+	// Open-addressing hash table of ids into the pool (-1 = empty)
+	std::vector<int> buckets;
+};
+
+#endif
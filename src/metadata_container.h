@@ -31,35 +31,29 @@
 
 class MetaDataTable;
 
+/*	class MetaDataContainer:
+ *
+ *	- refers to a single row (object) of a MetaDataTable
+ *	- the values themselves are stored column-wise inside the table,
+ *	  so a container is only a (table, objectID) pair
+ *	- containers are returned by value (see MetaDataTable::getObject()), and
+ *	  refer to the row by its index
+ */
 class MetaDataContainer
 {
     public:
 
-        MetaDataTable* table;
+        const MetaDataTable* table;
 
-        std::vector<double> doubles;
-        std::vector<long> ints;
-        std::vector<bool> bools;
-        std::vector<std::string> strings;
+        long objectID;
 
         MetaDataContainer();
-        MetaDataContainer(MetaDataTable* table, long doubleCount, long intCount,
-                          long boolCount, long stringCount);
-        MetaDataContainer(MetaDataTable* table, MetaDataContainer* mdc);
-
-        void getValue(long offset, double& dest) const;
-        void getValue(long offset, float& dest) const;
-        void getValue(long offset, int& dest) const;
-        void getValue(long offset, long& dest) const;
-        void getValue(long offset, bool& dest) const;
-        void getValue(long offset, std::string& dest) const;
+        MetaDataContainer(const MetaDataTable* table, long objectID);
 
-        void setValue(long offset, const double& src);
-        void setValue(long offset, const float& src);
-        void setValue(long offset, const int& src);
-        void setValue(long offset, const long& src);
-        void setValue(long offset, const bool& src);
-        void setValue(long offset, const std::string& src);
+        // Returns true if the label exists in the table
+        // (defined in metadata_table.h)
+        template<class T>
+        bool getValue(EMDLabel label, T& dest) const;
 };
 
 #endif
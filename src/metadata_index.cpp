@@ -0,0 +1,425 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+
+#include "src/metadata_index.h"
+#include "src/metadata_table.h"
+#include <cstring>
+#include <cmath>
+
+	inline size_t hashMixIndex(size_t hash, size_t value)
+	{
+		hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+		return hash;
+	}
+
+	inline size_t hashDoubleIndex(double value)
+	{
+		// +0 and -0 compare equal, so they should have the same hash
+		if (value == 0.) value = 0.;
+		unsigned long long bits;
+		memcpy(&bits, &value, sizeof(double));
+		return (size_t)(bits ^ (bits >> 29));
+	}
+
+	inline size_t hashStringIndex(const char* value)
+	{
+		// FNV-1a
+		size_t hash = 2166136261u;
+		for (; *value != '\0'; value++)
+		{
+			hash ^= (unsigned char)*value;
+			hash *= 16777619u;
+		}
+		return hash;
+	}
+
+MetaDataIndex::MetaDataIndex(const MetaDataTable& mdt, EMDLabel label)
+:	mdt(mdt),
+	labels(1, label)
+{
+	build();
+}
+
+MetaDataIndex::MetaDataIndex(const MetaDataTable& mdt, const std::vector<EMDLabel>& labels)
+:	mdt(mdt),
+	labels(labels)
+{
+	build();
+}
+
+void MetaDataIndex::build()
+{
+	if (labels.size() == 0)
+		REPORT_ERROR("MetaDataIndex: no labels given");
+
+	stringHashes.resize(labels.size());
+	for (long i = 0; i < labels.size(); i++)
+	{
+		if (!mdt.containsLabel(labels[i]))
+			REPORT_ERROR("MetaDataIndex: the table does not contain " + EMDL::label2Str(labels[i]));
+
+		// Hash every distinct string only once
+		if (EMDL::isString(labels[i]))
+		{
+			const MetaDataStringColumn& column = *mdt.getStringColumn(labels[i]);
+			stringHashes[i].resize(column.numberOfUniqueValues());
+			for (long id = 0; id < column.numberOfUniqueValues(); id++)
+				stringHashes[i][id] = hashStringIndex(column.getString(id));
+		}
+	}
+
+	const long nr_rows = mdt.numberOfObjects();
+
+	// There are at most as many keys as rows: keep the load factor below 1/2 without rehashing
+	size_t nr_buckets = 16;
+	while (nr_buckets < 2 * nr_rows) nr_buckets *= 2;
+	buckets.assign(nr_buckets, -1);
+	const size_t mask = nr_buckets - 1;
+
+	rowKeys.resize(nr_rows);
+	for (long row = 0; row < nr_rows; row++)
+	{
+		const size_t hash = hashRow(mdt, row);
+		size_t b = hash & mask;
+		long key = -1;
+
+		while (buckets[b] >= 0)
+		{
+			const long k = buckets[b];
+			if (keyHashes[k] == hash && equalRows(mdt, row, keyRow[k]))
+			{
+				key = k;
+				break;
+			}
+			b = (b + 1) & mask;
+		}
+
+		if (key < 0)
+		{
+			key = keyRow.size();
+			keyRow.push_back(row);
+			keyHashes.push_back(hash);
+			buckets[b] = key;
+		}
+
+		rowKeys[row] = key;
+	}
+
+	// Group the rows by key (counting sort, which keeps the table order within a key)
+	const long nr_keys = keyRow.size();
+	keyStart.assign(nr_keys + 1, 0);
+	for (long row = 0; row < nr_rows; row++)
+		keyStart[rowKeys[row] + 1]++;
+	for (long k = 0; k < nr_keys; k++)
+		keyStart[k + 1] += keyStart[k];
+
+	std::vector<long> fill(keyStart.begin(), keyStart.end() - 1);
+	keyRows.resize(nr_rows);
+	for (long row = 0; row < nr_rows; row++)
+		keyRows[fill[rowKeys[row]]++] = row;
+}
+
+long MetaDataIndex::findKey(const MetaDataTable& other, long row) const
+{
+	const size_t hash = hashRow(other, row);
+	const size_t mask = buckets.size() - 1;
+
+	for (size_t b = hash & mask; buckets[b] >= 0; b = (b + 1) & mask)
+	{
+		const long k = buckets[b];
+		if (keyHashes[k] == hash && equalRows(other, row, keyRow[k]))
+			return k;
+	}
+
+	return -1;
+}
+
+long MetaDataIndex::findKey(const std::string& value) const
+{
+	if (labels.size() != 1 || !EMDL::isString(labels[0]))
+		REPORT_ERROR("MetaDataIndex::findKey: a string can only be looked up in an index on a single string label");
+
+	const MetaDataStringColumn& column = *mdt.getStringColumn(labels[0]);
+	const size_t hash = hashMixIndex(0, hashStringIndex(value.c_str()));
+	const size_t mask = buckets.size() - 1;
+
+	for (size_t b = hash & mask; buckets[b] >= 0; b = (b + 1) & mask)
+	{
+		const long k = buckets[b];
+		if (keyHashes[k] == hash && strcmp(column.c_str(keyRow[k]), value.c_str()) == 0)
+			return k;
+	}
+
+	return -1;
+}
+
+size_t MetaDataIndex::hashRow(const MetaDataTable& other, long row) const
+{
+	size_t hash = 0;
+
+	for (long i = 0; i < labels.size(); i++)
+	{
+		const EMDLabel label = labels[i];
+		size_t value;
+
+		if (EMDL::isDouble(label))
+		{
+			value = hashDoubleIndex((*other.getDoubleColumn(label))[row]);
+		}
+		else if (EMDL::isInt(label))
+		{
+			value = (size_t)(*other.getIntColumn(label))[row];
+		}
+		else if (EMDL::isBool(label))
+		{
+			value = ((*other.getBoolColumn(label))[row] != 0);
+		}
+		else
+		{
+			const MetaDataStringColumn* column = other.getStringColumn(label);
+			if (column == NULL)
+				REPORT_ERROR("MetaDataIndex: the table does not contain " + EMDL::label2Str(label));
+
+			value = (&other == &mdt) ? stringHashes[i][column->getId(row)] : hashStringIndex(column->c_str(row));
+		}
+
+		hash = hashMixIndex(hash, value);
+	}
+
+	return hash;
+}
+
+bool MetaDataIndex::equalRows(const MetaDataTable& other, long row, long myRow) const
+{
+	for (long i = 0; i < labels.size(); i++)
+	{
+		const EMDLabel label = labels[i];
+
+		if (EMDL::isDouble(label))
+		{
+			if ((*other.getDoubleColumn(label))[row] != (*mdt.getDoubleColumn(label))[myRow]) return false;
+		}
+		else if (EMDL::isInt(label))
+		{
+			if ((*other.getIntColumn(label))[row] != (*mdt.getIntColumn(label))[myRow]) return false;
+		}
+		else if (EMDL::isBool(label))
+		{
+			if (((*other.getBoolColumn(label))[row] != 0) != ((*mdt.getBoolColumn(label))[myRow] != 0)) return false;
+		}
+		else
+		{
+			const MetaDataStringColumn& mine = *mdt.getStringColumn(label);
+			const MetaDataStringColumn& theirs = *other.getStringColumn(label);
+
+			if (&other == &mdt)
+			{
+				// Within one table, equal strings have equal ids
+				if (theirs.getId(row) != mine.getId(myRow)) return false;
+			}
+			else if (strcmp(theirs.c_str(row), mine.c_str(myRow)) != 0)
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+	template<class T>
+	void copyJoinedColumn(const MetaDataTable& MDright, MetaDataTable& MDout, EMDLabel label, const std::vector<long>& rightIds)
+	{
+		T value;
+		for (long i = 0; i < rightIds.size(); i++)
+		{
+			if (rightIds[i] >= 0)
+			{
+				MDright.getValue(label, value, rightIds[i]);
+				MDout.setValue(label, value, i);
+			}
+		}
+	}
+
+MetaDataTable joinMetaDataTables(const MetaDataTable& MDleft, const MetaDataTable& MDright,
+                                 const std::vector<EMDLabel>& keys, MetaDataJoinType type)
+{
+	for (long i = 0; i < keys.size(); i++)
+	{
+		if (!MDleft.containsLabel(keys[i]) || !MDright.containsLabel(keys[i]))
+			REPORT_ERROR("joinMetaDataTables: both tables should contain " + EMDL::label2Str(keys[i]));
+	}
+
+	const MetaDataIndex index(MDright, keys);
+
+	// Pairs of rows that go into the output (-1 for a left row without a match)
+	std::vector<long> leftIds, rightIds;
+	for (long row = 0; row < MDleft.numberOfObjects(); row++)
+	{
+		const long key = index.findKey(MDleft, row);
+
+		switch (type)
+		{
+		case JOIN_INNER:
+		case JOIN_LEFT:
+			if (key >= 0)
+			{
+				for (long i = 0; i < index.numberOfRows(key); i++)
+				{
+					leftIds.push_back(row);
+					rightIds.push_back(index.getRow(key, i));
+				}
+			}
+			else if (type == JOIN_LEFT)
+			{
+				leftIds.push_back(row);
+				rightIds.push_back(-1);
+			}
+			break;
+		case JOIN_SEMI:
+			if (key >= 0) leftIds.push_back(row);
+			break;
+		case JOIN_ANTI:
+			if (key < 0) leftIds.push_back(row);
+			break;
+		}
+	}
+
+	MetaDataTable MDout;
+	std::vector<EMDLabel> leftLabels = MDleft.getActiveLabels();
+	for (long i = 0; i < leftLabels.size(); i++)
+		MDout.addLabel(leftLabels[i]);
+	MDout.addObjects(MDleft, leftIds);
+
+	if (type == JOIN_INNER || type == JOIN_LEFT)
+	{
+		std::vector<EMDLabel> rightLabels = MDright.getActiveLabels();
+		for (long i = 0; i < rightLabels.size(); i++)
+		{
+			const EMDLabel label = rightLabels[i];
+			if (MDleft.containsLabel(label)) continue;
+
+			MDout.addLabel(label);
+			if (EMDL::isDouble(label))
+				copyJoinedColumn<double>(MDright, MDout, label, rightIds);
+			else if (EMDL::isInt(label))
+				copyJoinedColumn<long>(MDright, MDout, label, rightIds);
+			else if (EMDL::isBool(label))
+				copyJoinedColumn<bool>(MDright, MDout, label, rightIds);
+			else
+				copyJoinedColumn<std::string>(MDright, MDout, label, rightIds);
+		}
+	}
+
+	return MDout;
+}
+
+MetaDataTable groupMetaDataTable(const MetaDataTable& MDin, const std::vector<EMDLabel>& keys,
+                                 const std::vector<MetaDataAggregate>& aggregates)
+{
+	const MetaDataIndex index(MDin, keys);
+	const long nr_keys = index.numberOfKeys();
+
+	// The key values are taken from the first row of every group
+	MetaDataTable MDout;
+	std::vector<long> firstRows(nr_keys);
+	for (long k = 0; k < nr_keys; k++)
+		firstRows[k] = index.getRow(k);
+	for (long i = 0; i < keys.size(); i++)
+		MDout.addLabel(keys[i]);
+	MDout.addValuesOfDefinedLabels(MDin, firstRows);
+
+	std::vector<double> result(nr_keys);
+	for (long a = 0; a < aggregates.size(); a++)
+	{
+		const MetaDataAggregateType type = aggregates[a].type;
+		const EMDLabel input = aggregates[a].input;
+		const EMDLabel output = aggregates[a].output;
+
+		if (!EMDL::isNumber(output))
+			REPORT_ERROR("groupMetaDataTable: the output label " + EMDL::label2Str(output) + " should be numerical");
+
+		const std::vector<double>* doubles = NULL;
+		const std::vector<long>* ints = NULL;
+		if (type != AGGREGATE_COUNT)
+		{
+			doubles = MDin.getDoubleColumn(input);
+			ints = MDin.getIntColumn(input);
+			if (doubles == NULL && ints == NULL)
+				REPORT_ERROR("groupMetaDataTable: the table does not contain a numerical column " + EMDL::label2Str(input));
+		}
+
+		for (long k = 0; k < nr_keys; k++)
+		{
+			const long n = index.numberOfRows(k);
+			if (type == AGGREGATE_COUNT)
+			{
+				result[k] = n;
+				continue;
+			}
+
+			double sum = 0., sum2 = 0., min = 0., max = 0.;
+			for (long i = 0; i < n; i++)
+			{
+				const long row = index.getRow(k, i);
+				const double value = (doubles != NULL) ? (*doubles)[row] : (double)(*ints)[row];
+				sum += value;
+				sum2 += value * value;
+				if (i == 0 || value < min) min = value;
+				if (i == 0 || value > max) max = value;
+			}
+
+			switch (type)
+			{
+			case AGGREGATE_SUM:
+				result[k] = sum;
+				break;
+			case AGGREGATE_MEAN:
+				result[k] = sum / n;
+				break;
+			case AGGREGATE_MIN:
+				result[k] = min;
+				break;
+			case AGGREGATE_MAX:
+				result[k] = max;
+				break;
+			case AGGREGATE_STDDEV:
+				{
+					const double mean = sum / n;
+					result[k] = sqrt(XMIPP_MAX(0., sum2 / n - mean * mean));
+				}
+				break;
+			default:
+				break;
+			}
+		}
+
+		MDout.addLabel(output);
+		for (long k = 0; k < nr_keys; k++)
+		{
+			if (EMDL::isDouble(output))
+				MDout.setValue(output, result[k], k);
+			else
+				MDout.setValue(output, (long)floor(result[k] + 0.5), k);
+		}
+	}
+
+	return MDout;
+}
@@ -0,0 +1,145 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+
+#ifndef METADATA_INDEX_H
+#define METADATA_INDEX_H
+
+#include <vector>
+#include <string>
+#include "src/metadata_label.h"
+
+class MetaDataTable;
+
+/*	class MetaDataIndex:
+ *
+ *	- hash index over the values of one or more labels (the key) of a MetaDataTable
+ *	- every distinct combination of values gets a key number, in order of first occurrence
+ *	- the rows with a given key can be retrieved in table order
+ *	- rows of other tables that contain the same labels can be looked up
+ *	- the index refers to the table: it becomes invalid when the table is modified
+ */
+class MetaDataIndex
+{
+public:
+
+	MetaDataIndex(const MetaDataTable& mdt, EMDLabel label);
+	MetaDataIndex(const MetaDataTable& mdt, const std::vector<EMDLabel>& labels);
+
+	// Number of distinct keys
+	long numberOfKeys() const
+	{
+		return keyRow.size();
+	}
+
+	// Key of a row of the indexed table
+	long getKey(long row) const
+	{
+		return rowKeys[row];
+	}
+
+	// Number of rows with a given key
+	long numberOfRows(long key) const
+	{
+		return keyStart[key + 1] - keyStart[key];
+	}
+
+	// i-th row (in table order) with a given key
+	long getRow(long key, long i = 0) const
+	{
+		return keyRows[keyStart[key] + i];
+	}
+
+	// Key of row 'row' of table 'other', which contains the same labels; -1 if the key does not occur here
+	long findKey(const MetaDataTable& other, long row) const;
+
+	// Key of a single string value (only for an index on one string label); -1 if it does not occur
+	long findKey(const std::string& value) const;
+
+private:
+
+	void build();
+
+	size_t hashRow(const MetaDataTable& other, long row) const;
+	bool equalRows(const MetaDataTable& other, long row, long myRow) const;
+
+	const MetaDataTable& mdt;
+	std::vector<EMDLabel> labels;
+
+	// Key of every row
+	std::vector<long> rowKeys;
+
+	// First row of every key (its representative)
+	std::vector<long> keyRow;
+
+	// Rows grouped by key: the rows of key k are keyRows[keyStart[k]] ... keyRows[keyStart[k+1]-1]
+	std::vector<long> keyStart, keyRows;
+
+	// Open-addressing hash table of keys (-1 = empty)
+	std::vector<long> buckets;
+	std::vector<size_t> keyHashes;
+
+	// Hashes of the strings in the pools of the indexed string columns, by string id
+	std::vector<std::vector<size_t> > stringHashes;
+};
+
+// Types of join, see joinMetaDataTables()
+enum MetaDataJoinType
+{
+	JOIN_INNER, // a row for every pair of matching rows
+	JOIN_LEFT,  // as JOIN_INNER, plus the rows of the left table without a match (with default values for the right columns)
+	JOIN_SEMI,  // the rows of the left table that have a match (left columns only)
+	JOIN_ANTI   // the rows of the left table without a match (left columns only)
+};
+
+/* Join two tables on the values of the key labels, which must be present in both.
+ *  The output contains all labels of MDleft, followed by the labels of MDright that are not in MDleft (except for
+ *  JOIN_SEMI and JOIN_ANTI). Rows are in the order of MDleft, and then in the order of MDright */
+MetaDataTable joinMetaDataTables(const MetaDataTable& MDleft, const MetaDataTable& MDright,
+                                 const std::vector<EMDLabel>& keys, MetaDataJoinType type = JOIN_INNER);
+
+// Types of aggregation, see groupMetaDataTable()
+enum MetaDataAggregateType
+{
+	AGGREGATE_COUNT, // number of rows
+	AGGREGATE_SUM,
+	AGGREGATE_MEAN,
+	AGGREGATE_MIN,
+	AGGREGATE_MAX,
+	AGGREGATE_STDDEV
+};
+
+// One aggregated column: the values of 'input' are summarised into the (numerical) label 'output'
+struct MetaDataAggregate
+{
+	MetaDataAggregateType type;
+	EMDLabel input, output;
+
+	MetaDataAggregate(MetaDataAggregateType type, EMDLabel input, EMDLabel output)
+	: type(type), input(input), output(output)
+	{}
+};
+
+/* Group the rows of a table on the values of the key labels.
+ *  The output has one row per distinct key, in order of first occurrence, with the key labels
+ *  followed by the aggregated output labels (the input label is ignored for AGGREGATE_COUNT) */
+MetaDataTable groupMetaDataTable(const MetaDataTable& MDin, const std::vector<EMDLabel>& keys,
+                                 const std::vector<MetaDataAggregate>& aggregates);
+
+#endif
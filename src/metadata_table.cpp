@@ -44,15 +44,20 @@
 
 #include "src/metadata_table.h"
 #include "src/metadata_label.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <omp.h>
+#include <stdint.h>
 
 MetaDataTable::MetaDataTable()
-:	objects(0),
+:	doubleColumns(0),
+	intColumns(0),
+	boolColumns(0),
+	stringColumns(0),
 	label2offset(EMDL_LAST_LABEL, -1),
+	objectCount(0),
 	current_objectID(0),
-	doubleLabels(0),
-	intLabels(0),
-	boolLabels(0),
-	stringLabels(0),
 	isList(false),
 	name(""),
 	comment(""),
@@ -62,24 +67,19 @@ MetaDataTable::MetaDataTable()
 }
 
 MetaDataTable::MetaDataTable(const MetaDataTable &MD)
-:	objects(MD.objects.size()),
+:	doubleColumns(MD.doubleColumns),
+	intColumns(MD.intColumns),
+	boolColumns(MD.boolColumns),
+	stringColumns(MD.stringColumns),
 	label2offset(MD.label2offset),
+	objectCount(MD.objectCount),
 	current_objectID(0),
-	doubleLabels(MD.doubleLabels),
-	intLabels(MD.intLabels),
-	boolLabels(MD.boolLabels),
-	stringLabels(MD.stringLabels),
 	isList(MD.isList),
 	name(MD.name),
 	comment(MD.comment),
 	activeLabels(MD.activeLabels),
 	ignoreLabels(MD.ignoreLabels)
 {
-	for (size_t idx = 0; idx < MD.objects.size(); idx++)
-	{
-		objects[idx] = new MetaDataContainer(*(MD.objects[idx]));
-		objects[idx]->table = this;
-	}
 }
 
 MetaDataTable& MetaDataTable::operator = (const MetaDataTable &MD)
@@ -88,25 +88,19 @@ MetaDataTable& MetaDataTable::operator = (const MetaDataTable &MD)
 	{
 		clear();
 
-		objects.resize(MD.objects.size());
+		doubleColumns = MD.doubleColumns;
+		intColumns = MD.intColumns;
+		boolColumns = MD.boolColumns;
+		stringColumns = MD.stringColumns;
 		label2offset = MD.label2offset;
+		objectCount = MD.objectCount;
 		current_objectID = 0;
-		doubleLabels = MD.doubleLabels;
-		intLabels = MD.intLabels;
-		boolLabels = MD.boolLabels;
-		stringLabels = MD.stringLabels;
 		isList = MD.isList;
 		name = MD.name;
 		comment = MD.comment;
 
 		activeLabels = MD.activeLabels;
 		ignoreLabels = MD.ignoreLabels;
-
-		for (long int idx = 0; idx < MD.objects.size(); idx++)
-		{
-			objects[idx] = new MetaDataContainer(this, MD.objects[idx]);
-			objects[idx]->table = this;
-		}
 	}
 
 	return *this;
@@ -119,38 +113,29 @@ void MetaDataTable::setIsList(bool is_list)
 
 MetaDataTable::~MetaDataTable()
 {
-	for (long i = 0; i < objects.size(); i++)
-	{
-		delete objects[i];
-	}
 }
 
 bool MetaDataTable::isEmpty() const
 {
-	return (objects.size()==0);
+	return (objectCount == 0);
 }
 
 size_t MetaDataTable::numberOfObjects() const
 {
-	return objects.size();
+	return objectCount;
 }
 
 void MetaDataTable::clear()
 {
-	for (long i = 0; i < objects.size(); i++)
-	{
-		delete objects[i];
-	}
-	objects.clear();
+	doubleColumns.clear();
+	intColumns.clear();
+	boolColumns.clear();
+	stringColumns.clear();
+	objectCount = 0;
 
 	label2offset = std::vector<long>(EMDL_LAST_LABEL, -1);
 	current_objectID = 0;
 
-	doubleLabels = 0;
-	intLabels = 0;
-	boolLabels = 0;
-	stringLabels = 0;
-
 	isList = false;
 	name = "";
 	comment = "";
@@ -249,7 +234,7 @@ bool MetaDataTable::getValueToString(EMDLabel label, std::string &value, long ob
 
 size_t MetaDataTable::size()
 {
-	return objects.size();
+	return objectCount;
 }
 
 bool MetaDataTable::setValueFromString(EMDLabel label, const std::string &value,
@@ -287,81 +272,32 @@ bool MetaDataTable::setValueFromString(EMDLabel label, const std::string &value,
 	return false;
 }
 
-	// comparators used for sorting
-
-	struct MdDoubleComparator
-	{
-		MdDoubleComparator(long index) : index(index) {}
-
-		bool operator()(MetaDataContainer *lh, MetaDataContainer *rh) const
-		{
-			return lh->doubles[index] < rh->doubles[index];
-		}
-
-		long index;
-	};
+	// comparators used for sorting: they compare row indices by the values in one column
 
-	struct MdIntComparator
+	template<class T>
+	struct MdColumnComparator
 	{
-		MdIntComparator(long index) : index(index) {}
+		MdColumnComparator(const std::vector<T>& column) : column(column) {}
 
-		bool operator()(MetaDataContainer *lh, MetaDataContainer *rh) const
+		bool operator()(long lh, long rh) const
 		{
-			return lh->ints[index] < rh->ints[index];
+			return column[lh] < column[rh];
 		}
 
-		long index;
+		const std::vector<T>& column;
 	};
 
 	struct MdStringComparator
 	{
-		MdStringComparator(long index) : index(index) {}
-
-		bool operator()(MetaDataContainer *lh, MetaDataContainer *rh) const
-		{
-			return lh->strings[index] < rh->strings[index];
-		}
-
-		long index;
-	};
-
-	struct MdStringAfterAtComparator
-	{
-		MdStringAfterAtComparator(long index) : index(index) {}
+		MdStringComparator(const MetaDataStringColumn& column) : column(column) {}
 
-		bool operator()(MetaDataContainer *lh, MetaDataContainer *rh) const
+		bool operator()(long lh, long rh) const
 		{
-			std::string slh = lh->strings[index];
-			std::string srh = rh->strings[index];
-			slh = slh.substr(slh.find("@")+1);
-			srh = srh.substr(srh.find("@")+1);
-			return slh < srh;
-		}
-
-		long index;
-	};
-
-	struct MdStringBeforeAtComparator
-	{
-		MdStringBeforeAtComparator(long index) : index(index) {}
-
-		bool operator()(MetaDataContainer *lh, MetaDataContainer *rh) const
-		{
-			std::string slh = lh->strings[index];
-			std::string srh = rh->strings[index];
-			slh = slh.substr(0, slh.find("@"));
-			srh = srh.substr(0, srh.find("@"));
-			std::stringstream stslh, stsrh;
-			stslh << slh;
-			stsrh << srh;
-			long ilh, irh;
-			stslh >> ilh;
-			stsrh >> irh;
-
-			return ilh < irh;
+			const long idl = column.getId(lh), idr = column.getId(rh);
+			return idl != idr && strcmp(column.getString(idl), column.getString(idr)) < 0;
 		}
 
-		long index;
+		const MetaDataStringColumn& column;
 	};
 
 void MetaDataTable::sort(EMDLabel name, bool do_reverse, bool only_set_index, bool do_random)
@@ -372,29 +308,37 @@ void MetaDataTable::sort(EMDLabel name, bool do_reverse, bool only_set_index, bo
 	else if (!(EMDL::isInt(name) || EMDL::isDouble(name)) )
 		REPORT_ERROR("MetadataTable::sort%% ERROR: can only sorted numbers");
 
-	std::vector<std::pair<double,long int> > vp;
-	vp.reserve(objects.size());
-	long int i = 0;
-	FOR_ALL_OBJECTS_IN_METADATA_TABLE(*this)
+	std::vector<std::pair<double,long int> > vp(objectCount);
+
+	if (do_random)
 	{
-		double dval;
-		if (do_random)
+		for (long i = 0; i < objectCount; i++)
 		{
-			dval = (double)rand();
+			vp[i] = std::make_pair((double)rand(), i);
 		}
-		else if (EMDL::isInt(name))
+	}
+	else
+	{
+		const long off = label2offset[name];
+		if (off < 0)
+			REPORT_ERROR("MetadataTable::sort ERROR: table does not contain label " + EMDL::label2Str(name));
+
+		if (EMDL::isInt(name))
 		{
-			long val;
-			getValue(name, val);
-			dval = (double) val;
+			const std::vector<long>& column = intColumns[off];
+			for (long i = 0; i < objectCount; i++)
+			{
+				vp[i] = std::make_pair((double)column[i], i);
+			}
 		}
 		else // EMDL::isDouble(name)
 		{
-			getValue(name, dval);
+			const std::vector<double>& column = doubleColumns[off];
+			for (long i = 0; i < objectCount; i++)
+			{
+				vp[i] = std::make_pair(column[i], i);
+			}
 		}
-
-		vp.push_back(std::make_pair(dval, i));
-		i++;
 	}
 
 	std::sort(vp.begin(), vp.end());
@@ -412,14 +356,14 @@ void MetaDataTable::sort(EMDLabel name, bool do_reverse, bool only_set_index, bo
 	else
 	{
 		// Change the actual order in the MetaDataTable
-		std::vector<MetaDataContainer*> objs(objects.size());
+		std::vector<long> order(objectCount);
 
 		for (long j = 0; j < vp.size(); j++)
 		{
-			objs[j] = objects[vp[j].second];
+			order[j] = vp[j].second;
 		}
 
-		objects = objs;
+		reorder(order);
 	}
 	// reset pointer to the beginning of the table
 	firstObject();
@@ -427,30 +371,58 @@ void MetaDataTable::sort(EMDLabel name, bool do_reverse, bool only_set_index, bo
 
 void MetaDataTable::newSort(const EMDLabel label, bool do_reverse, bool do_sort_after_at, bool do_sort_before_at)
 {
+	const long off = label2offset[label];
+	if (off < 0)
+		REPORT_ERROR("MetaDataTable::newSort ERROR: table does not contain label " + EMDL::label2Str(label));
+
+	std::vector<long> order(objectCount);
+	for (long i = 0; i < objectCount; i++)
+	{
+		order[i] = i;
+	}
+
 	if (EMDL::isString(label))
 	{
+		const MetaDataStringColumn& column = stringColumns[off];
+
 		if (do_sort_after_at)
 		{
-			std::stable_sort(objects.begin(), objects.end(),
-							 MdStringAfterAtComparator(label2offset[label]));
+			// Only compare the part after the '@', extract it only once per row
+			std::vector<std::string> keys(objectCount);
+			for (long i = 0; i < objectCount; i++)
+			{
+				const std::string str = column.get(i);
+				keys[i] = str.substr(str.find("@")+1);
+			}
+
+			std::stable_sort(order.begin(), order.end(), MdColumnComparator<std::string>(keys));
 		}
 		else if (do_sort_before_at)
 		{
-			std::stable_sort(objects.begin(), objects.end(),
-							 MdStringBeforeAtComparator(label2offset[label]));
+			// Compare the number before the '@'
+			std::vector<long> keys(objectCount);
+			for (long i = 0; i < objectCount; i++)
+			{
+				const std::string str = column.get(i);
+				std::stringstream sts;
+				sts << str.substr(0, str.find("@"));
+				sts >> keys[i];
+			}
+
+			std::stable_sort(order.begin(), order.end(), MdColumnComparator<long>(keys));
 		}
 		else
 		{
-			std::stable_sort(objects.begin(), objects.end(), MdStringComparator(label2offset[label]));
+			std::stable_sort(order.begin(), order.end(), MdStringComparator(column));
 		}
 	}
 	else if (EMDL::isDouble(label))
 	{
-		std::stable_sort(objects.begin(), objects.end(), MdDoubleComparator(label2offset[label]));
+		std::stable_sort(order.begin(), order.end(), MdColumnComparator<double>(doubleColumns[off]));
 	}
 	else if (EMDL::isInt(label))
 	{
-		std::stable_sort(objects.begin(), objects.end(), MdIntComparator(label2offset[label]));
+		std::stable_sort(order.begin(), order.end(), MdColumnComparator<long>(intColumns[off]));
 	}
 	else
 	{
@@ -459,8 +431,10 @@ void MetaDataTable::newSort(const EMDLabel label, bool do_reverse, bool do_sort_
 
 	if (do_reverse)
 	{
-		std::reverse(objects.begin(), objects.end());
+		std::reverse(order.begin(), order.end());
 	}
+
+	reorder(order);
 }
 
 bool MetaDataTable::labelExists(EMDLabel name) const
@@ -506,47 +480,24 @@ void MetaDataTable::addLabel(EMDLabel label)
 
 		if (EMDL::isDouble(label))
 		{
-			id = doubleLabels;
-
-			for (long i = 0; i < objects.size(); i++)
-			{
-				objects[i]->doubles.push_back(0);
-			}
-
-			doubleLabels++;
+			id = doubleColumns.size();
+			doubleColumns.push_back(std::vector<double>(objectCount, 0.));
 		}
 		else if (EMDL::isInt(label))
 		{
-			id = intLabels;
-
-			for (long i = 0; i < objects.size(); i++)
-			{
-				objects[i]->ints.push_back(0);
-			}
-
-			intLabels++;
+			id = intColumns.size();
+			intColumns.push_back(std::vector<long>(objectCount, 0));
 		}
 		else if (EMDL::isBool(label))
 		{
-			id = boolLabels;
-
-			for (long i = 0; i < objects.size(); i++)
-			{
-				objects[i]->bools.push_back(false);
-			}
-
-			boolLabels++;
+			id = boolColumns.size();
+			boolColumns.push_back(std::vector<char>(objectCount, false));
 		}
 		else if (EMDL::isString(label))
 		{
-			id = stringLabels;
-
-			for (long i = 0; i < objects.size(); i++)
-			{
-				objects[i]->strings.push_back("empty");
-			}
-
-			stringLabels++;
+			id = stringColumns.size();
+			stringColumns.push_back(MetaDataStringColumn());
+			stringColumns[id].resize(objectCount, "empty");
 		}
 
 		label2offset[label] = id;
@@ -581,41 +532,40 @@ void MetaDataTable::append(const MetaDataTable& mdt)
 			REPORT_ERROR("ERROR in appending metadata tables with not the same columns!");
 	}
 
-	// Now append
-	objects.reserve(objects.size() + mdt.numberOfObjects());
-	for (long i = 0; i < mdt.objects.size(); i++)
+	// Now append, column by column
+	std::vector<long> objectIDs(mdt.objectCount);
+	for (long i = 0; i < mdt.objectCount; i++)
 	{
-		objects.push_back(new MetaDataContainer(
-			this, doubleLabels, intLabels, boolLabels, stringLabels));
-
-		setObjectUnsafe(mdt.getObject(i), objects.size() - 1);
+		objectIDs[i] = i;
 	}
 
+	appendRowsUnsafe(mdt, objectIDs);
+
 	// reset pointer to the beginning of the table
 	firstObject();
 }
 
 
-MetaDataContainer* MetaDataTable::getObject(long objectID) const
+MetaDataContainer MetaDataTable::getObject(long objectID) const
 {
 	if (objectID < 0) objectID = current_objectID;
 
 	checkObjectID(objectID,  "MetaDataTable::getObject");
 
-	return objects[objectID];
+	return MetaDataContainer(this, objectID);
 }
 
-void MetaDataTable::setObject(MetaDataContainer* data, long objectID)
+void MetaDataTable::setObject(const MetaDataContainer &data, long objectID)
 {
 	if (objectID < 0) objectID = current_objectID;
 
 	checkObjectID(objectID,  "MetaDataTable::setObject");
-	addMissingLabels(data->table);
+	addMissingLabels(data.table);
 
 	setObjectUnsafe(data, objectID);
 }
 
-void MetaDataTable::setValuesOfDefinedLabels(MetaDataContainer* data, long objectID)
+void MetaDataTable::setValuesOfDefinedLabels(const MetaDataContainer &data, long objectID)
 {
 	if (objectID < 0) objectID = current_objectID;
 
@@ -626,65 +576,154 @@ void MetaDataTable::setValuesOfDefinedLabels(MetaDataContainer* data, long objec
 
 void MetaDataTable::reserve(size_t capacity)
 {
-	objects.reserve(capacity);
+	for (long i = 0; i < doubleColumns.size(); i++) doubleColumns[i].reserve(capacity);
+	for (long i = 0; i < intColumns.size(); i++) intColumns[i].reserve(capacity);
+	for (long i = 0; i < boolColumns.size(); i++) boolColumns[i].reserve(capacity);
+	for (long i = 0; i < stringColumns.size(); i++) stringColumns[i].reserve(capacity);
 }
 
-void MetaDataTable::setObjectUnsafe(MetaDataContainer* data, long objectID)
+void MetaDataTable::setObjectUnsafe(const MetaDataContainer &data, long objectID)
 {
-	MetaDataContainer* obj = objects[objectID];
+	const MetaDataTable* src = data.table;
+	const long srcID = data.objectID;
 
-	for (long i = 0; i < data->table->activeLabels.size(); i++)
+	for (long i = 0; i < src->activeLabels.size(); i++)
 	{
-		EMDLabel label = data->table->activeLabels[i];
+		EMDLabel label = src->activeLabels[i];
 
 		long myOff = label2offset[label];
-		long srcOff = data->table->label2offset[label];
+		long srcOff = src->label2offset[label];
+
+		if (myOff < 0) continue;
+
+		if (EMDL::isDouble(label))
+		{
+			doubleColumns[myOff][objectID] = src->doubleColumns[srcOff][srcID];
+		}
+		else if (EMDL::isInt(label))
+		{
+			intColumns[myOff][objectID] = src->intColumns[srcOff][srcID];
+		}
+		else if (EMDL::isBool(label))
+		{
+			boolColumns[myOff][objectID] = src->boolColumns[srcOff][srcID];
+		}
+		else if (EMDL::isString(label))
+		{
+			stringColumns[myOff].set(objectID, src->stringColumns[srcOff].get(srcID));
+		}
+	}
+}
+
+void MetaDataTable::appendRowsUnsafe(const MetaDataTable& mdt, const std::vector<long>& objectIDs)
+{
+	const long n = objectIDs.size();
+
+	for (int l = 0; l < EMDL_LAST_LABEL; l++)
+	{
+		const EMDLabel label = (EMDLabel)l;
+		const long myOff = label2offset[label];
 
 		if (myOff < 0) continue;
 
+		// Only copy values that are active in mdt, as setObjectUnsafe does
+		const long srcOff = mdt.label2offset[label];
+		const bool have_src = srcOff >= 0 && mdt.containsLabel(label);
+
 		if (EMDL::isDouble(label))
 		{
-			obj->doubles[myOff] = data->doubles[srcOff];
+			std::vector<double>& dest = doubleColumns[myOff];
+			dest.reserve(objectCount + n);
+			if (have_src)
+			{
+				const std::vector<double>& src = mdt.doubleColumns[srcOff];
+				for (long i = 0; i < n; i++) dest.push_back(src[objectIDs[i]]);
+			}
+			else dest.resize(objectCount + n, 0.);
 		}
 		else if (EMDL::isInt(label))
 		{
-			obj->ints[myOff] = data->ints[srcOff];
+			std::vector<long>& dest = intColumns[myOff];
+			dest.reserve(objectCount + n);
+			if (have_src)
+			{
+				const std::vector<long>& src = mdt.intColumns[srcOff];
+				for (long i = 0; i < n; i++) dest.push_back(src[objectIDs[i]]);
+			}
+			else dest.resize(objectCount + n, 0);
 		}
 		else if (EMDL::isBool(label))
 		{
-			obj->bools[myOff] = data->bools[srcOff];
+			std::vector<char>& dest = boolColumns[myOff];
+			dest.reserve(objectCount + n);
+			if (have_src)
+			{
+				const std::vector<char>& src = mdt.boolColumns[srcOff];
+				for (long i = 0; i < n; i++) dest.push_back(src[objectIDs[i]]);
+			}
+			else dest.resize(objectCount + n, false);
 		}
 		else if (EMDL::isString(label))
 		{
-			obj->strings[myOff] = data->strings[srcOff];
+			if (have_src)
+			{
+				stringColumns[myOff].append(mdt.stringColumns[srcOff], objectIDs);
+			}
+			else stringColumns[myOff].resize(objectCount + n, "");
 		}
 	}
+
+	objectCount += n;
+}
+
+void MetaDataTable::resizeColumns(long newCount)
+{
+	for (long i = 0; i < doubleColumns.size(); i++) doubleColumns[i].resize(newCount, 0.);
+	for (long i = 0; i < intColumns.size(); i++) intColumns[i].resize(newCount, 0);
+	for (long i = 0; i < boolColumns.size(); i++) boolColumns[i].resize(newCount, false);
+	for (long i = 0; i < stringColumns.size(); i++) stringColumns[i].resize(newCount, "");
+
+	objectCount = newCount;
 }
 
 void MetaDataTable::addObject()
 {
-	objects.push_back(new MetaDataContainer(
-		this, doubleLabels, intLabels, boolLabels, stringLabels));
+	resizeColumns(objectCount + 1);
+
+	current_objectID = objectCount - 1;
+}
+
+void MetaDataTable::addObject(const MetaDataContainer &data)
+{
+	resizeColumns(objectCount + 1);
+
+	setObject(data, objectCount - 1);
+	current_objectID = objectCount - 1;
+}
+
+void MetaDataTable::addValuesOfDefinedLabels(const MetaDataContainer &data)
+{
+	resizeColumns(objectCount + 1);
 
-	current_objectID = objects.size()-1;
+	setValuesOfDefinedLabels(data, objectCount - 1);
+	current_objectID = objectCount - 1;
 }
 
-void MetaDataTable::addObject(MetaDataContainer* data)
+void MetaDataTable::addObjects(const MetaDataTable& mdt, const std::vector<long>& objectIDs)
 {
-	objects.push_back(new MetaDataContainer(
-		this, doubleLabels, intLabels, boolLabels, stringLabels));
+	if (objectIDs.size() == 0) return;
 
-	setObject(data, objects.size()-1);
-	current_objectID = objects.size()-1;
+	addMissingLabels(&mdt);
+	addValuesOfDefinedLabels(mdt, objectIDs);
 }
 
-void MetaDataTable::addValuesOfDefinedLabels(MetaDataContainer* data)
+void MetaDataTable::addValuesOfDefinedLabels(const MetaDataTable& mdt, const std::vector<long>& objectIDs)
 {
-	objects.push_back(new MetaDataContainer(
-		this, doubleLabels, intLabels, boolLabels, stringLabels));
+	if (objectIDs.size() == 0) return;
+
+	appendRowsUnsafe(mdt, objectIDs);
 
-	setValuesOfDefinedLabels(data, objects.size()-1);
-	current_objectID = objects.size()-1;
+	current_objectID = objectCount - 1;
 }
 
 void MetaDataTable::removeObject(long objectID)
@@ -693,10 +732,89 @@ void MetaDataTable::removeObject(long objectID)
 
 	checkObjectID(i,  "MetaDataTable::removeObject");
 
-	delete objects[i];
-	objects.erase(objects.begin() + i);
+	for (long c = 0; c < doubleColumns.size(); c++) doubleColumns[c].erase(doubleColumns[c].begin() + i);
+	for (long c = 0; c < intColumns.size(); c++) intColumns[c].erase(intColumns[c].begin() + i);
+	for (long c = 0; c < boolColumns.size(); c++) boolColumns[c].erase(boolColumns[c].begin() + i);
+	for (long c = 0; c < stringColumns.size(); c++) stringColumns[c].erase(i);
+
+	objectCount--;
+
+	current_objectID = objectCount - 1;
+}
+
+void MetaDataTable::reorder(const std::vector<long>& order)
+{
+	for (long c = 0; c < doubleColumns.size(); c++)
+	{
+		std::vector<double> column(order.size());
+		for (long i = 0; i < order.size(); i++) column[i] = doubleColumns[c][order[i]];
+		doubleColumns[c].swap(column);
+	}
+	for (long c = 0; c < intColumns.size(); c++)
+	{
+		std::vector<long> column(order.size());
+		for (long i = 0; i < order.size(); i++) column[i] = intColumns[c][order[i]];
+		intColumns[c].swap(column);
+	}
+	for (long c = 0; c < boolColumns.size(); c++)
+	{
+		std::vector<char> column(order.size());
+		for (long i = 0; i < order.size(); i++) column[i] = boolColumns[c][order[i]];
+		boolColumns[c].swap(column);
+	}
+	for (long c = 0; c < stringColumns.size(); c++)
+	{
+		stringColumns[c].permute(order);
+	}
+
+	objectCount = order.size();
+	current_objectID = 0;
+}
+
+const std::vector<double>* MetaDataTable::getDoubleColumn(EMDLabel label) const
+{
+	if (!labelExists(label) || !EMDL::isDouble(label)) return NULL;
+	return &doubleColumns[label2offset[label]];
+}
+
+const std::vector<long>* MetaDataTable::getIntColumn(EMDLabel label) const
+{
+	if (!labelExists(label) || !EMDL::isInt(label)) return NULL;
+	return &intColumns[label2offset[label]];
+}
+
+const std::vector<char>* MetaDataTable::getBoolColumn(EMDLabel label) const
+{
+	if (!labelExists(label) || !EMDL::isBool(label)) return NULL;
+	return &boolColumns[label2offset[label]];
+}
+
+const MetaDataStringColumn* MetaDataTable::getStringColumn(EMDLabel label) const
+{
+	if (!labelExists(label) || !EMDL::isString(label)) return NULL;
+	return &stringColumns[label2offset[label]];
+}
+
+long MetaDataTable::numberOfDistinctValues(EMDLabel label) const
+{
+	return MetaDataIndex(*this, label).numberOfKeys();
+}
+
+long MetaDataTable::numberOfDistinctValues(const std::vector<EMDLabel>& labels) const
+{
+	return MetaDataIndex(*this, labels).numberOfKeys();
+}
 
-	current_objectID = objects.size() - 1;
+size_t MetaDataTable::memoryUsage() const
+{
+	size_t bytes = 0;
+
+	for (long c = 0; c < doubleColumns.size(); c++) bytes += doubleColumns[c].capacity() * sizeof(double);
+	for (long c = 0; c < intColumns.size(); c++) bytes += intColumns[c].capacity() * sizeof(long);
+	for (long c = 0; c < boolColumns.size(); c++) bytes += boolColumns[c].capacity() * sizeof(char);
+	for (long c = 0; c < stringColumns.size(); c++) bytes += stringColumns[c].memoryUsage();
+
+	return bytes;
 }
 
 long int MetaDataTable::firstObject()
@@ -709,7 +827,7 @@ long int MetaDataTable::nextObject()
 {
 	current_objectID++;
 
-	if (current_objectID >= objects.size())
+	if (current_objectID >= objectCount)
 	{
 		return NO_MORE_OBJECTS;
 	}
@@ -727,13 +845,17 @@ long int MetaDataTable::goToObject(long int objectID)
 	return current_objectID;
 }
 
-long int MetaDataTable::readStarLoop(std::ifstream& in, std::vector<EMDLabel> *desiredLabels, std::string grep_pattern, bool do_only_count)
+long int MetaDataTable::readStarLoop(std::ifstream& in, std::vector<EMDLabel> *desiredLabels, std::string grep_pattern, bool do_only_count,
+		const MappedFile *mapped)
 {
 	setIsList(false);
 
 	//Read column labels
 	int labelPosition = 0;
 	std::string line, token;
+	std::vector<EMDLabel> columnLabels;
+	std::streampos dataStart = in.tellg();
+	bool has_data = false;
 
 	// First read all the column labels
 	while (getline(in, line, '\n'))
@@ -741,7 +863,10 @@ long int MetaDataTable::readStarLoop(std::ifstream& in, std::vector<EMDLabel> *d
 		line = simplify(line);
 		// TODO: handle comments...
 		if (line[0] == '#' || line[0] == '\0' || line[0] == ';')
+		{
+			dataStart = in.tellg();
 			continue;
+		}
 
 		if (line[0] == '_') // label definition line
 		{
@@ -754,13 +879,15 @@ long int MetaDataTable::readStarLoop(std::ifstream& in, std::vector<EMDLabel> *d
 			EMDLabel label = EMDL::str2Label(token);
 
 			//std::cerr << " label= XX" << label << "XX token= XX" << token<<"XX" << std::endl;
-			if (desiredLabels != NULL && !vectorContainsLabel(*desiredLabels, label))
-				label = EMDL_UNDEFINED; //ignore if not present in desiredLabels
-
 			if (label == EMDL_UNDEFINED)
 			{
 				//std::cerr << "Warning: ignoring the following (undefined) label:" <<token << std::endl;
 				REPORT_ERROR("ERROR: Unrecognised metadata label: " + token);
+			}
+
+			if (desiredLabels != NULL && !vectorContainsLabel(*desiredLabels, label))
+			{
+				label = EMDL_UNDEFINED; //ignore if not present in desiredLabels
 				ignoreLabels.push_back(labelPosition);
 			}
 			else
@@ -768,57 +895,270 @@ long int MetaDataTable::readStarLoop(std::ifstream& in, std::vector<EMDLabel> *d
 				addLabel(label);
 			}
 
+			columnLabels.push_back(label);
 			labelPosition++;
+			dataStart = in.tellg();
 		}
 		else // found first data line
 		{
+			has_data = true;
 			break;
 		}
 	}
 
-	// Then fill the table (dont read another line until the one from above has been handled)
-	bool is_first = true;
-	long int nr_objects = 0;
+	if (!has_data)
+		return 0;
+
+	const char* loopEnd;
+	long int nr_objects;
 
-	while (is_first || getline(in, line, '\n'))
+	if (mapped != NULL)
 	{
-		is_first = false;
+		// Parse directly from the memory-mapped file
+		const char* begin = mapped->begin() + (long int)dataStart;
+		nr_objects = readStarLoopData(begin, mapped->end(), columnLabels, grep_pattern, do_only_count, loopEnd);
 
-		if (grep_pattern == "" || line.find(grep_pattern) != std::string::npos)
+		// Leave the stream behind the loop, as if it had been read line by line
+		in.clear();
+		in.seekg(loopEnd - mapped->begin());
+	}
+	else
+	{
+		// Collect the lines of the loop (the first one has been read above) and parse them in one go
+		in.seekg(dataStart);
+		std::string buffer;
+		while (getline(in, line, '\n'))
 		{
-			line = simplify(line);
-			// Stop at empty line
-			if (line[0] == '\0')
+			buffer += line;
+			buffer += '\n';
+			if ((grep_pattern == "" || line.find(grep_pattern) != std::string::npos) && simplify(line)[0] == '\0')
 				break;
+		}
+		nr_objects = readStarLoopData(buffer.data(), buffer.data() + buffer.size(), columnLabels, grep_pattern, do_only_count, loopEnd);
+	}
 
-			nr_objects++;
-			if (!do_only_count)
+	return nr_objects;
+}
+
+	// whitespace as removed by simplify()
+	inline bool isStarSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f' || c == '\b' || c == '\a';
+	}
+
+	inline const char* endOfStarLine(const char* p, const char* end)
+	{
+		const char* eol = (const char*)memchr(p, '\n', end - p);
+		return (eol == NULL) ? end : eol;
+	}
+
+	inline bool isBlankStarLine(const char* p, const char* eol)
+	{
+		for (; p < eol; p++)
+		{
+			if (!isStarSpace(*p)) return false;
+		}
+		return true;
+	}
+
+	inline bool starLineContains(const char* p, const char* eol, const std::string& pattern)
+	{
+		return std::search(p, eol, pattern.begin(), pattern.end()) != eol;
+	}
+
+	// Numbers are parsed as by operator >> of a std::istream, which does not accept inf, nan or hexadecimal values
+	inline const char* startOfStarNumber(const char* p)
+	{
+		const char* q = (*p == '-' || *p == '+') ? p + 1 : p;
+		return ((*q >= '0' && *q <= '9') || *q == '.') ? p : NULL;
+	}
+
+	// Copy a token that is not followed by whitespace inside the buffer, so that strtod/strtol stop in time
+	inline const char* terminatedStarToken(const char* p, const char* q, const char* end, std::string& copy)
+	{
+		if (q < end)
+			return p;
+		copy.assign(p, q);
+		return copy.c_str();
+	}
+
+	inline double parseStarDouble(const char* p, const char* q, const char* end, std::string& copy)
+	{
+		const char* s = startOfStarNumber(terminatedStarToken(p, q, end, copy));
+		return (s == NULL) ? 0. : strtod(s, NULL);
+	}
+
+	inline long parseStarLong(const char* p, const char* q, const char* end, std::string& copy)
+	{
+		const char* s = startOfStarNumber(terminatedStarToken(p, q, end, copy));
+		return (s == NULL) ? 0 : strtol(s, NULL, 10);
+	}
+
+long int MetaDataTable::readStarLoopData(const char* begin, const char* end, const std::vector<EMDLabel>& columnLabels,
+                                         const std::string& grep_pattern, bool do_only_count, const char*& loopEnd)
+{
+	const bool do_grep = (grep_pattern != "");
+
+	// Find the end of the loop: the first empty line (that passes the grep filter)
+	const char* p = begin;
+	while (p < end)
+	{
+		const char* eol = endOfStarLine(p, end);
+		if ((!do_grep || starLineContains(p, eol, grep_pattern)) && isBlankStarLine(p, eol))
+			break;
+		p = (eol < end) ? eol + 1 : end;
+	}
+	loopEnd = p;
+	end = p;
+
+	// Split into chunks at line boundaries
+	const long int min_chunk_size = 1024 * 1024;
+	const int nr_threads = omp_get_max_threads();
+	long int nr_chunks = (end - begin) / min_chunk_size;
+	nr_chunks = XMIPP_MAX(1, XMIPP_MIN(nr_chunks, 8 * nr_threads));
+
+	std::vector<const char*> chunkStart(nr_chunks + 1);
+	chunkStart[0] = begin;
+	for (long int c = 1; c < nr_chunks; c++)
+	{
+		const char* q = begin + c * ((end - begin) / nr_chunks);
+		q = XMIPP_MAX(q, chunkStart[c-1]);
+		q = endOfStarLine(q, end);
+		chunkStart[c] = (q < end) ? q + 1 : end;
+	}
+	chunkStart[nr_chunks] = end;
+
+	// Count the rows in every chunk
+	std::vector<long int> chunkRows(nr_chunks, 0);
+
+	#pragma omp parallel for num_threads(nr_threads) schedule(dynamic)
+	for (long int c = 0; c < nr_chunks; c++)
+	{
+		for (const char* q = chunkStart[c]; q < chunkStart[c+1]; )
+		{
+			const char* eol = endOfStarLine(q, chunkStart[c+1]);
+			if (!isBlankStarLine(q, eol) && (!do_grep || starLineContains(q, eol, grep_pattern)))
+				chunkRows[c]++;
+			q = eol + 1;
+		}
+	}
+
+	std::vector<long int> chunkOffset(nr_chunks + 1, objectCount);
+	for (long int c = 0; c < nr_chunks; c++)
+		chunkOffset[c+1] = chunkOffset[c] + chunkRows[c];
+
+	const long int nr_objects = chunkOffset[nr_chunks] - objectCount;
+
+	if (do_only_count || nr_objects == 0)
+		return nr_objects;
+
+	// Where to store each column of the text: 'd'ouble, 'i'nt, 'b'ool, 's'tring or ignored (0)
+	const long int nr_columns = columnLabels.size();
+	std::vector<char> columnType(nr_columns, 0);
+	std::vector<long> columnOffset(nr_columns, -1);
+	for (long int i = 0; i < nr_columns; i++)
+	{
+		const EMDLabel label = columnLabels[i];
+		if (label == EMDL_UNDEFINED) continue;
+
+		columnOffset[i] = label2offset[label];
+		if (EMDL::isDouble(label)) columnType[i] = 'd';
+		else if (EMDL::isInt(label)) columnType[i] = 'i';
+		else if (EMDL::isBool(label)) columnType[i] = 'b';
+		else if (EMDL::isString(label)) columnType[i] = 's';
+	}
+
+	// Numerical columns are filled in place, strings are interned per chunk and merged afterwards
+	const long int firstObject = objectCount;
+	for (long i = 0; i < doubleColumns.size(); i++) doubleColumns[i].resize(firstObject + nr_objects, 0.);
+	for (long i = 0; i < intColumns.size(); i++) intColumns[i].resize(firstObject + nr_objects, 0);
+	for (long i = 0; i < boolColumns.size(); i++) boolColumns[i].resize(firstObject + nr_objects, false);
+
+	std::vector<std::vector<MetaDataStringColumn> > chunkStrings(nr_chunks, std::vector<MetaDataStringColumn>(stringColumns.size()));
+
+	#pragma omp parallel for num_threads(nr_threads) schedule(dynamic)
+	for (long int c = 0; c < nr_chunks; c++)
+	{
+		std::vector<MetaDataStringColumn>& strings = chunkStrings[c];
+		for (long i = 0; i < strings.size(); i++)
+			strings[i].reserve(chunkRows[c]);
+
+		std::vector<char> stringFilled(strings.size());
+		std::string copy;
+		long int row = chunkOffset[c];
+		const char* chunkEnd = chunkStart[c+1];
+
+		for (const char* q = chunkStart[c]; q < chunkEnd; )
+		{
+			const char* eol = endOfStarLine(q, chunkEnd);
+			if (isBlankStarLine(q, eol) || (do_grep && !starLineContains(q, eol, grep_pattern)))
+			{
+				q = eol + 1;
+				continue;
+			}
+
+			std::fill(stringFilled.begin(), stringFilled.end(), 0);
+
+			long int column = 0;
+			while (q < eol && column < nr_columns)
 			{
-				// Add a new line to the table
-				addObject();
-
-				// Parse data values
-				std::stringstream os2(line);
-				std::string value;
-				labelPosition = 0;
-				int counterIgnored = 0;
-				while (os2 >> value)
+				while (q < eol && isStarSpace(*q)) q++;
+				if (q == eol) break;
+
+				const char* t = q;
+				while (t < eol && !isStarSpace(*t)) t++;
+
+				const long off = columnOffset[column];
+				switch (columnType[column])
 				{
-					// TODO: handle comments here...
-					if (std::find(ignoreLabels.begin(), ignoreLabels.end(), labelPosition) != ignoreLabels.end())
+				case 'd':
+					doubleColumns[off][row] = parseStarDouble(q, t, end, copy);
+					break;
+				case 'i':
+					intColumns[off][row] = parseStarLong(q, t, end, copy);
+					break;
+				case 'b':
+					boolColumns[off][row] = (parseStarLong(q, t, end, copy) != 0);
+					break;
+				case 's':
+					if (!stringFilled[off])
+					{
+						strings[off].push_back(q, t - q);
+						stringFilled[off] = 1;
+					}
+					else
 					{
-						// Ignore this column
-						counterIgnored++;
-						labelPosition++;
-						continue;
+						strings[off].set(strings[off].size() - 1, std::string(q, t));
 					}
-					setValueFromString(activeLabels[labelPosition - counterIgnored], value);
-					labelPosition++;
+					break;
 				}
+
+				column++;
+				q = t;
+			}
+
+			// Missing values keep their default
+			for (long i = 0; i < strings.size(); i++)
+			{
+				if (!stringFilled[i])
+					strings[i].push_back("", 0);
 			}
-		} // end if grep_pattern
+
+			row++;
+			q = eol + 1;
+		}
+	}
+
+	for (long i = 0; i < stringColumns.size(); i++)
+	{
+		stringColumns[i].reserve(firstObject + nr_objects);
+		for (long int c = 0; c < nr_chunks; c++)
+			stringColumns[i].append(chunkStrings[c][i]);
 	}
 
+	objectCount = firstObject + nr_objects;
+	current_objectID = objectCount - 1;
+
 	return nr_objects;
 }
 
@@ -826,7 +1166,7 @@ bool MetaDataTable::readStarList(std::ifstream& in, std::vector<EMDLabel> *desir
 {
 	setIsList(true);
 	addObject();
-	long int objectID = objects.size() - 1;
+	long int objectID = objectCount - 1;
 
 	std::string line, firstword, value;
 	std::vector<std::string> words;
@@ -885,7 +1225,8 @@ bool MetaDataTable::readStarList(std::ifstream& in, std::vector<EMDLabel> *desir
 	 return also_has_loop;
 }
 
-long int MetaDataTable::readStar(std::ifstream& in, const std::string &name, std::vector<EMDLabel> *desiredLabels, std::string grep_pattern, bool do_only_count)
+long int MetaDataTable::readStar(std::ifstream& in, const std::string &name, std::vector<EMDLabel> *desiredLabels, std::string grep_pattern, bool do_only_count,
+		const MappedFile *mapped)
 {
 	std::string line, token, value;
 	clear();
@@ -914,7 +1255,7 @@ long int MetaDataTable::readStar(std::ifstream& in, const std::string &name, std
 					trim(line);
 					if (line.find("loop_") != std::string::npos)
 					{
-						return readStarLoop(in, desiredLabels, grep_pattern, do_only_count);
+						return readStarLoop(in, desiredLabels, grep_pattern, do_only_count, mapped);
 					}
 					else if (line[0] == '_')
 					{
@@ -951,11 +1292,23 @@ long int MetaDataTable::read(const FileName &filename, const std::string &name,
 	if (ext =="star")
 	{
 		//REPORT_ERROR("readSTAR not implemented yet...");
-		return readStar(in, name, desiredLabels, grep_pattern, do_only_count);
+		// Loops are parsed straight from a memory map of the file; fall back to the stream if it cannot be mapped
+		MappedFile mapped;
+		bool is_mapped = mapped.open(fn_read);
+		return readStar(in, name, desiredLabels, grep_pattern, do_only_count, (is_mapped) ? &mapped : NULL);
+	}
+	else if (ext == "bstar")
+	{
+		// Binary columns are used straight from a memory map of the file
+		MappedFile mapped;
+		if (!mapped.open(fn_read))
+			return 0; // empty file
+
+		return readBinary(mapped, fn_read, name, desiredLabels, grep_pattern, do_only_count);
 	}
 	else
 	{
-		REPORT_ERROR("MetaDataTable::read ERROR: metadata table should have a .star extension");
+		REPORT_ERROR("MetaDataTable::read ERROR: metadata table should have a .star or .bstar extension");
 	}
 
 	in.close();
@@ -992,7 +1345,7 @@ void MetaDataTable::write(std::ostream& out) const
 		}
 
 		// Write actual data block
-		for (long int idx = 0; idx < objects.size(); idx++)
+		for (long int idx = 0; idx < objectCount; idx++)
 		{
 			std::string entryComment = "";
 
@@ -1072,15 +1425,494 @@ void MetaDataTable::write(std::ostream& out) const
 void MetaDataTable::write(const FileName &fn_out) const
 {
 	std::ofstream  fh;
-	fh.open((fn_out).c_str(), std::ios::out);
-	if (!fh)
-		REPORT_ERROR( (std::string)"MetaDataTable::write: cannot write to file: " + fn_out);
+	if (fn_out.getFileFormat() == "bstar")
+	{
+		fh.open((fn_out).c_str(), std::ios::out | std::ios::binary);
+		if (!fh)
+			REPORT_ERROR( (std::string)"MetaDataTable::write: cannot write to file: " + fn_out);
+		writeBinary(fh);
+		fh.close();
+		return;
+	}
+
+	fh.open((fn_out).c_str(), std::ios::out);
+	if (!fh)
+		REPORT_ERROR( (std::string)"MetaDataTable::write: cannot write to file: " + fn_out);
 	fh << "# RELION; version " << RELION_VERSION << std::endl;
 	write(fh);
 	fh.close();
 
 }
 
+	/* Binary metadata format (.bstar)
+	 *
+	 * A file is a sequence of self-contained data blocks, one per table, each of which starts with:
+	 *	char[8]   "RLNBSTAR"
+	 *	uint32    format version
+	 *	uint32    byte-order mark (0x01020304, as written by the machine that wrote the file)
+	 *	uint64    size of the block in bytes, including this header
+	 *	uint64    number of rows
+	 *	uint32    number of columns
+	 *	uint32    1 for a list, 0 for a loop
+	 *	string    name of the table
+	 *	string    comment
+	 * followed by one directory entry per column:
+	 *	string    label name (as in STAR files, without the leading underscore)
+	 *	uint32    type (see BinaryStarType)
+	 *	uint64    offset of the column data from the start of the block
+	 *	uint64    size of the column data in bytes
+	 * Strings are stored as a uint32 length followed by the characters.
+	 * Column data starts at multiples of 8 bytes, so that it can be used straight from a memory map:
+	 *	double:   rows x float64
+	 *	int:      rows x int64
+	 *	bool:     rows x uint8
+	 *	string:   uint64 size of the pool, rows x int32 ids into the pool (padded to 8 bytes),
+	 *	          followed by the pool of '\0'-terminated unique strings
+	 */
+	const char BINARY_STAR_MAGIC[8] = {'R', 'L', 'N', 'B', 'S', 'T', 'A', 'R'};
+	const uint32_t BINARY_STAR_VERSION = 1;
+	const uint32_t BINARY_STAR_BYTE_ORDER = 0x01020304;
+
+	enum BinaryStarType
+	{
+		BINARY_STAR_DOUBLE = 0,
+		BINARY_STAR_INT = 1,
+		BINARY_STAR_BOOL = 2,
+		BINARY_STAR_STRING = 3
+	};
+
+	inline uint32_t binaryStarType(EMDLabel label)
+	{
+		if (EMDL::isDouble(label)) return BINARY_STAR_DOUBLE;
+		if (EMDL::isInt(label)) return BINARY_STAR_INT;
+		if (EMDL::isBool(label)) return BINARY_STAR_BOOL;
+		return BINARY_STAR_STRING;
+	}
+
+	inline uint64_t alignBinaryStar(uint64_t size)
+	{
+		return (size + 7) & ~(uint64_t)7;
+	}
+
+	template<class T>
+	inline void writeBinaryStarValue(std::ostream& out, const T& value)
+	{
+		out.write((const char*)&value, sizeof(T));
+	}
+
+	inline void writeBinaryStarString(std::ostream& out, const std::string& str)
+	{
+		writeBinaryStarValue(out, (uint32_t)str.length());
+		out.write(str.data(), str.length());
+	}
+
+	inline void writeBinaryStarPadding(std::ostream& out, uint64_t size)
+	{
+		const char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+		out.write(zeros, alignBinaryStar(size) - size);
+	}
+
+	// Write an array as elements of type FileT
+	template<class FileT, class T>
+	inline void writeBinaryStarArray(std::ostream& out, const std::vector<T>& values)
+	{
+		if (values.empty()) return;
+
+		if (sizeof(FileT) == sizeof(T))
+		{
+			out.write((const char*)&values[0], values.size() * sizeof(T));
+		}
+		else
+		{
+			std::vector<FileT> converted(values.begin(), values.end());
+			out.write((const char*)&converted[0], converted.size() * sizeof(FileT));
+		}
+	}
+
+	// Whether nr_values values of value_size bytes take exactly (or with !exact: at most) size bytes,
+	// checked without computing a product that may overflow for corrupt headers
+	inline bool binaryStarArrayFits(uint64_t size, uint64_t nr_values, uint64_t value_size, bool exact)
+	{
+		if (nr_values > size / value_size)
+			return false;
+		return (!exact || nr_values * value_size == size);
+	}
+
+	// Read an array of elements of type FileT
+	template<class FileT, class T>
+	inline void readBinaryStarArray(const char* data, uint64_t nr_values, std::vector<T>& values)
+	{
+		values.resize(nr_values);
+		if (nr_values == 0) return;
+
+		if (sizeof(FileT) == sizeof(T))
+		{
+			memcpy(&values[0], data, nr_values * sizeof(T));
+		}
+		else
+		{
+			const FileT* src = (const FileT*)data;
+			for (uint64_t i = 0; i < nr_values; i++)
+				values[i] = src[i];
+		}
+	}
+
+	// Bounds-checked reading of the header of a block
+	class BinaryStarReader
+	{
+		public:
+
+		BinaryStarReader(const char* begin, const char* end, const FileName& fn)
+		: ptr(begin), end(end), fn(fn)
+		{}
+
+		template<class T>
+		T get()
+		{
+			T value;
+			memcpy(&value, take(sizeof(T)), sizeof(T));
+			return value;
+		}
+
+		std::string getString()
+		{
+			uint32_t length = get<uint32_t>();
+			return std::string(take(length), length);
+		}
+
+		const char* take(uint64_t size)
+		{
+			if (size > (uint64_t)(end - ptr))
+				REPORT_ERROR("MetaDataTable::readBinary: " + fn + " is truncated or corrupt");
+			const char* result = ptr;
+			ptr += size;
+			return result;
+		}
+
+		const char* ptr;
+		const char* end;
+		const FileName& fn;
+	};
+
+	// Header of one data block
+	struct BinaryStarBlock
+	{
+		std::string name, comment;
+		bool isList;
+		uint64_t nrRows;
+		const char* begin;
+		const char* end;
+
+		std::vector<EMDLabel> labels;
+		std::vector<uint32_t> types;
+		std::vector<const char*> data;
+		std::vector<uint64_t> sizes;
+
+		// Parse the header of the block that starts at 'begin'
+		BinaryStarBlock(const char* begin, const char* file_end, const FileName& fn)
+		: begin(begin)
+		{
+			BinaryStarReader in(begin, file_end, fn);
+
+			if (memcmp(in.take(8), BINARY_STAR_MAGIC, 8) != 0)
+				REPORT_ERROR("MetaDataTable::readBinary: " + fn + " is not a binary metadata file");
+
+			uint32_t version = in.get<uint32_t>();
+			if (version > BINARY_STAR_VERSION)
+				REPORT_ERROR("MetaDataTable::readBinary: " + fn + " was written by a newer version of RELION (format version " + integerToString(version) + ")");
+
+			if (in.get<uint32_t>() != BINARY_STAR_BYTE_ORDER)
+				REPORT_ERROR("MetaDataTable::readBinary: " + fn + " was written on a machine with a different byte order");
+
+			uint64_t block_size = in.get<uint64_t>();
+			if (block_size < 8 + 4 + 4 + 8 || block_size > (uint64_t)(file_end - begin))
+				REPORT_ERROR("MetaDataTable::readBinary: " + fn + " is truncated or corrupt");
+			end = begin + block_size;
+			in.end = end;
+
+			nrRows = in.get<uint64_t>();
+			uint32_t nr_columns = in.get<uint32_t>();
+			// Every column takes at least one byte per row
+			if (nr_columns > 0 && nrRows > block_size)
+				REPORT_ERROR("MetaDataTable::readBinary: " + fn + " is truncated or corrupt");
+			isList = (in.get<uint32_t>() != 0);
+			name = in.getString();
+			comment = in.getString();
+
+			for (uint32_t i = 0; i < nr_columns; i++)
+			{
+				std::string label_name = in.getString();
+				EMDLabel label = EMDL::str2Label(label_name);
+				if (label == EMDL_UNDEFINED)
+					REPORT_ERROR("ERROR: Unrecognised metadata label: " + label_name);
+
+				uint32_t type = in.get<uint32_t>();
+				if (type != binaryStarType(label))
+					REPORT_ERROR("MetaDataTable::readBinary: " + fn + " stores " + label_name + " with a different type");
+
+				uint64_t offset = in.get<uint64_t>();
+				uint64_t size = in.get<uint64_t>();
+				if (offset > block_size || size > block_size - offset)
+					REPORT_ERROR("MetaDataTable::readBinary: " + fn + " is truncated or corrupt");
+
+				labels.push_back(label);
+				types.push_back(type);
+				data.push_back(begin + offset);
+				sizes.push_back(size);
+			}
+		}
+	};
+
+void MetaDataTable::writeBinary(std::ostream& out) const
+{
+	// Only write tables that have something in them (as write() does)
+	if (isEmpty())
+		return;
+
+	const long int nr_columns = activeLabels.size();
+
+	// Lay out the block: header, directory and 8-byte aligned column data
+	uint64_t header_size = 8 + 4 + 4 + 8 + 8 + 4 + 4 + (4 + name.length()) + (4 + comment.length());
+	for (long i = 0; i < nr_columns; i++)
+		header_size += 4 + EMDL::label2Str(activeLabels[i]).length() + 4 + 8 + 8;
+
+	std::vector<uint64_t> offsets(nr_columns), sizes(nr_columns);
+	uint64_t block_size = alignBinaryStar(header_size);
+
+	for (long i = 0; i < nr_columns; i++)
+	{
+		const EMDLabel label = activeLabels[i];
+		const long off = label2offset[label];
+
+		switch (binaryStarType(label))
+		{
+		case BINARY_STAR_DOUBLE:
+			sizes[i] = objectCount * sizeof(double);
+			break;
+		case BINARY_STAR_INT:
+			sizes[i] = objectCount * sizeof(int64_t);
+			break;
+		case BINARY_STAR_BOOL:
+			sizes[i] = objectCount * sizeof(uint8_t);
+			break;
+		case BINARY_STAR_STRING:
+			sizes[i] = alignBinaryStar(sizeof(uint64_t) + objectCount * sizeof(int32_t)) + stringColumns[off].getPool().size();
+			break;
+		}
+
+		offsets[i] = block_size;
+		block_size += alignBinaryStar(sizes[i]);
+	}
+
+	out.write(BINARY_STAR_MAGIC, 8);
+	writeBinaryStarValue(out, BINARY_STAR_VERSION);
+	writeBinaryStarValue(out, BINARY_STAR_BYTE_ORDER);
+	writeBinaryStarValue(out, block_size);
+	writeBinaryStarValue(out, (uint64_t)objectCount);
+	writeBinaryStarValue(out, (uint32_t)nr_columns);
+	writeBinaryStarValue(out, (uint32_t)(isList ? 1 : 0));
+	writeBinaryStarString(out, name);
+	writeBinaryStarString(out, comment);
+
+	for (long i = 0; i < nr_columns; i++)
+	{
+		writeBinaryStarString(out, EMDL::label2Str(activeLabels[i]));
+		writeBinaryStarValue(out, binaryStarType(activeLabels[i]));
+		writeBinaryStarValue(out, offsets[i]);
+		writeBinaryStarValue(out, sizes[i]);
+	}
+	writeBinaryStarPadding(out, header_size);
+
+	for (long i = 0; i < nr_columns; i++)
+	{
+		const EMDLabel label = activeLabels[i];
+		const long off = label2offset[label];
+
+		switch (binaryStarType(label))
+		{
+		case BINARY_STAR_DOUBLE:
+			writeBinaryStarArray<double>(out, doubleColumns[off]);
+			break;
+		case BINARY_STAR_INT:
+			writeBinaryStarArray<int64_t>(out, intColumns[off]);
+			break;
+		case BINARY_STAR_BOOL:
+			writeBinaryStarArray<uint8_t>(out, boolColumns[off]);
+			break;
+		case BINARY_STAR_STRING:
+			{
+				const std::vector<char>& pool = stringColumns[off].getPool();
+				writeBinaryStarValue(out, (uint64_t)pool.size());
+				writeBinaryStarArray<int32_t>(out, stringColumns[off].getIds());
+				writeBinaryStarPadding(out, sizeof(uint64_t) + objectCount * sizeof(int32_t));
+				if (!pool.empty())
+					out.write(&pool[0], pool.size());
+			}
+			break;
+		}
+		writeBinaryStarPadding(out, sizes[i]);
+	}
+
+	if (!out)
+		REPORT_ERROR("MetaDataTable::writeBinary: error writing table " + name);
+}
+
+long int MetaDataTable::readBinary(const MappedFile& file, const FileName &fn, const std::string &name, std::vector<EMDLabel> *desiredLabels, std::string grep_pattern, bool do_only_count)
+{
+	for (const char* ptr = file.begin(); ptr < file.end(); )
+	{
+		BinaryStarBlock block(ptr, file.end(), fn);
+		ptr = block.end;
+
+		// If a name has been given, only read that block, otherwise just read the first one
+		if (name != "" && name != block.name)
+			continue;
+
+		setName(block.name);
+		setComment(block.comment);
+		setIsList(block.isList);
+
+		// Only touch the columns that have been asked for
+		std::vector<bool> do_load(block.labels.size(), true);
+		for (long i = 0; i < block.labels.size(); i++)
+		{
+			if (desiredLabels != NULL && !vectorContainsLabel(*desiredLabels, block.labels[i]))
+				do_load[i] = false;
+			else
+				addLabel(block.labels[i]);
+		}
+
+		if (grep_pattern != "")
+		{
+			// Keep the rows in which any of the values, as written in STAR format, contains the pattern
+			MetaDataTable MDall;
+			MDall.readBinary(file, fn, block.name, NULL, "", false);
+
+			std::vector<long> selected;
+			std::string val;
+			for (long int idx = 0; idx < MDall.objectCount; idx++)
+			{
+				for (long i = 0; i < MDall.activeLabels.size(); i++)
+				{
+					MDall.getValueToString(MDall.activeLabels[i], val, idx);
+					if (val.find(grep_pattern) != std::string::npos)
+					{
+						selected.push_back(idx);
+						break;
+					}
+				}
+			}
+
+			if (!do_only_count)
+				addValuesOfDefinedLabels(MDall, selected);
+
+			return selected.size();
+		}
+
+		const uint64_t nr_rows = block.nrRows;
+
+		if (do_only_count)
+			return (block.isList) ? 1 : nr_rows;
+
+		for (long i = 0; i < block.labels.size(); i++)
+		{
+			if (!do_load[i]) continue;
+
+			const long off = label2offset[block.labels[i]];
+			const char* data = block.data[i];
+			bool is_valid = true;
+
+			switch (block.types[i])
+			{
+			case BINARY_STAR_DOUBLE:
+				is_valid = binaryStarArrayFits(block.sizes[i], nr_rows, sizeof(double), true);
+				if (is_valid) readBinaryStarArray<double>(data, nr_rows, doubleColumns[off]);
+				break;
+			case BINARY_STAR_INT:
+				is_valid = binaryStarArrayFits(block.sizes[i], nr_rows, sizeof(int64_t), true);
+				if (is_valid) readBinaryStarArray<int64_t>(data, nr_rows, intColumns[off]);
+				break;
+			case BINARY_STAR_BOOL:
+				is_valid = binaryStarArrayFits(block.sizes[i], nr_rows, sizeof(uint8_t), true);
+				if (is_valid) readBinaryStarArray<uint8_t>(data, nr_rows, boolColumns[off]);
+				break;
+			case BINARY_STAR_STRING:
+				// The pool size and the ids have to fit in the column before anything is read from it
+				if (block.sizes[i] < sizeof(uint64_t)
+				    || !binaryStarArrayFits(block.sizes[i] - sizeof(uint64_t), nr_rows, sizeof(int32_t), false)
+				    || alignBinaryStar(sizeof(uint64_t) + nr_rows * sizeof(int32_t)) > block.sizes[i])
+				{
+					is_valid = false;
+				}
+				else
+				{
+					const uint64_t ids_size = alignBinaryStar(sizeof(uint64_t) + nr_rows * sizeof(int32_t));
+					uint64_t pool_size;
+					memcpy(&pool_size, data, sizeof(uint64_t));
+					is_valid = (block.sizes[i] - ids_size == pool_size)
+					        && stringColumns[off].assign((const int*)(data + sizeof(uint64_t)), nr_rows, data + ids_size, pool_size);
+				}
+				break;
+			}
+
+			if (!is_valid)
+				REPORT_ERROR("MetaDataTable::readBinary: " + fn + " is corrupt: invalid column " + EMDL::label2Str(block.labels[i]) + " in table " + block.name);
+		}
+
+		// Columns that were not in the file (possible when the table already had labels) get default values
+		objectCount = nr_rows;
+		for (long i = 0; i < doubleColumns.size(); i++) doubleColumns[i].resize(nr_rows, 0.);
+		for (long i = 0; i < intColumns.size(); i++) intColumns[i].resize(nr_rows, 0);
+		for (long i = 0; i < boolColumns.size(); i++) boolColumns[i].resize(nr_rows, false);
+		for (long i = 0; i < stringColumns.size(); i++) stringColumns[i].resize(nr_rows, "");
+		current_objectID = 0;
+
+		return (block.isList) ? 1 : nr_rows;
+	}
+
+	return 0;
+}
+
+std::vector<std::string> getMetaDataBlockNames(const FileName &fn)
+{
+	std::vector<std::string> names;
+	FileName fn_read = fn.removeFileFormat();
+
+	if (fn.getFileFormat() == "bstar")
+	{
+		MappedFile file;
+		if (!file.open(fn_read))
+		{
+			if (!exists(fn_read))
+				REPORT_ERROR("getMetaDataBlockNames: File " + fn_read + " does not exist");
+			return names; // empty file
+		}
+
+		for (const char* ptr = file.begin(); ptr < file.end(); )
+		{
+			BinaryStarBlock block(ptr, file.end(), fn_read);
+			names.push_back(block.name);
+			ptr = block.end;
+		}
+	}
+	else
+	{
+		std::ifstream in(fn_read.c_str(), std::ios_base::in);
+		if (in.fail())
+			REPORT_ERROR("getMetaDataBlockNames: File " + fn_read + " does not exist");
+
+		std::string line;
+		while (getline(in, line, '\n'))
+		{
+			// Names as they are matched by readStar()
+			if (line.compare(0, 5, "data_") == 0)
+				names.push_back(line.substr(5));
+		}
+	}
+
+	return names;
+}
+
 void MetaDataTable::columnHistogram(EMDLabel label, std::vector<RFLOAT> &histX, std::vector<RFLOAT> &histY,
 		int verb, CPlot2D * plot2D,
 		long int nr_bin, RFLOAT hist_min, RFLOAT hist_max,
@@ -1247,7 +2079,7 @@ void MetaDataTable::addToCPlot2D(CPlot2D *plot2D, EMDLabel xaxis, EMDLabel yaxis
 	double mydbl;
 	long int myint;
 	double xval, yval;
-	for (long int idx = 0; idx < objects.size(); idx++)
+	for (long int idx = 0; idx < objectCount; idx++)
 	{
 		const long offx = label2offset[xaxis];
 		if (offx < 0)
@@ -1259,12 +2091,12 @@ void MetaDataTable::addToCPlot2D(CPlot2D *plot2D, EMDLabel xaxis, EMDLabel yaxis
 		}
 		else if (EMDL::isDouble(xaxis))
 		{
-			objects[idx]->getValue(offx, mydbl);
+			getValue(xaxis, mydbl, idx);
 			xval = mydbl;
 		}
 		else if (EMDL::isInt(xaxis))
 		{
-			objects[idx]->getValue(offx, myint);
+			getValue(xaxis, myint, idx);
 			xval = myint;
 		}
 		else
@@ -1276,12 +2108,12 @@ void MetaDataTable::addToCPlot2D(CPlot2D *plot2D, EMDLabel xaxis, EMDLabel yaxis
 
 		if (EMDL::isDouble(yaxis))
 		{
-			objects[idx]->getValue(offy, mydbl);
+			getValue(yaxis, mydbl, idx);
 			yval = mydbl;
 		}
 		else if (EMDL::isInt(yaxis))
 		{
-			objects[idx]->getValue(offy, myint);
+			getValue(yaxis, myint, idx);
 			yval = myint;
 		}
 		else
@@ -1310,21 +2142,221 @@ void MetaDataTable::printLabels(std::ostream &ost)
 
 void MetaDataTable::randomiseOrder()
 {
-	std::random_shuffle(objects.begin(), objects.end());
+	std::vector<long> order(objectCount);
+	for (long i = 0; i < objectCount; i++)
+	{
+		order[i] = i;
+	}
+
+	std::random_shuffle(order.begin(), order.end());
+	reorder(order);
 }
 
 void MetaDataTable::checkObjectID(long id, std::string caller) const
 {
-	if (id >= objects.size() || id < 0)
+	if (id >= objectCount || id < 0)
 	{
 		std::stringstream sts0, sts1;
 		sts0 << id;
-		sts1 << objects.size();
+		sts1 << objectCount;
 		REPORT_ERROR(caller+": object " + sts0.str()
 					 + " out of bounds! (" + sts1.str() + " objects present)");
 	}
 }
 
+	// Helpers for compareMetaDataTable: find the first row (in table order) of MD2 that lies within eps of a row of MD1
+
+	// Minimum over ranges of an array of row numbers
+	class MdRangeMinimum
+	{
+		public:
+
+		MdRangeMinimum(const std::vector<long>& values)
+		: n(values.size()), tree(2 * values.size())
+		{
+			for (long i = 0; i < n; i++)
+				tree[n + i] = values[i];
+			for (long i = n - 1; i > 0; i--)
+				tree[i] = XMIPP_MIN(tree[2 * i], tree[2 * i + 1]);
+		}
+
+		// Minimum of values[lo] ... values[hi-1], or -1 if the range is empty
+		long query(long lo, long hi) const
+		{
+			long result = -1;
+			for (lo += n, hi += n; lo < hi; lo /= 2, hi /= 2)
+			{
+				if (lo & 1)
+				{
+					result = (result < 0) ? tree[lo] : XMIPP_MIN(result, tree[lo]);
+					lo++;
+				}
+				if (hi & 1)
+				{
+					hi--;
+					result = (result < 0) ? tree[hi] : XMIPP_MIN(result, tree[hi]);
+				}
+			}
+			return result;
+		}
+
+		private:
+
+		long n;
+		std::vector<long> tree;
+	};
+
+	// The criteria of the original pairwise comparison
+	inline bool mdCompareMatch(long v1, long v2, long max_diff)
+	{
+		return ABS(v2 - v1) <= max_diff;
+	}
+
+	inline bool mdCompareMatch(double x1, double x2, double eps)
+	{
+		double dist = sqrt((x1 - x2) * (x1 - x2));
+		return ABS(dist) <= eps;
+	}
+
+	inline bool mdCompareMatch(double x1, double y1, double z1, double x2, double y2, double z2, double eps)
+	{
+		double dist = sqrt( (x1 - x2) * (x1 - x2) +
+		                    (y1 - y2) * (y1 - y2) +
+		                    (z1 - z2) * (z1 - z2) );
+		return ABS(dist) <= eps;
+	}
+
+	// 1D: the values of MD2 that match a value form a contiguous range once they are sorted
+	template<class T>
+	void mdCompareSorted(const std::vector<T>& values1, const std::vector<T>& values2, T tolerance, std::vector<long>& match)
+	{
+		// Not even equal values match
+		if (!(tolerance >= 0))
+			return;
+
+		std::vector<std::pair<T, long> > sorted;
+		sorted.reserve(values2.size());
+		for (long i = 0; i < values2.size(); i++)
+		{
+			if (values2[i] == values2[i]) // NaN never matches
+				sorted.push_back(std::make_pair(values2[i], i));
+		}
+		std::sort(sorted.begin(), sorted.end());
+
+		std::vector<long> rows(sorted.size());
+		for (long i = 0; i < sorted.size(); i++)
+			rows[i] = sorted[i].second;
+		MdRangeMinimum firstRow(rows);
+
+		for (long i = 0; i < values1.size(); i++)
+		{
+			const T v = values1[i];
+
+			// First position that is not below the range
+			long lo = 0, hi = sorted.size();
+			while (lo < hi)
+			{
+				long mid = (lo + hi) / 2;
+				if (sorted[mid].first < v && !mdCompareMatch(v, sorted[mid].first, tolerance)) lo = mid + 1;
+				else hi = mid;
+			}
+			const long begin = lo;
+
+			// First position above the range
+			hi = sorted.size();
+			while (lo < hi)
+			{
+				long mid = (lo + hi) / 2;
+				if (sorted[mid].first <= v || mdCompareMatch(v, sorted[mid].first, tolerance)) lo = mid + 1;
+				else hi = mid;
+			}
+
+			match[i] = firstRow.query(begin, lo);
+		}
+	}
+
+	inline long mdCompareCell(double x, double cell_size)
+	{
+		double c = floor(x / cell_size);
+		return (long)XMIPP_MAX(-1e15, XMIPP_MIN(1e15, c));
+	}
+
+	struct MdCompareCellEntry
+	{
+		long cx, cy, cz, row;
+
+		bool operator < (const MdCompareCellEntry& other) const
+		{
+			if (cx != other.cx) return cx < other.cx;
+			if (cy != other.cy) return cy < other.cy;
+			if (cz != other.cz) return cz < other.cz;
+			return row < other.row;
+		}
+	};
+
+	// 2D or 3D: look for neighbours in a grid of cells of size eps
+	void mdCompareGrid(const std::vector<double>* x1, const std::vector<double>* y1, const std::vector<double>* z1,
+	                   const std::vector<double>* x2, const std::vector<double>* y2, const std::vector<double>* z2,
+	                   double eps, std::vector<long>& match)
+	{
+		// Slightly larger cells, so that rounding can never put matching values more than one cell apart
+		const double cell_size = eps * (1. + 1e-9);
+
+		const long nr1 = x1->size(), nr2 = x2->size();
+		std::vector<MdCompareCellEntry> cells;
+		cells.reserve(nr2);
+		for (long i = 0; i < nr2; i++)
+		{
+			const double x = (*x2)[i], y = (y2 != NULL) ? (*y2)[i] : 0., z = (z2 != NULL) ? (*z2)[i] : 0.;
+			if (x != x || y != y || z != z) continue; // NaN never matches
+
+			MdCompareCellEntry entry;
+			entry.cx = mdCompareCell(x, cell_size);
+			entry.cy = mdCompareCell(y, cell_size);
+			entry.cz = mdCompareCell(z, cell_size);
+			entry.row = i;
+			cells.push_back(entry);
+		}
+		std::sort(cells.begin(), cells.end());
+
+		const int ry = (y1 != NULL) ? 1 : 0, rz = (z1 != NULL) ? 1 : 0;
+		for (long i = 0; i < nr1; i++)
+		{
+			const double x = (*x1)[i], y = (y1 != NULL) ? (*y1)[i] : 0., z = (z1 != NULL) ? (*z1)[i] : 0.;
+			if (x != x || y != y || z != z) continue;
+
+			const long cx = mdCompareCell(x, cell_size), cy = mdCompareCell(y, cell_size), cz = mdCompareCell(z, cell_size);
+			long best = -1;
+
+			for (int dx = -1; dx <= 1; dx++)
+			for (int dy = -ry; dy <= ry; dy++)
+			for (int dz = -rz; dz <= rz; dz++)
+			{
+				MdCompareCellEntry key;
+				key.cx = cx + dx;
+				key.cy = cy + dy;
+				key.cz = cz + dz;
+				key.row = -1;
+
+				// Rows within a cell are in table order: the first match is the one we need
+				for (std::vector<MdCompareCellEntry>::const_iterator it = std::lower_bound(cells.begin(), cells.end(), key);
+				     it != cells.end() && it->cx == key.cx && it->cy == key.cy && it->cz == key.cz; it++)
+				{
+					if (best >= 0 && it->row > best) break;
+
+					const long j = it->row;
+					if (mdCompareMatch(x, y, z, (*x2)[j], (y2 != NULL) ? (*y2)[j] : 0., (z2 != NULL) ? (*z2)[j] : 0., eps))
+					{
+						best = j;
+						break;
+					}
+				}
+			}
+
+			match[i] = best;
+		}
+	}
+
 void compareMetaDataTable(MetaDataTable &MD1, MetaDataTable &MD2,
 		MetaDataTable &MDboth, MetaDataTable &MDonly1, MetaDataTable &MDonly2,
 		EMDLabel label1, double eps, EMDLabel label2, EMDLabel label3)
@@ -1358,114 +2390,65 @@ void compareMetaDataTable(MetaDataTable &MD1, MetaDataTable &MD2,
 	MDonly1.clear();
 	MDonly2.clear();
 
-	std::string mystr1, mystr2;
-	long int myint1, myint2;
-	double myd1, myd2, mydy1 = 0., mydy2 = 0., mydz1 = 0., mydz2 = 0.;
-
+	if (!EMDL::isString(label1) && !EMDL::isInt(label1) && !EMDL::isDouble(label1))
+		REPORT_ERROR("compareMetaDataTableEqualLabel ERROR: only implemented for strings, integers or doubles");
 
-	// loop over MD1
-	std::vector<long int> to_remove_from_only2;
-	for (long int current_object1 = MD1.firstObject();
-				  current_object1 != MetaDataTable::NO_MORE_OBJECTS && current_object1 != MetaDataTable::NO_OBJECTS_STORED;
-				  current_object1 = MD1.nextObject())
+	if (EMDL::isString(label1) || (EMDL::isInt(label1) && ROUND(eps) == 0) || (EMDL::isDouble(label1) && eps == 0.))
 	{
-		if (EMDL::isString(label1))
-			MD1.getValue(label1, mystr1);
-		else if (EMDL::isInt(label1))
-			MD1.getValue(label1, myint1);
-		else if (EMDL::isDouble(label1))
-		{
-			MD1.getValue(label1, myd1);
-			if (label2 != EMDL_UNDEFINED)
-				MD1.getValue(label2, mydy1);
-			if (label3 != EMDL_UNDEFINED)
-				MD1.getValue(label3, mydz1);
-		}
-		else
-			REPORT_ERROR("compareMetaDataTableEqualLabel ERROR: only implemented for strings, integers or doubles");
-
-		// loop over MD2
-		bool have_in_2 = false;
-		for (long int current_object2 = MD2.firstObject();
-					  current_object2 != MetaDataTable::NO_MORE_OBJECTS && current_object2 != MetaDataTable::NO_OBJECTS_STORED;
-					  current_object2 = MD2.nextObject())
-		{
-
-			if (EMDL::isString(label1))
-			{
-				MD2.getValue(label1, mystr2);
-				if (strcmp(mystr1.c_str(), mystr2.c_str()) == 0)
-				{
-					have_in_2 = true;
-					to_remove_from_only2.push_back(current_object2);
-					MDboth.addObject(MD1.getObject());
-					break;
-				}
-			}
-			else if (EMDL::isInt(label1))
-			{
-				MD2.getValue(label1, myint2);
-				if ( ABS(myint2 - myint1) <= ROUND(eps) )
-				{
-					have_in_2 = true;
-					to_remove_from_only2.push_back(current_object2);
-					MDboth.addObject(MD1.getObject());
-					break;
-				}
-			}
-			else if (EMDL::isDouble(label1))
-			{
-				MD2.getValue(label1, myd2);
-				if (label2 != EMDL_UNDEFINED)
-					MD2.getValue(label2, mydy2);
-				if (label3 != EMDL_UNDEFINED)
-					MD2.getValue(label3, mydz2);
-
-				double dist = sqrt( (myd1 - myd2) * (myd1 - myd2) +
-									(mydy1 - mydy2) * (mydy1 - mydy2) +
-									(mydz1 - mydz2) * (mydz1 - mydz2) );
-				if ( ABS(dist) <= eps )
-				{
-					have_in_2 = true;
-					to_remove_from_only2.push_back(current_object2);
-					//std::cerr << " current_object1= " << current_object1 << std::endl;
-					//std::cerr << " myd1= " << myd1 << " myd2= " << myd2 << " mydy1= " << mydy1 << " mydy2= " << mydy2 << " dist= "<<dist<<std::endl;
-					//std::cerr << " to be removed current_object2= " << current_object2 << std::endl;
-					MDboth.addObject(MD1.getObject());
-					break;
-				}
-			}
-		}
+		// Exact matches: hashed semi- and anti-joins on the labels
+		std::vector<EMDLabel> keys(1, label1);
+		if (label2 != EMDL_UNDEFINED) keys.push_back(label2);
+		if (label3 != EMDL_UNDEFINED) keys.push_back(label3);
 
-		if (!have_in_2)
-		{
-			MDonly1.addObject(MD1.getObject());
-		}
+		MDboth = joinMetaDataTables(MD1, MD2, keys, JOIN_SEMI);
+		MDonly1 = joinMetaDataTables(MD1, MD2, keys, JOIN_ANTI);
+		MDonly2 = joinMetaDataTables(MD2, MD1, keys, JOIN_ANTI);
+		return;
 	}
 
+	const long int nr1 = MD1.numberOfObjects(), nr2 = MD2.numberOfObjects();
 
+	// For every row of MD1, the first row of MD2 within distance eps (-1 if none)
+	std::vector<long> match(nr1, -1);
 
-	for (long int current_object2 = MD2.firstObject();
-				current_object2 != MetaDataTable::NO_MORE_OBJECTS && current_object2 != MetaDataTable::NO_OBJECTS_STORED;
-				current_object2 = MD2.nextObject())
+	if (EMDL::isInt(label1))
 	{
+		mdCompareSorted(*MD1.getIntColumn(label1), *MD2.getIntColumn(label1), (long)ROUND(eps), match);
+	}
+	else if (label2 == EMDL_UNDEFINED && label3 == EMDL_UNDEFINED)
+	{
+		mdCompareSorted(*MD1.getDoubleColumn(label1), *MD2.getDoubleColumn(label1), eps, match);
+	}
+	else if (eps > 0.)
+	{
+		mdCompareGrid(MD1.getDoubleColumn(label1), MD1.getDoubleColumn(label2), MD1.getDoubleColumn(label3),
+		              MD2.getDoubleColumn(label1), MD2.getDoubleColumn(label2), MD2.getDoubleColumn(label3), eps, match);
+	}
 
-		bool to_be_removed = false;
-		for (long int i = 0; i < to_remove_from_only2.size(); i++)
+	std::vector<long int> in_both, only_in_1, only_in_2;
+	std::vector<bool> is_matched(nr2, false);
+	for (long int i = 0; i < nr1; i++)
+	{
+		if (match[i] >= 0)
 		{
-			if (to_remove_from_only2[i] == current_object2)
-			{
-				to_be_removed = true;
-				break;
-			}
+			in_both.push_back(i);
+			is_matched[match[i]] = true;
 		}
-		if (!to_be_removed)
+		else
 		{
-			//std::cerr << " doNOT remove current_object2= " << current_object2 << std::endl;
-			MDonly2.addObject(MD2.getObject(current_object2));
+			only_in_1.push_back(i);
 		}
 	}
 
+	for (long int i = 0; i < nr2; i++)
+	{
+		if (!is_matched[i])
+			only_in_2.push_back(i);
+	}
+
+	MDboth.addObjects(MD1, in_both);
+	MDonly1.addObjects(MD1, only_in_1);
+	MDonly2.addObjects(MD2, only_in_2);
 
 }
 
@@ -1539,10 +2522,13 @@ MetaDataTable combineMetaDataTables(std::vector<MetaDataTable> &MDin)
 
 			for (size_t i = 0; i < MDin.size(); i++)
 			{
-				for (size_t j = 0; j < MDin[i].numberOfObjects(); j++)
+				std::vector<long> objectIDs(MDin[i].numberOfObjects());
+				for (size_t j = 0; j < objectIDs.size(); j++)
 				{
-					MDc.addValuesOfDefinedLabels(MDin[i].getObject(j));
+					objectIDs[j] = j;
 				}
+
+				MDc.addValuesOfDefinedLabels(MDin[i], objectIDs);
 			}
 		}
 	}
@@ -1579,30 +2565,33 @@ MetaDataTable subsetMetaDataTable(MetaDataTable &MDin, EMDLabel label, RFLOAT mi
 	if (!MDin.containsLabel(label))
 		REPORT_ERROR("subsetMetadataTable ERROR: input MetaDataTable does not contain label: " +  EMDL::label2Str(label));
 
-	MetaDataTable MDout;
-	FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDin)
+	std::vector<long> selected;
+	const long nr_objects = MDin.numberOfObjects();
+
+	if (EMDL::isInt(label))
 	{
-		bool do_include = false;
-		if (EMDL::isInt(label))
+		const std::vector<long>& column = *MDin.getIntColumn(label);
+		for (long i = 0; i < nr_objects; i++)
 		{
-			long val;
-			MDin.getValue(label, val);
-			do_include = ((RFLOAT)val < max_value && (RFLOAT)val > min_value);
+			const RFLOAT val = column[i];
+			if (val < max_value && val > min_value)
+				selected.push_back(i);
 		}
-		else
-		{
-			RFLOAT val;
-			MDin.getValue(label, val);
-			do_include = ((RFLOAT)val < max_value && (RFLOAT)val > min_value);
-		}
-
-		if (do_include)
+	}
+	else
+	{
+		const std::vector<double>& column = *MDin.getDoubleColumn(label);
+		for (long i = 0; i < nr_objects; i++)
 		{
-			MDout.addObject(MDin.getObject(current_object));
+			const RFLOAT val = column[i];
+			if (val < max_value && val > min_value)
+				selected.push_back(i);
 		}
-
 	}
 
+	MetaDataTable MDout;
+	MDout.addObjects(MDin, selected);
+
 	return MDout;
 
 }
@@ -1616,20 +2605,26 @@ MetaDataTable subsetMetaDataTable(MetaDataTable &MDin, EMDLabel label, std::stri
 	if (!MDin.containsLabel(label))
 		REPORT_ERROR("subsetMetadataTable ERROR: input MetaDataTable does not contain label: " +  EMDL::label2Str(label));
 
-	MetaDataTable MDout;
-	FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDin)
-	{
-		std::string val;
-		MDin.getValue(label, val);
+	const MetaDataStringColumn& column = *MDin.getStringColumn(label);
 
-		bool found = (val.find(search_str) != std::string::npos);
+	// Only search each distinct string once
+	std::vector<char> found(column.numberOfUniqueValues());
+	for (long id = 0; id < found.size(); id++)
+	{
+		found[id] = (strstr(column.getString(id), search_str.c_str()) != NULL);
+	}
 
-		if ((!exclude && found) || (exclude && !found))
-		{
-			MDout.addObject(MDin.getObject(current_object));
-		}
+	std::vector<long> selected;
+	const long nr_objects = MDin.numberOfObjects();
+	for (long i = 0; i < nr_objects; i++)
+	{
+		if (found[column.getId(i)] != exclude)
+			selected.push_back(i);
 	}
 
+	MetaDataTable MDout;
+	MDout.addObjects(MDin, selected);
+
 	return MDout;
 }
 
@@ -1643,47 +2638,46 @@ MetaDataTable removeDuplicatedParticles(MetaDataTable &MDin, EMDLabel mic_label,
 	if (!MDin.containsLabel(mic_label))
 		REPORT_ERROR("STAR file does not contain " + EMDL::label2Str(mic_label));
 
-	std::vector<bool> valid(MDin.numberOfObjects(), true);
-	std::vector<RFLOAT> xs(MDin.numberOfObjects(), 0.0);
-	std::vector<RFLOAT> ys(MDin.numberOfObjects(), 0.0);
+	const long nr_objects = MDin.numberOfObjects();
+	std::vector<bool> valid(nr_objects, true);
+	std::vector<RFLOAT> xs(nr_objects, 0.0);
+	std::vector<RFLOAT> ys(nr_objects, 0.0);
 
 	RFLOAT threshold_sq = threshold * threshold;
 
-	// group by micrograph
-	std::map<std::string, std::vector<long> > grouped;
-	FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDin)
-	{
-		std::string mic_name;
-		MDin.getValue(mic_label, mic_name);
+	const std::vector<double>& origin_x = *MDin.getDoubleColumn(EMDL_ORIENT_ORIGIN_X);
+	const std::vector<double>& origin_y = *MDin.getDoubleColumn(EMDL_ORIENT_ORIGIN_Y);
+	const std::vector<double>& coord_x = *MDin.getDoubleColumn(EMDL_IMAGE_COORD_X);
+	const std::vector<double>& coord_y = *MDin.getDoubleColumn(EMDL_IMAGE_COORD_Y);
+	const MetaDataStringColumn& mics = *MDin.getStringColumn(mic_label);
 
-		RFLOAT val1, val2;
-		MDin.getValue(EMDL_ORIENT_ORIGIN_X, val1);
-		MDin.getValue(EMDL_IMAGE_COORD_X, val2);
-		xs[current_object] = -val1 * origin_scale + val2;
-		MDin.getValue(EMDL_ORIENT_ORIGIN_Y, val1);
-		MDin.getValue(EMDL_IMAGE_COORD_Y, val2);
-		ys[current_object] = -val1 * origin_scale + val2;
+	// group by micrograph: equal micrograph names have equal ids in the string column
+	std::vector<std::vector<long> > grouped(mics.numberOfUniqueValues());
+	for (long i = 0; i < nr_objects; i++)
+	{
+		xs[i] = -origin_x[i] * origin_scale + coord_x[i];
+		ys[i] = -origin_y[i] * origin_scale + coord_y[i];
 
-		grouped[mic_name].push_back(current_object);
+		grouped[mics.getId(i)].push_back(i);
 	}
 
 	// find duplicate
-	for (std::map<std::string, std::vector<long> >::iterator it = grouped.begin(); it != grouped.end(); ++it)
+	for (long g = 0; g < grouped.size(); g++)
 	{
-		long n_particles = it->second.size();
+		const std::vector<long>& group = grouped[g];
+		long n_particles = group.size();
 
 		for (long i = 0; i < n_particles; i++)
 		{
-			long part_id1 = it->second[i];
+			long part_id1 = group[i];
 
 			for (long j = i + 1; j < n_particles; j++)
 			{
-				long part_id2 = it->second[j];
+				long part_id2 = group[j];
 				RFLOAT dist_sq = (xs[part_id1] - xs[part_id2]) * (xs[part_id1] - xs[part_id2]) + (ys[part_id1] - ys[part_id2]) * (ys[part_id1] - ys[part_id2]);
 
 				if (dist_sq <= threshold_sq)
 				{
-//					std::cout << it->first << " " << part_id1 << " " << part_id2 << " " << dist_sq << std::endl;
 					valid[part_id1] = false;
 					break;
 				}
@@ -1691,26 +2685,23 @@ MetaDataTable removeDuplicatedParticles(MetaDataTable &MDin, EMDLabel mic_label,
 		}
 	}
 
-
-	MetaDataTable MDout, MDremoved;
-	long n_removed = 0;
-	FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDin)
+	std::vector<long> kept, removed;
+	for (long i = 0; i < nr_objects; i++)
 	{
-		if (valid[current_object])
-		{
-			MDout.addObject(MDin.getObject(current_object));
-		}
+		if (valid[i])
+			kept.push_back(i);
 		else
-		{
-			MDremoved.addObject(MDin.getObject(current_object));
-			n_removed++;
-		}
+			removed.push_back(i);
 	}
 
+	MetaDataTable MDout, MDremoved;
+	MDout.addObjects(MDin, kept);
+	MDremoved.addObjects(MDin, removed);
+
 	if (fn_removed != "")
 		MDremoved.write(fn_removed);
 
-	std::cout << "Removed " << n_removed << " duplicated objects from " << MDin.numberOfObjects() << " objects." << std::endl;
+	std::cout << "Removed " << removed.size() << " duplicated objects from " << nr_objects << " objects." << std::endl;
 
 	return MDout;
 }
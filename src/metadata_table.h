@@ -44,6 +44,9 @@
 #include "src/args.h"
 #include "src/CPlot2D.h"
 #include "src/metadata_container.h"
+#include "src/metadata_column.h"
+#include "src/mapped_file.h"
+#include "src/metadata_index.h"
 #include "src/metadata_label.h"
 
 /** For all objects.
@@ -69,29 +72,32 @@
  *	- stores a table of values for an arbitrary subset of predefined EMDLabels
  *	- each column corresponds to a label
  *	- each row represents a data point
- *	- the rows are stored in per-type contiguous blocks of memory
- *	-
+ *	- each column is stored as one contiguous array of its own type;
+ *	  string columns only store indices into a per-column pool of unique strings
  */
 class MetaDataTable
 {
-	// Effectively stores all metadata
-	std::vector<MetaDataContainer*> objects;
+	// Effectively stores all metadata: one array per defined label
+	std::vector<std::vector<double> > doubleColumns;
+	std::vector<std::vector<long> > intColumns;
+	std::vector<std::vector<char> > boolColumns;
+	std::vector<MetaDataStringColumn> stringColumns;
 
-	// Maps labels to corresponding indices in the vectors in MetaDataContainer.
+	// Maps labels to corresponding indices in the column vectors.
 	// The length of label2offset is always equal to the number of defined labels (~320)
 	// e.g.:
 	// the value of "defocus-U" for row r is stored in:
-	//	 objects[r]->doubles[label2offset[EMDL_CTF_DEFOCUSU]]
+	//	 doubleColumns[label2offset[EMDL_CTF_DEFOCUSU]][r]
 	// the value of "image name" is stored in:
-	//	 objects[r]->strings[label2offset[EMDL_IMAGE_NAME]]
+	//	 stringColumns[label2offset[EMDL_IMAGE_NAME]].get(r)
 	std::vector<long> label2offset;
 
+	// Number of rows
+	long objectCount;
+
 	// Current object id
 	long current_objectID;
 
-	// Number of labels of each type
-	long doubleLabels, intLabels, boolLabels, stringLabels;
-
 	// Is this a 2D table or a 1D list?
 	bool isList;
 
@@ -186,7 +192,8 @@ public:
 	void append(const MetaDataTable& app);
 
 	// Get metadatacontainer for objectID (current_objectID if objectID < 0)
-	MetaDataContainer* getObject(long objectID = -1) const;
+	// The container refers to the row by its index, so it should not be kept while rows are removed or reordered.
+	MetaDataContainer getObject(long objectID = -1) const;
 
 	/* setObject(data, objectID)
 	 *  copies values from 'data' to object 'objectID'.
@@ -195,7 +202,7 @@ public:
 	 *  Undefined labels are inserted.
 	 *
 	 *  Use addObject() to set an object that does not yet exist */
-	void setObject(MetaDataContainer* data, long objectID = -1);
+	void setObject(const MetaDataContainer &data, long objectID = -1);
 
 	/* setValuesOfDefinedLabels(data, objectID)
 	 * copies values from 'data' to object 'objectID'.
@@ -204,7 +211,7 @@ public:
 	 * Only already defined labels are considered.
 	 *
 	 * Use addValuesOfDefinedLabels() to add an object that does not yet exist */
-	void setValuesOfDefinedLabels(MetaDataContainer* data, long objectID = -1);
+	void setValuesOfDefinedLabels(const MetaDataContainer &data, long objectID = -1);
 
 	// reserve memory for this many lines
 	void reserve(size_t capacity);
@@ -218,13 +225,42 @@ public:
 	 *  Adds a new object and sets its values to those from 'data'.
 	 *  The set of labels for the table is extended as necessary.
 	 *  Afterwards, 'current_objectID' points to the newly added object.*/
-	void addObject(MetaDataContainer* data);
+	void addObject(const MetaDataContainer &data);
 
 	/* addValuesOfDefinedLabels(data)
 	 *  Adds a new object and sets the already defined values to those from 'data'.
 	 *  Labels from 'data' that are not already defined are ignored.
 	 *  Afterwards, 'current_objectID' points to the newly added object.*/
-	void addValuesOfDefinedLabels(MetaDataContainer* data);
+	void addValuesOfDefinedLabels(const MetaDataContainer &data);
+
+	/* addObjects(mdt, objectIDs)
+	 *  Adds copies of the objects 'objectIDs' from 'mdt' in one go (column by column).
+	 *  The set of labels for the table is extended as necessary.
+	 *  Afterwards, 'current_objectID' points to the last added object.*/
+	void addObjects(const MetaDataTable& mdt, const std::vector<long>& objectIDs);
+
+	/* addValuesOfDefinedLabels(mdt, objectIDs)
+	 *  Same as addObjects, but labels from 'mdt' that are not already defined are ignored.*/
+	void addValuesOfDefinedLabels(const MetaDataTable& mdt, const std::vector<long>& objectIDs);
+
+	/* reorder(order)
+	 *  Rearranges the rows such that new row i is old row order[i].
+	 *  If 'order' is shorter than the table, only the listed rows are kept.*/
+	void reorder(const std::vector<long>& order);
+
+	// Approximate number of bytes used to store the values in this table
+	size_t memoryUsage() const;
+
+	// Number of distinct values in a column, or of distinct combinations of values in several columns
+	long numberOfDistinctValues(EMDLabel label) const;
+	long numberOfDistinctValues(const std::vector<EMDLabel>& labels) const;
+
+	// Read-only access to the column of a label.
+	// Returns NULL if the label is not defined or is of another type.
+	const std::vector<double>* getDoubleColumn(EMDLabel label) const;
+	const std::vector<long>* getIntColumn(EMDLabel label) const;
+	const std::vector<char>* getBoolColumn(EMDLabel label) const;
+	const MetaDataStringColumn* getStringColumn(EMDLabel label) const;
 
 	/* removeObject(objectID)
 	 *  If objectID is not given, 'current_objectID' will be removed.
@@ -240,8 +276,9 @@ public:
 
 	long goToObject(long objectID);
 
-	// Read a STAR loop structure
-	long int readStarLoop(std::ifstream& in, std::vector<EMDLabel> *labelsVector = NULL, std::string grep_pattern = "", bool do_only_count = false);
+	// Read a STAR loop structure (parsed straight from mapped, the memory map of the file of in, if given)
+	long int readStarLoop(std::ifstream& in, std::vector<EMDLabel> *labelsVector = NULL, std::string grep_pattern = "", bool do_only_count = false,
+			const MappedFile *mapped = NULL);
 
 	/* Read a STAR list
 	 * The function returns true if the list is followed by a loop, false otherwise */
@@ -257,16 +294,24 @@ public:
 	 * If the data block contains only a list or a table, it is read in the MetaDataTable and the function will return 1
 	 *
 	 * If no data block is found the function will return 0 and the MetaDataTable remains empty
+	 *
+	 * Loops are parsed straight from mapped, the memory map of the file of in, if it is given
 	 */
-	long int readStar(std::ifstream& in, const std::string &name = "", std::vector<EMDLabel> *labelsVector = NULL, std::string grep_pattern = "", bool do_only_count = false);
+	long int readStar(std::ifstream& in, const std::string &name = "", std::vector<EMDLabel> *labelsVector = NULL, std::string grep_pattern = "", bool do_only_count = false,
+			const MappedFile *mapped = NULL);
 
-	// Read a MetaDataTable (get file format from extension)
+	// Read a MetaDataTable (get file format from extension: .star for text, .bstar for binary)
 	long int read(const FileName &filename, const std::string &name = "", std::vector<EMDLabel> *labelsVector = NULL, std::string grep_pattern = "", bool do_only_count = false);
 
 	// Write a MetaDataTable in STAR format
 	void write(std::ostream& out = std::cout) const;
 
-	// Write to a single file
+	/* Write a MetaDataTable as one data block of the binary format
+	 *  (the stream should have been opened with std::ios::binary)
+	 *  Several tables may be written one after the other into the same file */
+	void writeBinary(std::ostream& out) const;
+
+	// Write to a single file (binary if the extension is .bstar, STAR otherwise)
 	void write(const FileName & fn_out) const;
 
 	// Make a histogram of a column
@@ -301,7 +346,75 @@ private:
 
 	/* setObjectUnsafe(data)
 	 *  Same as setObject, but assumes that all labels are present. */
-	void setObjectUnsafe(MetaDataContainer* data, long objId);
+	void setObjectUnsafe(const MetaDataContainer &data, long objId);
+
+	// Append rows of 'mdt' for all labels defined here (missing ones get default values)
+	void appendRowsUnsafe(const MetaDataTable& mdt, const std::vector<long>& objectIDs);
+
+	// Resize all columns to objectCount rows, filling new rows with default values
+	void resizeColumns(long newCount);
+
+	/* Parse the data lines of a loop_ structure in [begin, end)
+	 *  column i of the text is stored under columnLabels[i] (EMDL_UNDEFINED columns are skipped)
+	 *  parsing stops at the first empty line; its position is returned in loopEnd
+	 *  large loops are split into chunks at line boundaries and parsed in parallel */
+	long int readStarLoopData(const char* begin, const char* end, const std::vector<EMDLabel>& columnLabels,
+	                          const std::string& grep_pattern, bool do_only_count, const char*& loopEnd);
+
+	/* Read the data block called name (or the first one) from a file in the binary format
+	 *  Only the columns in labelsVector are loaded; the other columns are never touched */
+	long int readBinary(const MappedFile& file, const FileName &fn, const std::string &name, std::vector<EMDLabel> *labelsVector, std::string grep_pattern, bool do_only_count);
+
+	// Typed access to the column storage (the type of the argument selects the column type)
+	inline void getColumnValue(long off, long objectID, double& dest) const
+	{
+		dest = doubleColumns[off][objectID];
+	}
+	inline void getColumnValue(long off, long objectID, float& dest) const
+	{
+		dest = (float)doubleColumns[off][objectID];
+	}
+	inline void getColumnValue(long off, long objectID, int& dest) const
+	{
+		dest = (int)intColumns[off][objectID];
+	}
+	inline void getColumnValue(long off, long objectID, long& dest) const
+	{
+		dest = intColumns[off][objectID];
+	}
+	inline void getColumnValue(long off, long objectID, bool& dest) const
+	{
+		dest = (boolColumns[off][objectID] != 0);
+	}
+	inline void getColumnValue(long off, long objectID, std::string& dest) const
+	{
+		dest = stringColumns[off].c_str(objectID);
+	}
+
+	inline void setColumnValue(long off, long objectID, const double& src)
+	{
+		doubleColumns[off][objectID] = src;
+	}
+	inline void setColumnValue(long off, long objectID, const float& src)
+	{
+		doubleColumns[off][objectID] = src;
+	}
+	inline void setColumnValue(long off, long objectID, const int& src)
+	{
+		intColumns[off][objectID] = src;
+	}
+	inline void setColumnValue(long off, long objectID, const long& src)
+	{
+		intColumns[off][objectID] = src;
+	}
+	inline void setColumnValue(long off, long objectID, const bool& src)
+	{
+		boolColumns[off][objectID] = src;
+	}
+	inline void setColumnValue(long off, long objectID, const std::string& src)
+	{
+		stringColumns[off].set(objectID, src);
+	}
 
 };
 
@@ -321,6 +434,9 @@ MetaDataTable subsetMetaDataTable(MetaDataTable &MDin, EMDLabel label, RFLOAT mi
 // find a subset of the input metadata table that has corresponding entries with or without a given substring
 MetaDataTable subsetMetaDataTable(MetaDataTable &MDin, EMDLabel label, std::string search_str, bool exclude=false);
 
+// Names of all data blocks in a STAR or binary metadata file, in the order in which they occur
+std::vector<std::string> getMetaDataBlockNames(const FileName &fn);
+
 // remove duplicated particles that are in the same micrograph (mic_label) and within a given threshold [px]
 // OriginX/Y are multiplied by origin_scale before added to CoordinateX/Y to compensate for down-sampling
 MetaDataTable removeDuplicatedParticles(MetaDataTable &MDin, EMDLabel mic_label, RFLOAT threshold, RFLOAT origin_scale=1.0, FileName fn_removed="", bool verb=true);
@@ -340,7 +456,7 @@ bool MetaDataTable::getValue(EMDLabel label, T& value, long objectID) const
 		else
 			checkObjectID(objectID,  "MetaDataTable::getValue");
 
-		objects[objectID]->getValue(off, value);
+		getColumnValue(off, objectID, value);
 		return true;
 	}
 	else
@@ -370,7 +486,7 @@ bool MetaDataTable::setValue(EMDLabel name, const T &value, long int objectID)
 
 	if (off > -1)
 	{
-		objects[objectID]->setValue(off, value);
+		setColumnValue(off, objectID, value);
 		return true;
 	}
 	else
@@ -379,4 +495,10 @@ bool MetaDataTable::setValue(EMDLabel name, const T &value, long int objectID)
 	}
 }
 
+template<class T>
+bool MetaDataContainer::getValue(EMDLabel label, T& dest) const
+{
+	return table->getValue(label, dest, objectID);
+}
+
 #endif
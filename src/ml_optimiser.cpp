@@ -42,6 +42,7 @@
 #include "src/macros.h"
 #include "src/error.h"
 #include "src/ml_optimiser.h"
+#include "src/fftw_plan_cache.h"
 #ifdef CUDA
 #include "src/acc/cuda/cuda_ml_optimiser.h"
 #include <nvToolsExt.h>
@@ -51,6 +52,7 @@
 	#include <tbb/tbb.h>
 	#include <tbb/parallel_for.h>
 	#include <tbb/task_scheduler_init.h>
+	#include "src/acc/cpu/cpu_tuning.h"
 	#include "src/acc/cpu/cpu_ml_optimiser.h"
 #endif
 
@@ -85,6 +87,22 @@ void globalThreadExpectationSomeParticles(ThreadArgument &thArg)
 	}
 }
 
+void globalThreadReduceBackProjectors(ThreadArgument &thArg)
+{
+	MlOptimiser *MLO = (MlOptimiser*) thArg.workClass;
+
+	try
+	{
+		MLO->doThreadReduceBackProjectors(thArg.thread_id);
+	}
+	catch (RelionError XE)
+	{
+		RelionError *gE = new RelionError(XE.msg, XE.file, XE.line);
+		gE->msg = XE.msg;
+		MLO->threadException = gE;
+	}
+}
+
 
 /** ========================== I/O operations  =========================== */
 
@@ -136,6 +154,7 @@ void MlOptimiser::parseContinue(int argc, char **argv)
 		fn_out = fn_out_new;
 
 	do_force_converge =  parser.checkOption("--force_converge", "Force an auto-refinement run to converge immediately upon continuation.");
+	do_write_binary_metadata = parser.checkOption("--write_binary_metadata", "Write the particle metadata of every iteration to a binary _data.bstar file instead of _data.star, which is much faster to write and read (convert with relion_star_handler --to_star)");
 
 	// For multi-body refinement
 	bool fn_body_masks_was_empty = (fn_body_masks == "None");
@@ -394,6 +413,19 @@ void MlOptimiser::parseContinue(int argc, char **argv)
 	combine_weights_thru_disc = !parser.checkOption("--dont_combine_weights_via_disc", "Send the large arrays of summed weights through the MPI network, instead of writing large files to disc");
 	do_shifts_onthefly = parser.checkOption("--onthefly_shifts", "Calculate shifted images on-the-fly, do not store precalculated ones in memory");
 	do_preread_images  = parser.checkOption("--preread_images", "Use this to let the master process read all particles into memory. Be careful you have enough RAM for large data sets!");
+	nr_prefetch_threads = textToInteger(parser.getOption("--prefetch_threads", "Number of threads that read particle images from disc ahead of the calculations (0 = read them on the fly)", "1"));
+	prefetch_depth = textToInteger(parser.getOption("--prefetch_depth", "Maximum number of pools of particle images that are read ahead", "2"));
+	cache_encoding = parser.getOption("--cache_particles", "Keep compressed copies of the particles in RAM, as an alternative to --preread_images: float16, lossless or bounded", "");
+	cache_max_error = textToFloat(parser.getOption("--cache_max_error", "Maximum absolute error per pixel for --cache_particles bounded", "0.01"));
+	cache_ram = textToFloat(parser.getOption("--cache_ram", "Maximum amount of RAM (in Gb) per process for --cache_particles; the remaining stacks are read from disc (negative for no limit)", "-1"));
+	do_thread_bp = parser.checkOption("--thread_bp", "Let each thread backproject into its own copy of the reconstructions, which are summed at the end of the expectation step");
+	thread_bp_max_ram = textToFloat(parser.getOption("--thread_bp_max_ram", "Maximum amount of RAM (in Gb) per process for the copies of --thread_bp; otherwise all threads share the reconstructions", "8"));
+	fn_ooc = parser.getOption("--ooc_dir", "Keep the Fourier-space arrays of the 3D reconstructions in the maximisation step in memory-mapped files in this directory, to reconstruct large boxes with less RAM", "");
+	ooc_max_ram = textToFloat(parser.getOption("--ooc_max_ram", "Maximum amount of RAM (in Gb) per reconstruction for the parts of the arrays in --ooc_dir that are processed at a time. This does not include the data and weight arrays of the back-projections (about 12 bytes per voxel of the padded box per class, in double precision), which stay in RAM", "1"));
+	projector_precision = textToPrecision(parser.getOption("--projector_precision", "Precision of the Fourier transforms of the references during the expectation step: double, float or half (less memory per class, projections are still interpolated in double)", "double"));
+	backprojector_precision = textToPrecision(parser.getOption("--backprojector_precision", "Precision in which the backprojections are summed during the expectation step: double or float (half the memory per class; not with --cpu or --gpu)", "double"));
+	do_profile_trace = parser.checkOption("--profile_trace", "Also write every timed call to a Chrome trace-event file (rootname_trace.json, one per MPI rank) for chrome://tracing or Perfetto");
+	do_profile = parser.checkOption("--profile", "Write the time spent per thread in the expectation sub-steps, combining of weighted sums, maximization, I/O and FFTs to rootname_profile.jsonl, one line per iteration (and MPI rank)") || do_profile_trace;
 	fn_scratch = parser.getOption("--scratch_dir", "If provided, particle stacks will be copied to this local scratch disk prior to refinement.", "");
 	keep_free_scratch_Gb = textToInteger(parser.getOption("--keep_free_scratch", "Space available for copying particle stacks (in Gb)", "10"));
 	do_reuse_scratch = parser.checkOption("--reuse_scratch", "Re-use data on scratchdir, instead of wiping it and re-copying all data. This works only when ALL particles have already been cached.");
@@ -401,6 +433,8 @@ void MlOptimiser::parseContinue(int argc, char **argv)
 
 #ifdef ALTCPU
 	do_cpu = parser.checkOption("--cpu", "Use intel vectorisation implementation for CPU");
+	do_skip_cpu_tuning = parser.checkOption("--skip_cpu_tuning", "Use the compiled-in block sizes of the CPU kernels, instead of the ones tuned for this CPU and box size (see RELION_CPU_TUNING)");
+	do_tune_only = parser.checkOption("--tune_only", "Only tune the block sizes of the CPU kernels for this CPU and box size, store them in the tuning file, and exit");
 #else
         do_cpu = false;
 #endif
@@ -416,6 +450,9 @@ void MlOptimiser::parseContinue(int argc, char **argv)
 		do_gpu = false;
 	}
 #endif
+	// The accelerators sum the backprojections in their own arrays, sized from the RFLOAT data of the backprojectors
+	if ((do_cpu || do_gpu) && backprojector_precision != PRECISION_RFLOAT)
+		REPORT_ERROR("ERROR: --backprojector_precision float cannot be combined with --cpu or --gpu");
 	double temp_reqSize = textToDouble(parser.getOption("--free_gpu_memory", "GPU device memory (in Mb) to leave free after allocation.", "0"));
 	if(!do_zero_mask)
 		temp_reqSize += 100;
@@ -503,6 +540,7 @@ void MlOptimiser::parseInitial(int argc, char **argv)
 	fn_local_symmetry = parser.getOption("--local_symmetry", "Local symmetry description file containing list of masks and their operators", "None");
     do_split_random_halves = parser.checkOption("--split_random_halves", "Refine two random halves of the data completely separately");
 	low_resol_join_halves = textToFloat(parser.getOption("--low_resol_join_halves", "Resolution (in Angstrom) up to which the two random half-reconstructions will not be independent to prevent diverging orientations","-1"));
+	do_write_binary_metadata = parser.checkOption("--write_binary_metadata", "Write the particle metadata of every iteration to a binary _data.bstar file instead of _data.star, which is much faster to write and read (convert with relion_star_handler --to_star)");
 
 	// Initialisation
 	int init_section = parser.addSection("Initialisation");
@@ -650,6 +688,19 @@ void MlOptimiser::parseInitial(int argc, char **argv)
 	do_shifts_onthefly = parser.checkOption("--onthefly_shifts", "Calculate shifted images on-the-fly, do not store precalculated ones in memory");
 	do_parallel_disc_io = !parser.checkOption("--no_parallel_disc_io", "Do NOT let parallel (MPI) processes access the disc simultaneously (use this option with NFS)");
 	do_preread_images  = parser.checkOption("--preread_images", "Use this to let the master process read all particles into memory. Be careful you have enough RAM for large data sets!");
+	nr_prefetch_threads = textToInteger(parser.getOption("--prefetch_threads", "Number of threads that read particle images from disc ahead of the calculations (0 = read them on the fly)", "1"));
+	prefetch_depth = textToInteger(parser.getOption("--prefetch_depth", "Maximum number of pools of particle images that are read ahead", "2"));
+	cache_encoding = parser.getOption("--cache_particles", "Keep compressed copies of the particles in RAM, as an alternative to --preread_images: float16, lossless or bounded", "");
+	cache_max_error = textToFloat(parser.getOption("--cache_max_error", "Maximum absolute error per pixel for --cache_particles bounded", "0.01"));
+	cache_ram = textToFloat(parser.getOption("--cache_ram", "Maximum amount of RAM (in Gb) per process for --cache_particles; the remaining stacks are read from disc (negative for no limit)", "-1"));
+	do_thread_bp = parser.checkOption("--thread_bp", "Let each thread backproject into its own copy of the reconstructions, which are summed at the end of the expectation step");
+	thread_bp_max_ram = textToFloat(parser.getOption("--thread_bp_max_ram", "Maximum amount of RAM (in Gb) per process for the copies of --thread_bp; otherwise all threads share the reconstructions", "8"));
+	fn_ooc = parser.getOption("--ooc_dir", "Keep the Fourier-space arrays of the 3D reconstructions in the maximisation step in memory-mapped files in this directory, to reconstruct large boxes with less RAM", "");
+	ooc_max_ram = textToFloat(parser.getOption("--ooc_max_ram", "Maximum amount of RAM (in Gb) per reconstruction for the parts of the arrays in --ooc_dir that are processed at a time. This does not include the data and weight arrays of the back-projections (about 12 bytes per voxel of the padded box per class, in double precision), which stay in RAM", "1"));
+	projector_precision = textToPrecision(parser.getOption("--projector_precision", "Precision of the Fourier transforms of the references during the expectation step: double, float or half (less memory per class, projections are still interpolated in double)", "double"));
+	backprojector_precision = textToPrecision(parser.getOption("--backprojector_precision", "Precision in which the backprojections are summed during the expectation step: double or float (half the memory per class; not with --cpu or --gpu)", "double"));
+	do_profile_trace = parser.checkOption("--profile_trace", "Also write every timed call to a Chrome trace-event file (rootname_trace.json, one per MPI rank) for chrome://tracing or Perfetto");
+	do_profile = parser.checkOption("--profile", "Write the time spent per thread in the expectation sub-steps, combining of weighted sums, maximization, I/O and FFTs to rootname_profile.jsonl, one line per iteration (and MPI rank)") || do_profile_trace;
 	fn_scratch = parser.getOption("--scratch_dir", "If provided, particle stacks will be copied to this local scratch disk prior to refinement.", "");
 	keep_free_scratch_Gb = textToInteger(parser.getOption("--keep_free_scratch", "Space available for copying particle stacks (in Gb)", "10"));
 	do_reuse_scratch = parser.checkOption("--reuse_scratch", "Re-use data on scratchdir, instead of wiping it and re-copying all data.");
@@ -657,6 +708,8 @@ void MlOptimiser::parseInitial(int argc, char **argv)
 	do_fast_subsets = parser.checkOption("--fast_subsets", "Use faster optimisation by using subsets of the data in the first 15 iterations");
 #ifdef ALTCPU
 	do_cpu = parser.checkOption("--cpu", "Use intel vectorisation implementation for CPU");
+	do_skip_cpu_tuning = parser.checkOption("--skip_cpu_tuning", "Use the compiled-in block sizes of the CPU kernels, instead of the ones tuned for this CPU and box size (see RELION_CPU_TUNING)");
+	do_tune_only = parser.checkOption("--tune_only", "Only tune the block sizes of the CPU kernels for this CPU and box size, store them in the tuning file, and exit");
 #else
         do_cpu = false;
 #endif
@@ -670,6 +723,9 @@ void MlOptimiser::parseInitial(int argc, char **argv)
 		do_gpu = false;
 	}
 #endif
+	// The accelerators sum the backprojections in their own arrays, sized from the RFLOAT data of the backprojectors
+	if ((do_cpu || do_gpu) && backprojector_precision != PRECISION_RFLOAT)
+		REPORT_ERROR("ERROR: --backprojector_precision float cannot be combined with --cpu or --gpu");
 	double temp_reqSize = textToDouble(parser.getOption("--free_gpu_memory", "GPU device memory (in Mb) to leave free after allocation.", "0"));
 	if(!do_zero_mask)
 		temp_reqSize += 100;
@@ -974,6 +1030,8 @@ void MlOptimiser::write(bool do_write_sampling, bool do_write_data, bool do_writ
 	if (subset_size > 0 && (iter % write_every_sgd_iter) != 0)
 		return;
 
+	ProfileScope profile_scope(PROF_WRITE_OUTPUT);
+
 	FileName fn_root, fn_tmp, fn_model, fn_model2, fn_data, fn_sampling, fn_root2;
 	std::ofstream  fh;
 	if (iter > -1)
@@ -1007,7 +1065,7 @@ void MlOptimiser::write(bool do_write_sampling, bool do_write_data, bool do_writ
 		{
 			fn_model = fn_root2 + "_model.star";
 		}
-		fn_data = fn_root + "_data.star";
+		fn_data = fn_root + ((do_write_binary_metadata) ? "_data.bstar" : "_data.star");
 		fn_sampling = fn_root + "_sampling.star";
 
 		MetaDataTable MD;
@@ -1120,7 +1178,7 @@ void MlOptimiser::write(bool do_write_sampling, bool do_write_data, bool do_writ
 
 	// And write the mydata to file
 	if (do_write_data)
-		mydata.write(fn_root);
+		mydata.write(fn_root, do_write_binary_metadata);
 
 	// And write the sampling object
 	if (do_write_sampling)
@@ -1240,7 +1298,13 @@ void MlOptimiser::initialise()
 	{
 		// Set the size of the TBB thread pool for the entire run
 		tbbSchedulerInit.initialize(nr_threads);
+
+		// Block sizes of the kernels for this CPU and box size
+		if (!do_skip_cpu_tuning || do_tune_only)
+			CpuTuning::initialise(mymodel.ori_size, mymodel.ref_dim, mymodel.data_dim, do_tune_only, verb);
 	}
+	else if (do_tune_only)
+		REPORT_ERROR("ERROR: --tune_only is only for the CPU kernels (--cpu)");
 #endif
 #ifdef MKLFFT
 	// Enable multi-threaded FFTW
@@ -1250,7 +1314,7 @@ void MlOptimiser::initialise()
 
 	// And allow plans before expectation to run using allowed
 	// number of threads
-	fftw_plan_with_nthreads(nr_threads);
+	FftwPlanCache::setNumberOfThreads(nr_threads);
 #endif
 
 	if (fn_sigma != "")
@@ -1854,6 +1918,11 @@ void MlOptimiser::initialiseGeneral(int rank)
 
 	// Initialise the wsum_model according to the mymodel
 	wsum_model.initialise(mymodel, sampling.symmetryGroup(), asymmetric_padding, skip_gridding);
+	for (int iclass = 0; iclass < wsum_model.BPref.size(); iclass++)
+	{
+		wsum_model.BPref[iclass].ooc_dir = fn_ooc;
+		wsum_model.BPref[iclass].ooc_max_ram = ooc_max_ram;
+	}
 
 	// Initialise sums of hidden variable changes
 	// In later iterations, this will be done in updateOverallChangesInHiddenVariables
@@ -1992,6 +2061,78 @@ void MlOptimiser::initialiseWorkLoad()
 	}
     }
 
+    initialiseParticleCache();
+
+}
+
+void MlOptimiser::initialiseParticleCache(int random_subset)
+{
+	if (cache_encoding == "")
+		return;
+
+	if (do_preread_images)
+		REPORT_ERROR("ERROR: --cache_particles cannot be combined with --preread_images");
+
+	// Only the expectation step with parallel disc access of 2D images reads from the cache
+	if (!do_parallel_disc_io || mymodel.data_dim == 3)
+	{
+		if (verb > 0)
+			std::cout << " WARNING: --cache_particles is ignored for sub-tomograms or with --no_parallel_disc_io" << std::endl;
+		return;
+	}
+
+	delete particle_cache;
+	RFLOAT budget = (cache_ram < 0.) ? -1. : cache_ram * 1024. * 1024. * 1024.;
+	particle_cache = new ParticleCache(mydata.numberOfParticles(), ParticleCache::encodingFromString(cache_encoding), cache_max_error, budget);
+
+	long int nr_particles = mydata.numberOfParticles();
+	int barstep = XMIPP_MAX(1, nr_particles / 60);
+	if (verb > 0)
+	{
+		std::cout << " Caching particles in RAM ..." << std::endl;
+		init_progress_bar(nr_particles);
+	}
+
+	// Only open stacks once, a stack is either cached completely or not at all
+	fImageHandler hFile;
+	long int dump;
+	FileName fn_img, fn_stack, fn_open_stack = "";
+	for (long int part_id = 0; part_id < nr_particles; part_id++)
+	{
+		// Do not spend the budget on particles of the other half-set, which this process never reads
+		if (random_subset > 0 && mydata.getRandomSubset(part_id) != random_subset)
+			continue;
+
+		if (!mydata.getImageNameOnScratch(part_id, fn_img))
+			mydata.MDimg.getValue(EMDL_IMAGE_NAME, fn_img, part_id);
+
+		fn_img.decompose(dump, fn_stack);
+		if (fn_stack != fn_open_stack)
+		{
+			if (!particle_cache->startStack())
+				break;
+			hFile.openFile(fn_stack, WRITE_READONLY);
+			fn_open_stack = fn_stack;
+		}
+
+		Image<float> img;
+		img.readFromOpenFile(fn_img, hFile, -1, false);
+		if (!particle_cache->addImage(part_id, img()))
+			break;
+
+		if (verb > 0 && part_id % barstep == 0)
+			progress_bar(part_id);
+	}
+
+	if (verb > 0)
+	{
+		progress_bar(nr_particles);
+		std::cout << " Cached " << particle_cache->getNrImages() << " of " << mydata.numberOfParticles(random_subset) << " particles in "
+				<< particle_cache->getNrBytes() / (1024. * 1024. * 1024.) << " Gb";
+		if (particle_cache->getNrBytes() > 0)
+			std::cout << " (" << (RFLOAT)particle_cache->getNrBytesUncompressed() / particle_cache->getNrBytes() << " times less than as floats)";
+		std::cout << std::endl;
+	}
 }
 
 void MlOptimiser::calculateSumOfPowerSpectraAndAverageImage(MultidimArray<RFLOAT> &Mavg, bool myverb)
@@ -2392,6 +2533,11 @@ void MlOptimiser::iterateSetup()
 	// Set up the thread task distributors for the particles and the orientations (will be resized later on)
 	exp_ipart_ThreadTaskDistributor = new ThreadTaskDistributor(nr_threads, 1);
 
+	// Read the particle images ahead of the calculations, unless they are all in memory already
+	// Sub-tomograms are read one at a time inside the expectation step to save RAM
+	if (nr_prefetch_threads > 0 && do_parallel_disc_io && !do_preread_images && mymodel.data_dim != 3)
+		image_prefetcher = new ParticlePrefetcher(nr_prefetch_threads, prefetch_depth);
+
 }
 void MlOptimiser::iterateWrapUp()
 {
@@ -2400,6 +2546,8 @@ void MlOptimiser::iterateWrapUp()
 	delete global_barrier;
 	delete global_ThreadManager;
 	delete exp_ipart_ThreadTaskDistributor;
+	delete image_prefetcher;
+	image_prefetcher = NULL;
 
 	// Delete volatile space on scratch
 	if (!keep_scratch)
@@ -2417,6 +2565,9 @@ void MlOptimiser::iterate()
 		REPORT_ERROR("ERROR: Cannot split data into random halves without using MPI!");
 
 
+	if (do_profile)
+		Profiler::start(fn_out + "_profile.jsonl", (do_profile_trace) ? fn_out + "_trace.json" : "", 0);
+
 	// launch threads etc
 	iterateSetup();
 
@@ -2439,6 +2590,8 @@ void MlOptimiser::iterate()
 	bool has_already_reached_convergence = false;
 	for (iter = iter + 1; iter <= nr_iter; iter++)
 	{
+		Profiler::nextIteration(iter);
+
 #ifdef DEBUG_HELICAL_ORIENTATIONAL_SEARCH
 		// May18,2015 - Shaoda & Sjors, Helical refinement (orientational searches)
 		std::cerr << std::endl << std::endl;
@@ -2607,10 +2760,13 @@ void MlOptimiser::iterate()
 	// delete threads etc
 	iterateWrapUp();
 
+	Profiler::stop();
+
 }
 
 void MlOptimiser::expectation()
 {
+	ProfileScope profile_scope(PROF_EXPECTATION);
 
 //#define DEBUG_EXP
 #ifdef DEBUG_EXP
@@ -2619,7 +2775,7 @@ void MlOptimiser::expectation()
 
 #ifdef MKLFFT
 	// Allow parallel FFTW execution
-	fftw_plan_with_nthreads(nr_threads);
+	FftwPlanCache::setNumberOfThreads(nr_threads);
 #endif
 
 	// Initialise some stuff
@@ -2774,9 +2930,13 @@ void MlOptimiser::expectation()
 #endif // ALTCPU
 	/************************************************************************/
 
+	// Keep the references in lower precision for the rest of the expectation step (only if --projector_precision)
+	for (int i = 0; i < mymodel.PPref.size(); i++)
+		mymodel.PPref[i].setDataPrecision(projector_precision);
+
 #ifdef MKLFFT
 	// Single-threaded FFTW execution for code inside parallel processing loop
-	fftw_plan_with_nthreads(1);
+	FftwPlanCache::setNumberOfThreads(1);
 #endif
 
 	// Now perform real expectation over all particles
@@ -2806,6 +2966,13 @@ void MlOptimiser::expectation()
 		init_progress_bar(my_nr_ori_particles);
 	}
 
+	long int prefetch_first_ori_particle = my_first_ori_particle;
+	if (image_prefetcher != NULL)
+		image_prefetcher->clear();
+	// Only report the statistics of this expectation step
+	std::vector<double> reading_stats;
+	getImageReadingStatistics(reading_stats);
+
 	while (nr_ori_particles_done < my_nr_ori_particles)
 	{
 
@@ -2819,6 +2986,10 @@ void MlOptimiser::expectation()
 		// Get the metadata for these particles
 		getMetaAndImageDataSubset(my_pool_first_ori_particle, my_pool_last_ori_particle, !do_parallel_disc_io);
 
+		// Let the prefetcher read this pool and the next ones while this one is being processed
+		if (image_prefetcher != NULL)
+			prefetch_first_ori_particle = prefetchImages(prefetch_first_ori_particle, my_last_ori_particle);
+
 #ifdef TIMING
 		timer.toc(TIMING_EXP_METADATA);
 #endif
@@ -2856,8 +3027,21 @@ void MlOptimiser::expectation()
 	}
 
 	if (verb > 0)
+	{
 		progress_bar(my_nr_ori_particles);
 
+		std::vector<double> stats;
+		getImageReadingStatistics(stats);
+		printImageReadingStatistics(stats);
+	}
+
+	// Add the backprojections of all threads together (only if --thread_bp)
+	reduceThreadBackProjectors();
+
+	// Combine and reconstruct in RFLOAT
+	for (int i = 0; i < wsum_model.BPref.size(); i++)
+		wsum_model.BPref[i].setDataPrecision(PRECISION_RFLOAT);
+
 #ifdef CUDA
 	if (do_gpu)
 	{
@@ -2969,12 +3153,12 @@ void MlOptimiser::expectation()
 #ifdef  MKLFFT
 	// Allow parallel FFTW execution to continue now that we are outside the parallel
 	// portion of expectation
-	fftw_plan_with_nthreads(nr_threads);
+	FftwPlanCache::setNumberOfThreads(nr_threads);
 #endif
 
 	// Clean up some memory
 	for (int iclass = 0; iclass < mymodel.nr_classes; iclass++)
-		mymodel.PPref[iclass].data.clear();
+		mymodel.PPref[iclass].clearData();
 
 #ifdef DEBUG_EXP
 	std::cerr << "Expectation: done " << std::endl;
@@ -2985,6 +3169,7 @@ void MlOptimiser::expectation()
 
 void MlOptimiser::expectationSetup()
 {
+	ProfileScope profile_scope(PROF_EXP_SETUP);
 #ifdef DEBUG
 	std::cerr << "Entering expectationSetup" << std::endl;
 #endif
@@ -3002,6 +3187,13 @@ void MlOptimiser::expectationSetup()
 	// Initialise all weighted sums to zero
 	wsum_model.initZeros();
 
+	// Sum the backprojections in lower precision (only if --backprojector_precision float)
+	for (int i = 0; i < wsum_model.BPref.size(); i++)
+		wsum_model.BPref[i].setDataPrecision(backprojector_precision);
+
+	// Private copies of the backprojectors for the threads (only if --thread_bp)
+	initialiseThreadBackProjectors();
+
 	// If we're doing SGD with gradual decrease of sigma2_fudge: calculate current fudge-factor here
 	if (do_sgd && sgd_sigma2fudge_halflife > 0)
 	{
@@ -3095,8 +3287,9 @@ void MlOptimiser::expectationSetupCheckMemory(int myverb)
 		// Each RFLOAT takes 8 bytes, and their are mymodel.nr_classes references, express in Gb
 		RFLOAT Gb = sizeof(RFLOAT) / (1024. * 1024. * 1024.);
 		// A. Calculate approximate size of the reference maps
-		// Forward projector has complex data, backprojector has complex data and real weight
-		RFLOAT mem_references = Gb * mymodel.nr_classes * (2 * MULTIDIM_SIZE((mymodel.PPref[0]).data) + 3 * MULTIDIM_SIZE((wsum_model.BPref[0]).data));
+		// Forward projector has complex data, backprojector has complex data and real weight (in the precisions of the expectation step)
+		RFLOAT mem_references = mymodel.nr_classes * (Projector::getElementSize(projector_precision) * (mymodel.PPref[0]).getSize() +
+				(wsum_model.BPref[0]).getDataMemory()) / (1024. * 1024. * 1024.);
 		// B. Weight vectors
 		RFLOAT mem_pool = Gb * mymodel.nr_classes * sampling.NrSamplingPoints(adaptive_oversampling,
 				&pointer_dir_nonzeroprior, &pointer_psi_nonzeroprior);
@@ -3121,7 +3314,7 @@ void MlOptimiser::expectationSetupCheckMemory(int myverb)
 		// Each reconstruction has to store 1 extra complex array (Fconv) and 4 extra RFLOAT arrays (Fweight, Fnewweight. vol_out and Mconv in convoluteBlobRealSpace),
 		// in adddition to the RFLOAT weight-array and the complex data-array of the BPref
 		// That makes a total of 2*2 + 5 = 9 * a RFLOAT array of size BPref
-		RFLOAT total_mem_Gb_max = Gb * 9 * MULTIDIM_SIZE((wsum_model.BPref[0]).data);
+		RFLOAT total_mem_Gb_max = Gb * 9 * (wsum_model.BPref[0]).getSize();
 
 		std::cout << " Estimated memory for expectation  step > " << total_mem_Gb_exp << " Gb."<<std::endl;
 		std::cout << " Estimated memory for maximization step > " << total_mem_Gb_max << " Gb."<<std::endl;
@@ -3200,6 +3393,7 @@ void MlOptimiser::precalculateABMatrices()
 
 void MlOptimiser::expectationSomeParticles(long int my_first_ori_particle, long int my_last_ori_particle)
 {
+	ProfileScope profile_scope(PROF_EXP_SOME_PARTICLES);
 
 #ifdef TIMING
 	timer.tic(TIMING_ESP);
@@ -3236,6 +3430,15 @@ void MlOptimiser::expectationSomeParticles(long int my_first_ori_particle, long
     exp_nr_images = 0;
     long int istop = 0;
     exp_imgs.clear();
+
+	// If the images of this pool have not been queued by prefetchImages() or queueImages(), queue them now,
+	// so that the prefetcher reads ahead of the calculations within this pool
+	if (image_prefetcher != NULL && !image_prefetcher->hasBatch(my_first_ori_particle, my_last_ori_particle))
+	{
+		image_prefetcher->clear();
+		queueImages(my_first_ori_particle, my_last_ori_particle, exp_fn_img);
+	}
+
     for (long int ori_part_id = my_first_ori_particle; ori_part_id <= my_last_ori_particle; ori_part_id++)
 	{
 
@@ -3289,14 +3492,23 @@ void MlOptimiser::expectationSomeParticles(long int my_first_ori_particle, long
 
 		// Sjors 7 March 2016 to prevent too high disk access... Read in all pooled images simultaneously
 		// Don't do this for sub-tomograms to save RAM!
-		if (do_parallel_disc_io && !do_preread_images && mymodel.data_dim != 3)
+		if (image_prefetcher == NULL && do_parallel_disc_io && !do_preread_images && mymodel.data_dim != 3)
 		{
+			ProfileScope profile_scope(PROF_READ_IMAGES);
+
 			// Read in all images, only open/close common stacks once
 			for (int ipart = 0; ipart < mydata.ori_particles[ori_part_id].particles_id.size(); ipart++, istop++)
 			{
 
 				long int part_id = mydata.ori_particles[ori_part_id].particles_id[ipart];
 
+				// Cached images are decompressed later on, by the thread that needs them
+				if (particle_cache != NULL && particle_cache->contains(part_id))
+				{
+					exp_imgs.push_back(MultidimArray<RFLOAT>());
+					continue;
+				}
+
 				// Read from disc
 				// Get the filename
 				if (!mydata.getImageNameOnScratch(part_id, fn_img))
@@ -3327,7 +3539,6 @@ void MlOptimiser::expectationSomeParticles(long int my_first_ori_particle, long
 
 	} //end loop over ori_part_id
 
-
 #ifdef DEBUG_EXPSOME
 	std::cerr << " exp_my_first_ori_particle= " << exp_my_first_ori_particle << " exp_my_last_ori_particle= " << exp_my_last_ori_particle << std::endl;
 	std::cerr << " exp_nr_images= " << exp_nr_images << std::endl;
@@ -3338,7 +3549,11 @@ void MlOptimiser::expectationSomeParticles(long int my_first_ori_particle, long
 		// process multiple particles at once
 		exp_ipart_ThreadTaskDistributor->resize(my_last_ori_particle - my_first_ori_particle + 1, 1);
 		exp_ipart_ThreadTaskDistributor->reset();
-		global_ThreadManager->run(globalThreadExpectationSomeParticles);
+		global_ThreadManager->runAsync(globalThreadExpectationSomeParticles);
+		// The main thread only waits for the threads, so meanwhile it may handle messages (see MlOptimiserMpi)
+		while (!exp_ipart_ThreadTaskDistributor->allTasksAssigned() && pollDuringExpectation())
+			usleep(1000);
+		global_ThreadManager->wait();
 	}
 #ifdef ALTCPU
 	else
@@ -3349,6 +3564,8 @@ void MlOptimiser::expectationSomeParticles(long int my_first_ori_particle, long
 		// (roughly equivalent to GPU "threads").
 		int tCount = 0;
 
+		pollDuringExpectation();
+
 		// process all passed particles in parallel
 		//for(unsigned long i=my_first_ori_particle; i<=my_last_ori_particle; i++) {
 		tbb::parallel_for(my_first_ori_particle, my_last_ori_particle+1, [&](int i) {
@@ -3369,6 +3586,10 @@ void MlOptimiser::expectationSomeParticles(long int my_first_ori_particle, long
 	}  // do_cpu
 #endif  // ifdef ALTCPU
 
+	// The images of this pool are no longer needed
+	if (image_prefetcher != NULL)
+		image_prefetcher->popBatch();
+
 	if (threadException != NULL)
 		throw *threadException;
 
@@ -3430,9 +3651,111 @@ void MlOptimiser::doThreadExpectationSomeParticles(int thread_id)
 
 }
 
+long int MlOptimiser::prefetchImages(long int first_ori_particle, long int last_ori_particle)
+{
+	// Use the same pools as the expectation step
+	while (first_ori_particle <= last_ori_particle && !image_prefetcher->isFull())
+	{
+		long int last_pool_ori_particle = XMIPP_MIN(last_ori_particle, first_ori_particle + nr_pool - 1);
+
+		std::vector<FileName> fn_imgs;
+		for (long int ori_part_id = first_ori_particle; ori_part_id <= last_pool_ori_particle; ori_part_id++)
+		{
+			for (int ipart = 0; ipart < mydata.ori_particles[ori_part_id].particles_id.size(); ipart++)
+			{
+				long int part_id = mydata.ori_particles[ori_part_id].particles_id[ipart];
+				// Cached images do not have to be read (an empty name tells the prefetcher to skip them)
+				FileName fn_img = "";
+				if (particle_cache == NULL || !particle_cache->contains(part_id))
+				{
+					if (!mydata.getImageNameOnScratch(part_id, fn_img))
+						mydata.MDimg.getValue(EMDL_IMAGE_NAME, fn_img, part_id);
+				}
+				fn_imgs.push_back(fn_img);
+			}
+		}
+
+		image_prefetcher->addBatch(first_ori_particle, last_pool_ori_particle, fn_imgs);
+		first_ori_particle = last_pool_ori_particle + 1;
+	}
+
+	return first_ori_particle;
+}
+
+void MlOptimiser::queueImages(long int first_ori_particle, long int last_ori_particle, const std::string &fn_imgs)
+{
+	std::vector<FileName> fn_queue;
+	std::istringstream split(fn_imgs);
+	for (long int ori_part_id = first_ori_particle; ori_part_id <= last_ori_particle; ori_part_id++)
+	{
+		for (int ipart = 0; ipart < mydata.ori_particles[ori_part_id].particles_id.size(); ipart++)
+		{
+			long int part_id = mydata.ori_particles[ori_part_id].particles_id[ipart];
+			std::string fn_line;
+			FileName fn_img;
+			getline(split, fn_line);
+			if (particle_cache != NULL && particle_cache->contains(part_id))
+				fn_img = "";
+			else if (!mydata.getImageNameOnScratch(part_id, fn_img))
+				fn_img = fn_line;
+			fn_queue.push_back(fn_img);
+		}
+	}
+
+	image_prefetcher->addBatch(first_ori_particle, last_ori_particle, fn_queue);
+}
+
+void MlOptimiser::getExpImage(long int part_id, long int istop, MultidimArray<RFLOAT> &img)
+{
+	ProfileScope profile_scope(PROF_READ_IMAGES);
+	if (particle_cache != NULL && particle_cache->getImage(part_id, img))
+		return;
+	else if (image_prefetcher != NULL)
+		img = image_prefetcher->getImage(istop);
+	else
+		img = exp_imgs[istop];
+}
+
+void MlOptimiser::getImageReadingStatistics(std::vector<double> &stats)
+{
+	stats.assign(6, 0.);
+
+	if (image_prefetcher != NULL)
+	{
+		stats[0] = image_prefetcher->getWaitTime();
+		stats[1] = image_prefetcher->getReadTime();
+		stats[2] = image_prefetcher->getNrImagesRead();
+		image_prefetcher->resetStatistics();
+	}
+
+	if (particle_cache != NULL)
+	{
+		long int nr_hits, nr_misses;
+		particle_cache->getStatistics(nr_hits, nr_misses, stats[5]);
+		stats[3] = nr_hits;
+		stats[4] = nr_misses;
+		particle_cache->resetStatistics();
+	}
+}
+
+void MlOptimiser::printImageReadingStatistics(const std::vector<double> &stats, int nr_processes)
+{
+	std::string per_process = (nr_processes > 1) ? " on average per slave" : "";
+
+	if (stats[2] > 0. || stats[0] > 0.)
+		std::cout << " Waited " << stats[0] / nr_processes << " sec" << per_process << " for particle images ("
+				<< (long int)stats[2] << " images read in " << stats[1] << " sec)" << std::endl;
+
+	if (stats[3] + stats[4] > 0.)
+		std::cout << " Particle cache: " << ROUND(100. * stats[3] / (stats[3] + stats[4])) << "% hits, decoding took "
+				<< stats[5] / nr_processes << " sec" << per_process << std::endl;
+}
+
+
 
 void MlOptimiser::expectationOneParticle(long int my_ori_particle, int thread_id)
 {
+	ProfileScope profile_scope(PROF_EXP_ONE_PARTICLE);
 #ifdef TIMING
 	if (my_ori_particle == exp_my_first_ori_particle)
 		timer.tic(TIMING_ESP_INI);
@@ -3742,7 +4065,8 @@ void MlOptimiser::expectationOneParticle(long int my_ori_particle, int thread_id
 				exp_power_imgs, exp_old_offset, exp_prior, exp_Mweight, exp_Mcoarse_significant,
 				exp_significant_weight, exp_sum_weight, exp_max_weight,
 				exp_pointer_dir_nonzeroprior, exp_pointer_psi_nonzeroprior, exp_directions_prior, exp_psi_prior,
-				exp_local_Fimgs_shifted, exp_local_Fimgs_shifted_nomask, exp_local_Minvsigma2s, exp_local_Fctfs, exp_local_sqrtXi2);
+				exp_local_Fimgs_shifted, exp_local_Fimgs_shifted_nomask, exp_local_Minvsigma2s, exp_local_Fctfs, exp_local_sqrtXi2,
+				thread_id);
 
 #ifdef RELION_TESTING
 //		std::string mode;
@@ -3925,6 +4249,7 @@ void MlOptimiser::makeGoodHelixForEachRef()
 
 void MlOptimiser::maximization()
 {
+	ProfileScope profile_scope(PROF_MAXIMIZATION);
 
 	if (verb > 0)
 	{
@@ -4700,6 +5025,7 @@ void MlOptimiser::getFourierTransformsAndCtfs(long int my_ori_particle, int ibod
 		std::vector<RFLOAT> &exp_directions_prior,
 		std::vector<RFLOAT> &exp_psi_prior)
 {
+	ProfileScope profile_scope(PROF_EXP_FOURIER_TRANSFORMS);
 
 	FourierTransformer transformer;
 	for (int ipart = 0; ipart < mydata.ori_particles[my_ori_particle].particles_id.size(); ipart++)
@@ -4924,6 +5250,7 @@ void MlOptimiser::getFourierTransformsAndCtfs(long int my_ori_particle, int ibod
 				if (mymodel.data_dim == 3)
 				{
 					// Read sub-tomograms from disc in parallel (to save RAM in exp_imgs)
+					ProfileScope profile_scope(PROF_READ_IMAGES);
 					FileName fn_img;
 					if (!mydata.getImageNameOnScratch(part_id, fn_img))
 					{
@@ -4936,7 +5263,7 @@ void MlOptimiser::getFourierTransformsAndCtfs(long int my_ori_particle, int ibod
 				}
 				else
 				{
-					img() = exp_imgs[istop];
+					getExpImage(part_id, istop, img());
 				}
 #endif
 			}
@@ -5593,6 +5920,7 @@ void MlOptimiser::precalculateShiftedImagesCtfsAndInvSigma2s(bool do_also_unmask
 		std::vector<RFLOAT> &exp_local_sqrtXi2,
 		std::vector<MultidimArray<RFLOAT> > &exp_local_Minvsigma2s)
 {
+	ProfileScope profile_scope(PROF_EXP_PRECALC_SHIFTS);
 
 #ifdef TIMING
 	if (my_ori_particle == exp_my_first_ori_particle)
@@ -5869,6 +6197,7 @@ void MlOptimiser::getAllSquaredDifferences(long int my_ori_particle, int ibody,
 		std::vector<MultidimArray<RFLOAT> > &exp_local_Fctfs,
 		std::vector<RFLOAT> &exp_local_sqrtXi2)
 {
+	ProfileScope profile_scope(PROF_EXP_DIFF2);
 
 #ifdef TIMING
 	if (my_ori_particle == exp_my_first_ori_particle)
@@ -6456,6 +6785,7 @@ void MlOptimiser::convertAllSquaredDifferencesToWeights(long int my_ori_particle
 		std::vector<int> &exp_pointer_dir_nonzeroprior, std::vector<int> &exp_pointer_psi_nonzeroprior,
 		std::vector<RFLOAT> &exp_directions_prior, std::vector<RFLOAT> &exp_psi_prior)
 {
+	ProfileScope profile_scope(PROF_EXP_WEIGHTS);
 
 #ifdef TIMING
 	if (my_ori_particle == exp_my_first_ori_particle)
@@ -7035,8 +7365,10 @@ void MlOptimiser::storeWeightedSums(long int my_ori_particle, int ibody, int exp
 		std::vector<MultidimArray<Complex > > &exp_local_Fimgs_shifted_nomask,
 		std::vector<MultidimArray<RFLOAT> > &exp_local_Minvsigma2s,
 		std::vector<MultidimArray<RFLOAT> > &exp_local_Fctfs,
-		std::vector<RFLOAT> &exp_local_sqrtXi2)
+		std::vector<RFLOAT> &exp_local_sqrtXi2,
+		int thread_id)
 {
+	ProfileScope profile_scope(PROF_EXP_WSUM);
 #ifdef TIMING
 	if (my_ori_particle == exp_my_first_ori_particle)
 		timer.tic(TIMING_ESP_WSUM);
@@ -7797,14 +8129,25 @@ void MlOptimiser::storeWeightedSums(long int my_ori_particle, int ibody, int exp
 #endif
 							// Perform the actual back-projection.
 							// This is done with the sum of all (in-plane) shifted Fimg's
-							// Perform this inside a mutex
-							int my_mutex = exp_iclass % NR_CLASS_MUTEXES;
-							pthread_mutex_lock(&global_mutex2[my_mutex]);
-							if (mymodel.nr_bodies > 1)
-								(wsum_model.BPref[ibody]).set2DFourierTransform(Fimg, Abody, IS_NOT_INV, &Fweight);
+							// Perform this inside a mutex, unless each thread has its own copy of the backprojectors
+							if (thread_BPref.size() > 0)
+							{
+								std::vector<BackProjector> &myBPref = (thread_id == 0) ? wsum_model.BPref : thread_BPref[thread_id - 1];
+								if (mymodel.nr_bodies > 1)
+									(myBPref[ibody]).set2DFourierTransform(Fimg, Abody, IS_NOT_INV, &Fweight);
+								else
+									(myBPref[exp_iclass]).set2DFourierTransform(Fimg, A, IS_NOT_INV, &Fweight);
+							}
 							else
-								(wsum_model.BPref[exp_iclass]).set2DFourierTransform(Fimg, A, IS_NOT_INV, &Fweight);
-							pthread_mutex_unlock(&global_mutex2[my_mutex]);
+							{
+								int my_mutex = exp_iclass % NR_CLASS_MUTEXES;
+								pthread_mutex_lock(&global_mutex2[my_mutex]);
+								if (mymodel.nr_bodies > 1)
+									(wsum_model.BPref[ibody]).set2DFourierTransform(Fimg, Abody, IS_NOT_INV, &Fweight);
+								else
+									(wsum_model.BPref[exp_iclass]).set2DFourierTransform(Fimg, A, IS_NOT_INV, &Fweight);
+								pthread_mutex_unlock(&global_mutex2[my_mutex]);
+							}
 #ifdef TIMING
 							// Only time one thread, as I also only time one MPI process
                                                         if (my_ori_particle == exp_my_first_ori_particle)
@@ -7984,6 +8327,60 @@ void MlOptimiser::storeWeightedSums(long int my_ori_particle, int ibody, int exp
 #endif
 }
 
+void MlOptimiser::initialiseThreadBackProjectors()
+{
+	thread_BPref.clear();
+
+	// The GPU and the ALTCPU code have their own backprojectors, and without maximisation nothing is backprojected
+	if (!do_thread_bp || nr_threads < 2 || do_gpu || do_cpu || do_skip_maximization)
+		return;
+
+	// Thread 0 uses wsum_model.BPref, all other threads a copy of it
+	double Gb = 0.;
+	for (int i = 0; i < wsum_model.BPref.size(); i++)
+		Gb += (double)wsum_model.BPref[i].getDataMemory();
+	Gb *= (nr_threads - 1) / (1024. * 1024. * 1024.);
+	if (Gb > thread_bp_max_ram)
+	{
+		if (verb > 0)
+			std::cout << " + The copies of the reconstructions for --thread_bp would take " << Gb << " Gb (more than --thread_bp_max_ram), all threads will share them instead" << std::endl;
+		return;
+	}
+
+	thread_BPref.resize(nr_threads - 1, wsum_model.BPref);
+}
+
+void MlOptimiser::reduceThreadBackProjectors()
+{
+	if (thread_BPref.size() == 0)
+		return;
+
+	ProfileScope profile_scope(PROF_EXP_REDUCE_BACKPROJECTORS);
+
+	global_ThreadManager->run(globalThreadReduceBackProjectors);
+
+	if (threadException != NULL)
+		throw *threadException;
+
+	thread_BPref.clear();
+}
+
+void MlOptimiser::doThreadReduceBackProjectors(int thread_id)
+{
+	// Each thread sums its own slab of the elements of all classes (or bodies)
+	for (int i = 0; i < wsum_model.BPref.size(); i++)
+	{
+		std::vector<BackProjector *> others(thread_BPref.size());
+		for (int ithr = 0; ithr < thread_BPref.size(); ithr++)
+			others[ithr] = &thread_BPref[ithr][i];
+
+		long int size = wsum_model.BPref[i].getSize();
+		long int first = size * thread_id / nr_threads;
+		long int last = size * (thread_id + 1) / nr_threads;
+		wsum_model.BPref[i].addTreeSum(others, first, last);
+	}
+}
+
 /** Monitor the changes in the optimal translations, orientations and class assignments for some particles */
 void MlOptimiser::monitorHiddenVariableChanges(long int my_first_ori_particle, long int my_last_ori_particle)
 {
@@ -36,6 +36,9 @@
 #include "src/ml_model.h"
 #include "src/parallel.h"
 #include "src/exp_model.h"
+#include "src/particle_prefetcher.h"
+#include "src/profiler.h"
+#include "src/particle_cache.h"
 #include "src/ctf.h"
 #include "src/time.h"
 #include "src/mask.h"
@@ -380,6 +383,42 @@ public:
 	// Use parallel access to disc?
 	bool do_parallel_disc_io;
 
+	// Number of threads that read particle images ahead of the expectation step (0 = read them on the fly)
+	int nr_prefetch_threads;
+
+	// Maximum number of pools of particle images that are read ahead
+	int prefetch_depth;
+
+	// Encoding of the compressed in-RAM particle cache (float16, lossless or bounded; empty for no cache)
+	std::string cache_encoding;
+
+	// Maximum absolute error per pixel for the bounded encoding
+	RFLOAT cache_max_error;
+
+	// Maximum amount of RAM for the particle cache (in Gb, negative for no limit)
+	RFLOAT cache_ram;
+
+	// Let each thread backproject into its own copy of the backprojectors, instead of locking the shared ones
+	bool do_thread_bp;
+
+	// Maximum amount of RAM for those copies (in Gb); with more, the shared backprojectors are used
+	RFLOAT thread_bp_max_ram;
+
+	// Directory for the memory-mapped files of out-of-core 3D reconstructions (empty: reconstruct in RAM)
+	FileName fn_ooc;
+
+	// Maximum amount of RAM (in Gb) for the parts of those files that are processed at a time
+	RFLOAT ooc_max_ram;
+
+	// Precision of the references (PRECISION_RFLOAT, _FLOAT or _HALF) and of the backprojections during the expectation step
+	int projector_precision, backprojector_precision;
+
+	// Write the time spent in each part of every iteration to <fn_out>_profile.jsonl
+	bool do_profile;
+
+	// Also write every timed call to a Chrome trace-event file <fn_out>_trace.json
+	bool do_profile_trace;
+
 	// Use gpu resources?
 	bool do_gpu;
 	bool anticipate_oom;
@@ -387,6 +426,12 @@ public:
 	// Use alternate cpu implementation
 	bool do_cpu;
 
+	// Use the compiled-in block sizes of the cpu kernels instead of tuned ones
+	bool do_skip_cpu_tuning;
+
+	// Only (re-)tune the block sizes of the cpu kernels, and do not refine
+	bool do_tune_only;
+
 	// Which GPU devices to use?
 	std::string gpu_ids;
 
@@ -564,6 +609,9 @@ public:
 	// Prepare for automated 2D class average selection: nice to have access to unmasked reference
 	bool do_write_unmasked_refs;
 
+	// Also write the particle metadata of every iteration in the binary metadata format (_data.bstar)
+	bool do_write_binary_metadata;
+
 	/////////// Keep track of hidden variable changes ////////////////////////
 
 	// Changes from one iteration to the next in the angles
@@ -589,6 +637,16 @@ public:
 	// Thread Managers for the expectation step: one for all (pooled) particles
 	ThreadTaskDistributor *exp_ipart_ThreadTaskDistributor;
 
+	// Reads particle images for the expectation step on separate threads (NULL if images are read on the fly)
+	ParticlePrefetcher *image_prefetcher;
+
+	// Compressed copies of the particle images in RAM (NULL if not used)
+	ParticleCache *particle_cache;
+
+	// Copies of wsum_model.BPref for threads 1 until nr_threads-1 during the expectation step (thread 0 uses wsum_model.BPref itself)
+	// Empty if all threads backproject into wsum_model.BPref
+	std::vector<std::vector<BackProjector> > thread_BPref;
+
 	// Number of threads to run in parallel
 	int x_pool;
 	int nr_threads;
@@ -694,11 +752,22 @@ public:
 		debug2(0),
 		do_always_join_random_halves(0),
 		my_first_ori_particle_id(0),
+		do_profile(0),
+		do_profile_trace(0),
 		x_pool(1),
 		nr_threads(0),
 		do_shifts_onthefly(0),
 		exp_ipart_ThreadTaskDistributor(0),
 		do_parallel_disc_io(0),
+		nr_prefetch_threads(0),
+		prefetch_depth(0),
+		cache_max_error(0),
+		cache_ram(0),
+		do_thread_bp(0),
+		thread_bp_max_ram(0),
+		ooc_max_ram(0),
+		projector_precision(0),
+		backprojector_precision(0),
 		sum_changes_optimal_orientations(0),
 		do_solvent(0),
 		strict_highres_exp(0),
@@ -749,6 +818,9 @@ public:
 		random_seed(0),
 		do_gpu(0),
 		anticipate_oom(0),
+		do_cpu(0),
+		do_skip_cpu_tuning(0),
+		do_tune_only(0),
 		do_helical_refine(0),
 		ignore_helical_symmetry(0),
 		helical_twist_initial(0),
@@ -759,6 +831,9 @@ public:
 		do_helical_symmetry_local_refinement(0),
 		helical_sigma_distance(0),
 		helical_keep_tilt_prior_fixed(0),
+		do_write_binary_metadata(0),
+		image_prefetcher(0),
+		particle_cache(0),
 		//directional_lowpass(0),
 		asymmetric_padding(false),
 		maximum_significants(0),
@@ -804,6 +879,10 @@ public:
 	// Randomise particle processing order and resize metadata array
 	void initialiseWorkLoad();
 
+	// Read the particle images into the compressed in-RAM particle cache (if requested)
+	// With random_subset > 0, only the particles of that half-set are cached
+	void initialiseParticleCache(int random_subset = 0);
+
 	/* Calculates the sum of all individual power spectra and the average of all images for initial sigma_noise estimation
 	 * The rank is passed so that if one splits the data into random halves one can know which random half to treat
 	 */
@@ -854,9 +933,39 @@ public:
 	 */
 	void expectationSomeParticles(long int my_first_particle, long int my_last_particle);
 
+	/* Called by the main thread of expectationSomeParticles() while the threads work on the particles (without waiting for anything),
+	 * until it returns false. MlOptimiserMpi receives the next job in it
+	 */
+	virtual bool pollDuringExpectation()
+	{
+		return false;
+	}
+
 	/* Perform expectation step for some particles using threads */
 	void doThreadExpectationSomeParticles(int thread_id);
 
+	/* Queue the images of the pools of particles from first_ori_particle onwards (up to last_ori_particle) on the image_prefetcher,
+	 * until its queue is full. Returns the first original particle that has not been queued yet.
+	 */
+	long int prefetchImages(long int first_ori_particle, long int last_ori_particle);
+
+	/* Queue the images of original particles first_ori_particle..last_ori_particle on the image_prefetcher, with the names in fn_imgs
+	 * (one line per image, as in exp_fn_img) unless they are on the scratch disc or in the particle_cache
+	 */
+	void queueImages(long int first_ori_particle, long int last_ori_particle, const std::string &fn_imgs);
+
+	/* Image istop (particle part_id) of the current pool of particles, from the particle_cache, the image_prefetcher or exp_imgs */
+	void getExpImage(long int part_id, long int istop, MultidimArray<RFLOAT> &img);
+
+	/* Statistics on reading particle images since the last call (which are then reset):
+	 * time waiting for the prefetcher, time reading in the prefetcher, number of images read by the prefetcher,
+	 * particle cache hits, particle cache misses, time decoding cached images
+	 */
+	void getImageReadingStatistics(std::vector<double> &stats);
+
+	/* Print statistics from getImageReadingStatistics, summed over nr_processes processes */
+	void printImageReadingStatistics(const std::vector<double> &stats, int nr_processes = 1);
+
 	/* Perform the expectation integration over all k, phi and series elements for a given particle */
 	void expectationOneParticle(long int my_ori_particle, int thread_id);
 
@@ -1001,7 +1110,17 @@ public:
 			std::vector<MultidimArray<Complex > > &exp_local_Fimgs_shifted_nomask,
 			std::vector<MultidimArray<RFLOAT> > &exp_local_Minvsigma2s,
 			std::vector<MultidimArray<RFLOAT> > &exp_local_Fctfs,
-			std::vector<RFLOAT> &exp_local_sqrtXi2);
+			std::vector<RFLOAT> &exp_local_sqrtXi2,
+			int thread_id);
+
+	/* Make copies of the backprojectors in wsum_model for all threads but the first (see --thread_bp) */
+	void initialiseThreadBackProjectors();
+
+	/* Add the copies of the backprojectors of all threads to wsum_model, and free them */
+	void reduceThreadBackProjectors();
+
+	// Threaded core of reduceThreadBackProjectors(): each thread sums its own part of the elements
+	void doThreadReduceBackProjectors(int thread_id);
 
 	/** Monitor the changes in the optimal translations, orientations and class assignments for some particles */
 	void monitorHiddenVariableChanges(long int my_first_ori_particle, long int my_last_ori_particle);
@@ -1034,4 +1153,7 @@ public:
 // Global call to threaded core of doThreadExpectationSomeParticles
 void globalThreadExpectationSomeParticles(ThreadArgument &thArg);
 
+// Global call to threaded core of reduceThreadBackProjectors
+void globalThreadReduceBackProjectors(ThreadArgument &thArg);
+
 #endif /* MAXLIK_H_ */
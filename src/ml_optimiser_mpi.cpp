@@ -19,11 +19,13 @@
  ***************************************************************************/
 #include "src/ml_optimiser_mpi.h"
 #include "src/ml_optimiser.h"
+#include "src/fftw_plan_cache.h"
 #ifdef CUDA
 #include "src/acc/cuda/cuda_ml_optimiser.h"
 #endif
 #ifdef ALTCPU
 	#include <tbb/tbb.h>
+	#include "src/acc/cpu/cpu_tuning.h"
 	#include "src/acc/cpu/cpu_ml_optimiser.h"
 #endif
 #include <stdio.h>
@@ -44,6 +46,34 @@
     	#define RCTOC(timer,label)
 #endif
 
+// A job that the master has sent to a slave, with its own copies of the data until the slave has received them
+class PendingJob
+{
+public:
+	MultidimArray<long int> header;
+	MultidimArray<RFLOAT> metadata, imagedata;
+	std::string fn_img, fn_ctf, fn_recimg;
+	std::vector<MPI_Request> requests;
+
+	void send(MpiNode *node, void *buf, long int count, MPI_Datatype datatype, int dest, int tag)
+	{
+		requests.push_back(MPI_REQUEST_NULL);
+		int result = MPI_Isend(buf, count, datatype, dest, tag, MPI_COMM_WORLD, &requests.back());
+		if (result != MPI_SUCCESS)
+			node->report_MPI_ERROR(result);
+	}
+
+	void wait(MpiNode *node)
+	{
+		if (requests.size() == 0)
+			return;
+		int result = MPI_Waitall(requests.size(), &requests[0], MPI_STATUSES_IGNORE);
+		if (result != MPI_SUCCESS)
+			node->report_MPI_ERROR(result);
+		requests.clear();
+	}
+};
+
 void MlOptimiserMpi::read(int argc, char **argv)
 {
 #ifdef DEBUG
@@ -63,6 +93,8 @@ void MlOptimiserMpi::read(int argc, char **argv)
     only_do_unfinished_movies = parser.checkOption("--only_do_unfinished_movies", "When processing movies on a per-micrograph basis, ignore those movies for which the output STAR file already exists.");
     halt_all_slaves_except_this = textToInteger(parser.getOption("--halt_all_slaves_except", "For debugging: keep all slaves except this one waiting", "-1"));
     do_keep_debug_reconstruct_files  = parser.checkOption("--keep_debug_reconstruct_files", "For debugging: keep temporary data and weight files for debug-reconstructions.");
+    do_static_jobs = parser.checkOption("--static_jobs", "Give all slaves jobs of --pool particles, one at a time, instead of queueing a next job on each slave and sizing the last jobs by the speed of the slaves");
+    do_serial_combine = parser.checkOption("--serial_combine", "Pass the weighted sums from one slave to the next, instead of summing them in log2(nr_slaves) steps (only without combining through disc)");
 
     // Don't put any output to screen for mpi slaves
     ori_verb = verb;
@@ -470,7 +502,28 @@ will still yield good performance and possibly a more stable execution. \n" << s
 	{
 		// Set the size of the TBB thread pool for the entire run
 		tbbSchedulerInit.initialize(nr_threads);
+
+		// Block sizes of the kernels for this CPU and box size: the first slave on each host tunes them if they are not
+		// in the tuning file of that host yet, and the other slaves read them afterwards, so that no two slaves
+		// tune at the same time on the same CPUs
+		if (!do_skip_cpu_tuning || do_tune_only)
+		{
+			MPI_Comm host_comm;
+			MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, node->rank, MPI_INFO_NULL, &host_comm);
+			int my_rank = (node->isMaster()) ? node->size : node->rank;
+			int first_slave_on_host;
+			MPI_Allreduce(&my_rank, &first_slave_on_host, 1, MPI_INT, MPI_MIN, host_comm);
+			MPI_Comm_free(&host_comm);
+
+			if (node->rank == first_slave_on_host)
+				CpuTuning::initialise(mymodel.ori_size, mymodel.ref_dim, mymodel.data_dim, do_tune_only, (node->rank == 1) ? ori_verb : 0);
+			MPI_Barrier(MPI_COMM_WORLD);
+			if (!node->isMaster() && node->rank != first_slave_on_host)
+				CpuTuning::initialise(mymodel.ori_size, mymodel.ref_dim, mymodel.data_dim, false, 0);
+		}
 	}
+	else if (do_tune_only)
+		REPORT_ERROR("ERROR: --tune_only is only for the CPU kernels (--cpu)");
 #endif
 #ifdef MKLFFT
 	// Enable multi-threaded FFTW
@@ -480,7 +533,7 @@ will still yield good performance and possibly a more stable execution. \n" << s
 
 	// And allow plans before expectation to run using allowed
 	// number of threads
-	fftw_plan_with_nthreads(nr_threads);
+	FftwPlanCache::setNumberOfThreads(nr_threads);
 #endif
 
 	if (fn_sigma != "")
@@ -701,6 +754,10 @@ void MlOptimiserMpi::initialiseWorkLoad()
 
     MPI_Barrier(MPI_COMM_WORLD);
 
+    // Only the slaves read particles in the expectation step, and only those of their own half-set
+    if (!node->isMaster())
+    	initialiseParticleCache((do_split_random_halves) ? node->myRandomSubset() : 0);
+
     if(!do_split_random_halves)
 	{
     	if(!node->isMaster())
@@ -751,6 +808,7 @@ void MlOptimiserMpi::calculateSumOfPowerSpectraAndAverageImage(MultidimArray<RFL
 
 void MlOptimiserMpi::expectation()
 {
+	ProfileScope profile_scope(PROF_EXPECTATION);
 #ifdef TIMING
 		timer.tic(TIMING_EXP_1);
 #endif
@@ -765,10 +823,12 @@ void MlOptimiserMpi::expectation()
 	int n_trials_acc = (mymodel.ref_dim==3 && mymodel.data_dim != 3) ? 100 : 10;
 	n_trials_acc = XMIPP_MIN(n_trials_acc, mydata.numberOfOriginalParticles());
 	MPI_Status status;
+	// Time that a slave spends waiting for jobs, and for the other slaves at the end
+	double idle_time = 0.;
 
 #ifdef MKLFFT
 	// Allow parallel FFTW execution
-	fftw_plan_with_nthreads(nr_threads);
+	FftwPlanCache::setNumberOfThreads(nr_threads);
 #endif
 
 	// Initialise some stuff
@@ -961,6 +1021,8 @@ void MlOptimiserMpi::expectation()
 #define JOB_LEN_FN_CTF  (first_last_nr_images(4))
 #define JOB_LEN_FN_RECIMG  (first_last_nr_images(5))
 #define JOB_NPAR  (JOB_LAST - JOB_FIRST + 1)
+// Reply of the master when it has no job for a slave yet, but will give it one (or tell it to stop) on its next request
+#define JOB_NOT_YET (-2)
 
 #ifdef CUDA
 	/************************************************************************/
@@ -1097,9 +1159,13 @@ void MlOptimiserMpi::expectation()
 #endif // ALTCPU
 	/************************************************************************/
 
+	// Keep the references in lower precision for the rest of the expectation step (only if --projector_precision)
+	for (int i = 0; i < mymodel.PPref.size(); i++)
+		mymodel.PPref[i].setDataPrecision(projector_precision);
+
 #ifdef MKLFFT
 	// Single-threaded FFTW execution for code inside parallel processing loop
-	fftw_plan_with_nthreads(1);
+	FftwPlanCache::setNumberOfThreads(1);
 #endif
 
 #ifdef TIMING
@@ -1160,6 +1226,13 @@ void MlOptimiserMpi::expectation()
 			long int nr_particles_done_halfset2 = 0;
 			long int my_nr_particles_done = 0;
 
+			// For the dynamic job sizes: the number of jobs each slave has in hand (at most one running and one queued),
+			// the number of particles it has done, and when it got its first job
+			std::vector<long int> nr_jobs_out(node->size, 0);
+			std::vector<double> slave_nr_done(node->size, 0.), slave_start_time(node->size, -1.), slave_rates(node->size, 0.);
+			// Jobs are sent without waiting for the slave to receive them, so that the master can serve the other slaves
+			std::vector<PendingJob> pending_jobs(node->size);
+
 
 			while (nr_slaves_done < node->size - 1)
 			{
@@ -1175,9 +1248,15 @@ void MlOptimiserMpi::expectation()
 						<< " JOB_NIMG= "<<JOB_NIMG<< " JOB_NPAR= "<<JOB_NPAR<< std::endl;
 #endif
 				// The first time a slave reports it only asks for input, but does not send output of a previous processing task. In that case JOB_NIMG==0
+				// (and likewise when a slave asks for its next job before it starts on the current one)
 				// Otherwise, the master needs to receive and handle the updated metadata from the slaves
 				if (JOB_NIMG > 0)
 				{
+					// Keep track of the throughput of this slave
+					nr_jobs_out[this_slave]--;
+					slave_nr_done[this_slave] += JOB_NPAR;
+					slave_rates[this_slave] = slave_nr_done[this_slave] / XMIPP_MAX(1e-6, MPI_Wtime() - slave_start_time[this_slave]);
+
 					exp_metadata.resize(JOB_NIMG, METADATA_LINE_LENGTH_BEFORE_BODIES + (mymodel.nr_bodies) * METADATA_NR_BODY_PARAMS);
 					node->relion_MPI_Recv(MULTIDIM_ARRAY(exp_metadata), MULTIDIM_SIZE(exp_metadata), MY_MPI_DOUBLE, this_slave, MPITAG_METADATA, MPI_COMM_WORLD, status);
 
@@ -1202,14 +1281,14 @@ void MlOptimiserMpi::expectation()
 						my_nr_particles_done = nr_particles_done_halfset1;
 						nr_particles_todo = my_last_ori_particle_halfset1 - my_first_ori_particle_halfset1 + 1;
 						JOB_FIRST = nr_ori_particles_done_halfset1;
-						JOB_LAST  = XMIPP_MIN(my_last_ori_particle_halfset1, JOB_FIRST + nr_pool - 1);
+						JOB_LAST  = XMIPP_MIN(my_last_ori_particle_halfset1, JOB_FIRST + getJobSize(this_slave, nr_particles_todo - my_nr_particles_done, slave_rates) - 1);
 					}
 					else
 					{
 						my_nr_particles_done = nr_particles_done_halfset2;
 						nr_particles_todo = my_last_ori_particle_halfset2 - my_first_ori_particle_halfset2 + 1;
 						JOB_FIRST = mydata.numberOfOriginalParticles(1) + nr_ori_particles_done_halfset2;
-						JOB_LAST  = XMIPP_MIN(my_last_ori_particle_halfset2, JOB_FIRST + nr_pool - 1);
+						JOB_LAST  = XMIPP_MIN(my_last_ori_particle_halfset2, JOB_FIRST + getJobSize(this_slave, nr_particles_todo - my_nr_particles_done, slave_rates) - 1);
 					}
 				}
 				else
@@ -1218,17 +1297,36 @@ void MlOptimiserMpi::expectation()
 					my_nr_particles_done = nr_particles_done;
 					nr_particles_todo =  my_last_ori_particle - my_first_ori_particle + 1;
 					JOB_FIRST = nr_ori_particles_done;
-					JOB_LAST  = XMIPP_MIN(my_last_ori_particle, JOB_FIRST + nr_pool - 1);
+					JOB_LAST  = XMIPP_MIN(my_last_ori_particle, JOB_FIRST + getJobSize(this_slave, nr_particles_todo - my_nr_particles_done, slave_rates) - 1);
 				}
 
+				// A slave that still has a job in hand only gets a second one to queue if the end of the iteration is not near,
+				// so that the last particles go to the slaves that are idle
+				bool do_queue = (nr_jobs_out[this_slave] == 0 ||
+						nr_particles_todo - my_nr_particles_done > getNumberOfSlavesInHalfset(this_slave) * nr_pool);
+
 				// Now send out a new job
-				if (my_nr_particles_done < nr_particles_todo)
+				if (my_nr_particles_done < nr_particles_todo && do_queue)
 				{
 					MlOptimiser::getMetaAndImageDataSubset(JOB_FIRST, JOB_LAST, !do_parallel_disc_io);
 					JOB_NIMG = YSIZE(exp_metadata);
 					JOB_LEN_FN_IMG = exp_fn_img.length() + 1; // +1 to include \0 at the end of the string
 					JOB_LEN_FN_CTF = exp_fn_ctf.length() + 1;
 					JOB_LEN_FN_RECIMG = exp_fn_recimg.length() + 1;
+
+					nr_jobs_out[this_slave]++;
+					if (slave_start_time[this_slave] < 0.)
+						slave_start_time[this_slave] = MPI_Wtime();
+				}
+				else if (my_nr_particles_done < nr_particles_todo)
+				{
+					// Nothing for now: this slave will ask again when it has finished its current job
+					JOB_FIRST = JOB_NOT_YET;
+					JOB_LAST = JOB_NOT_YET - 1;
+					JOB_NIMG = 0;
+					JOB_LEN_FN_IMG = 0;
+					JOB_LEN_FN_CTF = 0;
+					JOB_LEN_FN_RECIMG = 0;
 				}
 				else
 				{
@@ -1242,8 +1340,9 @@ void MlOptimiserMpi::expectation()
 					exp_metadata.clear();
 					exp_imagedata.clear();
 
-					// No more particles, this slave is done now
-					nr_slaves_done++;
+					// No more particles: this slave is done once it has returned all its jobs
+					if (nr_jobs_out[this_slave] == 0)
+						nr_slaves_done++;
 				}
 
 				//std::cerr << "subset= " << subset << " half-set= " << random_halfset
@@ -1254,25 +1353,34 @@ void MlOptimiserMpi::expectation()
 				std::cerr << " MASTER SENDING to slave= " << this_slave<< " JOB_FIRST= " << JOB_FIRST << " JOB_LAST= " << JOB_LAST
 								<< " JOB_NIMG= "<<JOB_NIMG<< " JOB_NPAR= "<<JOB_NPAR<< std::endl;
 #endif
-				node->relion_MPI_Send(MULTIDIM_ARRAY(first_last_nr_images), MULTIDIM_SIZE(first_last_nr_images), MPI_LONG, this_slave, MPITAG_JOB_REPLY, MPI_COMM_WORLD);
+				// The previous job of this slave has to be on its way before its buffers can be re-used
+				PendingJob &job = pending_jobs[this_slave];
+				job.wait(node);
+				job.header = first_last_nr_images;
+				job.send(node, MULTIDIM_ARRAY(job.header), MULTIDIM_SIZE(job.header), MPI_LONG, this_slave, MPITAG_JOB_REPLY);
 
 				//806 Master also sends the required metadata and imagedata for this job
 				if (JOB_NIMG > 0)
 				{
-					node->relion_MPI_Send(MULTIDIM_ARRAY(exp_metadata), MULTIDIM_SIZE(exp_metadata), MY_MPI_DOUBLE, this_slave, MPITAG_METADATA, MPI_COMM_WORLD);
+					job.metadata = exp_metadata;
+					job.send(node, MULTIDIM_ARRAY(job.metadata), MULTIDIM_SIZE(job.metadata), MY_MPI_DOUBLE, this_slave, MPITAG_METADATA);
 					if (do_parallel_disc_io)
 					{
-						node->relion_MPI_Send((void*)exp_fn_img.c_str(), JOB_LEN_FN_IMG, MPI_CHAR, this_slave, MPITAG_METADATA, MPI_COMM_WORLD);
+						job.fn_img = exp_fn_img;
+						job.fn_ctf = exp_fn_ctf;
+						job.fn_recimg = exp_fn_recimg;
+						job.send(node, (void*)job.fn_img.c_str(), JOB_LEN_FN_IMG, MPI_CHAR, this_slave, MPITAG_METADATA);
 						// Send filenames of images to the slaves
 						if (JOB_LEN_FN_CTF > 1)
-							node->relion_MPI_Send((void*)exp_fn_ctf.c_str(), JOB_LEN_FN_CTF, MPI_CHAR, this_slave, MPITAG_METADATA, MPI_COMM_WORLD);
+							job.send(node, (void*)job.fn_ctf.c_str(), JOB_LEN_FN_CTF, MPI_CHAR, this_slave, MPITAG_METADATA);
 						if (JOB_LEN_FN_RECIMG > 1)
-							node->relion_MPI_Send((void*)exp_fn_recimg.c_str(), JOB_LEN_FN_RECIMG, MPI_CHAR, this_slave, MPITAG_METADATA, MPI_COMM_WORLD);
+							job.send(node, (void*)job.fn_recimg.c_str(), JOB_LEN_FN_RECIMG, MPI_CHAR, this_slave, MPITAG_METADATA);
 					}
 					else
 					{
 						// Send imagedata to the slaves
-						node->relion_MPI_Send(MULTIDIM_ARRAY(exp_imagedata), MULTIDIM_SIZE(exp_imagedata), MY_MPI_DOUBLE, this_slave, MPITAG_IMAGE, MPI_COMM_WORLD);
+						job.imagedata = exp_imagedata;
+						job.send(node, MULTIDIM_ARRAY(job.imagedata), MULTIDIM_SIZE(job.imagedata), MY_MPI_DOUBLE, this_slave, MPITAG_IMAGE);
 					}
 				}
 
@@ -1294,6 +1402,10 @@ void MlOptimiserMpi::expectation()
 					}
 				}
 			}
+
+			// The last replies have to arrive before their buffers go
+			for (int slave = 1; slave < node->size; slave++)
+				pending_jobs[slave].wait(node);
         }
         catch (RelionError XE)
         {
@@ -1329,24 +1441,63 @@ void MlOptimiserMpi::expectation()
 			JOB_LEN_FN_CTF = 0;
 			JOB_LEN_FN_RECIMG = 0;
 			node->relion_MPI_Send(MULTIDIM_ARRAY(first_last_nr_images), MULTIDIM_SIZE(first_last_nr_images), MPI_LONG, 0, MPITAG_JOB_REQUEST, MPI_COMM_WORLD);
+			// The number of my requests that the master has not answered yet
+			int nr_requests_out = 1;
+			// With the image_prefetcher, the next job is received while working on the current one, so that its images are read ahead
+			has_next_job = is_next_job_pending = false;
+			next_job.resize(6);
 
 			while (true)
 			{
 #ifdef TIMING
 				timer.tic(TIMING_MPISLAVEWAIT1);
 #endif
-				//Receive a new bunch of particles
-				node->relion_MPI_Recv(MULTIDIM_ARRAY(first_last_nr_images), MULTIDIM_SIZE(first_last_nr_images), MPI_LONG, 0, MPITAG_JOB_REPLY, MPI_COMM_WORLD, status);
+				double wait_start = MPI_Wtime();
+				long long int profile_wait_start = Profiler::now();
+				// The answer to my next job request did not arrive while I worked on the previous job
+				if (is_next_job_pending)
+				{
+					int result = MPI_Wait(&next_job_request, MPI_STATUS_IGNORE);
+					if (result != MPI_SUCCESS)
+						node->report_MPI_ERROR(result);
+					is_next_job_pending = false;
+					receiveNextJob();
+				}
+				//Receive a new bunch of particles, unless it was received already
+				bool is_received = has_next_job;
+				if (has_next_job)
+				{
+					first_last_nr_images = next_job;
+					has_next_job = false;
+				}
+				else
+				{
+					node->relion_MPI_Recv(MULTIDIM_ARRAY(first_last_nr_images), MULTIDIM_SIZE(first_last_nr_images), MPI_LONG, 0, MPITAG_JOB_REPLY, MPI_COMM_WORLD, status);
+					nr_requests_out--;
+				}
 #ifdef TIMING
 				timer.toc(TIMING_MPISLAVEWAIT1);
 #endif
 
+				// No job yet: the answer to my other request will have one
+				if (JOB_NIMG <= 0 && JOB_FIRST == JOB_NOT_YET)
+				{
+					idle_time += MPI_Wtime() - wait_start;
+					Profiler::record(PROF_MPI_WAIT, profile_wait_start, Profiler::now());
+					continue;
+				}
+
 				//Check whether I am done
 				if (JOB_NIMG <= 0)
 				{
 #ifdef DEBUG
 					std::cerr <<" slave "<< node->rank << " has finished expectation.."<<std::endl;
 #endif
+					// The answers to my other requests are the same
+					for (; nr_requests_out > 0; nr_requests_out--)
+						node->relion_MPI_Recv(MULTIDIM_ARRAY(first_last_nr_images), MULTIDIM_SIZE(first_last_nr_images), MPI_LONG, 0, MPITAG_JOB_REPLY, MPI_COMM_WORLD, status);
+					idle_time += MPI_Wtime() - wait_start;
+					Profiler::record(PROF_MPI_WAIT, profile_wait_start, Profiler::now());
 					exp_imagedata.clear();
 					exp_metadata.clear();
 					break;
@@ -1356,68 +1507,110 @@ void MlOptimiserMpi::expectation()
 #ifdef TIMING
 					timer.tic(TIMING_MPISLAVEWAIT2);
 #endif
-					// Also receive the imagedata and the metadata for these images from the master
-					exp_metadata.resize(JOB_NIMG, METADATA_LINE_LENGTH_BEFORE_BODIES + (mymodel.nr_bodies) * METADATA_NR_BODY_PARAMS);
-					node->relion_MPI_Recv(MULTIDIM_ARRAY(exp_metadata), MULTIDIM_SIZE(exp_metadata), MY_MPI_DOUBLE, 0, MPITAG_METADATA, MPI_COMM_WORLD, status);
-
-					// Receive the image filenames or the exp_imagedata
-					if (do_parallel_disc_io)
+					if (is_received)
 					{
-						// Resize the exp_fn_img strings
-				        char* rec_buf;
-				        rec_buf = (char *) malloc(JOB_LEN_FN_IMG);
-				        node->relion_MPI_Recv(rec_buf, JOB_LEN_FN_IMG, MPI_CHAR, 0, MPITAG_METADATA, MPI_COMM_WORLD, status);
-				        exp_fn_img = rec_buf;
-				        free(rec_buf);
-						if (JOB_LEN_FN_CTF > 1)
-						{
-					        char* rec_buf2;
-					        rec_buf2 = (char *) malloc(JOB_LEN_FN_CTF);
-					        node->relion_MPI_Recv(rec_buf2, JOB_LEN_FN_CTF, MPI_CHAR, 0, MPITAG_METADATA, MPI_COMM_WORLD, status);
-					        exp_fn_ctf = rec_buf2;
-					        free(rec_buf2);
-
-						}
-						if (JOB_LEN_FN_RECIMG > 1)
-						{
-					        char* rec_buf3;
-					        rec_buf3 = (char *) malloc(JOB_LEN_FN_RECIMG);
-					        node->relion_MPI_Recv(rec_buf3, JOB_LEN_FN_RECIMG, MPI_CHAR, 0, MPITAG_METADATA, MPI_COMM_WORLD, status);
-					        exp_fn_recimg = rec_buf3;
-					        free(rec_buf3);
-						}
+						exp_metadata = next_metadata;
+						exp_fn_img = next_fn_img;
+						exp_fn_ctf = next_fn_ctf;
+						exp_fn_recimg = next_fn_recimg;
 					}
 					else
 					{
-						// resize the exp_imagedata array
-						if (mymodel.data_dim == 3)
+						// Also receive the imagedata and the metadata for these images from the master
+						exp_metadata.resize(JOB_NIMG, METADATA_LINE_LENGTH_BEFORE_BODIES + (mymodel.nr_bodies) * METADATA_NR_BODY_PARAMS);
+						node->relion_MPI_Recv(MULTIDIM_ARRAY(exp_metadata), MULTIDIM_SIZE(exp_metadata), MY_MPI_DOUBLE, 0, MPITAG_METADATA, MPI_COMM_WORLD, status);
+
+						// Receive the image filenames or the exp_imagedata
+						if (do_parallel_disc_io)
 						{
+							// Resize the exp_fn_img strings
+					        char* rec_buf;
+					        rec_buf = (char *) malloc(JOB_LEN_FN_IMG);
+					        node->relion_MPI_Recv(rec_buf, JOB_LEN_FN_IMG, MPI_CHAR, 0, MPITAG_METADATA, MPI_COMM_WORLD, status);
+					        exp_fn_img = rec_buf;
+					        free(rec_buf);
+							if (JOB_LEN_FN_CTF > 1)
+							{
+						        char* rec_buf2;
+						        rec_buf2 = (char *) malloc(JOB_LEN_FN_CTF);
+						        node->relion_MPI_Recv(rec_buf2, JOB_LEN_FN_CTF, MPI_CHAR, 0, MPITAG_METADATA, MPI_COMM_WORLD, status);
+						        exp_fn_ctf = rec_buf2;
+						        free(rec_buf2);
 
-							if (do_ctf_correction)
+							}
+							if (JOB_LEN_FN_RECIMG > 1)
 							{
-								if (has_converged && do_use_reconstruct_images)
-									exp_imagedata.resize(3*mymodel.ori_size, mymodel.ori_size, mymodel.ori_size);
+						        char* rec_buf3;
+						        rec_buf3 = (char *) malloc(JOB_LEN_FN_RECIMG);
+						        node->relion_MPI_Recv(rec_buf3, JOB_LEN_FN_RECIMG, MPI_CHAR, 0, MPITAG_METADATA, MPI_COMM_WORLD, status);
+						        exp_fn_recimg = rec_buf3;
+						        free(rec_buf3);
+							}
+						}
+						else
+						{
+							// resize the exp_imagedata array
+							if (mymodel.data_dim == 3)
+							{
+
+								if (do_ctf_correction)
+								{
+									if (has_converged && do_use_reconstruct_images)
+										exp_imagedata.resize(3*mymodel.ori_size, mymodel.ori_size, mymodel.ori_size);
+									else
+										exp_imagedata.resize(2*mymodel.ori_size, mymodel.ori_size, mymodel.ori_size);
+								}
 								else
-									exp_imagedata.resize(2*mymodel.ori_size, mymodel.ori_size, mymodel.ori_size);
+								{
+									if (has_converged && do_use_reconstruct_images)
+										exp_imagedata.resize(2*mymodel.ori_size, mymodel.ori_size, mymodel.ori_size);
+									else
+										exp_imagedata.resize(mymodel.ori_size, mymodel.ori_size, mymodel.ori_size);
+								}
 							}
 							else
 							{
 								if (has_converged && do_use_reconstruct_images)
-									exp_imagedata.resize(2*mymodel.ori_size, mymodel.ori_size, mymodel.ori_size);
+									exp_imagedata.resize(2*JOB_NIMG, mymodel.ori_size, mymodel.ori_size);
 								else
-									exp_imagedata.resize(mymodel.ori_size, mymodel.ori_size, mymodel.ori_size);
+									exp_imagedata.resize(JOB_NIMG, mymodel.ori_size, mymodel.ori_size);
 							}
+							node->relion_MPI_Recv(MULTIDIM_ARRAY(exp_imagedata), MULTIDIM_SIZE(exp_imagedata), MY_MPI_DOUBLE, 0, MPITAG_IMAGE, MPI_COMM_WORLD, status);
 						}
-						else
+					}
+
+					// Ask for my next job already, so that it is on its way while I work on this one
+					if (!do_static_jobs && nr_requests_out == 0)
+					{
+						MultidimArray<long int> next_request(6);
+						next_request(0) = 0;
+						next_request(1) = -1;
+						node->relion_MPI_Send(MULTIDIM_ARRAY(next_request), MULTIDIM_SIZE(next_request), MPI_LONG, 0, MPITAG_JOB_REQUEST, MPI_COMM_WORLD);
+						nr_requests_out++;
+					}
+
+					// With the image_prefetcher, receive the answer to my oldest open request while I work on this job,
+					// and then queue the images of that next job behind the ones of this job, so that they are read ahead.
+					// The image_prefetcher is only used with do_parallel_disc_io, so the master sends the image names, not the images
+					if (image_prefetcher != NULL && nr_requests_out > 0)
+					{
+						if (!image_prefetcher->hasBatch(JOB_FIRST, JOB_LAST))
 						{
-							if (has_converged && do_use_reconstruct_images)
-								exp_imagedata.resize(2*JOB_NIMG, mymodel.ori_size, mymodel.ori_size);
-							else
-								exp_imagedata.resize(JOB_NIMG, mymodel.ori_size, mymodel.ori_size);
+							image_prefetcher->clear();
+							queueImages(JOB_FIRST, JOB_LAST, exp_fn_img);
 						}
-						node->relion_MPI_Recv(MULTIDIM_ARRAY(exp_imagedata), MULTIDIM_SIZE(exp_imagedata), MY_MPI_DOUBLE, 0, MPITAG_IMAGE, MPI_COMM_WORLD, status);
+
+						int result = MPI_Irecv(MULTIDIM_ARRAY(next_job), MULTIDIM_SIZE(next_job), MPI_LONG, 0, MPITAG_JOB_REPLY, MPI_COMM_WORLD, &next_job_request);
+						if (result != MPI_SUCCESS)
+							node->report_MPI_ERROR(result);
+						is_next_job_pending = true;
+						nr_requests_out--;
+						pollDuringExpectation();
 					}
 
+					idle_time += MPI_Wtime() - wait_start;
+					Profiler::record(PROF_MPI_WAIT, profile_wait_start, Profiler::now());
+
 					// Now process these images
 #ifdef DEBUG_MPIEXP
 					std::cerr << " SLAVE EXECUTING node->rank= " << node->rank << " JOB_FIRST= " << JOB_FIRST << " JOB_LAST= " << JOB_LAST << std::endl;
@@ -1436,6 +1629,7 @@ void MlOptimiserMpi::expectation()
 					node->relion_MPI_Send(MULTIDIM_ARRAY(first_last_nr_images), MULTIDIM_SIZE(first_last_nr_images), MPI_LONG, 0, MPITAG_JOB_REQUEST, MPI_COMM_WORLD);
 					// Also send the metadata belonging to those
 					node->relion_MPI_Send(MULTIDIM_ARRAY(exp_metadata), MULTIDIM_SIZE(exp_metadata), MY_MPI_DOUBLE, 0, MPITAG_METADATA, MPI_COMM_WORLD);
+					nr_requests_out++;
 
 #ifdef TIMING
 					timer.toc(TIMING_MPISLAVEWAIT3);
@@ -1447,6 +1641,13 @@ void MlOptimiserMpi::expectation()
 
 //		TODO: define MPI_COMM_SLAVES!!!!	MPI_Barrier(node->MPI_COMM_SLAVES);
 
+			// Add the backprojections of all threads together (only if --thread_bp)
+			reduceThreadBackProjectors();
+
+			// Combine and reconstruct in RFLOAT
+			for (int i = 0; i < wsum_model.BPref.size(); i++)
+				wsum_model.BPref[i].setDataPrecision(PRECISION_RFLOAT);
+
 #ifdef CUDA
 			if (do_gpu)
 			{
@@ -1584,7 +1785,7 @@ void MlOptimiserMpi::expectation()
 #ifdef  MKLFFT
 	// Allow parallel FFTW execution to continue now that we are outside the parallel
 	// portion of expectation
-	fftw_plan_with_nthreads(nr_threads);
+	FftwPlanCache::setNumberOfThreads(nr_threads);
 #endif
 
     // Just make sure the temporary arrays are empty...
@@ -1604,7 +1805,29 @@ void MlOptimiserMpi::expectation()
 #endif
 
 	// Wait until expected angular errors have been calculated
+	double barrier_start = MPI_Wtime();
+	long long int profile_barrier_start = Profiler::now();
 	MPI_Barrier(MPI_COMM_WORLD);
+	idle_time += MPI_Wtime() - barrier_start;
+	Profiler::record(PROF_MPI_WAIT, profile_barrier_start, Profiler::now());
+
+	// Report how long each slave was idle
+	std::vector<double> idle_times(node->size);
+	MPI_Gather(&idle_time, 1, MPI_DOUBLE, &idle_times[0], 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+	if (verb > 0 && node->size > 1)
+	{
+		std::cout << " Idle time per slave (sec):";
+		for (int slave = 1; slave < node->size; slave++)
+			std::cout << " " << ROUND(100. * idle_times[slave]) / 100.;
+		std::cout << std::endl;
+	}
+
+	// Report how long the slaves had to wait for their particle images, and how well the particle cache worked
+	std::vector<double> my_stats, stats(6);
+	getImageReadingStatistics(my_stats);
+	MPI_Reduce(&my_stats[0], &stats[0], 6, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+	if (verb > 0 && node->size > 1)
+		printImageReadingStatistics(stats, node->size - 1);
 
 	// All slaves reset the size of their projector to zero to save memory
 	if (!node->isMaster())
@@ -1621,8 +1844,95 @@ void MlOptimiserMpi::expectation()
 }
 
 
+void MlOptimiserMpi::receiveNextJob()
+{
+	MPI_Status status;
+	if (next_job(2) > 0)
+	{
+		next_metadata.resize(next_job(2), METADATA_LINE_LENGTH_BEFORE_BODIES + (mymodel.nr_bodies) * METADATA_NR_BODY_PARAMS);
+		node->relion_MPI_Recv(MULTIDIM_ARRAY(next_metadata), MULTIDIM_SIZE(next_metadata), MY_MPI_DOUBLE, 0, MPITAG_METADATA, MPI_COMM_WORLD, status);
+		std::vector<char> rec_buf(next_job(3));
+		node->relion_MPI_Recv(&rec_buf[0], next_job(3), MPI_CHAR, 0, MPITAG_METADATA, MPI_COMM_WORLD, status);
+		next_fn_img = &rec_buf[0];
+		if (next_job(4) > 1)
+		{
+			rec_buf.resize(next_job(4));
+			node->relion_MPI_Recv(&rec_buf[0], next_job(4), MPI_CHAR, 0, MPITAG_METADATA, MPI_COMM_WORLD, status);
+			next_fn_ctf = &rec_buf[0];
+		}
+		if (next_job(5) > 1)
+		{
+			rec_buf.resize(next_job(5));
+			node->relion_MPI_Recv(&rec_buf[0], next_job(5), MPI_CHAR, 0, MPITAG_METADATA, MPI_COMM_WORLD, status);
+			next_fn_recimg = &rec_buf[0];
+		}
+
+		// The images of the current job have been queued before the request was posted
+		if (!image_prefetcher->isFull())
+			queueImages(next_job(0), next_job(1), next_fn_img);
+	}
+	// Without a job yet, I will ask again when I report on this one
+	has_next_job = (next_job(2) > 0 || next_job(0) != JOB_NOT_YET);
+}
+
+bool MlOptimiserMpi::pollDuringExpectation()
+{
+	if (!is_next_job_pending)
+		return false;
+
+	int is_done = 0;
+	int result = MPI_Test(&next_job_request, &is_done, MPI_STATUS_IGNORE);
+	if (result != MPI_SUCCESS)
+		node->report_MPI_ERROR(result);
+	if (!is_done)
+		return true;
+
+	// The master sends the rest of the job right after its header
+	is_next_job_pending = false;
+	receiveNextJob();
+	return false;
+}
+
+int MlOptimiserMpi::getNumberOfSlavesInHalfset(int slave)
+{
+	if (!do_split_random_halves)
+		return node->size - 1;
+	// Odd slaves work on the first half, even ones on the second
+	return (slave % 2 == 1) ? node->size / 2 : (node->size - 1) / 2;
+}
+
+long int MlOptimiserMpi::getJobSize(int slave, long int nr_particles_left, const std::vector<double> &slave_rates)
+{
+	if (do_static_jobs)
+		return nr_pool;
+
+	// The summed speed of all slaves in the same (half-)set, where slaves that have not finished a job yet count as average ones
+	double sum_rates = 0.;
+	int nr_slaves = 0, nr_measured = 0;
+	for (int other = 1; other < node->size; other++)
+	{
+		if (do_split_random_halves && other % 2 != slave % 2)
+			continue;
+		nr_slaves++;
+		if (slave_rates[other] > 0.)
+		{
+			sum_rates += slave_rates[other];
+			nr_measured++;
+		}
+	}
+	double average_rate = (nr_measured > 0) ? sum_rates / nr_measured : 1.;
+	double my_rate = (slave_rates[slave] > 0.) ? slave_rates[slave] : average_rate;
+	sum_rates += (nr_slaves - nr_measured) * average_rate;
+
+	// Give this slave half of its share of the particles that are left, so that the jobs get smaller towards the end,
+	// but never more than --pool particles (which sets the memory use), or less than one per thread
+	long int job_size = CEIL(0.5 * nr_particles_left * my_rate / sum_rates);
+	return XMIPP_MAX(XMIPP_MIN(nr_pool, nr_threads), XMIPP_MIN(nr_pool, job_size));
+}
+
 void MlOptimiserMpi::combineAllWeightedSumsViaFile()
 {
+	ProfileScope profile_scope(PROF_COMBINE_WSUMS);
 
 #ifdef TIMING
     timer.tic(TIMING_MPICOMBINEDISC);
@@ -1728,6 +2038,7 @@ void MlOptimiserMpi::combineAllWeightedSumsViaFile()
 
 void MlOptimiserMpi::combineAllWeightedSums()
 {
+	ProfileScope profile_scope(PROF_COMBINE_WSUMS);
 
 #ifdef TIMING
     timer.tic(TIMING_MPICOMBINENETW);
@@ -1746,7 +2057,30 @@ void MlOptimiserMpi::combineAllWeightedSums()
 	std::cerr << " starting combineAllWeightedSums..." << std::endl;
 #endif
 	// Only combine weighted sums if there are more than one slaves per subset!
-	if ((node->size - 1)/nr_halfsets > 1)
+	if ((node->size - 1)/nr_halfsets > 1 && !do_serial_combine)
+	{
+		// All slaves of a subset sum their Mpacks together, piece by piece
+		if (!node->isMaster())
+		{
+			std::vector<int> subset_ranks;
+			for (int slave = 1; slave < node->size; slave++)
+				if (!do_split_random_halves || slave % 2 == node->rank % 2)
+					subset_ranks.push_back(slave);
+
+			int piece = 0;
+			int nr_pieces = 1;
+			while (piece < nr_pieces)
+			{
+				wsum_model.pack(Mpack, piece, nr_pieces);
+				node->relion_MPI_Allreduce_sum(MULTIDIM_ARRAY(Mpack), MULTIDIM_SIZE(Mpack), subset_ranks, MPITAG_PACK, MPI_COMM_WORLD);
+				// Subtract 1 from piece because it was incremented already...
+				wsum_model.unpack(Mpack, piece - 1);
+			}
+		}
+
+		MPI_Barrier(MPI_COMM_WORLD);
+	}
+	else if ((node->size - 1)/nr_halfsets > 1)
 	{
 		// Loop over possibly multiple instances of Mpack of maximum size
 		int piece = 0;
@@ -1876,6 +2210,8 @@ void MlOptimiserMpi::combineAllWeightedSums()
 
 void MlOptimiserMpi::combineWeightedSumsTwoRandomHalvesViaFile()
 {
+	ProfileScope profile_scope(PROF_COMBINE_WSUMS);
+
 	// Just sum the weighted halves from slave 1 and slave 2 and Bcast to everyone else
 	if (!do_split_random_halves)
 		REPORT_ERROR("MlOptimiserMpi::combineWeightedSumsTwoRandomHalvesViaFile BUG: you cannot combineWeightedSumsTwoRandomHalves if you have not split random halves");
@@ -1930,6 +2266,8 @@ void MlOptimiserMpi::combineWeightedSumsTwoRandomHalvesViaFile()
 
 void MlOptimiserMpi::combineWeightedSumsTwoRandomHalves()
 {
+	ProfileScope profile_scope(PROF_COMBINE_WSUMS);
+
 	// Just sum the weighted halves from slave 1 and slave 2 and Bcast to everyone else
 	if (!do_split_random_halves)
 		REPORT_ERROR("MlOptimiserMpi::combineWeightedSumsTwoRandomHalves BUG: you cannot combineWeightedSumsTwoRandomHalves if you have not split random halves");
@@ -2006,6 +2344,7 @@ void MlOptimiserMpi::combineWeightedSumsTwoRandomHalves()
 
 void MlOptimiserMpi::maximization()
 {
+	ProfileScope profile_scope(PROF_MAXIMIZATION);
 #ifdef DEBUG
 	std::cerr << "MlOptimiserMpi::maximization: Entering " << std::endl;
 #endif
@@ -2993,6 +3332,16 @@ void MlOptimiserMpi::iterate()
 	TIMING_MPISLAVEWAIT3= timer.setNew("mpiSlaveWaiting3");
 #endif
 
+	if (do_profile)
+	{
+		// One file per rank, all on the time axis of the master
+		FileName fn_rank = fn_out + "_rank" + integerToString(node->rank);
+		Profiler::start(fn_rank + "_profile.jsonl", (do_profile_trace) ? fn_rank + "_trace.json" : "", node->rank);
+		long long int origin = Profiler::getOrigin();
+		MPI_Bcast(&origin, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+		Profiler::setOrigin(origin);
+	}
+
 	// Launch threads etc.
 	MlOptimiser::iterateSetup();
 
@@ -3001,6 +3350,8 @@ void MlOptimiserMpi::iterate()
 
 	for (iter = iter + 1; iter <= nr_iter; iter++)
     {
+		Profiler::nextIteration(iter);
+
 #ifdef TIMING
 		timer.tic(TIMING_EXP);
 #endif
@@ -3278,7 +3629,7 @@ void MlOptimiserMpi::iterate()
 					std::cout << " Auto-refine: + Final reconstructions of each body from all particles are saved as " <<  fn_out << "_bodyNNN.mrc, where NNN is the body number" << std::endl;
 
 				std::cout << " Auto-refine: + Final model parameters are stored in: " << fn_out << "_model.star" << std::endl;
-				std::cout << " Auto-refine: + Final data parameters are stored in: " << fn_out << "_data.star" << std::endl;
+				std::cout << " Auto-refine: + Final data parameters are stored in: " << fn_out << ((do_write_binary_metadata) ? "_data.bstar" : "_data.star") << std::endl;
 
 				if (mymodel.tau2_fudge_factor > 1.)
 				{
@@ -3327,6 +3678,8 @@ void MlOptimiserMpi::iterate()
 	MlOptimiser::iterateWrapUp();
 	MPI_Barrier(MPI_COMM_WORLD);
 
+	Profiler::stop();
+
 }
 
 void MlOptimiserMpi::processMoviesPerMicrograph(int argc, char **argv)
@@ -3357,7 +3710,7 @@ void MlOptimiserMpi::processMoviesPerMicrograph(int argc, char **argv)
 		fn_out = fn_out_ori + fn_post.without(".star");
 
 		// Set new output star file back into MDbatches, to be written out at the end
-		FileName fn_data = fn_out + "_data.star";
+		FileName fn_data = fn_out + ((do_write_binary_metadata) ? "_data.bstar" : "_data.star");
 		MDbatches.setValue(EMDL_STARFILE_MOVIE_PARTICLES, fn_data);
 
 		if (!(only_do_unfinished_movies && exists(fn_data)))
@@ -29,6 +29,17 @@ class MlOptimiserMpi: public MlOptimiser
 {
 	std::vector<int> cudaDeviceShares;
 
+	// With the image_prefetcher, a slave receives the answer to its next job request while it works on the current job:
+	// the header of that job is received with next_job_request, the rest once the header has arrived
+	MultidimArray<long int> next_job;
+	MultidimArray<RFLOAT> next_metadata;
+	std::string next_fn_img, next_fn_ctf, next_fn_recimg;
+	MPI_Request next_job_request;
+	bool is_next_job_pending, has_next_job;
+
+	// Receive the rest of the next job after its header, and queue its images in the image_prefetcher
+	void receiveNextJob();
+
 public:
 	MpiNode *node;
 
@@ -46,9 +57,20 @@ public:
     // For debugging: halt all slaves except this one
     int halt_all_slaves_except_this;
 
+    // Hand out jobs of nr_pool particles, one at a time per slave, instead of queueing a next job on the slaves and shrinking the jobs towards the end
+    bool do_static_jobs;
+
+    // Pass the weighted sums from slave to slave, instead of summing them with MpiNode::relion_MPI_Allreduce_sum
+    bool do_serial_combine;
+
     // Original verb
     int ori_verb;
 
+	MlOptimiserMpi():
+		is_next_job_pending(false),
+		has_next_job(false)
+	{}
+
 	/** Destructor, calls MPI_Finalize */
     ~MlOptimiserMpi()
     {
@@ -80,6 +102,19 @@ public:
      */
     void expectation();
 
+    /** On a slave, check whether the answer to its next job request has arrived (see receiveNextJob())
+     *  Returns true while it has not
+     */
+    bool pollDuringExpectation();
+
+    /** Number of slaves that work on the same random half as this slave (or all slaves without random halves) */
+    int getNumberOfSlavesInHalfset(int slave);
+
+    /** Number of particles in the next job of this slave, given the particles that are left in its (half-)set
+     *  and the measured speeds (particles per second, 0 if unknown) of all slaves
+     */
+    long int getJobSize(int slave, long int nr_particles_left, const std::vector<double> &slave_rates);
+
     /** After expectation combine all weighted sum arrays across all nodes
      *  Use read/write to temporary files instead of MPI
      */
@@ -26,7 +26,10 @@
 #include "src/matrix1d.h"
 #include "src/jaz/image_op.h"
 #include "src/funcs.h"
+#include "src/movie_reader.h"
 #include <omp.h>
+#include <deque>
+#include <sys/time.h>
 
 //#define TIMING
 #ifdef TIMING
@@ -36,7 +39,6 @@
 	Timer timer;
 	int TIMING_READ_GAIN = timer.setNew("read gain");
 	int TIMING_READ_MOVIE = timer.setNew("read movie");
-	int TIMING_APPLY_GAIN = timer.setNew("apply gain");
 	int TIMING_INITIAL_SUM = timer.setNew("initial sum");
 	int TIMING_DETECT_HOT = timer.setNew("detect hot pixels");
 	int TIMING_GLOBAL_FFT = timer.setNew("global FFT");
@@ -120,6 +122,8 @@ void MotioncorrRunner::read(int argc, char **argv, int rank)
 	interpolate_shifts = parser.checkOption("--interpolate_shifts", "(EXPERIMENTAL) Interpolate shifts");
 	ccf_downsample = textToFloat(parser.getOption("--ccf_downsample", "(EXPERT) Downsampling rate of CC map. default = 0 = automatic based on B factor", "0"));
 	early_binning = parser.checkOption("--early_binning", "(EXPERT) Do binning before alignment to reduce memory usage. This might dampen signal near Nyquist.");
+	pipeline_depth = textToInteger(parser.getOption("--pipeline_depth", "Number of movies processed at the same time: while one is aligned, the next is read and preprocessed. The --j threads are shared between the stages (this needs --j 4 or more) and each movie in the pipeline is kept in memory. 1 = one movie after another, each stage with all --j threads", "2"));
+	if (pipeline_depth < 1) REPORT_ERROR("--pipeline_depth should be at least 1.");
 	dose_motionstats_cutoff = textToFloat(parser.getOption("--dose_motionstats_cutoff", "Electron dose (in electrons/A2) at which to distinguish early/late global accumulated motion in output statistics", "4."));
 	if (ccf_downsample > 1) REPORT_ERROR("--ccf_downsample cannot exceed 1.");
 	if (skip_defect && !do_own) REPORT_ERROR("--skip_decet is valid only for --use_own");
@@ -416,32 +420,45 @@ void MotioncorrRunner::run()
 		barstep = XMIPP_MAX(1, fn_micrographs.size() / 60);
 	}
 
-	for (long int imic = 0; imic < fn_micrographs.size(); imic++)
+	if (do_own)
 	{
-		if (verb > 0 && imic % barstep == 0)
-			progress_bar(imic);
+		long int nr_movies;
+		double wall_time;
+		std::vector<double> stage_times;
+		runOwnMotionCorrection(0, fn_micrographs.size() - 1, nr_movies, wall_time, stage_times);
+		if (verb > 0)
+		{
+			progress_bar(fn_micrographs.size());
+			printOwnMotionCorrectionStatistics(nr_movies, wall_time, stage_times);
+		}
+	}
+	else
+	{
+		for (long int imic = 0; imic < fn_micrographs.size(); imic++)
+		{
+			if (verb > 0 && imic % barstep == 0)
+				progress_bar(imic);
 
 
-		Micrograph mic(fn_micrographs[imic], fn_gain_reference, bin_factor);
+			Micrograph mic(fn_micrographs[imic], fn_gain_reference, bin_factor);
 
-		bool result = false;
-		if (do_own)
-			result = executeOwnMotionCorrection(mic);
-		else if (do_unblur)
-			result = executeUnblur(mic);
-		else if (do_motioncor2)
-			result = executeMotioncor2(mic);
-		else
-			REPORT_ERROR("Bug: by now it should be clear whether to use MotionCor2 or Unblur...");
+			bool result = false;
+			if (do_unblur)
+				result = executeUnblur(mic);
+			else if (do_motioncor2)
+				result = executeMotioncor2(mic);
+			else
+				REPORT_ERROR("Bug: by now it should be clear whether to use MotionCor2 or Unblur...");
 
-		if (result) {
-			saveModel(mic);
-			plotShifts(fn_micrographs[imic], mic);
+			if (result) {
+				saveModel(mic);
+				plotShifts(fn_micrographs[imic], mic);
+			}
 		}
-	}
 
-	if (verb > 0)
-		progress_bar(fn_micrographs.size());
+		if (verb > 0)
+			progress_bar(fn_micrographs.size());
+	}
 
 	// Make a logfile with the shifts in pdf format and write output STAR files
 	generateLogFilePDFAndWriteStarFiles();
@@ -1164,37 +1181,358 @@ void MotioncorrRunner::generateLogFilePDFAndWriteStarFiles()
 	}
 }
 
+static double ownWallTime()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + 1e-6 * tv.tv_usec;
+}
+
 bool MotioncorrRunner::executeOwnMotionCorrection(Micrograph &mic) {
-	FileName fn_mic = mic.getMovieFilename();
-	FileName fn_avg, fn_mov;
-	getOutputFileNames(fn_mic, fn_avg, fn_mov);
-	FileName fn_avg_noDW = fn_avg.withoutExtension() + "_noDW.mrc";
-	FileName fn_log = fn_avg.withoutExtension() + ".log";
-	std::ofstream logfile;
+	setOwnStageThreads(1);
+	OwnMovieJob job;
+	job.mic = mic;
+	for (int stage = 0; stage < OWN_NR_STAGES; stage++)
+		runOwnStage(job, stage);
+	mic = job.mic;
+
+	return job.is_ok;
+}
+
+int MotioncorrRunner::setOwnStageThreads(int depth) {
+	// Too few threads to give each stage its own
+	if (n_threads < OWN_NR_STAGES)
+		depth = 1;
+
+	if (depth == 1)
+	{
+		for (int stage = 0; stage < OWN_NR_STAGES; stage++)
+			stage_threads[stage] = n_threads;
+		return depth;
+	}
+
+	// Alignment takes most of the time: each other stage gets a sixth of the threads, alignment the rest
+	int nr_other = XMIPP_MAX(1, n_threads / (2 * (OWN_NR_STAGES - 1)));
+	for (int stage = 0; stage < OWN_NR_STAGES; stage++)
+		stage_threads[stage] = nr_other;
+	stage_threads[OWN_STAGE_ALIGN] = n_threads - (OWN_NR_STAGES - 1) * nr_other;
+
+	return depth;
+}
+
+void MotioncorrRunner::runOwnStage(OwnMovieJob &job, int stage) {
+	if (stage == OWN_STAGE_READ)
+	{
+		for (int i = 0; i < OWN_NR_STAGES; i++)
+			job.stage_time[i] = 0.;
+	}
+	else if (!job.is_ok)
+		return;
+
+	double t_start = ownWallTime();
+	switch (stage)
+	{
+	case OWN_STAGE_READ:
+		ownReadMovie(job);
+		break;
+	case OWN_STAGE_PREPROCESS:
+		ownPreprocessMovie(job);
+		break;
+	case OWN_STAGE_ALIGN:
+		ownAlignMovie(job);
+		break;
+	case OWN_STAGE_WRITE:
+		ownWriteMovie(job);
+		break;
+	default:
+		REPORT_ERROR("Bug: unknown stage of own motion correction");
+	}
+	job.stage_time[stage] = ownWallTime() - t_start;
+
+	if (stage == OWN_STAGE_WRITE)
+	{
+		job.logfile << std::endl << "Wall-clock time spent in each stage (s): read = " << job.stage_time[OWN_STAGE_READ]
+		            << " preprocess = " << job.stage_time[OWN_STAGE_PREPROCESS] << " align = " << job.stage_time[OWN_STAGE_ALIGN]
+		            << " sum/write = " << job.stage_time[OWN_STAGE_WRITE] << std::endl;
+		job.logfile.close();
+	}
+}
+
+/*	struct OwnPipeline:
+ *
+ *	- the movies go through the stages read, preprocess, align and sum/write;
+ *	  read, preprocess and align each run on a thread of their own (each with
+ *	  stage_threads[stage] OpenMP threads), sum/write runs on the calling thread,
+ *	  which also saves and plots the models
+ *	- queues[stage] holds the movies waiting for that stage, in the order of
+ *	  fn_micrographs; a NULL job marks the end of the micrographs
+ *	- at most depth movies are in memory at the same time; with a depth of 1
+ *	  the stages of one movie run one after another, each with all n_threads
+ *	  threads, otherwise n_threads is shared between the stages
+ *	- the first error raised in any stage stops all threads, and is rethrown
+ *	  by runOwnMotionCorrection()
+ */
+struct MotioncorrRunner::OwnPipeline
+{
+	struct Thread
+	{
+		OwnPipeline *pipeline;
+		int stage;
+	};
+
+	MotioncorrRunner *runner;
+	long int next_mic, last_mic;
+
+	// Maximum number of movies in the pipeline
+	int depth;
+
+	pthread_mutex_t mutex;
+
+	// Signalled when a movie has moved to another stage, or on an error
+	pthread_cond_t cond;
+
+	std::deque<OwnMovieJob*> queues[OWN_NR_STAGES];
+
+	// Movies that have been started but not yet written
+	int nr_in_flight;
+
+	// Time spent in each stage, summed over all movies
+	double stage_times[OWN_NR_STAGES];
+
+	RelionError *error;
+
+	pthread_t threads[OWN_STAGE_WRITE];
+	Thread thread_data[OWN_STAGE_WRITE];
+};
+
+void* MotioncorrRunner::ownPipelineThread(void *data)
+{
+	OwnPipeline::Thread *thread = (OwnPipeline::Thread*)data;
+	OwnPipeline *pipeline = thread->pipeline;
+	MotioncorrRunner *runner = pipeline->runner;
+	const int stage = thread->stage;
+
+	pthread_mutex_lock(&pipeline->mutex);
+	while (true)
+	{
+		OwnMovieJob *job;
+		if (stage == OWN_STAGE_READ)
+		{
+			// Only start the next movie when there is room for it in the pipeline
+			while (pipeline->error == NULL && pipeline->next_mic <= pipeline->last_mic &&
+			       pipeline->nr_in_flight >= pipeline->depth)
+				pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+
+			if (pipeline->error != NULL)
+				break;
+			if (pipeline->next_mic > pipeline->last_mic)
+				job = NULL;
+			else
+			{
+				job = new OwnMovieJob;
+				job->imic = pipeline->next_mic++;
+				pipeline->nr_in_flight++;
+			}
+		}
+		else
+		{
+			while (pipeline->error == NULL && pipeline->queues[stage].empty())
+				pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+
+			if (pipeline->error != NULL)
+				break;
+			job = pipeline->queues[stage].front();
+			pipeline->queues[stage].pop_front();
+		}
+
+		if (job == NULL)
+		{
+			pipeline->queues[stage + 1].push_back(NULL);
+			pthread_cond_broadcast(&pipeline->cond);
+			break;
+		}
+		pthread_mutex_unlock(&pipeline->mutex);
+
+		RelionError *my_error = NULL;
+		try
+		{
+			if (stage == OWN_STAGE_READ)
+				job->mic = Micrograph(runner->fn_micrographs[job->imic], runner->fn_gain_reference, runner->bin_factor);
+			runner->runOwnStage(*job, stage);
+		}
+		catch (RelionError XE)
+		{
+			my_error = new RelionError(XE.msg, XE.file, XE.line);
+		}
+
+		pthread_mutex_lock(&pipeline->mutex);
+		if (my_error != NULL)
+		{
+			if (pipeline->error == NULL)
+				pipeline->error = my_error;
+			else
+				delete my_error;
+			delete job;
+			pipeline->nr_in_flight--;
+			pthread_cond_broadcast(&pipeline->cond);
+			break;
+		}
+		pipeline->stage_times[stage] += job->stage_time[stage];
+		pipeline->queues[stage + 1].push_back(job);
+		pthread_cond_broadcast(&pipeline->cond);
+	}
+	pthread_mutex_unlock(&pipeline->mutex);
+
+	return NULL;
+}
+
+void MotioncorrRunner::runOwnMotionCorrection(long int first_mic, long int last_mic, long int &nr_movies, double &wall_time, std::vector<double> &stage_times)
+{
+	double t_start = ownWallTime();
+
+	OwnPipeline pipeline;
+	pipeline.runner = this;
+	pipeline.next_mic = first_mic;
+	pipeline.last_mic = last_mic;
+	pipeline.depth = setOwnStageThreads(pipeline_depth);
+	pipeline.nr_in_flight = 0;
+	pipeline.error = NULL;
+	for (int stage = 0; stage < OWN_NR_STAGES; stage++)
+		pipeline.stage_times[stage] = 0.;
+	pthread_mutex_init(&pipeline.mutex, NULL);
+	pthread_cond_init(&pipeline.cond, NULL);
+
+	for (int stage = 0; stage < OWN_STAGE_WRITE; stage++)
+	{
+		pipeline.thread_data[stage].pipeline = &pipeline;
+		pipeline.thread_data[stage].stage = stage;
+		if (pthread_create(&pipeline.threads[stage], NULL, ownPipelineThread, (void*)&pipeline.thread_data[stage]))
+			REPORT_ERROR("MotioncorrRunner::runOwnMotionCorrection: failed to create a thread");
+	}
+
+	int barstep = XMIPP_MAX(1, (last_mic - first_mic + 1) / 60);
+	long int nr_done = 0;
+	nr_movies = 0;
+
+	pthread_mutex_lock(&pipeline.mutex);
+	while (true)
+	{
+		while (pipeline.error == NULL && pipeline.queues[OWN_STAGE_WRITE].empty())
+			pthread_cond_wait(&pipeline.cond, &pipeline.mutex);
+
+		if (pipeline.error != NULL)
+			break;
+		OwnMovieJob *job = pipeline.queues[OWN_STAGE_WRITE].front();
+		pipeline.queues[OWN_STAGE_WRITE].pop_front();
+		if (job == NULL)
+			break;
+		pthread_mutex_unlock(&pipeline.mutex);
+
+		RelionError *my_error = NULL;
+		try
+		{
+			runOwnStage(*job, OWN_STAGE_WRITE);
+			if (job->is_ok)
+			{
+				saveModel(job->mic);
+				plotShifts(fn_micrographs[job->imic], job->mic);
+			}
+		}
+		catch (RelionError XE)
+		{
+			my_error = new RelionError(XE.msg, XE.file, XE.line);
+		}
+
+		pthread_mutex_lock(&pipeline.mutex);
+		pipeline.stage_times[OWN_STAGE_WRITE] += job->stage_time[OWN_STAGE_WRITE];
+		pipeline.nr_in_flight--;
+		// Only movies that were corrected count for the throughput
+		if (job->is_ok && my_error == NULL)
+			nr_movies++;
+		delete job;
+		if (my_error != NULL)
+		{
+			if (pipeline.error == NULL)
+				pipeline.error = my_error;
+			else
+				delete my_error;
+		}
+		pthread_cond_broadcast(&pipeline.cond);
+		if (pipeline.error != NULL)
+			break;
+
+		nr_done++;
+		if (verb > 0 && nr_done % barstep == 0)
+			progress_bar(nr_done);
+	}
+	pthread_mutex_unlock(&pipeline.mutex);
+
+	for (int stage = 0; stage < OWN_STAGE_WRITE; stage++)
+		pthread_join(pipeline.threads[stage], NULL);
+
+	// After an error, free the movies that did not make it through the pipeline
+	for (int stage = 0; stage < OWN_NR_STAGES; stage++)
+		for (int i = 0; i < pipeline.queues[stage].size(); i++)
+			delete pipeline.queues[stage][i];
+
+	pthread_cond_destroy(&pipeline.cond);
+	pthread_mutex_destroy(&pipeline.mutex);
+
+	if (pipeline.error != NULL)
+	{
+		RelionError XE(*pipeline.error);
+		delete pipeline.error;
+		throw XE;
+	}
+
+	wall_time = ownWallTime() - t_start;
+	stage_times.assign(pipeline.stage_times, pipeline.stage_times + OWN_NR_STAGES);
+}
+
+void MotioncorrRunner::printOwnMotionCorrectionStatistics(long int nr_movies, double wall_time, const std::vector<double> &stage_times)
+{
+	if (nr_movies == 0 || wall_time <= 0.)
+		return;
+
+	const char *names[OWN_NR_STAGES] = {"read", "preprocess", "align", "sum/write"};
+	std::cout << " Processed " << nr_movies << " movies in " << wall_time << " sec (" << nr_movies * 3600. / wall_time << " movies/hour)" << std::endl;
+	std::cout << " Average time per movie in each stage (sec):";
+	for (int stage = 0; stage < OWN_NR_STAGES; stage++)
+		std::cout << " " << names[stage] << " = " << stage_times[stage] / nr_movies;
+	std::cout << std::endl;
+}
+
+void MotioncorrRunner::ownReadMovie(OwnMovieJob &job) {
+	const int nr_threads = stage_threads[OWN_STAGE_READ];
+	FileName fn_mic = job.fn_mic = job.mic.getMovieFilename();
+	FileName fn_mov;
+	getOutputFileNames(fn_mic, job.fn_avg, fn_mov);
+	job.fn_avg_noDW = job.fn_avg.withoutExtension() + "_noDW.mrc";
+	FileName fn_log = job.fn_avg.withoutExtension() + ".log";
+	std::ofstream &logfile = job.logfile;
 	logfile.open(fn_log);
+	job.is_ok = true;
 
-	int n_io_threads = n_threads;
-	logfile << "Working on " << fn_mic << " with " << n_threads << " thread(s)." << std::endl << std::endl;
+	int n_io_threads = nr_threads;
+	logfile << "Working on " << fn_mic << " with " << nr_threads << " thread(s)." << std::endl << std::endl;
 	if (max_io_threads > 0 && n_io_threads > max_io_threads)
 	{
 		n_io_threads = max_io_threads;
 		logfile << "Limitted the number of IO threads per movie to " << n_io_threads << " thread(s)." << std::endl;
 	}
 
-	Image<float> Ihead, Igain, Iref;
-	std::vector<MultidimArray<fComplex> > Fframes;
-	std::vector<Image<float> > Iframes;
-	std::vector<int> frames;
-
-	RFLOAT output_angpix = angpix * bin_factor;
-	RFLOAT prescaling = 1;
-
-	const int hotpixel_sigma = 6;
-	const int fit_rmsd_threshold = 10; // px
+	Image<float> &Igain = job.Igain;
+	std::vector<PackedFrame> &Pframes = job.Pframes;
+	std::vector<int> &frames = job.frames;
 
 	// Check image size
-	Ihead.read(fn_mic, false, -1, false, true); // select_img -1, mmap false, is_2D true
-	int nx = XSIZE(Ihead()), ny = YSIZE(Ihead()), nn = NSIZE(Ihead());
+	// The movie is opened (and for TIFF, its frames are indexed) only once
+	MovieReader movie;
+	movie.open(fn_mic);
+	int &nx = job.nx, &ny = job.ny;
+	nx = movie.getWidth();
+	ny = movie.getHeight();
+	int nn = movie.getNumberOfFrames();
 
 	// Which frame to use?
 	logfile << "Movie size: X = " << nx << " Y = " << ny << " N = " << nn << std::endl;
@@ -1209,22 +1547,24 @@ bool MotioncorrRunner::executeOwnMotionCorrection(Micrograph &mic) {
 	}
 	logfile << std::endl;
 
-	const int n_frames = frames.size();
-	Iframes.resize(n_frames);
-	Fframes.resize(n_frames);
-
-	std::vector<RFLOAT> xshifts(n_frames), yshifts(n_frames);
+	const int n_frames = job.n_frames = frames.size();
+	Pframes.resize(n_frames);
+	job.Iframes.resize(n_frames);
+	job.Fframes.resize(n_frames);
 
 	// Setup grouping
 	logfile << "Frame grouping: n_frames = " << n_frames << ", requested group size = " << group << std::endl;
-	const int n_groups = n_frames / group;
+	const int n_groups = job.n_groups = n_frames / group;
 	if (n_groups < 3) 
 	{
 		std::cerr << "Skipped " << fn_mic << ": too few frames (" << n_groups << " < 3) after grouping . Probably the movie is truncated or you made a mistake in frame grouping." << std::endl;
-		return false;
+		job.is_ok = false;
+		return;
 	}
 	int n_remaining = n_frames % group;
-	std::vector<int> group_start(n_groups, 0), group_size(n_groups, group);
+	std::vector<int> &group_start = job.group_start, &group_size = job.group_size;
+	group_start.assign(n_groups, 0);
+	group_size.assign(n_groups, group);
 	while (n_remaining > 0) {
 		for (int i = n_groups - 1; i >= 1 && n_remaining > 0; i--) {
 			// Do not expand the first group, where the motion is largest.
@@ -1262,49 +1602,60 @@ bool MotioncorrRunner::executeOwnMotionCorrection(Micrograph &mic) {
 	}
 	RCTOC(TIMING_READ_GAIN);
 
-	// Read images
-	RCTIC(TIMING_READ_MOVIE);
-	#pragma omp parallel for num_threads(n_io_threads)
+	// Read the frames in the data type of the movie on n_io_threads threads in the background
+	std::vector<PackedFrame*> frame_data(n_frames);
 	for (int iframe = 0; iframe < n_frames; iframe++) {
-		Iframes[iframe].read(fn_mic, true, frames[iframe], false, true); // mmap false, is_2D true
+		frame_data[iframe] = &Pframes[iframe];
 	}
-	RCTOC(TIMING_READ_MOVIE);
+	movie.startReading(frames, frame_data, n_io_threads);
 
-	// Apply gain
-	RCTIC(TIMING_APPLY_GAIN);
-	if (fn_gain_reference != "") {
-		#pragma omp parallel for num_threads(n_threads)
-		for (int iframe = 0; iframe < n_frames; iframe++) {
-			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Igain()) {
-				DIRECT_MULTIDIM_ELEM(Iframes[iframe](), n) *= DIRECT_MULTIDIM_ELEM(Igain(), n);
-			}
-		}
-	}
-	RCTOC(TIMING_APPLY_GAIN);
-
-	MultidimArray<float> Isum(ny, nx);
-	Isum.initZeros();
-	// First sum unaligned frames
-	RCTIC(TIMING_INITIAL_SUM);
+	// Sum the unaligned, gain corrected frames as soon as each frame has been read
+	const MultidimArray<float> *gain = (fn_gain_reference != "") ? &Igain() : NULL;
+	MultidimArray<float> &Isum = job.Isum;
+	Isum.initZeros(ny, nx);
+	size_t packed_memory = 0;
 	for (int iframe = 0; iframe < n_frames; iframe++) {
-		#pragma omp parallel for num_threads(n_threads)
-		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Isum) {
-			DIRECT_MULTIDIM_ELEM(Isum, n) += DIRECT_MULTIDIM_ELEM(Iframes[iframe](), n);
-		}
-	}
-	RCTOC(TIMING_INITIAL_SUM);
+		RCTIC(TIMING_READ_MOVIE);
+		movie.waitForFrame(iframe);
+		RCTOC(TIMING_READ_MOVIE);
+
+		RCTIC(TIMING_INITIAL_SUM);
+		Pframes[iframe].addTo(Isum, gain, nr_threads);
+		packed_memory += Pframes[iframe].getMemory();
+		RCTOC(TIMING_INITIAL_SUM);
+	}
+	movie.finishReading();
+	logfile << "Memory used by the frames as read: " << packed_memory / (1024. * 1024.) << " MB ("
+	        << (double)n_frames * nx * ny * sizeof(float) / (1024. * 1024.) << " MB in float)" << std::endl;
+}
+
+void MotioncorrRunner::ownPreprocessMovie(OwnMovieJob &job) {
+	const int nr_threads = stage_threads[OWN_STAGE_PREPROCESS];
+	std::ofstream &logfile = job.logfile;
+	std::vector<PackedFrame> &Pframes = job.Pframes;
+	std::vector<MultidimArray<fComplex> > &Fframes = job.Fframes;
+	MultidimArray<float> &Isum = job.Isum;
+	int &nx = job.nx, &ny = job.ny;
+	const int n_frames = job.n_frames;
+
+	const int hotpixel_sigma = 6;
+
+	job.prescaling = 1;
 
 	// Hot pixel
+	MultidimArray<bool> bBad;
+	std::vector<long int> bad_pixels;
+	RFLOAT frame_mean = 0, frame_std = 0;
 	if (!skip_defect)
 	{
 		RCTIC(TIMING_DETECT_HOT);
 		RFLOAT mean = 0, std = 0;
-		#pragma omp parallel for reduction(+:mean) num_threads(n_threads)
+		#pragma omp parallel for reduction(+:mean) num_threads(nr_threads)
 		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Isum) {
 			mean += DIRECT_MULTIDIM_ELEM(Isum, n);
 		}
 		mean /=  YXSIZE(Isum);
-		#pragma omp parallel for reduction(+:std) num_threads(n_threads)
+		#pragma omp parallel for reduction(+:std) num_threads(nr_threads)
 		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Isum) {
 			RFLOAT d = (DIRECT_MULTIDIM_ELEM(Isum, n) - mean);
 			std += d * d;
@@ -1313,55 +1664,24 @@ bool MotioncorrRunner::executeOwnMotionCorrection(Micrograph &mic) {
 		const RFLOAT threshold = mean + hotpixel_sigma * std;
 		logfile << "In unaligned sum, Mean = " << mean << " Std = " << std << " Hotpixel threshold = " << threshold << std::endl;
 
-		MultidimArray<bool> bBad(ny, nx);
+		bBad.resize(ny, nx);
 		bBad.initZeros();
-		int n_bad = 0;
 		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Isum) {
 			if (DIRECT_MULTIDIM_ELEM(Isum, n) > threshold) {
 				DIRECT_MULTIDIM_ELEM(bBad, n) = true;
-				n_bad++;
+				bad_pixels.push_back(n);
 			}
 		}
-		logfile << "Detected " << n_bad << " hot pixels to be corrected." << std::endl;
-		Isum.clear();
+		logfile << "Detected " << bad_pixels.size() << " hot pixels to be corrected." << std::endl;
 		RCTOC(TIMING_DETECT_HOT);
 
-		const RFLOAT frame_mean = mean / n_frames;
-		const RFLOAT frame_std = std / n_frames;
-
-		// 25 neighbours; should be enough even for super-resolution images.
-		const int NUM_MIN_OK = 6;
-		const int D_MAX = 2;
-		FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(bBad)
-		{
-			if (!DIRECT_A2D_ELEM(bBad, i, j)) continue;
-//			std::cout << "Hot pixel at (" << i << ", " << j << ")" << std::endl;
-			#pragma omp parallel for num_threads(n_threads)
-			for (int iframe = 0; iframe < n_frames; iframe++)
-			{
-				int n_ok = 0;
-				RFLOAT val = 0;
-				for (int dy= -D_MAX; dy <= D_MAX; dy++)
-				{
-					int y = i + dy;
-					if (y < 0 || y >= ny) continue;
-					for (int dx = -D_MAX; dx <= D_MAX; dx++)
-					{
-						int x = j + dx;
-						if (x < 0 || x >= nx) continue;
-						if (DIRECT_A2D_ELEM(bBad, y, x)) continue;
-
-						n_ok++;
-						val += DIRECT_A2D_ELEM(Iframes[iframe](), y, x);
-					}
-				}
-//				std::cout << "n_ok = " << n_ok << " val = " << val << std::endl;
-				if (n_ok > NUM_MIN_OK) DIRECT_A2D_ELEM(Iframes[iframe](), i, j) = val / n_ok;
-				else DIRECT_A2D_ELEM(Iframes[iframe](), i, j) = rnd_gaus(frame_mean, frame_std);
-			}
-		}
-		logfile << "Fixed hot pixels." << std::endl;
+		frame_mean = mean / n_frames;
+		frame_std = std / n_frames;
 	} // !skip_defect
+	Isum.clear();
+
+	// The hot pixels are fixed in the frames before binning
+	const int movie_nx = nx, movie_ny = ny;
 
 	if (early_binning) {
 		nx /= bin_factor; ny /= bin_factor;
@@ -1369,25 +1689,75 @@ bool MotioncorrRunner::executeOwnMotionCorrection(Micrograph &mic) {
 			// Do not adjust the size because it might lead to non-square pixels
 			REPORT_ERROR("The dimensions of the image after binning must be even");
 		}
-		prescaling = bin_factor;
+		job.prescaling = bin_factor;
 		logfile << "Image size after binning: X = " << nx << " Y = " << ny << std::endl;
 	}
 
-	// FFT
+	// 25 neighbours; should be enough even for super-resolution images.
+	const int NUM_MIN_OK = 6;
+	const int D_MAX = 2;
+
+	// Convert each frame to float just before its FFT, and apply the gain reference and fix the hot pixels only then
+	const MultidimArray<float> *gain = (fn_gain_reference != "") ? &job.Igain() : NULL;
 	RCTIC(TIMING_GLOBAL_FFT);
-	#pragma omp parallel for num_threads(n_threads)
+	#pragma omp parallel for num_threads(nr_threads)
 	for (int iframe = 0; iframe < n_frames; iframe++) {
+		MultidimArray<float> Iframe;
+		Pframes[iframe].unpack(Iframe, gain);
+		Pframes[iframe].clear();
+
+		for (int ibad = 0, ibad_lim = bad_pixels.size(); ibad < ibad_lim; ibad++)
+		{
+			const int i = bad_pixels[ibad] / movie_nx, j = bad_pixels[ibad] % movie_nx;
+			int n_ok = 0;
+			RFLOAT val = 0;
+			for (int dy= -D_MAX; dy <= D_MAX; dy++)
+			{
+				int y = i + dy;
+				if (y < 0 || y >= movie_ny) continue;
+				for (int dx = -D_MAX; dx <= D_MAX; dx++)
+				{
+					int x = j + dx;
+					if (x < 0 || x >= movie_nx) continue;
+					if (DIRECT_A2D_ELEM(bBad, y, x)) continue;
+
+					n_ok++;
+					val += DIRECT_A2D_ELEM(Iframe, y, x);
+				}
+			}
+			if (n_ok > NUM_MIN_OK) DIRECT_A2D_ELEM(Iframe, i, j) = val / n_ok;
+			else DIRECT_A2D_ELEM(Iframe, i, j) = rnd_gaus(frame_mean, frame_std);
+		}
+
 		if (!early_binning) {
-			NewFFT::FourierTransform(Iframes[iframe](), Fframes[iframe]);
+			NewFFT::FourierTransform(Iframe, Fframes[iframe]);
 		} else {
 			MultidimArray<fComplex> Fframe;
-			NewFFT::FourierTransform(Iframes[iframe](), Fframe);
+			NewFFT::FourierTransform(Iframe, Fframe);
 			Fframes[iframe].reshape(ny, nx / 2 + 1);
 			cropInFourierSpace(Fframe, Fframes[iframe]);
 		}
-		Iframes[iframe].clear(); // save some memory (global alignment use the most memory)
 	}
 	RCTOC(TIMING_GLOBAL_FFT);
+	job.Igain.clear();
+	if (!skip_defect)
+		logfile << "Fixed hot pixels." << std::endl;
+}
+
+void MotioncorrRunner::ownAlignMovie(OwnMovieJob &job) {
+	const int nr_threads = stage_threads[OWN_STAGE_ALIGN];
+	Micrograph &mic = job.mic;
+	const FileName &fn_mic = job.fn_mic;
+	std::ofstream &logfile = job.logfile;
+	std::vector<Image<float> > &Iframes = job.Iframes;
+	std::vector<MultidimArray<fComplex> > &Fframes = job.Fframes;
+	std::vector<int> &frames = job.frames, &group_start = job.group_start, &group_size = job.group_size;
+	const int nx = job.nx, ny = job.ny, n_frames = job.n_frames, n_groups = job.n_groups;
+	const RFLOAT prescaling = job.prescaling;
+
+	const int fit_rmsd_threshold = 10; // px
+
+	std::vector<RFLOAT> xshifts(n_frames), yshifts(n_frames);
 
 	// TODO: write power spectrum for CTF estimation
 
@@ -1402,10 +1772,8 @@ bool MotioncorrRunner::executeOwnMotionCorrection(Micrograph &mic) {
 		mic.setGlobalShift(frames[i] + 1, xshifts[i] * prescaling, yshifts[i] * prescaling); // 1-indexed
         }
 
-	Iref().reshape(ny, nx);
-	Iref().initZeros();
 	RCTIC(TIMING_GLOBAL_IFFT);
-	#pragma omp parallel for num_threads(n_threads)
+	#pragma omp parallel for num_threads(nr_threads)
 	for (int iframe = 0; iframe < n_frames; iframe++) {
 		Iframes[iframe]().reshape(ny, nx);
 		NewFFT::inverseFourierTransform(Fframes[iframe], Iframes[iframe]());
@@ -1451,8 +1819,8 @@ bool MotioncorrRunner::executeOwnMotionCorrection(Micrograph &mic) {
 
 				std::vector<RFLOAT> local_xshifts(n_groups), local_yshifts(n_groups);
 				RCTIC(TIMING_PREP_PATCH);
-				std::vector<MultidimArray<float> >Ipatches(n_threads);
-				#pragma omp parallel for num_threads(n_threads)
+				std::vector<MultidimArray<float> >Ipatches(nr_threads);
+				#pragma omp parallel for num_threads(nr_threads)
 				for (int igroup = 0; igroup < n_groups; igroup++) {
 					const int tid = omp_get_thread_num();
 					Ipatches[tid].reshape(y_end - y_start, x_end - x_start); // end is not included
@@ -1516,7 +1884,7 @@ bool MotioncorrRunner::executeOwnMotionCorrection(Micrograph &mic) {
 		if (n_obs <= n_params) {
 			std::cerr << fn_mic << ": too few valid local trajectories to fit local motion model." << std::endl;
 			mic.model = NULL;
-			goto skip_fitting; // TODO: Refactor!
+			return;
 		}
 
 		Matrix2D <RFLOAT> matA(n_obs, n_params);
@@ -1617,8 +1985,22 @@ bool MotioncorrRunner::executeOwnMotionCorrection(Micrograph &mic) {
 	} else { // !do_local
 		mic.model = NULL;
 	}
+}
+
+void MotioncorrRunner::ownWriteMovie(OwnMovieJob &job) {
+	const int nr_threads = stage_threads[OWN_STAGE_WRITE];
+	Micrograph &mic = job.mic;
+	std::ofstream &logfile = job.logfile;
+	std::vector<Image<float> > &Iframes = job.Iframes;
+	std::vector<MultidimArray<fComplex> > &Fframes = job.Fframes;
+	std::vector<int> &frames = job.frames;
+	const FileName &fn_avg = job.fn_avg, &fn_avg_noDW = job.fn_avg_noDW;
+	const int n_frames = job.n_frames;
+	const RFLOAT prescaling = job.prescaling;
+
+	const RFLOAT output_angpix = angpix * bin_factor;
+	Image<float> Iref;
 
-skip_fitting:
 	if (!do_dose_weighting || save_noDW) {
 		Iref().initZeros(Iframes[0]());
 
@@ -1665,7 +2047,7 @@ skip_fitting:
 
 		// Update real space images
 		RCTIC(TIMING_DW_IFFT);
-		#pragma omp parallel for num_threads(n_threads)
+		#pragma omp parallel for num_threads(nr_threads)
 		for (int iframe = 0; iframe < n_frames; iframe++) {
 			NewFFT::inverseFourierTransform(Fframes[iframe], Iframes[iframe]());
 		}
@@ -1694,8 +2076,6 @@ skip_fitting:
 
 	// Set the start frame for the local motion model.
 	mic.first_frame = frames[0] + 1; // NOTE that this is 1-indexed.
-
-	return true;
 }
 
 void MotioncorrRunner::interpolateShifts(std::vector<int> &group_start, std::vector<int> &group_size,
@@ -1733,6 +2113,7 @@ void MotioncorrRunner::interpolateShifts(std::vector<int> &group_start, std::vec
 }
 
 void MotioncorrRunner::realSpaceInterpolation(Image <float> &Isum, std::vector<Image<float> > &Iframes, MotionModel *model, std::ostream &logfile) {
+	const int nr_threads = stage_threads[OWN_STAGE_WRITE];
 	int model_version = MOTION_MODEL_NULL;
 	if (model != NULL) {
 		model_version = model->getModelVersion();
@@ -1744,7 +2125,7 @@ void MotioncorrRunner::realSpaceInterpolation(Image <float> &Isum, std::vector<I
 		for (int iframe = 0; iframe < n_frames; iframe++) {
 			logfile << "." << std::flush;
 
-			#pragma omp parallel for num_threads(n_threads)
+			#pragma omp parallel for num_threads(nr_threads)
 			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Isum()) {
 				DIRECT_MULTIDIM_ELEM(Isum(), n) += DIRECT_MULTIDIM_ELEM(Iframes[iframe](), n);
 			}
@@ -1759,7 +2140,7 @@ void MotioncorrRunner::realSpaceInterpolation(Image <float> &Isum, std::vector<I
 			logfile << "." << std::flush;
 			const RFLOAT z = iframe;
 
-			#pragma omp parallel for num_threads(n_threads)
+			#pragma omp parallel for num_threads(nr_threads)
 			for (int iy = 0; iy < ny; iy++) {
 				const RFLOAT y = (RFLOAT)iy / ny - 0.5;
 				for (int ix = 0; ix < nx; ix++) {
@@ -1812,6 +2193,7 @@ void MotioncorrRunner::realSpaceInterpolation(Image <float> &Isum, std::vector<I
 }
 
 void MotioncorrRunner::realSpaceInterpolation_ThirdOrderPolynomial(Image <float> &Isum, std::vector<Image<float> > &Iframes, ThirdOrderPolynomialModel &model, std::ostream &logfile) {
+	const int nr_threads = stage_threads[OWN_STAGE_WRITE];
 	const int n_frames = Iframes.size();
 	const int nx = XSIZE(Iframes[0]()), ny = YSIZE(Iframes[0]());
 	const Matrix1D<RFLOAT> coeffX = model.coeffX, coeffY = model.coeffY;
@@ -1835,7 +2217,7 @@ void MotioncorrRunner::realSpaceInterpolation_ThirdOrderPolynomial(Image <float>
 		const RFLOAT y_C4 = coeffY(12) * z + coeffY(13) * z2 + coeffY(14) * z3;
 		const RFLOAT y_C5 = coeffY(15) * z + coeffY(16) * z2 + coeffY(17) * z3;
 
-		#pragma omp parallel for num_threads(n_threads)
+		#pragma omp parallel for num_threads(nr_threads)
 		for (int iy = 0; iy < ny; iy++) {
 			const RFLOAT y = (RFLOAT)iy / ny - 0.5;
 			for (int ix = 0; ix < nx; ix++) {
@@ -1898,9 +2280,10 @@ void MotioncorrRunner::realSpaceInterpolation_ThirdOrderPolynomial(Image <float>
 }
 
 bool MotioncorrRunner::alignPatch(std::vector<MultidimArray<fComplex> > &Fframes, const int pnx, const int pny, const RFLOAT scaled_B, std::vector<RFLOAT> &xshifts, std::vector<RFLOAT> &yshifts, std::ostream &logfile) {
-	std::vector<Image<float> > Iccs(n_threads);
+	const int nr_threads = stage_threads[OWN_STAGE_ALIGN];
+	std::vector<Image<float> > Iccs(nr_threads);
 	MultidimArray<fComplex> Fref;
-	std::vector<MultidimArray<fComplex> > Fccs(n_threads);
+	std::vector<MultidimArray<fComplex> > Fccs(nr_threads);
 	MultidimArray<float> weight;
 	std::vector<RFLOAT> cur_xshifts, cur_yshifts;
 	bool converged = false;
@@ -1941,7 +2324,7 @@ bool MotioncorrRunner::alignPatch(std::vector<MultidimArray<fComplex> > &Fframes
 	const int nfy_half = nfy / 2;
 
 	Fref.reshape(ccf_nfy, ccf_nfx);
-	for (int i = 0; i < n_threads; i++) {
+	for (int i = 0; i < nr_threads; i++) {
 		Iccs[i]().reshape(ccf_ny, ccf_nx);
 		Fccs[i].reshape(Fref);
 	}
@@ -1958,7 +2341,7 @@ bool MotioncorrRunner::alignPatch(std::vector<MultidimArray<fComplex> > &Fframes
 	// Initialize B factor weight
 	weight.reshape(Fref);
 	RCTIC(TIMING_PREP_WEIGHT);
-	#pragma omp parallel for num_threads(n_threads)
+	#pragma omp parallel for num_threads(nr_threads)
 	for (int y = 0; y < ccf_nfy; y++) {
 		const int ly = (y > ccf_nfy_half) ? (y - ccf_nfy) : y;
 		RFLOAT ly2 = ly * (RFLOAT)ly / (nfy * (RFLOAT)nfy);
@@ -1974,7 +2357,7 @@ bool MotioncorrRunner::alignPatch(std::vector<MultidimArray<fComplex> > &Fframes
 		RCTIC(TIMING_MAKE_REF);
 		Fref.initZeros();
 
-		#pragma omp parallel for num_threads(n_threads)
+		#pragma omp parallel for num_threads(nr_threads)
 		for (int y = 0; y < ccf_nfy; y++) {
 			const int ly = (y > ccf_nfy_half) ? (y - ccf_nfy + nfy) : y;
 			for (int x = 0; x < ccf_nfx; x++) {
@@ -1985,7 +2368,7 @@ bool MotioncorrRunner::alignPatch(std::vector<MultidimArray<fComplex> > &Fframes
 		}
 		RCTOC(TIMING_MAKE_REF);
 
-		#pragma omp parallel for num_threads(n_threads)
+		#pragma omp parallel for num_threads(nr_threads)
 		for (int iframe = 0; iframe < n_frames; iframe++) {
 			const int tid = omp_get_thread_num();
 
@@ -2072,7 +2455,7 @@ bool MotioncorrRunner::alignPatch(std::vector<MultidimArray<fComplex> > &Fframes
 		// Apply shifts
 		// Since the image is not necessarily square, we cannot use the method in fftw.cpp
 		RCTIC(TIMING_FOURIER_SHIFT);
-		#pragma omp parallel for num_threads(n_threads)
+		#pragma omp parallel for num_threads(nr_threads)
 		for (int iframe = 1; iframe < n_frames; iframe++) {
 			shiftNonSquareImageInFourierTransform(Fframes[iframe], -cur_xshifts[iframe] / pnx, -cur_yshifts[iframe] / pny);
 		}
@@ -2119,6 +2502,7 @@ int MotioncorrRunner::findGoodSize(int request) {
 // This implements the model by Timothy Grant & Nikolaus Grigorieff on eLife, 2015
 // doi: 10.7554/eLife.06980
 void MotioncorrRunner::doseWeighting(std::vector<MultidimArray<fComplex> > &Fframes, std::vector<RFLOAT> doses, RFLOAT apix) {
+	const int nr_threads = stage_threads[OWN_STAGE_WRITE];
 	const int nfx = XSIZE(Fframes[0]), nfy = YSIZE(Fframes[0]);
 	const int nfy_half = nfy / 2;
 	const RFLOAT nfy2 = (RFLOAT)nfy * nfy;
@@ -2126,7 +2510,7 @@ void MotioncorrRunner::doseWeighting(std::vector<MultidimArray<fComplex> > &Ffra
 	const int n_frames= Fframes.size();
 	const RFLOAT A = 0.245, B = -1.665, C = 2.81;
 
-	#pragma omp parallel for num_threads(n_threads)
+	#pragma omp parallel for num_threads(nr_threads)
 	for (int y = 0; y < nfy; y++) {
 		int ly = y;
 		if (y > nfy_half) ly = y - nfy;
@@ -31,6 +31,7 @@
 #include "src/metadata_table.h"
 #include "src/image.h"
 #include "src/micrograph_model.h"
+#include "src/movie_reader.h"
 #include "src/jaz/new_ft.h"
 
 class MotioncorrRunner
@@ -57,6 +58,10 @@ public:
 	bool do_own;
 	bool interpolate_shifts;
 
+	// Number of movies our own implementation works on at the same time, each in another stage of the
+	// pipeline (read, preprocess, align, sum/write): while one movie is aligned, the next one is read
+	int pipeline_depth;
+
 	// Maximum number of iterations
 	int max_iter;
 
@@ -172,6 +177,14 @@ public:
 	// Execute our own implementation for a single micrograph
 	bool executeOwnMotionCorrection(Micrograph &mic);
 
+	// Execute our own implementation for micrographs first_mic to last_mic (inclusive) in a pipeline,
+	// with the movies in different stages at the same time, and save and plot their models
+	// Returns the number of movies processed, the wall-clock time, and the time spent in each stage
+	void runOwnMotionCorrection(long int first_mic, long int last_mic, long int &nr_movies, double &wall_time, std::vector<double> &stage_times);
+
+	// Write the throughput and the time spent in each stage to the screen
+	void printOwnMotionCorrectionStatistics(long int nr_movies, double wall_time, const std::vector<double> &stage_times);
+
 	// Get the shifts from UNBLUR
 	void getShiftsUnblur(FileName fn_mic, Micrograph &mic);
 
@@ -191,6 +204,65 @@ public:
 	void writeSTAR();
 
 private:
+
+	// Stages of the pipeline of our own implementation
+	enum OwnStage
+	{
+		OWN_STAGE_READ,
+		OWN_STAGE_PREPROCESS,
+		OWN_STAGE_ALIGN,
+		OWN_STAGE_WRITE,
+		OWN_NR_STAGES
+	};
+
+	// Number of OpenMP threads of each stage (see setOwnStageThreads())
+	int stage_threads[OWN_NR_STAGES];
+
+	// A movie on its way through the pipeline
+	struct OwnMovieJob
+	{
+		// Index in fn_micrographs
+		long int imic;
+		Micrograph mic;
+		FileName fn_mic, fn_avg, fn_avg_noDW;
+		std::ofstream logfile;
+
+		// False if the movie is skipped (too few frames)
+		bool is_ok;
+
+		int nx, ny, n_frames, n_groups;
+		RFLOAT prescaling;
+		std::vector<int> frames, group_start, group_size;
+		std::vector<Image<float> > Iframes;
+		std::vector<MultidimArray<fComplex> > Fframes;
+
+		// Frames in the data type of the movie, until they are Fourier transformed
+		// The gain reference and the hot pixel correction are applied only then
+		std::vector<PackedFrame> Pframes;
+		Image<float> Igain;
+
+		// Unaligned sum, for hot pixel detection
+		MultidimArray<float> Isum;
+
+		// Wall-clock time (in seconds) spent in each stage
+		double stage_time[OWN_NR_STAGES];
+	};
+
+	// State shared by the threads of the pipeline (in motioncorr_runner.cpp)
+	struct OwnPipeline;
+
+	void ownReadMovie(OwnMovieJob &job);
+	void ownPreprocessMovie(OwnMovieJob &job);
+	void ownAlignMovie(OwnMovieJob &job);
+	void ownWriteMovie(OwnMovieJob &job);
+	void runOwnStage(OwnMovieJob &job, int stage);
+
+	// Share n_threads between the stages, which run at the same time when more than one movie is in
+	// the pipeline. Returns the number of movies that may be in the pipeline.
+	int setOwnStageThreads(int depth);
+
+	static void* ownPipelineThread(void *data);
+
 	// shiftx, shifty is relative to the (real space) image size
 	void shiftNonSquareImageInFourierTransform(MultidimArray<fComplex> &frame, RFLOAT shiftx, RFLOAT shifty);
 
@@ -60,30 +60,50 @@ void MotioncorrRunnerMpi::run()
 		barstep = XMIPP_MAX(1, my_nr_micrographs / 60);
 	}
 
-	for (long int imic = my_first_micrograph; imic <= my_last_micrograph; imic++)
+	if (do_own)
 	{
-		if (verb > 0 && imic % barstep == 0)
-			progress_bar(imic);
-
-		Micrograph mic(fn_micrographs[imic], fn_gain_reference, bin_factor);
-
-		bool result;
-		if (do_own)
-			result = executeOwnMotionCorrection(mic);
-		else if (do_unblur)
-			result = executeUnblur(mic);
-		else if (do_motioncor2)
-			result = executeMotioncor2(mic, node->rank);
-		else
-			REPORT_ERROR("Bug: by now it should be clear whether to use MotionCor2 or Unblur...");
-
-		if (result) {
-			saveModel(mic);
-			plotShifts(fn_micrographs[imic], mic);
+		long int nr_movies;
+		double wall_time;
+		std::vector<double> stage_times;
+		runOwnMotionCorrection(my_first_micrograph, my_last_micrograph, nr_movies, wall_time, stage_times);
+		if (verb > 0)
+			progress_bar(my_nr_micrographs);
+
+		// The throughput of all nodes together
+		long int all_nr_movies;
+		double all_wall_time;
+		std::vector<double> all_stage_times(stage_times.size());
+		MPI_Reduce(&nr_movies, &all_nr_movies, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+		MPI_Reduce(&wall_time, &all_wall_time, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+		MPI_Reduce(&stage_times[0], &all_stage_times[0], stage_times.size(), MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+		if (verb > 0)
+			printOwnMotionCorrectionStatistics(all_nr_movies, all_wall_time, all_stage_times);
+	}
+	else
+	{
+		for (long int imic = my_first_micrograph; imic <= my_last_micrograph; imic++)
+		{
+			if (verb > 0 && imic % barstep == 0)
+				progress_bar(imic);
+
+			Micrograph mic(fn_micrographs[imic], fn_gain_reference, bin_factor);
+
+			bool result;
+			if (do_unblur)
+				result = executeUnblur(mic);
+			else if (do_motioncor2)
+				result = executeMotioncor2(mic, node->rank);
+			else
+				REPORT_ERROR("Bug: by now it should be clear whether to use MotionCor2 or Unblur...");
+
+			if (result) {
+				saveModel(mic);
+				plotShifts(fn_micrographs[imic], mic);
+			}
 		}
+		if (verb > 0)
+			progress_bar(my_nr_micrographs);
 	}
-	if (verb > 0)
-		progress_bar(my_nr_micrographs);
 
 	MPI_Barrier(MPI_COMM_WORLD);
 
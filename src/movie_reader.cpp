@@ -0,0 +1,511 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "src/movie_reader.h"
+
+template <typename T>
+static void convertRow(const char *src, float *row, int width)
+{
+	const T *ptr = (const T*)src;
+	for (int x = 0; x < width; x++)
+		row[x] = (float)ptr[x];
+}
+
+void PackedFrame::unpackRow(int y, float *row, const MultidimArray<float> *gain) const
+{
+	const int y_data = (flip_y) ? height - 1 - y : y;
+
+	switch (datatype)
+	{
+	case UChar:
+		convertRow<unsigned char>(&data[(size_t)y_data * width], row, width);
+		break;
+	case SChar:
+		convertRow<signed char>(&data[(size_t)y_data * width], row, width);
+		break;
+	case UShort:
+		convertRow<unsigned short>(&data[(size_t)y_data * width * 2], row, width);
+		break;
+	case Short:
+		convertRow<short>(&data[(size_t)y_data * width * 2], row, width);
+		break;
+	case UInt:
+		convertRow<unsigned int>(&data[(size_t)y_data * width * 4], row, width);
+		break;
+	case Int:
+		convertRow<int>(&data[(size_t)y_data * width * 4], row, width);
+		break;
+	case Float:
+		convertRow<float>(&data[(size_t)y_data * width * 4], row, width);
+		break;
+	case UHalf:
+		{
+			// Two pixels per byte, the first one in the low bits, as in Image::castPage2T()
+			// The width is even, so that every row starts at a full byte
+			const unsigned char *ptr = (const unsigned char*)&data[(size_t)y_data * width / 2];
+			for (int x = 0; x < width / 2; x++)
+			{
+				row[2 * x] = (float)(ptr[x] & 15);
+				row[2 * x + 1] = (float)((ptr[x] >> 4) & 15);
+			}
+			break;
+		}
+	default:
+		REPORT_ERROR("PackedFrame::unpackRow ERROR: unsupported data type " + integerToString(datatype));
+	}
+
+	if (gain != NULL)
+	{
+		const float *gain_row = MULTIDIM_ARRAY(*gain) + (size_t)y * width;
+		for (int x = 0; x < width; x++)
+			row[x] *= gain_row[x];
+	}
+}
+
+void PackedFrame::unpack(MultidimArray<float> &img, const MultidimArray<float> *gain) const
+{
+	if (gain != NULL && (XSIZE(*gain) != width || YSIZE(*gain) != height))
+		REPORT_ERROR("PackedFrame::unpack ERROR: the size of the gain reference does not match the size of the frame");
+
+	img.resize(height, width);
+	for (int y = 0; y < height; y++)
+		unpackRow(y, MULTIDIM_ARRAY(img) + (size_t)y * width, gain);
+}
+
+void PackedFrame::addTo(MultidimArray<float> &sum, const MultidimArray<float> *gain, int nr_threads) const
+{
+	if (XSIZE(sum) != width || YSIZE(sum) != height)
+		REPORT_ERROR("PackedFrame::addTo ERROR: the size of the sum does not match the size of the frame");
+	if (gain != NULL && (XSIZE(*gain) != width || YSIZE(*gain) != height))
+		REPORT_ERROR("PackedFrame::addTo ERROR: the size of the gain reference does not match the size of the frame");
+
+	#pragma omp parallel num_threads(nr_threads)
+	{
+		// Only one row is converted to float at a time
+		std::vector<float> row(width);
+
+		#pragma omp for
+		for (int y = 0; y < height; y++)
+		{
+			unpackRow(y, &row[0], gain);
+			float *sum_row = MULTIDIM_ARRAY(sum) + (size_t)y * width;
+			for (int x = 0; x < width; x++)
+				sum_row[x] += row[x];
+		}
+	}
+}
+
+MovieReader::MovieReader()
+:	format(MOVIE_OTHER),
+	width(0),
+	height(0),
+	nr_frames(0),
+	datatype(Unknown_Type),
+	fd(-1),
+	nr_started(0),
+	do_stop(false),
+	error(NULL)
+{
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&ready_cond, NULL);
+}
+
+MovieReader::~MovieReader()
+{
+	close();
+
+	delete error;
+
+	pthread_cond_destroy(&ready_cond);
+	pthread_mutex_destroy(&mutex);
+}
+
+void MovieReader::open(const FileName &_fn_movie)
+{
+	close();
+
+	fn_movie = _fn_movie;
+	fn_file = fn_movie.removeFileFormat();
+	FileName ext_name = fn_movie.getFileFormat();
+
+	if (ext_name.contains("tif"))
+	{
+#ifdef HAVE_TIFF
+		format = MOVIE_TIFF;
+
+		TIFF *ftiff = TIFFOpen(fn_file.c_str(), "r");
+		if (ftiff == NULL)
+			REPORT_ERROR("MovieReader::open ERROR: cannot open " + fn_movie);
+		free_tiff_handles.push_back(ftiff);
+
+		// Walk the chain of image directories once, and remember where each of them starts
+		uint32 tiff_width, tiff_length;
+		uint16 sample_format, bits_per_sample;
+		do
+		{
+			uint32 cur_width, cur_length;
+			uint16 cur_sample_format, cur_bits_per_sample;
+			if (TIFFGetField(ftiff, TIFFTAG_IMAGEWIDTH, &cur_width) != 1 ||
+			    TIFFGetField(ftiff, TIFFTAG_IMAGELENGTH, &cur_length) != 1)
+				REPORT_ERROR("MovieReader::open ERROR: the input TIFF file does not have the width or height field: " + fn_movie);
+			TIFFGetFieldDefaulted(ftiff, TIFFTAG_BITSPERSAMPLE, &cur_bits_per_sample);
+			TIFFGetFieldDefaulted(ftiff, TIFFTAG_SAMPLEFORMAT, &cur_sample_format);
+
+			if (tiff_dir_offsets.size() == 0)
+			{
+				tiff_width = cur_width;
+				tiff_length = cur_length;
+				bits_per_sample = cur_bits_per_sample;
+				sample_format = cur_sample_format;
+			}
+			else if (cur_width != tiff_width || cur_length != tiff_length ||
+			         cur_bits_per_sample != bits_per_sample || cur_sample_format != sample_format)
+				REPORT_ERROR("MovieReader::open ERROR: all frames in a TIFF should have same width, height and pixel format: " + fn_movie);
+
+			tiff_dir_offsets.push_back(TIFFCurrentDirOffset(ftiff));
+		}
+		while (TIFFReadDirectory(ftiff));
+
+		if (bits_per_sample == 8 && sample_format == 1)
+			datatype = UChar;
+		else if (bits_per_sample == 16 && sample_format == 1)
+			datatype = UShort;
+		else if (bits_per_sample == 16 && sample_format == 2)
+			datatype = Short;
+		else if (bits_per_sample == 32 && sample_format == 3)
+			datatype = Float;
+		else
+		{
+			std::cerr << "Unsupported TIFF format: sample format = " << sample_format << ", bits per sample = " << bits_per_sample << std::endl;
+			REPORT_ERROR("MovieReader::open ERROR: unsupported TIFF format: " + fn_movie);
+		}
+
+		width = tiff_width;
+		height = tiff_length;
+		nr_frames = tiff_dir_offsets.size();
+#else
+		REPORT_ERROR("TIFF support was not enabled during compilation");
+#endif
+	}
+	else
+	{
+		format = (ext_name.contains("mrc")) ? MOVIE_MRC : MOVIE_OTHER;
+
+		// select_img -1, mmap false, is_2D true: the frames of an MRC file are in N, also for .mrc
+		Ihead.read(fn_movie, false, -1, false, true);
+		width = XSIZE(Ihead());
+		height = YSIZE(Ihead());
+		nr_frames = NSIZE(Ihead());
+		datatype = (DataType)Ihead.dataType();
+
+		if (format == MOVIE_MRC && (fd = ::open(fn_file.c_str(), O_RDONLY)) < 0)
+			REPORT_ERROR("MovieReader::open ERROR: cannot open " + fn_movie);
+	}
+}
+
+void MovieReader::close()
+{
+	pthread_mutex_lock(&mutex);
+	do_stop = true;
+	pthread_mutex_unlock(&mutex);
+
+	joinThreads();
+
+	if (fd >= 0)
+		::close(fd);
+	fd = -1;
+
+#ifdef HAVE_TIFF
+	for (int i = 0; i < free_tiff_handles.size(); i++)
+		TIFFClose(free_tiff_handles[i]);
+	free_tiff_handles.clear();
+	tiff_dir_offsets.clear();
+#endif
+
+	width = height = nr_frames = 0;
+}
+
+void MovieReader::readFrame(int iframe, MultidimArray<float> &img)
+{
+	if (iframe < 0 || iframe >= nr_frames)
+		REPORT_ERROR("MovieReader::readFrame ERROR: frame " + integerToString(iframe + 1) + " does not exist in " + fn_movie);
+
+	if (format == MOVIE_OTHER)
+	{
+		Image<float> Iframe;
+		Iframe.read(fn_movie, true, iframe, false, true);
+		img = Iframe();
+	}
+	else
+	{
+		PackedFrame frame;
+		readFrame(iframe, frame);
+		frame.unpack(img);
+	}
+}
+
+void MovieReader::readFrame(int iframe, PackedFrame &frame)
+{
+	if (iframe < 0 || iframe >= nr_frames)
+		REPORT_ERROR("MovieReader::readFrame ERROR: frame " + integerToString(iframe + 1) + " does not exist in " + fn_movie);
+
+	if (format == MOVIE_TIFF)
+		readTIFFFrame(iframe, frame);
+	else if (format == MOVIE_MRC)
+		readMRCFrame(iframe, frame);
+	else
+	{
+		// Nothing to gain for other formats: keep them in float
+		Image<float> Iframe;
+		Iframe.read(fn_movie, true, iframe, false, true);
+		frame.width = width;
+		frame.height = height;
+		frame.datatype = Float;
+		frame.flip_y = false;
+		frame.data.resize((size_t)width * height * sizeof(float));
+		memcpy(&frame.data[0], MULTIDIM_ARRAY(Iframe()), frame.data.size());
+	}
+}
+
+void MovieReader::readTIFFFrame(int iframe, PackedFrame &frame)
+{
+#ifdef HAVE_TIFF
+	// TIFF handles keep the state of the decoder: every thread needs one of its own
+	TIFF *ftiff = NULL;
+	pthread_mutex_lock(&mutex);
+	if (free_tiff_handles.size() > 0)
+	{
+		ftiff = free_tiff_handles.back();
+		free_tiff_handles.pop_back();
+	}
+	pthread_mutex_unlock(&mutex);
+
+	if (ftiff == NULL && (ftiff = TIFFOpen(fn_file.c_str(), "r")) == NULL)
+		REPORT_ERROR("MovieReader::readFrame ERROR: cannot open " + fn_movie);
+
+	size_t nr_pixels = (size_t)width * height;
+	size_t typesize = gettypesize(datatype);
+	frame.width = width;
+	frame.height = height;
+	frame.datatype = datatype;
+	frame.flip_y = true; // as in readTIFF()
+	frame.data.resize(nr_pixels * typesize);
+	size_t haveread_n = 0;
+	std::string error_msg = "";
+
+	// Jump straight to the directory of this frame
+	if (!TIFFSetSubDirectory(ftiff, tiff_dir_offsets[iframe]))
+		error_msg = "cannot find the image directory of frame ";
+	else
+	{
+		tsize_t strip_size = TIFFStripSize(ftiff);
+		tstrip_t nr_strips = TIFFNumberOfStrips(ftiff);
+		tdata_t buf = _TIFFmalloc(strip_size);
+		for (tstrip_t strip = 0; strip < nr_strips; strip++)
+		{
+			tsize_t actually_read = TIFFReadEncodedStrip(ftiff, strip, buf, strip_size);
+			size_t actually_read_n = (actually_read < 0) ? 0 : actually_read / typesize;
+			if (actually_read < 0 || haveread_n + actually_read_n > nr_pixels)
+			{
+				error_msg = "cannot decode frame ";
+				break;
+			}
+			memcpy(&frame.data[haveread_n * typesize], buf, actually_read_n * typesize);
+			haveread_n += actually_read_n;
+		}
+		_TIFFfree(buf);
+
+		if (error_msg == "" && haveread_n != nr_pixels)
+			error_msg = "not enough data in frame ";
+	}
+
+	pthread_mutex_lock(&mutex);
+	free_tiff_handles.push_back(ftiff);
+	pthread_mutex_unlock(&mutex);
+
+	if (error_msg != "")
+		REPORT_ERROR("MovieReader::readFrame ERROR: " + error_msg + integerToString(iframe + 1) + " of " + fn_movie);
+#else
+	REPORT_ERROR("TIFF support was not enabled during compilation");
+#endif
+}
+
+void MovieReader::readMRCFrame(int iframe, PackedFrame &frame)
+{
+	size_t nr_pixels = (size_t)width * height;
+	size_t pagesize = (datatype == UHalf) ? nr_pixels / 2 : nr_pixels * gettypesize(datatype);
+	off_t myoffset = Ihead.dataOffset() + (off_t)iframe * pagesize;
+
+	if (datatype == UHalf && width % 2 != 0)
+		REPORT_ERROR("MovieReader::readFrame ERROR: the width of 4-bit movies must be even: " + fn_movie);
+	frame.width = width;
+	frame.height = height;
+	frame.datatype = datatype;
+	frame.flip_y = false;
+
+	// pread() does not move a shared file position, so that all threads can use the same descriptor
+	std::vector<char> &page = frame.data;
+	page.resize(pagesize);
+	size_t haveread = 0;
+	while (haveread < pagesize)
+	{
+		ssize_t result = pread(fd, &page[haveread], pagesize - haveread, myoffset + haveread);
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result <= 0)
+			REPORT_ERROR("MovieReader::readFrame ERROR: cannot read frame " + integerToString(iframe + 1) + " of " + fn_movie);
+		haveread += result;
+	}
+
+	if (Ihead.dataSwap() && datatype != UHalf)
+		Ihead.swapPage(&page[0], pagesize, datatype);
+}
+
+void MovieReader::startReading(const std::vector<int> &_frames, const std::vector<MultidimArray<float>*> &_imgs, int nr_threads)
+{
+	if (_frames.size() != _imgs.size())
+		REPORT_ERROR("BUG: MovieReader::startReading needs an array for every frame");
+
+	joinThreads();
+
+	imgs = _imgs;
+	packed_frames.clear();
+	startThreads(_frames, nr_threads);
+}
+
+void MovieReader::startReading(const std::vector<int> &_frames, const std::vector<PackedFrame*> &_packed_frames, int nr_threads)
+{
+	if (_frames.size() != _packed_frames.size())
+		REPORT_ERROR("BUG: MovieReader::startReading needs a PackedFrame for every frame");
+
+	joinThreads();
+
+	imgs.clear();
+	packed_frames = _packed_frames;
+	startThreads(_frames, nr_threads);
+}
+
+void MovieReader::startThreads(const std::vector<int> &_frames, int nr_threads)
+{
+	frames = _frames;
+	is_read.assign(frames.size(), 0);
+	nr_started = 0;
+	do_stop = false;
+	delete error;
+	error = NULL;
+
+	threads.resize(XMIPP_MIN(XMIPP_MAX(1, nr_threads), (int)frames.size()));
+	for (int i = 0; i < threads.size(); i++)
+	{
+		if (pthread_create(&threads[i], NULL, threadMain, (void*)this))
+		{
+			threads.resize(i);
+			close();
+			REPORT_ERROR("MovieReader ERROR: cannot create reader thread");
+		}
+	}
+}
+
+void MovieReader::waitForFrame(int i)
+{
+	pthread_mutex_lock(&mutex);
+
+	if (i < 0 || i >= is_read.size())
+	{
+		pthread_mutex_unlock(&mutex);
+		REPORT_ERROR("BUG: MovieReader::waitForFrame requested a frame that was not queued");
+	}
+
+	while (!is_read[i] && error == NULL)
+		pthread_cond_wait(&ready_cond, &mutex);
+
+	if (error != NULL)
+	{
+		RelionError XE(*error);
+		pthread_mutex_unlock(&mutex);
+		throw XE;
+	}
+
+	pthread_mutex_unlock(&mutex);
+}
+
+void MovieReader::finishReading()
+{
+	joinThreads();
+
+	if (error != NULL)
+	{
+		RelionError XE(*error);
+		throw XE;
+	}
+}
+
+void MovieReader::joinThreads()
+{
+	for (int i = 0; i < threads.size(); i++)
+		pthread_join(threads[i], NULL);
+	threads.clear();
+}
+
+void* MovieReader::threadMain(void *data)
+{
+	((MovieReader*)data)->readFrames();
+	return NULL;
+}
+
+void MovieReader::readFrames()
+{
+	pthread_mutex_lock(&mutex);
+
+	// Hand out the frames in the order of the list, so that the first ones are ready first
+	while (!do_stop && error == NULL && nr_started < frames.size())
+	{
+		int i = nr_started++;
+		pthread_mutex_unlock(&mutex);
+
+		RelionError *my_error = NULL;
+		try
+		{
+			if (packed_frames.size() > 0)
+				readFrame(frames[i], *packed_frames[i]);
+			else
+				readFrame(frames[i], *imgs[i]);
+		}
+		catch (RelionError XE)
+		{
+			my_error = new RelionError(XE.msg, XE.file, XE.line);
+		}
+
+		pthread_mutex_lock(&mutex);
+		is_read[i] = 1;
+		if (my_error != NULL)
+		{
+			if (error == NULL)
+				error = my_error;
+			else
+				delete my_error;
+		}
+		pthread_cond_broadcast(&ready_cond);
+	}
+
+	pthread_mutex_unlock(&mutex);
+}
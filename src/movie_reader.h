@@ -0,0 +1,201 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef MOVIE_READER_H
+#define MOVIE_READER_H
+
+#include <pthread.h>
+#include <vector>
+#include "src/image.h"
+
+/*	class PackedFrame:
+ *
+ *	- a movie frame in the data type of the file: 1 byte per pixel for 8-bit
+ *	  counts and 2 pixels per byte for 4-bit counts, i.e. 4 to 8 times less
+ *	  memory than the frame in float
+ *	- the pixel values are converted to float (and multiplied by the gain
+ *	  reference) only where the frame is used
+ *	- the data are in the byte order of this machine; TIFF frames are stored
+ *	  bottom row first, and are flipped along Y when they are converted
+ */
+class PackedFrame
+{
+public:
+
+	int width, height;
+	DataType datatype;
+	bool flip_y;
+	std::vector<char> data;
+
+	PackedFrame()
+	:	width(0),
+		height(0),
+		datatype(Unknown_Type),
+		flip_y(false)
+	{
+	}
+
+	// Memory used by the pixel values, in bytes
+	size_t getMemory() const
+	{
+		return data.size();
+	}
+
+	void clear()
+	{
+		std::vector<char>().swap(data);
+	}
+
+	// Convert row y (counting from the top of the frame) to float, multiplied by the gain reference if it is not NULL
+	void unpackRow(int y, float *row, const MultidimArray<float> *gain = NULL) const;
+
+	// Convert to float (resized to height x width), multiplied by the gain reference if it is not NULL
+	void unpack(MultidimArray<float> &img, const MultidimArray<float> *gain = NULL) const;
+
+	// Add the frame (multiplied by the gain reference if it is not NULL) to sum, on nr_threads OpenMP threads
+	void addTo(MultidimArray<float> &sum, const MultidimArray<float> *gain = NULL, int nr_threads = 1) const;
+};
+
+/*	class MovieReader:
+ *
+ *	- opens a movie (a TIFF file or an MRC stack) once and reads its header once;
+ *	  Image::read() re-opens the file and re-reads the header for every frame
+ *	- for TIFF, the chain of image directories is walked once, and the file
+ *	  offset of the directory of every frame is remembered, so that a frame is
+ *	  decoded without scanning the directories of all frames before it
+ *	- for MRC, the frames are read with pread() at their offsets from a single
+ *	  file descriptor
+ *	- other formats are read frame by frame with Image::read()
+ *	- readFrame() may be called from several threads at the same time: TIFF
+ *	  frames are decoded through a pool of file handles, one per thread
+ *	- startReading() decodes a list of frames on its own threads, and
+ *	  waitForFrame() returns as soon as a frame has been read, so that
+ *	  processing of the first frames can start before the whole movie is in memory
+ *	- the frames are returned as in Image::read(..., is_2D = true); TIFF frames
+ *	  are flipped along Y, as in readTIFF()
+ *	- frames can also be read as PackedFrame, which keeps the pixel values in
+ *	  the data type of the file
+ */
+class MovieReader
+{
+public:
+
+	MovieReader();
+	~MovieReader();
+
+	// Open the movie and read its header
+	void open(const FileName &fn_movie);
+
+	// Stop reading and close all files
+	void close();
+
+	int getWidth()
+	{
+		return width;
+	}
+
+	int getHeight()
+	{
+		return height;
+	}
+
+	int getNumberOfFrames()
+	{
+		return nr_frames;
+	}
+
+	// Read frame iframe (counting from 0) into img (resized to getHeight() x getWidth())
+	void readFrame(int iframe, MultidimArray<float> &img);
+
+	// Read frame iframe without converting its pixel values to float
+	void readFrame(int iframe, PackedFrame &frame);
+
+	// Read frames[i] into *imgs[i] on nr_threads threads of their own, in the order of the list
+	// The arrays must not be used until waitForFrame(i) has returned
+	void startReading(const std::vector<int> &frames, const std::vector<MultidimArray<float>*> &imgs, int nr_threads);
+
+	// As above, but keep the frames in the data type of the file
+	void startReading(const std::vector<int> &frames, const std::vector<PackedFrame*> &packed_frames, int nr_threads);
+
+	// Wait until frames[i] of the last call to startReading() has been read
+	void waitForFrame(int i);
+
+	// Wait until all frames have been read and stop the threads
+	void finishReading();
+
+private:
+
+	enum MovieFormat
+	{
+		MOVIE_TIFF,
+		MOVIE_MRC,
+		MOVIE_OTHER
+	};
+
+	// Not copyable
+	MovieReader(const MovieReader&);
+	MovieReader& operator=(const MovieReader&);
+
+	void readTIFFFrame(int iframe, PackedFrame &frame);
+	void readMRCFrame(int iframe, PackedFrame &frame);
+
+	void startThreads(const std::vector<int> &frames, int nr_threads);
+
+	// Stop the reader threads (mutex must not be locked)
+	void joinThreads();
+
+	static void* threadMain(void *data);
+	void readFrames();
+
+	FileName fn_movie, fn_file;
+	MovieFormat format;
+	int width, height, nr_frames;
+	DataType datatype;
+
+	// Header of the movie, also used to convert (and swap) the pixel values
+	Image<float> Ihead;
+
+	// MRC: file descriptor shared by all threads
+	int fd;
+
+	// TIFF: file offsets of the image directories of all frames, and handles that are not in use
+#ifdef HAVE_TIFF
+	std::vector<toff_t> tiff_dir_offsets;
+	std::vector<TIFF*> free_tiff_handles;
+#endif
+
+	pthread_mutex_t mutex;
+
+	// Signalled when a frame has been read
+	pthread_cond_t ready_cond;
+
+	// Frames of the last call to startReading()
+	std::vector<pthread_t> threads;
+	std::vector<int> frames;
+	std::vector<MultidimArray<float>*> imgs;
+	std::vector<PackedFrame*> packed_frames;
+	std::vector<char> is_read;
+	int nr_started;
+	bool do_stop;
+
+	// First error raised by a reader thread, rethrown by waitForFrame() and finishReading()
+	RelionError *error;
+};
+
+#endif
@@ -282,6 +282,135 @@ int MpiNode::relion_MPI_Bcast(void *buffer, long int count, MPI_Datatype datatyp
 	return result;
 }
 
+// Start the transfer of segment k of an exchange with another rank (see below)
+static void postSegment(MpiNode &node, std::ptrdiff_t k, RFLOAT *send, std::ptrdiff_t n_send, RFLOAT *recv, std::ptrdiff_t n_recv,
+		int partner, int tag, MPI_Comm comm, std::ptrdiff_t segment_size, MPI_Request *requests)
+{
+	std::ptrdiff_t first = k * segment_size;
+	requests[0] = requests[1] = MPI_REQUEST_NULL;
+	if (first < n_recv)
+	{
+		int result = MPI_Irecv(recv, (int)XMIPP_MIN(segment_size, n_recv - first), MY_MPI_DOUBLE, partner, tag, comm, &requests[1]);
+		if (result != MPI_SUCCESS)
+			node.report_MPI_ERROR(result);
+	}
+	if (first < n_send)
+	{
+		int result = MPI_Isend(send + first, (int)XMIPP_MIN(segment_size, n_send - first), MY_MPI_DOUBLE, partner, tag, comm, &requests[0]);
+		if (result != MPI_SUCCESS)
+			node.report_MPI_ERROR(result);
+	}
+}
+
+// Send n_send values to partner while receiving n_recv values from it, segment by segment.
+// With do_add, the received values are added to recv (while the next segment is under way), otherwise they overwrite it.
+static void exchangeSegments(MpiNode &node, RFLOAT *send, std::ptrdiff_t n_send, RFLOAT *recv, std::ptrdiff_t n_recv, bool do_add,
+		int partner, int tag, MPI_Comm comm, std::ptrdiff_t segment_size, std::vector<RFLOAT> &buffer)
+{
+	std::ptrdiff_t nr_segments = (XMIPP_MAX(n_send, n_recv) + segment_size - 1) / segment_size;
+	if (nr_segments == 0)
+		return;
+	if (do_add && buffer.size() < 2 * segment_size)
+		buffer.resize(2 * segment_size);
+
+	MPI_Request requests[4];
+	MPI_Status statuses[2];
+	postSegment(node, 0, send, n_send, (do_add) ? &buffer[0] : recv, n_recv, partner, tag, comm, segment_size, requests);
+	for (std::ptrdiff_t k = 0; k < nr_segments; k++)
+	{
+		int slot = k % 2;
+		int result = MPI_Waitall(2, requests + 2 * slot, statuses);
+		if (result != MPI_SUCCESS)
+			node.report_MPI_ERROR(result);
+
+		if (k + 1 < nr_segments)
+		{
+			int next = (k + 1) % 2;
+			RFLOAT *next_recv = (do_add) ? &buffer[next * segment_size] : recv + (k + 1) * segment_size;
+			postSegment(node, k + 1, send, n_send, next_recv, n_recv, partner, tag, comm, segment_size, requests + 2 * next);
+		}
+
+		std::ptrdiff_t first = k * segment_size;
+		if (do_add && first < n_recv)
+		{
+			std::ptrdiff_t n = XMIPP_MIN(segment_size, n_recv - first);
+			RFLOAT *segment = &buffer[slot * segment_size];
+			for (std::ptrdiff_t i = 0; i < n; i++)
+				recv[first + i] += segment[i];
+		}
+	}
+}
+
+void MpiNode::relion_MPI_Allreduce_sum(RFLOAT *buf, std::ptrdiff_t count, const std::vector<int> &ranks, int tag, MPI_Comm comm,
+		std::ptrdiff_t segment_size)
+{
+	int nr_ranks = ranks.size();
+	int rank_in_comm;
+	MPI_Comm_rank(comm, &rank_in_comm);
+	int me = -1;
+	for (int i = 0; i < nr_ranks; i++)
+		if (ranks[i] == rank_in_comm)
+			me = i;
+	if (me < 0)
+		REPORT_ERROR("MpiNode::relion_MPI_Allreduce_sum BUG: this rank is not in the list of ranks");
+	if (nr_ranks < 2 || count == 0)
+		return;
+
+	std::vector<RFLOAT> buffer;
+
+	// The ranks beyond the largest power of two pass their sums to a partner, and get the result back from it at the end
+	int nr_pow2 = 1;
+	while (2 * nr_pow2 <= nr_ranks)
+		nr_pow2 *= 2;
+	int nr_extra = nr_ranks - nr_pow2;
+	if (me >= nr_pow2)
+	{
+		exchangeSegments(*this, buf, count, NULL, 0, false, ranks[me - nr_pow2], tag, comm, segment_size, buffer);
+		exchangeSegments(*this, NULL, 0, buf, count, false, ranks[me - nr_pow2], tag, comm, segment_size, buffer);
+		return;
+	}
+	if (me < nr_extra)
+		exchangeSegments(*this, NULL, 0, buf, count, true, ranks[me + nr_pow2], tag, comm, segment_size, buffer);
+
+	// Recursive halving: in every step, give half of my block to a partner and add its half of the other part to mine,
+	// until each rank holds the total sum for 1/nr_pow2 of the values
+	std::vector<std::ptrdiff_t> block_start, block_end;
+	std::ptrdiff_t start = 0, end = count;
+	for (int mask = nr_pow2 / 2; mask > 0; mask /= 2)
+	{
+		std::ptrdiff_t mid = start + (end - start) / 2;
+		block_start.push_back(start);
+		block_end.push_back(end);
+		if (me & mask)
+		{
+			exchangeSegments(*this, buf + start, mid - start, buf + mid, end - mid, true, ranks[me ^ mask], tag, comm, segment_size, buffer);
+			start = mid;
+		}
+		else
+		{
+			exchangeSegments(*this, buf + mid, end - mid, buf + start, mid - start, true, ranks[me ^ mask], tag, comm, segment_size, buffer);
+			end = mid;
+		}
+	}
+
+	// Recursive doubling: swap the summed blocks in the reverse order, until all ranks have all sums
+	for (int mask = 1; mask < nr_pow2; mask *= 2)
+	{
+		std::ptrdiff_t parent_start = block_start.back();
+		std::ptrdiff_t parent_end = block_end.back();
+		block_start.pop_back();
+		block_end.pop_back();
+		std::ptrdiff_t other_start = (me & mask) ? parent_start : end;
+		std::ptrdiff_t other_end = (me & mask) ? start : parent_end;
+		exchangeSegments(*this, buf + start, end - start, buf + other_start, other_end - other_start, false, ranks[me ^ mask], tag, comm, segment_size, buffer);
+		start = parent_start;
+		end = parent_end;
+	}
+
+	if (me < nr_extra)
+		exchangeSegments(*this, buf, count, NULL, 0, false, ranks[me + nr_pow2], tag, comm, segment_size, buffer);
+}
+
 void MpiNode::report_MPI_ERROR(int error_code)
 {
 	char error_string[200];
@@ -49,6 +49,7 @@
 #include <cstdlib>
 #include <cstdio>
 #include <unistd.h>
+#include <vector>
 #include "src/error.h"
 #include "src/macros.h"
 
@@ -100,6 +101,16 @@ public:
 
 	int relion_MPI_Bcast(void *buffer, long int count, MPI_Datatype datatype, int root, MPI_Comm comm);
 
+	/* Sum the count values in buf over the ranks (in comm) in the list, and leave the sum in buf on all of them.
+	 * All ranks in the list call this with the same list; other ranks do not call it.
+	 * This takes log2(ranks.size()) steps of recursive halving followed by as many of recursive doubling,
+	 * and sends every value only about twice. Messages are sent in segments of segment_size values,
+	 * so that adding up one segment overlaps with the transfer of the next one.
+	 * All ranks end up with exactly the same sum.
+	 */
+	void relion_MPI_Allreduce_sum(RFLOAT *buf, std::ptrdiff_t count, const std::vector<int> &ranks, int tag, MPI_Comm comm,
+			std::ptrdiff_t segment_size = 1048576);
+
 	/* Better error handling of MPI error messages */
 	void report_MPI_ERROR(int error_code);
 
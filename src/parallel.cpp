@@ -267,6 +267,14 @@ bool ParallelTaskDistributor::getTasks(size_t &first, size_t &last)
     return result;
 }
 
+bool ParallelTaskDistributor::allTasksAssigned()
+{
+    lock();
+    bool result = (assignedTasks >= numberOfTasks);
+    unlock();
+    return result;
+}
+
 bool ParallelTaskDistributor::setAssignedTasks(size_t tasks)
 {
     if (tasks < 0 || tasks >= numberOfTasks)
@@ -342,6 +342,9 @@ public:
      *  @endcode
      */
     bool getTasks(size_t &first, size_t &last); // False = no more jobs, true = more jobs
+
+    /** Whether all tasks have been handed out (the workers may still be busy with the last ones) */
+    bool allTasksAssigned();
     /* This function set the number of completed tasks.
      * Usually this not need to be called. Its more useful
      * for restarting work, when usually the master detect
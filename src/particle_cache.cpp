@@ -0,0 +1,471 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <sys/time.h>
+#include <cstring>
+#include <cmath>
+#include "src/particle_cache.h"
+#include "src/float16.h"
+#include "src/error.h"
+
+// Compressed images are stored in blocks of this size (larger images get a block of their own)
+#define PARTICLE_CACHE_BLOCK_SIZE (64 << 20)
+
+// First byte of lossless and bounded images: is the rest LZ-compressed or not?
+#define PARTICLE_CACHE_RAW 0
+#define PARTICLE_CACHE_LZ 1
+
+	static double particleCacheWallTime()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + 1e-6 * tv.tv_usec;
+	}
+
+	static inline unsigned int readUint32(const unsigned char *p)
+	{
+		unsigned int u;
+		memcpy(&u, p, 4);
+		return u;
+	}
+
+	static void lzWriteLength(std::vector<unsigned char> &out, size_t length)
+	{
+		for (; length >= 255; length -= 255)
+			out.push_back(255);
+		out.push_back((unsigned char)length);
+	}
+
+	// Byte-oriented LZ77 in the style of LZ4: each sequence is a token (4 bits literal length, 4 bits match length),
+	// the literals, and a 16-bit offset to the match (the last sequence has no match)
+	static void lzCompress(const unsigned char *in, size_t nr_in, std::vector<unsigned char> &out)
+	{
+		const int hash_bits = 14;
+		const size_t min_match = 4;
+		std::vector<long int> table(1 << hash_bits, -1);
+
+		size_t i = 0, anchor = 0;
+		while (nr_in >= min_match && i <= nr_in - min_match)
+		{
+			unsigned int sequence = readUint32(in + i);
+			unsigned int hash = (sequence * 2654435761u) >> (32 - hash_bits);
+			long int candidate = table[hash];
+			table[hash] = i;
+
+			if (candidate < 0 || i - candidate > 65535 || readUint32(in + candidate) != sequence)
+			{
+				i++;
+				continue;
+			}
+
+			size_t match = min_match;
+			while (i + match < nr_in && in[candidate + match] == in[i + match])
+				match++;
+
+			size_t literals = i - anchor;
+			size_t offset = i - candidate;
+			out.push_back((unsigned char)((XMIPP_MIN(literals, 15) << 4) | XMIPP_MIN(match - min_match, 15)));
+			if (literals >= 15)
+				lzWriteLength(out, literals - 15);
+			out.insert(out.end(), in + anchor, in + i);
+			out.push_back(offset & 0xff);
+			out.push_back(offset >> 8);
+			if (match - min_match >= 15)
+				lzWriteLength(out, match - min_match - 15);
+
+			i += match;
+			anchor = i;
+		}
+
+		// Remaining literals
+		size_t literals = nr_in - anchor;
+		out.push_back((unsigned char)(XMIPP_MIN(literals, 15) << 4));
+		if (literals >= 15)
+			lzWriteLength(out, literals - 15);
+		out.insert(out.end(), in + anchor, in + nr_in);
+	}
+
+	static void lzDecompress(const unsigned char *in, size_t nr_in, unsigned char *out, size_t nr_out)
+	{
+		const unsigned char *ip = in, *end = in + nr_in;
+		size_t op = 0;
+
+		while (ip < end)
+		{
+			unsigned char token = *ip++;
+
+			size_t literals = token >> 4;
+			if (literals == 15)
+			{
+				unsigned char b;
+				do
+				{
+					if (ip >= end) REPORT_ERROR("BUG: corrupt data in particle cache");
+					b = *ip++;
+					literals += b;
+				} while (b == 255);
+			}
+			if (literals > end - ip || literals > nr_out - op)
+				REPORT_ERROR("BUG: corrupt data in particle cache");
+			memcpy(out + op, ip, literals);
+			ip += literals;
+			op += literals;
+
+			// The last sequence has no match
+			if (ip >= end)
+				break;
+
+			if (end - ip < 2)
+				REPORT_ERROR("BUG: corrupt data in particle cache");
+			size_t offset = ip[0] | (ip[1] << 8);
+			ip += 2;
+			size_t match = (token & 15) + 4;
+			if ((token & 15) == 15)
+			{
+				unsigned char b;
+				do
+				{
+					if (ip >= end) REPORT_ERROR("BUG: corrupt data in particle cache");
+					b = *ip++;
+					match += b;
+				} while (b == 255);
+			}
+			if (offset == 0 || offset > op || match > nr_out - op)
+				REPORT_ERROR("BUG: corrupt data in particle cache");
+
+			// Matches may overlap with their own output, so copy byte by byte
+			for (size_t j = 0; j < match; j++, op++)
+				out[op] = out[op - offset];
+		}
+
+		if (op != nr_out)
+			REPORT_ERROR("BUG: corrupt data in particle cache");
+	}
+
+	// Store data with a leading byte that says whether it was worth compressing it
+	static void lzCompressOrCopy(const std::vector<unsigned char> &data, std::vector<unsigned char> &out)
+	{
+		out.clear();
+		out.push_back(PARTICLE_CACHE_LZ);
+		lzCompress(&data[0], data.size(), out);
+		if (out.size() > data.size() + 1)
+		{
+			out.clear();
+			out.push_back(PARTICLE_CACHE_RAW);
+			out.insert(out.end(), data.begin(), data.end());
+		}
+	}
+
+	static void lzDecompressOrCopy(const unsigned char *in, size_t nr_in, std::vector<unsigned char> &data, size_t nr_data)
+	{
+		data.resize(nr_data);
+		if (nr_in < 1)
+			REPORT_ERROR("BUG: corrupt data in particle cache");
+		if (in[0] == PARTICLE_CACHE_LZ)
+			lzDecompress(in + 1, nr_in - 1, &data[0], nr_data);
+		else if (nr_in - 1 == nr_data)
+			memcpy(&data[0], in + 1, nr_data);
+		else
+			REPORT_ERROR("BUG: corrupt data in particle cache");
+	}
+
+ParticleCache::ParticleCache(long int nr_particles, Encoding _encoding, double _max_error, double _budget)
+:	encoding(_encoding),
+	max_error(_max_error),
+	budget(_budget),
+	stack_block(0),
+	stack_offset(0),
+	is_full(false),
+	nr_images(0),
+	nr_bytes(0),
+	nr_bytes_uncompressed(0),
+	nr_hits(0),
+	nr_misses(0),
+	decode_time(0.)
+{
+	if (encoding == CACHE_BOUNDED && !(max_error > 0.))
+		REPORT_ERROR("ParticleCache ERROR: the maximum error for bounded compression should be positive");
+
+	Entry empty;
+	empty.block = empty.offset = empty.nr_bytes = 0;
+	empty.xdim = empty.ydim = 0;
+	entries.resize(nr_particles, empty);
+
+	pthread_mutex_init(&mutex, NULL);
+}
+
+ParticleCache::~ParticleCache()
+{
+	pthread_mutex_destroy(&mutex);
+}
+
+ParticleCache::Encoding ParticleCache::encodingFromString(const std::string &name)
+{
+	if (name == "float16")
+		return CACHE_FLOAT16;
+	else if (name == "lossless")
+		return CACHE_LOSSLESS;
+	else if (name == "bounded")
+		return CACHE_BOUNDED;
+	else
+		REPORT_ERROR("ParticleCache ERROR: unknown encoding " + name + ", use float16, lossless or bounded");
+}
+
+bool ParticleCache::startStack()
+{
+	if (is_full)
+		return false;
+
+	stack_images.clear();
+	stack_block = (blocks.size() > 0) ? blocks.size() - 1 : 0;
+	stack_offset = (blocks.size() > 0) ? blocks.back().size() : 0;
+
+	return true;
+}
+
+bool ParticleCache::addImage(long int part_id, const MultidimArray<float> &img)
+{
+	if (is_full)
+		return false;
+
+	if (part_id < 0 || part_id >= entries.size())
+		REPORT_ERROR("BUG: ParticleCache::addImage got an invalid particle id");
+	if (ZSIZE(img) != 1 || NSIZE(img) != 1)
+		REPORT_ERROR("ParticleCache ERROR: only single 2D images can be cached");
+
+	std::vector<unsigned char> data;
+	encode(img, data);
+
+	if (budget >= 0. && nr_bytes + data.size() > budget)
+	{
+		rollBackStack();
+		is_full = true;
+		return false;
+	}
+
+	// Start a new block if this image does not fit in the last one
+	if (blocks.size() == 0 || blocks.back().size() + data.size() > blocks.back().capacity())
+	{
+		blocks.push_back(std::vector<unsigned char>());
+		blocks.back().reserve(XMIPP_MAX(PARTICLE_CACHE_BLOCK_SIZE, data.size()));
+	}
+
+	// Replacing an image leaves the old data unused, but keeps the bookkeeping right
+	Entry &entry = entries[part_id];
+	if (entry.nr_bytes > 0)
+	{
+		nr_images--;
+		nr_bytes -= entry.nr_bytes;
+		nr_bytes_uncompressed -= (size_t)entry.xdim * entry.ydim * sizeof(float);
+	}
+
+	entry.block = blocks.size() - 1;
+	entry.offset = blocks.back().size();
+	entry.nr_bytes = data.size();
+	entry.xdim = XSIZE(img);
+	entry.ydim = YSIZE(img);
+	blocks.back().insert(blocks.back().end(), data.begin(), data.end());
+
+	stack_images.push_back(part_id);
+	nr_images++;
+	nr_bytes += data.size();
+	nr_bytes_uncompressed += MULTIDIM_SIZE(img) * sizeof(float);
+
+	return true;
+}
+
+bool ParticleCache::getImage(long int part_id, MultidimArray<RFLOAT> &img)
+{
+	if (!contains(part_id))
+	{
+		pthread_mutex_lock(&mutex);
+		nr_misses++;
+		pthread_mutex_unlock(&mutex);
+		return false;
+	}
+
+	double t0 = particleCacheWallTime();
+
+	const Entry &entry = entries[part_id];
+	std::vector<float> values;
+	decode(&blocks[entry.block][entry.offset], entry.nr_bytes, (long int)entry.xdim * entry.ydim, values);
+
+	img.resize(entry.ydim, entry.xdim);
+	for (long int n = 0; n < values.size(); n++)
+		DIRECT_MULTIDIM_ELEM(img, n) = values[n];
+	img.setXmippOrigin();
+
+	double t1 = particleCacheWallTime();
+
+	pthread_mutex_lock(&mutex);
+	nr_hits++;
+	decode_time += t1 - t0;
+	pthread_mutex_unlock(&mutex);
+
+	return true;
+}
+
+void ParticleCache::getStatistics(long int &_nr_hits, long int &_nr_misses, double &_decode_time)
+{
+	pthread_mutex_lock(&mutex);
+	_nr_hits = nr_hits;
+	_nr_misses = nr_misses;
+	_decode_time = decode_time;
+	pthread_mutex_unlock(&mutex);
+}
+
+void ParticleCache::resetStatistics()
+{
+	pthread_mutex_lock(&mutex);
+	nr_hits = nr_misses = 0;
+	decode_time = 0.;
+	pthread_mutex_unlock(&mutex);
+}
+
+void ParticleCache::encode(const MultidimArray<float> &img, std::vector<unsigned char> &out) const
+{
+	const long int nr_pixels = MULTIDIM_SIZE(img);
+
+	if (encoding == CACHE_FLOAT16)
+	{
+		out.resize(2 * nr_pixels);
+		for (long int n = 0; n < nr_pixels; n++)
+		{
+			unsigned short h = floatToHalf(DIRECT_MULTIDIM_ELEM(img, n));
+			out[2*n] = h & 0xff;
+			out[2*n+1] = h >> 8;
+		}
+	}
+	else if (encoding == CACHE_LOSSLESS)
+	{
+		// Shuffle the bytes of the floats into 4 planes: the planes with sign and exponent compress well
+		std::vector<unsigned char> planes(4 * nr_pixels);
+		for (long int n = 0; n < nr_pixels; n++)
+		{
+			unsigned char bytes[4];
+			memcpy(bytes, &DIRECT_MULTIDIM_ELEM(img, n), 4);
+			for (int b = 0; b < 4; b++)
+				planes[b * nr_pixels + n] = bytes[b];
+		}
+		lzCompressOrCopy(planes, out);
+	}
+	else
+	{
+		// Quantise with a step of twice the maximum error, and store zigzag-encoded differences as variable-length integers
+		const double step = 2. * max_error;
+		std::vector<unsigned char> deltas;
+		deltas.reserve(nr_pixels);
+		long long previous = 0;
+		for (long int n = 0; n < nr_pixels; n++)
+		{
+			long long current = llround(DIRECT_MULTIDIM_ELEM(img, n) / step);
+			long long delta = current - previous;
+			unsigned long long zigzag = (delta < 0) ? ((unsigned long long)(-(delta + 1)) << 1) | 1 : (unsigned long long)delta << 1;
+			while (zigzag >= 128)
+			{
+				deltas.push_back((unsigned char)(zigzag | 128));
+				zigzag >>= 7;
+			}
+			deltas.push_back((unsigned char)zigzag);
+			previous = current;
+		}
+
+		// Prefix the length of the varint stream, so that decode() knows how much to decompress
+		std::vector<unsigned char> compressed;
+		lzCompressOrCopy(deltas, compressed);
+		unsigned long long nr_deltas = deltas.size();
+		out.resize(8);
+		memcpy(&out[0], &nr_deltas, 8);
+		out.insert(out.end(), compressed.begin(), compressed.end());
+	}
+}
+
+void ParticleCache::decode(const unsigned char *in, size_t nr_in, long int nr_pixels, std::vector<float> &out) const
+{
+	out.resize(nr_pixels);
+
+	if (encoding == CACHE_FLOAT16)
+	{
+		if (nr_in != 2 * nr_pixels)
+			REPORT_ERROR("BUG: corrupt data in particle cache");
+		for (long int n = 0; n < nr_pixels; n++)
+			out[n] = halfToFloat(in[2*n] | (in[2*n+1] << 8));
+	}
+	else if (encoding == CACHE_LOSSLESS)
+	{
+		std::vector<unsigned char> planes;
+		lzDecompressOrCopy(in, nr_in, planes, 4 * nr_pixels);
+		for (long int n = 0; n < nr_pixels; n++)
+		{
+			unsigned char bytes[4];
+			for (int b = 0; b < 4; b++)
+				bytes[b] = planes[b * nr_pixels + n];
+			memcpy(&out[n], bytes, 4);
+		}
+	}
+	else
+	{
+		if (nr_in < 8)
+			REPORT_ERROR("BUG: corrupt data in particle cache");
+		unsigned long long nr_deltas;
+		memcpy(&nr_deltas, in, 8);
+		std::vector<unsigned char> deltas;
+		lzDecompressOrCopy(in + 8, nr_in - 8, deltas, nr_deltas);
+
+		const double step = 2. * max_error;
+		long long current = 0;
+		size_t i = 0;
+		for (long int n = 0; n < nr_pixels; n++)
+		{
+			unsigned long long zigzag = 0;
+			for (int shift = 0; ; shift += 7)
+			{
+				if (i >= deltas.size() || shift > 63)
+					REPORT_ERROR("BUG: corrupt data in particle cache");
+				unsigned char b = deltas[i++];
+				zigzag |= (unsigned long long)(b & 127) << shift;
+				if (b < 128)
+					break;
+			}
+			long long delta = (zigzag & 1) ? -(long long)(zigzag >> 1) - 1 : (long long)(zigzag >> 1);
+			current += delta;
+			out[n] = current * step;
+		}
+	}
+}
+
+void ParticleCache::rollBackStack()
+{
+	for (long int i = 0; i < stack_images.size(); i++)
+	{
+		Entry &entry = entries[stack_images[i]];
+		nr_images--;
+		nr_bytes -= entry.nr_bytes;
+		nr_bytes_uncompressed -= (size_t)entry.xdim * entry.ydim * sizeof(float);
+		entry.nr_bytes = 0;
+	}
+	stack_images.clear();
+
+	// Release the data of the stack, blocks that were started for it are freed completely
+	if (blocks.size() > 0)
+	{
+		blocks.resize(stack_block + 1);
+		blocks.back().resize(stack_offset);
+	}
+}
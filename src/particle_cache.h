@@ -0,0 +1,135 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef PARTICLE_CACHE_H
+#define PARTICLE_CACHE_H
+
+#include <pthread.h>
+#include <vector>
+#include <string>
+#include "src/multidim_array.h"
+
+/*	class ParticleCache:
+ *
+ *	- keeps compressed copies of 2D particle images in RAM, as a cheaper
+ *	  alternative to pre-reading all of them as float arrays
+ *	- three encodings:
+ *	    float16:  half-precision floats (2 bytes per pixel)
+ *	    lossless: the bytes of the 32-bit floats are shuffled into planes and LZ-compressed
+ *	    bounded:  values are quantised such that the error never exceeds max_error,
+ *	              and the differences between neighbouring pixels are LZ-compressed
+ *	- images are added one stack at a time: if a stack does not fit in the
+ *	  RAM budget anymore, it is left out completely (together with all stacks
+ *	  after it) and those particles have to be read from disc (or scratch)
+ *	- getImage() decompresses on demand and may be called from several threads
+ */
+class ParticleCache
+{
+public:
+
+	enum Encoding {CACHE_FLOAT16, CACHE_LOSSLESS, CACHE_BOUNDED};
+
+	// Budget in bytes (negative means unlimited), max_error is only used for CACHE_BOUNDED
+	ParticleCache(long int nr_particles, Encoding encoding, double max_error, double budget);
+	~ParticleCache();
+
+	// Parse "float16", "lossless" or "bounded"
+	static Encoding encodingFromString(const std::string &name);
+
+	// Start a new stack, returns false once the budget has been exceeded
+	bool startStack();
+
+	// Add image part_id to the current stack, returns false (and removes the whole stack) if it does not fit
+	bool addImage(long int part_id, const MultidimArray<float> &img);
+
+	bool isFull() const
+	{
+		return is_full;
+	}
+
+	bool contains(long int part_id) const
+	{
+		return part_id >= 0 && part_id < entries.size() && entries[part_id].nr_bytes > 0;
+	}
+
+	// Decompress image part_id into img (with its origin in the centre), returns false if it is not in the cache
+	bool getImage(long int part_id, MultidimArray<RFLOAT> &img);
+
+	long int getNrImages() const
+	{
+		return nr_images;
+	}
+
+	// Number of bytes of compressed data, and of the same images as 32-bit floats
+	size_t getNrBytes() const
+	{
+		return nr_bytes;
+	}
+
+	size_t getNrBytesUncompressed() const
+	{
+		return nr_bytes_uncompressed;
+	}
+
+	// Number of calls to getImage() that found (hits) or did not find (misses) the image,
+	// and the time (in seconds, summed over all threads) spent decoding
+	void getStatistics(long int &nr_hits, long int &nr_misses, double &decode_time);
+	void resetStatistics();
+
+private:
+
+	struct Entry
+	{
+		size_t block, offset, nr_bytes;
+		int xdim, ydim;
+	};
+
+	// Not copyable
+	ParticleCache(const ParticleCache&);
+	ParticleCache& operator=(const ParticleCache&);
+
+	void encode(const MultidimArray<float> &img, std::vector<unsigned char> &out) const;
+	void decode(const unsigned char *in, size_t nr_in, long int nr_pixels, std::vector<float> &out) const;
+
+	// Remove all images of the current stack
+	void rollBackStack();
+
+	Encoding encoding;
+	double max_error;
+	double budget;
+
+	std::vector<Entry> entries;
+
+	// Compressed data, in large blocks that are never reallocated
+	std::vector<std::vector<unsigned char> > blocks;
+
+	// Images in the current stack, and where it started
+	std::vector<long int> stack_images;
+	size_t stack_block, stack_offset;
+
+	bool is_full;
+	long int nr_images;
+	size_t nr_bytes, nr_bytes_uncompressed;
+
+	pthread_mutex_t mutex;
+	long int nr_hits, nr_misses;
+	double decode_time;
+};
+
+#endif
@@ -0,0 +1,300 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <sys/time.h>
+#include "src/particle_prefetcher.h"
+#include "src/image.h"
+#include "src/profiler.h"
+
+	static double prefetcherWallTime()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + 1e-6 * tv.tv_usec;
+	}
+
+ParticlePrefetcher::ParticlePrefetcher(int nr_threads, int _queue_depth)
+:	queue_depth(XMIPP_MAX(1, _queue_depth)),
+	do_stop(false),
+	error(NULL),
+	wait_time(0.),
+	read_time(0.),
+	nr_images_read(0)
+{
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&work_cond, NULL);
+	pthread_cond_init(&ready_cond, NULL);
+
+	threads.resize(XMIPP_MAX(1, nr_threads));
+	for (int i = 0; i < threads.size(); i++)
+	{
+		if (pthread_create(&threads[i], NULL, threadMain, (void*)this))
+			REPORT_ERROR("ParticlePrefetcher ERROR: cannot create reader thread");
+	}
+}
+
+ParticlePrefetcher::~ParticlePrefetcher()
+{
+	pthread_mutex_lock(&mutex);
+	do_stop = true;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&mutex);
+
+	for (int i = 0; i < threads.size(); i++)
+		pthread_join(threads[i], NULL);
+
+	for (int i = 0; i < batches.size(); i++)
+		delete batches[i];
+
+	delete error;
+
+	pthread_cond_destroy(&ready_cond);
+	pthread_cond_destroy(&work_cond);
+	pthread_mutex_destroy(&mutex);
+}
+
+bool ParticlePrefetcher::isFull()
+{
+	pthread_mutex_lock(&mutex);
+	bool is_full = (batches.size() >= queue_depth);
+	pthread_mutex_unlock(&mutex);
+
+	return is_full;
+}
+
+void ParticlePrefetcher::addBatch(long int first_ori_particle, long int last_ori_particle, const std::vector<FileName> &fn_imgs)
+{
+	Batch *batch = new Batch();
+	batch->first_ori_particle = first_ori_particle;
+	batch->last_ori_particle = last_ori_particle;
+	batch->fn_imgs = fn_imgs;
+	batch->imgs.resize(fn_imgs.size());
+	batch->is_read.resize(fn_imgs.size(), 0);
+	batch->nr_started = 0;
+	batch->nr_busy = 0;
+
+	pthread_mutex_lock(&mutex);
+	batches.push_back(batch);
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&mutex);
+}
+
+bool ParticlePrefetcher::hasBatch(long int first_ori_particle, long int last_ori_particle)
+{
+	pthread_mutex_lock(&mutex);
+	bool has_batch = batches.size() > 0
+			&& batches.front()->first_ori_particle == first_ori_particle
+			&& batches.front()->last_ori_particle == last_ori_particle;
+	pthread_mutex_unlock(&mutex);
+
+	return has_batch;
+}
+
+const MultidimArray<RFLOAT>& ParticlePrefetcher::getImage(long int i)
+{
+	pthread_mutex_lock(&mutex);
+
+	if (batches.size() == 0 || i < 0 || i >= batches.front()->imgs.size())
+	{
+		pthread_mutex_unlock(&mutex);
+		REPORT_ERROR("BUG: ParticlePrefetcher::getImage requested an image that was not queued");
+	}
+
+	Batch *batch = batches.front();
+	if (!batch->is_read[i] && error == NULL)
+	{
+		double t0 = prefetcherWallTime();
+		while (!batch->is_read[i] && error == NULL)
+			pthread_cond_wait(&ready_cond, &mutex);
+		wait_time += prefetcherWallTime() - t0;
+	}
+
+	if (error != NULL)
+	{
+		RelionError XE(*error);
+		pthread_mutex_unlock(&mutex);
+		throw XE;
+	}
+
+	pthread_mutex_unlock(&mutex);
+
+	return batch->imgs[i];
+}
+
+void ParticlePrefetcher::popBatch()
+{
+	pthread_mutex_lock(&mutex);
+	if (batches.size() > 0)
+		discardOldestBatch();
+	pthread_mutex_unlock(&mutex);
+}
+
+void ParticlePrefetcher::clear()
+{
+	pthread_mutex_lock(&mutex);
+	while (batches.size() > 0)
+		discardOldestBatch();
+
+	// Start afresh after an error
+	delete error;
+	error = NULL;
+	pthread_mutex_unlock(&mutex);
+}
+
+double ParticlePrefetcher::getWaitTime()
+{
+	pthread_mutex_lock(&mutex);
+	double result = wait_time;
+	pthread_mutex_unlock(&mutex);
+
+	return result;
+}
+
+double ParticlePrefetcher::getReadTime()
+{
+	pthread_mutex_lock(&mutex);
+	double result = read_time;
+	pthread_mutex_unlock(&mutex);
+
+	return result;
+}
+
+long int ParticlePrefetcher::getNrImagesRead()
+{
+	pthread_mutex_lock(&mutex);
+	long int result = nr_images_read;
+	pthread_mutex_unlock(&mutex);
+
+	return result;
+}
+
+void ParticlePrefetcher::resetStatistics()
+{
+	pthread_mutex_lock(&mutex);
+	wait_time = read_time = 0.;
+	nr_images_read = 0;
+	pthread_mutex_unlock(&mutex);
+}
+
+void* ParticlePrefetcher::threadMain(void *data)
+{
+	((ParticlePrefetcher*)data)->readImages();
+	return NULL;
+}
+
+void ParticlePrefetcher::readImages()
+{
+	// Every reader thread keeps its own stack open, and only re-opens it when the next image is in another stack
+	fImageHandler hFile;
+	FileName fn_open_stack = "";
+
+	pthread_mutex_lock(&mutex);
+
+	while (true)
+	{
+		// Find the oldest batch with images that have not been handed out yet
+		Batch *batch = NULL;
+		for (int b = 0; b < batches.size(); b++)
+		{
+			if (batches[b]->nr_started < batches[b]->fn_imgs.size())
+			{
+				batch = batches[b];
+				break;
+			}
+		}
+
+		if (batch == NULL)
+		{
+			if (do_stop)
+				break;
+			pthread_cond_wait(&work_cond, &mutex);
+			continue;
+		}
+
+		long int i = batch->nr_started++;
+
+		// Images without a name are not needed (e.g. because they are in the particle cache)
+		if (batch->fn_imgs[i] == "")
+		{
+			batch->is_read[i] = 1;
+			pthread_cond_broadcast(&ready_cond);
+			continue;
+		}
+
+		batch->nr_busy++;
+		FileName fn_img = batch->fn_imgs[i];
+		pthread_mutex_unlock(&mutex);
+
+		double t0 = prefetcherWallTime();
+		long long int profile_start = Profiler::now();
+		RelionError *my_error = NULL;
+		try
+		{
+			long int dump;
+			FileName fn_stack;
+			fn_img.decompose(dump, fn_stack);
+			if (fn_stack != fn_open_stack)
+			{
+				hFile.openFile(fn_stack, WRITE_READONLY);
+				fn_open_stack = fn_stack;
+			}
+
+			Image<RFLOAT> img;
+			img.readFromOpenFile(fn_img, hFile, -1, false);
+			img().setXmippOrigin();
+			batch->imgs[i] = img();
+		}
+		catch (RelionError XE)
+		{
+			my_error = new RelionError(XE.msg, XE.file, XE.line);
+			fn_open_stack = "";
+		}
+		double t1 = prefetcherWallTime();
+		Profiler::record(PROF_READ_IMAGES, profile_start, Profiler::now());
+
+		pthread_mutex_lock(&mutex);
+		batch->is_read[i] = 1;
+		batch->nr_busy--;
+		read_time += t1 - t0;
+		nr_images_read++;
+		if (my_error != NULL)
+		{
+			if (error == NULL)
+				error = my_error;
+			else
+				delete my_error;
+		}
+		pthread_cond_broadcast(&ready_cond);
+	}
+
+	pthread_mutex_unlock(&mutex);
+}
+
+void ParticlePrefetcher::discardOldestBatch()
+{
+	Batch *batch = batches.front();
+
+	// Do not hand out any more images of this batch, and let the reads in progress finish
+	batch->nr_started = batch->fn_imgs.size();
+	while (batch->nr_busy > 0)
+		pthread_cond_wait(&ready_cond, &mutex);
+
+	batches.pop_front();
+	delete batch;
+}
@@ -0,0 +1,122 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef PARTICLE_PREFETCHER_H
+#define PARTICLE_PREFETCHER_H
+
+#include <pthread.h>
+#include <deque>
+#include <vector>
+#include "src/multidim_array.h"
+#include "src/filename.h"
+#include "src/error.h"
+
+/*	class ParticlePrefetcher:
+ *
+ *	- reads particle images from disc on its own threads, so that the
+ *	  expectation step does not have to wait for I/O
+ *	- images are queued in batches (one batch per pool of original particles),
+ *	  at most queue_depth batches are kept in memory
+ *	- batches are consumed in the order in which they were added: getImage()
+ *	  returns an image of the oldest batch as soon as it has been read, so that
+ *	  processing can start before the whole batch is in memory
+ *	- getImage() may be called from several threads at the same time
+ */
+class ParticlePrefetcher
+{
+public:
+
+	ParticlePrefetcher(int nr_threads, int queue_depth);
+	~ParticlePrefetcher();
+
+	// Can another batch be added without exceeding the queue depth?
+	bool isFull();
+
+	// Queue the images of original particles first_ori_particle..last_ori_particle,
+	// in the order in which they will be requested (images with an empty name are skipped)
+	void addBatch(long int first_ori_particle, long int last_ori_particle, const std::vector<FileName> &fn_imgs);
+
+	// Is the oldest batch the one for first_ori_particle..last_ori_particle?
+	bool hasBatch(long int first_ori_particle, long int last_ori_particle);
+
+	// Image i of the oldest batch, waits until it has been read
+	// The reference stays valid until popBatch() is called
+	const MultidimArray<RFLOAT>& getImage(long int i);
+
+	// Discard the oldest batch
+	void popBatch();
+
+	// Discard all batches
+	void clear();
+
+	// Time (in seconds, summed over all calling threads) spent in getImage() waiting for images
+	double getWaitTime();
+
+	// Time (in seconds, summed over all reader threads) spent reading images
+	double getReadTime();
+
+	// Number of images read
+	long int getNrImagesRead();
+
+	void resetStatistics();
+
+private:
+
+	struct Batch
+	{
+		long int first_ori_particle, last_ori_particle;
+		std::vector<FileName> fn_imgs;
+		std::vector<MultidimArray<RFLOAT> > imgs;
+		std::vector<char> is_read;
+
+		// Number of images handed to reader threads, and number being read right now
+		long int nr_started, nr_busy;
+	};
+
+	// Not copyable
+	ParticlePrefetcher(const ParticlePrefetcher&);
+	ParticlePrefetcher& operator=(const ParticlePrefetcher&);
+
+	static void* threadMain(void *data);
+	void readImages();
+
+	// Wait until no reader thread works on the oldest batch anymore and delete it (mutex must be locked)
+	void discardOldestBatch();
+
+	std::vector<pthread_t> threads;
+	pthread_mutex_t mutex;
+
+	// Signalled when there is new work for the readers, or when they should stop
+	pthread_cond_t work_cond;
+
+	// Signalled when an image has been read
+	pthread_cond_t ready_cond;
+
+	std::deque<Batch*> batches;
+	int queue_depth;
+	bool do_stop;
+
+	// First error raised by a reader thread, rethrown by getImage()
+	RelionError *error;
+
+	double wait_time, read_time;
+	long int nr_images_read;
+};
+
+#endif
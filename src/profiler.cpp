@@ -0,0 +1,303 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <pthread.h>
+#include <time.h>
+#include <cstdio>
+#include <vector>
+#include "src/profiler.h"
+#include "src/error.h"
+
+// Names of the regions in the output, and whether each call is written to the trace
+static const struct
+{
+	const char *name;
+	bool do_trace;
+} profile_regions[PROF_NR_REGIONS] =
+{
+	{"expectation", true},
+	{"expectation_setup", true},
+	{"expectation_some_particles", true},
+	{"expectation_one_particle", true},
+	{"get_fourier_transforms", true},
+	{"precalculate_shifted_images", true},
+	{"get_squared_differences", true},
+	{"convert_to_weights", true},
+	{"store_weighted_sums", true},
+	{"reduce_backprojectors", true},
+	{"mpi_wait", true},
+	{"combine_weighted_sums", true},
+	{"maximization", true},
+	{"reconstruct", true},
+	{"read_images", true},
+	{"write_output", true},
+	{"fft", false}
+};
+
+struct ProfileEvent
+{
+	int region;
+	long long int t_start, t_end;
+};
+
+struct ProfileThreadData
+{
+	int thread_nr;
+
+	// Locked by the owning thread in record(), and by nextIteration() when it collects the counters
+	pthread_mutex_t mutex;
+	long long int total_ns[PROF_NR_REGIONS];
+	long int count[PROF_NR_REGIONS];
+	std::vector<ProfileEvent> events;
+};
+
+bool Profiler::is_active = false;
+
+static pthread_mutex_t profiler_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t profiler_key;
+static pthread_once_t profiler_key_once = PTHREAD_ONCE_INIT;
+
+// Counters of all threads (indexed by thread number), and those of threads that have ended
+static std::vector<ProfileThreadData*> profiler_threads, profiler_free_threads;
+
+static FILE *profiler_fh_json = NULL, *profiler_fh_trace = NULL;
+static int profiler_rank = 0, profiler_iter = 0;
+static bool profiler_has_iter = false, profiler_has_events = false;
+static long long int profiler_origin = 0, profiler_iter_start = 0;
+
+static void releaseProfileThreadData(void *data)
+{
+	pthread_mutex_lock(&profiler_mutex);
+	profiler_free_threads.push_back((ProfileThreadData*)data);
+	pthread_mutex_unlock(&profiler_mutex);
+}
+
+static void createProfilerKey()
+{
+	pthread_key_create(&profiler_key, releaseProfileThreadData);
+}
+
+static ProfileThreadData* getProfileThreadData()
+{
+	pthread_once(&profiler_key_once, createProfilerKey);
+	ProfileThreadData *data = (ProfileThreadData*)pthread_getspecific(profiler_key);
+	if (data != NULL)
+		return data;
+
+	pthread_mutex_lock(&profiler_mutex);
+	if (!profiler_free_threads.empty())
+	{
+		data = profiler_free_threads.back();
+		profiler_free_threads.pop_back();
+	}
+	else
+	{
+		data = new ProfileThreadData;
+		data->thread_nr = profiler_threads.size();
+		pthread_mutex_init(&data->mutex, NULL);
+		for (int i = 0; i < PROF_NR_REGIONS; i++)
+		{
+			data->total_ns[i] = 0;
+			data->count[i] = 0;
+		}
+		profiler_threads.push_back(data);
+	}
+	pthread_mutex_unlock(&profiler_mutex);
+
+	pthread_setspecific(profiler_key, data);
+	return data;
+}
+
+static void writeTraceEvent(const char *name, int tid, long long int t_start, long long int t_end, int iter)
+{
+	fprintf(profiler_fh_trace, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"iter\":%d}}",
+			profiler_has_events ? ",\n" : "", name, profiler_rank, tid,
+			1e-3 * (t_start - profiler_origin), 1e-3 * (t_end - t_start), iter);
+	profiler_has_events = true;
+}
+
+// Collect and reset the counters of all threads, and write them as one JSON line
+static void writeProfileIteration(long long int t_end)
+{
+	std::vector<std::vector<long long int> > total_ns(PROF_NR_REGIONS);
+	std::vector<long int> count(PROF_NR_REGIONS, 0);
+
+	pthread_mutex_lock(&profiler_mutex);
+	int nr_threads = profiler_threads.size();
+	for (int ithr = 0; ithr < nr_threads; ithr++)
+	{
+		ProfileThreadData *data = profiler_threads[ithr];
+		pthread_mutex_lock(&data->mutex);
+		for (int i = 0; i < PROF_NR_REGIONS; i++)
+		{
+			total_ns[i].push_back(data->total_ns[i]);
+			count[i] += data->count[i];
+			data->total_ns[i] = 0;
+			data->count[i] = 0;
+		}
+		if (profiler_fh_trace != NULL)
+			for (int i = 0; i < data->events.size(); i++)
+				writeTraceEvent(profile_regions[data->events[i].region].name, ithr,
+						data->events[i].t_start, data->events[i].t_end, profiler_iter);
+		data->events.clear();
+		pthread_mutex_unlock(&data->mutex);
+	}
+	pthread_mutex_unlock(&profiler_mutex);
+
+	if (profiler_fh_trace != NULL)
+	{
+		char name[32];
+		sprintf(name, "iteration %d", profiler_iter);
+		writeTraceEvent(name, 0, profiler_iter_start, t_end, profiler_iter);
+		fflush(profiler_fh_trace);
+	}
+
+	fprintf(profiler_fh_json, "{\"iter\": %d, \"rank\": %d, \"start_sec\": %.6f, \"wall_sec\": %.6f, \"threads\": %d, \"regions\": {",
+			profiler_iter, profiler_rank, 1e-9 * (profiler_iter_start - profiler_origin), 1e-9 * (t_end - profiler_iter_start), nr_threads);
+	bool is_first = true;
+	for (int i = 0; i < PROF_NR_REGIONS; i++)
+	{
+		if (count[i] == 0)
+			continue;
+		long long int sum_ns = 0;
+		for (int ithr = 0; ithr < nr_threads; ithr++)
+			sum_ns += total_ns[i][ithr];
+		fprintf(profiler_fh_json, "%s\"%s\": {\"calls\": %ld, \"total_sec\": %.6f, \"thread_sec\": [",
+				is_first ? "" : ", ", profile_regions[i].name, count[i], 1e-9 * sum_ns);
+		for (int ithr = 0; ithr < nr_threads; ithr++)
+			fprintf(profiler_fh_json, "%s%.6f", ithr > 0 ? ", " : "", 1e-9 * total_ns[i][ithr]);
+		fprintf(profiler_fh_json, "]}");
+		is_first = false;
+	}
+	fprintf(profiler_fh_json, "}}\n");
+	fflush(profiler_fh_json);
+}
+
+void Profiler::start(const std::string &fn_json, const std::string &fn_trace, int rank)
+{
+	if (is_active)
+		stop();
+
+	profiler_fh_json = fopen(fn_json.c_str(), "w");
+	if (profiler_fh_json == NULL)
+		REPORT_ERROR("Profiler::start ERROR: cannot write to file: " + fn_json);
+
+	profiler_has_events = false;
+	if (fn_trace != "")
+	{
+		profiler_fh_trace = fopen(fn_trace.c_str(), "w");
+		if (profiler_fh_trace == NULL)
+			REPORT_ERROR("Profiler::start ERROR: cannot write to file: " + fn_trace);
+		fprintf(profiler_fh_trace, "[{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"rank %d\"}}", rank, rank);
+		profiler_has_events = true;
+	}
+
+	profiler_rank = rank;
+	profiler_origin = now();
+	profiler_has_iter = false;
+
+	// The calling thread becomes thread 0, and counts from before start() are dropped
+	getProfileThreadData();
+	pthread_mutex_lock(&profiler_mutex);
+	for (int ithr = 0; ithr < profiler_threads.size(); ithr++)
+	{
+		ProfileThreadData *data = profiler_threads[ithr];
+		pthread_mutex_lock(&data->mutex);
+		for (int i = 0; i < PROF_NR_REGIONS; i++)
+		{
+			data->total_ns[i] = 0;
+			data->count[i] = 0;
+		}
+		data->events.clear();
+		pthread_mutex_unlock(&data->mutex);
+	}
+	pthread_mutex_unlock(&profiler_mutex);
+
+	is_active = true;
+}
+
+void Profiler::stop()
+{
+	if (!is_active)
+		return;
+
+	if (profiler_has_iter)
+		writeProfileIteration(now());
+	is_active = false;
+
+	fclose(profiler_fh_json);
+	profiler_fh_json = NULL;
+	if (profiler_fh_trace != NULL)
+	{
+		fprintf(profiler_fh_trace, "\n]\n");
+		fclose(profiler_fh_trace);
+		profiler_fh_trace = NULL;
+	}
+}
+
+void Profiler::nextIteration(int iter)
+{
+	if (!is_active)
+		return;
+
+	long long int t = now();
+	if (profiler_has_iter)
+		writeProfileIteration(t);
+	profiler_iter = iter;
+	profiler_iter_start = t;
+	profiler_has_iter = true;
+}
+
+long long int Profiler::now()
+{
+	// Wall-clock time rather than CLOCK_MONOTONIC, so that the traces of MPI ranks on different nodes line up
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (long long int)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+long long int Profiler::getOrigin()
+{
+	return profiler_origin;
+}
+
+void Profiler::setOrigin(long long int origin)
+{
+	profiler_origin = origin;
+}
+
+void Profiler::record(int region, long long int t_start, long long int t_end)
+{
+	if (!is_active)
+		return;
+
+	ProfileThreadData *data = getProfileThreadData();
+	pthread_mutex_lock(&data->mutex);
+	data->total_ns[region] += t_end - t_start;
+	data->count[region]++;
+	if (profiler_fh_trace != NULL && profile_regions[region].do_trace)
+	{
+		ProfileEvent event;
+		event.region = region;
+		event.t_start = t_start;
+		event.t_end = t_end;
+		data->events.push_back(event);
+	}
+	pthread_mutex_unlock(&data->mutex);
+}
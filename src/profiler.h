@@ -0,0 +1,121 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <string>
+
+// The regions of a refinement iteration that are timed
+// (their names in the output are in profiler.cpp)
+enum ProfileRegion
+{
+	PROF_EXPECTATION,
+	PROF_EXP_SETUP,
+	PROF_EXP_SOME_PARTICLES,
+	PROF_EXP_ONE_PARTICLE,
+	PROF_EXP_FOURIER_TRANSFORMS,
+	PROF_EXP_PRECALC_SHIFTS,
+	PROF_EXP_DIFF2,
+	PROF_EXP_WEIGHTS,
+	PROF_EXP_WSUM,
+	PROF_EXP_REDUCE_BACKPROJECTORS,
+	PROF_MPI_WAIT,
+	PROF_COMBINE_WSUMS,
+	PROF_MAXIMIZATION,
+	PROF_RECONSTRUCT,
+	PROF_READ_IMAGES,
+	PROF_WRITE_OUTPUT,
+	PROF_FFT,
+	PROF_NR_REGIONS
+};
+
+/*	class Profiler:
+ *
+ *	- always compiled in: when it has not been started, timing a region costs
+ *	  a single test of a flag
+ *	- every thread adds the time spent in each region (nanoseconds) to its own
+ *	  counters; threads that end hand their counters on to the next new thread,
+ *	  so the thread numbers stay small
+ *	- nextIteration() appends the totals since its previous call as one JSON
+ *	  line: for each region the number of calls, the summed time and the time
+ *	  of each thread, to show the load imbalance between the threads
+ *	- optionally, each region is also written as a complete ("ph":"X") event
+ *	  to a Chrome trace-event file (chrome://tracing, Perfetto), with the MPI
+ *	  rank as process id. Very frequent regions (FFTs) are only counted.
+ *	- timestamps are wall-clock times, relative to an origin that may be set
+ *	  to the same value on all MPI ranks
+ */
+class Profiler
+{
+public:
+
+	// Start profiling, with the output to fn_json (JSON lines) and, if not empty, fn_trace
+	static void start(const std::string &fn_json, const std::string &fn_trace, int rank);
+
+	// Write the last iteration and close the files
+	static void stop();
+
+	// Write the totals of the previous iteration (if any) and start counting for iteration iter
+	// No other thread may be inside a region at the time of the call
+	static void nextIteration(int iter);
+
+	// Nanoseconds since the epoch
+	static long long int now();
+
+	// Start of the time axis of the trace and the JSON lines
+	static long long int getOrigin();
+	static void setOrigin(long long int origin);
+
+	// Add one call of region that ran from t_start to t_end (in ns, from now())
+	static void record(int region, long long int t_start, long long int t_end);
+
+	static bool isActive()
+	{
+		return is_active;
+	}
+
+private:
+
+	static bool is_active;
+};
+
+// Times the region from construction to destruction of the object
+class ProfileScope
+{
+public:
+
+	ProfileScope(int _region):
+		region(_region),
+		t_start(Profiler::isActive() ? Profiler::now() : -1)
+	{}
+
+	~ProfileScope()
+	{
+		if (t_start >= 0)
+			Profiler::record(region, t_start, Profiler::now());
+	}
+
+private:
+
+	int region;
+	long long int t_start;
+};
+
+#endif
@@ -42,6 +42,101 @@
 
 
 
+// Value of an element of the data array, in any precision
+static inline Complex projectorValue(const Complex &val, RFLOAT scale)
+{
+	return val;
+}
+
+static inline Complex projectorValue(const FloatComplex &val, RFLOAT scale)
+{
+	return Complex(val.real, val.imag);
+}
+
+static inline Complex projectorValue(const HalfComplex &val, RFLOAT scale)
+{
+	return Complex(scale * halfToFloat(val.real), scale * halfToFloat(val.imag));
+}
+
+int textToPrecision(const std::string &text)
+{
+	if (text == "double")
+		return PRECISION_RFLOAT;
+	else if (text == "float")
+		return PRECISION_FLOAT;
+	else if (text == "half")
+		return PRECISION_HALF;
+	else
+		REPORT_ERROR("textToPrecision ERROR: unknown precision (should be double, float or half): " + text);
+}
+
+void Projector::setDataPrecision(int precision)
+{
+	if (precision == data_precision)
+		return;
+
+	// First back to RFLOAT
+	if (data_precision == PRECISION_FLOAT)
+	{
+		data.resize(data_float);
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(data_float)
+			DIRECT_MULTIDIM_ELEM(data, n) = Complex(DIRECT_MULTIDIM_ELEM(data_float, n).real, DIRECT_MULTIDIM_ELEM(data_float, n).imag);
+		data_float.clear();
+	}
+	else if (data_precision == PRECISION_HALF)
+	{
+		data.resize(data_half);
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(data_half)
+			DIRECT_MULTIDIM_ELEM(data, n) = projectorValue(DIRECT_MULTIDIM_ELEM(data_half, n), half_scale);
+		data_half.clear();
+	}
+	data_precision = PRECISION_RFLOAT;
+
+	if (precision == PRECISION_FLOAT)
+	{
+		data_float.resize(data);
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(data)
+		{
+			DIRECT_MULTIDIM_ELEM(data_float, n).real = DIRECT_MULTIDIM_ELEM(data, n).real;
+			DIRECT_MULTIDIM_ELEM(data_float, n).imag = DIRECT_MULTIDIM_ELEM(data, n).imag;
+		}
+		data.clear();
+	}
+	else if (precision == PRECISION_HALF)
+	{
+		// Scale the largest value to 2^14: this leaves room for rounding up, and values
+		// down to 4e-9 times the largest one are still normal half-precision numbers
+		RFLOAT max_val = 0.;
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(data)
+			max_val = XMIPP_MAX(max_val, XMIPP_MAX(ABS(DIRECT_MULTIDIM_ELEM(data, n).real), ABS(DIRECT_MULTIDIM_ELEM(data, n).imag)));
+		half_scale = (max_val > 0.) ? max_val / 16384. : 1.;
+
+		data_half.resize(data);
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(data)
+		{
+			DIRECT_MULTIDIM_ELEM(data_half, n).real = floatToHalf(DIRECT_MULTIDIM_ELEM(data, n).real / half_scale);
+			DIRECT_MULTIDIM_ELEM(data_half, n).imag = floatToHalf(DIRECT_MULTIDIM_ELEM(data, n).imag / half_scale);
+		}
+		data.clear();
+	}
+	else if (precision != PRECISION_RFLOAT)
+		REPORT_ERROR("Projector::setDataPrecision ERROR: unknown precision");
+	data_precision = precision;
+}
+
+size_t Projector::getElementSize(int precision)
+{
+	switch (precision)
+	{
+	case PRECISION_FLOAT:
+		return sizeof(FloatComplex);
+	case PRECISION_HALF:
+		return sizeof(HalfComplex);
+	default:
+		return sizeof(Complex);
+	}
+}
+
 void Projector::initialiseData(int current_size)
 {
 	// By default r_max is half ori_size
@@ -53,6 +148,11 @@ void Projector::initialiseData(int current_size)
 	// Never allow r_max beyond Nyquist...
 	r_max = XMIPP_MIN(r_max, ori_size / 2);
 
+	// The new data array is in RFLOAT
+	data_float.clear();
+	data_half.clear();
+	data_precision = PRECISION_RFLOAT;
+
 	// Set pad_size
 	pad_size = 2 * (ROUND(padding_factor * r_max) + 1) + 1;
 
@@ -318,7 +418,8 @@ void Projector::griddingCorrect(MultidimArray<RFLOAT> &vol_in)
 	}
 }
 
-void Projector::project(MultidimArray<Complex > &f2d, Matrix2D<RFLOAT> &A, bool inv)
+template <typename T>
+void Projector::project(const MultidimArray<T> &data, RFLOAT data_scale, MultidimArray<Complex > &f2d, Matrix2D<RFLOAT> &A, bool inv)
 {
 	RFLOAT fx, fy, fz, xp, yp, zp;
 	int x0, x1, y0, y1, z0, z1, y, y2, r2;
@@ -420,14 +521,14 @@ void Projector::project(MultidimArray<Complex > &f2d, Matrix2D<RFLOAT> &A, bool
 				z1 = z0 + 1;
 
 				// Matrix access can be accelerated through pre-calculation of z0*xydim etc.
-				d000 = DIRECT_A3D_ELEM(data, z0, y0, x0);
-				d001 = DIRECT_A3D_ELEM(data, z0, y0, x1);
-				d010 = DIRECT_A3D_ELEM(data, z0, y1, x0);
-				d011 = DIRECT_A3D_ELEM(data, z0, y1, x1);
-				d100 = DIRECT_A3D_ELEM(data, z1, y0, x0);
-				d101 = DIRECT_A3D_ELEM(data, z1, y0, x1);
-				d110 = DIRECT_A3D_ELEM(data, z1, y1, x0);
-				d111 = DIRECT_A3D_ELEM(data, z1, y1, x1);
+				d000 = projectorValue(DIRECT_A3D_ELEM(data, z0, y0, x0), data_scale);
+				d001 = projectorValue(DIRECT_A3D_ELEM(data, z0, y0, x1), data_scale);
+				d010 = projectorValue(DIRECT_A3D_ELEM(data, z0, y1, x0), data_scale);
+				d011 = projectorValue(DIRECT_A3D_ELEM(data, z0, y1, x1), data_scale);
+				d100 = projectorValue(DIRECT_A3D_ELEM(data, z1, y0, x0), data_scale);
+				d101 = projectorValue(DIRECT_A3D_ELEM(data, z1, y0, x1), data_scale);
+				d110 = projectorValue(DIRECT_A3D_ELEM(data, z1, y1, x0), data_scale);
+				d111 = projectorValue(DIRECT_A3D_ELEM(data, z1, y1, x1), data_scale);
 
 				// Set the interpolated value in the 2D output array
 				dx00 = LIN_INTERP(fx, d000, d001);
@@ -449,9 +550,9 @@ void Projector::project(MultidimArray<Complex > &f2d, Matrix2D<RFLOAT> &A, bool
 				y0 = ROUND(yp);
 				z0 = ROUND(zp);
 				if (x0 < 0)
-					DIRECT_A2D_ELEM(f2d, i, x) = conj(A3D_ELEM(data, -z0, -y0, -x0));
+					DIRECT_A2D_ELEM(f2d, i, x) = conj(projectorValue(A3D_ELEM(data, -z0, -y0, -x0), data_scale));
 				else
-					DIRECT_A2D_ELEM(f2d, i, x) = A3D_ELEM(data, z0, y0, x0);
+					DIRECT_A2D_ELEM(f2d, i, x) = projectorValue(A3D_ELEM(data, z0, y0, x0), data_scale);
 
 			} // endif NEAREST_NEIGHBOUR
 			else
@@ -465,7 +566,8 @@ void Projector::project(MultidimArray<Complex > &f2d, Matrix2D<RFLOAT> &A, bool
     std::cerr << "done with project..." << std::endl;
 #endif
 }
-void Projector::project2Dto1D(MultidimArray<Complex > &f1d, Matrix2D<RFLOAT> &A, bool inv)
+template <typename T>
+void Projector::project2Dto1D(const MultidimArray<T> &data, RFLOAT data_scale, MultidimArray<Complex > &f1d, Matrix2D<RFLOAT> &A, bool inv)
 {
 	RFLOAT fx, fy, xp, yp;
 	int x0, x1, y0, y1, y, y2, r2;
@@ -524,10 +626,10 @@ void Projector::project2Dto1D(MultidimArray<Complex > &f1d, Matrix2D<RFLOAT> &A,
 			y1 = y0 + 1;
 
 			// Matrix access can be accelerated through pre-calculation of z0*xydim etc.
-			d00 = DIRECT_A2D_ELEM(data, y0, x0);
-			d01 = DIRECT_A2D_ELEM(data, y0, x1);
-			d10 = DIRECT_A2D_ELEM(data, y1, x0);
-			d11 = DIRECT_A2D_ELEM(data, y1, x1);
+			d00 = projectorValue(DIRECT_A2D_ELEM(data, y0, x0), data_scale);
+			d01 = projectorValue(DIRECT_A2D_ELEM(data, y0, x1), data_scale);
+			d10 = projectorValue(DIRECT_A2D_ELEM(data, y1, x0), data_scale);
+			d11 = projectorValue(DIRECT_A2D_ELEM(data, y1, x1), data_scale);
 
 			// Set the interpolated value in the 2D output array
 			dx0 = LIN_INTERP(fx, d00, d01);
@@ -544,9 +646,9 @@ void Projector::project2Dto1D(MultidimArray<Complex > &f1d, Matrix2D<RFLOAT> &A,
 			x0 = ROUND(xp);
 			y0 = ROUND(yp);
 			if (x0 < 0)
-				DIRECT_A1D_ELEM(f1d, x) = conj(A2D_ELEM(data, -y0, -x0));
+				DIRECT_A1D_ELEM(f1d, x) = conj(projectorValue(A2D_ELEM(data, -y0, -x0), data_scale));
 			else
-				DIRECT_A1D_ELEM(f1d, x) = A2D_ELEM(data, y0, x0);
+				DIRECT_A1D_ELEM(f1d, x) = projectorValue(A2D_ELEM(data, y0, x0), data_scale);
 
 		} // endif NEAREST_NEIGHBOUR
 		else
@@ -557,7 +659,8 @@ void Projector::project2Dto1D(MultidimArray<Complex > &f1d, Matrix2D<RFLOAT> &A,
 
 }
 
-void Projector::rotate2D(MultidimArray<Complex > &f2d, Matrix2D<RFLOAT> &A, bool inv)
+template <typename T>
+void Projector::rotate2D(const MultidimArray<T> &data, RFLOAT data_scale, MultidimArray<Complex > &f2d, Matrix2D<RFLOAT> &A, bool inv)
 {
 	RFLOAT fx, fy, xp, yp;
 	int x0, x1, y0, y1, y, y2, r2;
@@ -644,10 +747,10 @@ void Projector::rotate2D(MultidimArray<Complex > &f2d, Matrix2D<RFLOAT> &A, bool
 				y1 = y0 + 1;
 
 				// Matrix access can be accelerated through pre-calculation of z0*xydim etc.
-				d00 = DIRECT_A2D_ELEM(data, y0, x0);
-				d01 = DIRECT_A2D_ELEM(data, y0, x1);
-				d10 = DIRECT_A2D_ELEM(data, y1, x0);
-				d11 = DIRECT_A2D_ELEM(data, y1, x1);
+				d00 = projectorValue(DIRECT_A2D_ELEM(data, y0, x0), data_scale);
+				d01 = projectorValue(DIRECT_A2D_ELEM(data, y0, x1), data_scale);
+				d10 = projectorValue(DIRECT_A2D_ELEM(data, y1, x0), data_scale);
+				d11 = projectorValue(DIRECT_A2D_ELEM(data, y1, x1), data_scale);
 
 				// Set the interpolated value in the 2D output array
 				dx0 = LIN_INTERP(fx, d00, d01);
@@ -662,9 +765,9 @@ void Projector::rotate2D(MultidimArray<Complex > &f2d, Matrix2D<RFLOAT> &A, bool
 				x0 = ROUND(xp);
 				y0 = ROUND(yp);
 				if (x0 < 0)
-					DIRECT_A2D_ELEM(f2d, i, x) = conj(A2D_ELEM(data, -y0, -x0));
+					DIRECT_A2D_ELEM(f2d, i, x) = conj(projectorValue(A2D_ELEM(data, -y0, -x0), data_scale));
 				else
-					DIRECT_A2D_ELEM(f2d, i, x) = A2D_ELEM(data, y0, x0);
+					DIRECT_A2D_ELEM(f2d, i, x) = projectorValue(A2D_ELEM(data, y0, x0), data_scale);
 			} // endif NEAREST_NEIGHBOUR
 			else
 				REPORT_ERROR("Unrecognized interpolator in Projector::project");
@@ -673,7 +776,8 @@ void Projector::rotate2D(MultidimArray<Complex > &f2d, Matrix2D<RFLOAT> &A, bool
 }
 
 
-void Projector::rotate3D(MultidimArray<Complex > &f3d, Matrix2D<RFLOAT> &A, bool inv)
+template <typename T>
+void Projector::rotate3D(const MultidimArray<T> &data, RFLOAT data_scale, MultidimArray<Complex > &f3d, Matrix2D<RFLOAT> &A, bool inv)
 {
 	RFLOAT fx, fy, fz, xp, yp, zp;
 	int x0, x1, y0, y1, z0, z1, y, z, y2, z2, r2;
@@ -784,14 +888,14 @@ void Projector::rotate3D(MultidimArray<Complex > &f3d, Matrix2D<RFLOAT> &A, bool
 					z1 = z0 + 1;
 
 					// Matrix access can be accelerated through pre-calculation of z0*xydim etc.
-					d000 = DIRECT_A3D_ELEM(data, z0, y0, x0);
-					d001 = DIRECT_A3D_ELEM(data, z0, y0, x1);
-					d010 = DIRECT_A3D_ELEM(data, z0, y1, x0);
-					d011 = DIRECT_A3D_ELEM(data, z0, y1, x1);
-					d100 = DIRECT_A3D_ELEM(data, z1, y0, x0);
-					d101 = DIRECT_A3D_ELEM(data, z1, y0, x1);
-					d110 = DIRECT_A3D_ELEM(data, z1, y1, x0);
-					d111 = DIRECT_A3D_ELEM(data, z1, y1, x1);
+					d000 = projectorValue(DIRECT_A3D_ELEM(data, z0, y0, x0), data_scale);
+					d001 = projectorValue(DIRECT_A3D_ELEM(data, z0, y0, x1), data_scale);
+					d010 = projectorValue(DIRECT_A3D_ELEM(data, z0, y1, x0), data_scale);
+					d011 = projectorValue(DIRECT_A3D_ELEM(data, z0, y1, x1), data_scale);
+					d100 = projectorValue(DIRECT_A3D_ELEM(data, z1, y0, x0), data_scale);
+					d101 = projectorValue(DIRECT_A3D_ELEM(data, z1, y0, x1), data_scale);
+					d110 = projectorValue(DIRECT_A3D_ELEM(data, z1, y1, x0), data_scale);
+					d111 = projectorValue(DIRECT_A3D_ELEM(data, z1, y1, x1), data_scale);
 
 					// Set the interpolated value in the 2D output array
 					// interpolate in x
@@ -817,9 +921,9 @@ void Projector::rotate3D(MultidimArray<Complex > &f3d, Matrix2D<RFLOAT> &A, bool
 					z0 = ROUND(zp);
 
 					if (x0 < 0)
-						DIRECT_A3D_ELEM(f3d, k, i, x) = conj(A3D_ELEM(data, -z0, -y0, -x0));
+						DIRECT_A3D_ELEM(f3d, k, i, x) = conj(projectorValue(A3D_ELEM(data, -z0, -y0, -x0), data_scale));
 					else
-						DIRECT_A3D_ELEM(f3d, k, i, x) = A3D_ELEM(data, z0, y0, x0);
+						DIRECT_A3D_ELEM(f3d, k, i, x) = projectorValue(A3D_ELEM(data, z0, y0, x0), data_scale);
 
 				} // endif NEAREST_NEIGHBOUR
 				else
@@ -829,8 +933,42 @@ void Projector::rotate3D(MultidimArray<Complex > &f3d, Matrix2D<RFLOAT> &A, bool
 	} // endif z-loop
 }
 
+void Projector::project(MultidimArray<Complex > &f2d, Matrix2D<RFLOAT> &A, bool inv)
+{
+	if (data_precision == PRECISION_FLOAT)
+		project(data_float, 1., f2d, A, inv);
+	else if (data_precision == PRECISION_HALF)
+		project(data_half, half_scale, f2d, A, inv);
+	else
+		project(data, 1., f2d, A, inv);
+}
 
+void Projector::project2Dto1D(MultidimArray<Complex > &f1d, Matrix2D<RFLOAT> &A, bool inv)
+{
+	if (data_precision == PRECISION_FLOAT)
+		project2Dto1D(data_float, 1., f1d, A, inv);
+	else if (data_precision == PRECISION_HALF)
+		project2Dto1D(data_half, half_scale, f1d, A, inv);
+	else
+		project2Dto1D(data, 1., f1d, A, inv);
+}
 
+void Projector::rotate2D(MultidimArray<Complex > &f2d, Matrix2D<RFLOAT> &A, bool inv)
+{
+	if (data_precision == PRECISION_FLOAT)
+		rotate2D(data_float, 1., f2d, A, inv);
+	else if (data_precision == PRECISION_HALF)
+		rotate2D(data_half, half_scale, f2d, A, inv);
+	else
+		rotate2D(data, 1., f2d, A, inv);
+}
 
-
-
+void Projector::rotate3D(MultidimArray<Complex > &f3d, Matrix2D<RFLOAT> &A, bool inv)
+{
+	if (data_precision == PRECISION_FLOAT)
+		rotate3D(data_float, 1., f3d, A, inv);
+	else if (data_precision == PRECISION_HALF)
+		rotate3D(data_half, half_scale, f3d, A, inv);
+	else
+		rotate3D(data, 1., f3d, A, inv);
+}
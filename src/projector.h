@@ -23,6 +23,7 @@
 #include "src/fftw.h"
 #include "src/multidim_array.h"
 #include "src/image.h"
+#include "src/float16.h"
 
 #define NEAREST_NEIGHBOUR 0
 #define TRILINEAR 1
@@ -34,6 +35,46 @@
 #define ACT_ON_DATA 0
 #define ACT_ON_WEIGHT 1
 
+// Precision in which the data array is kept (see Projector::setDataPrecision)
+#define PRECISION_RFLOAT 0
+#define PRECISION_FLOAT 1
+#define PRECISION_HALF 2
+
+// Complex values in single precision, for the data array of Projectors and BackProjectors
+struct FloatComplex
+{
+	float real, imag;
+
+	FloatComplex(float _real = 0., float _imag = 0.): real(_real), imag(_imag)
+	{}
+
+	FloatComplex& operator+=(const Complex &op)
+	{
+		real += op.real;
+		imag += op.imag;
+		return *this;
+	}
+
+	FloatComplex& operator+=(const FloatComplex &op)
+	{
+		real += op.real;
+		imag += op.imag;
+		return *this;
+	}
+};
+
+// Complex values in half precision (see float16.h), for the data array of Projectors
+struct HalfComplex
+{
+	unsigned short real, imag;
+
+	HalfComplex(unsigned short _real = 0, unsigned short _imag = 0): real(_real), imag(_imag)
+	{}
+};
+
+// PRECISION_RFLOAT, PRECISION_FLOAT or PRECISION_HALF from "double", "float" or "half"
+int textToPrecision(const std::string &text);
+
 class Projector
 {
 public:
@@ -64,6 +105,15 @@ public:
     // Dimension of the projections (1 or 2 or 3)
     int data_dim;
 
+    // Precision of the data: with PRECISION_FLOAT or PRECISION_HALF data is empty, and the
+    // values are in data_float or data_half (with the same size and origin) instead
+    int data_precision;
+    MultidimArray<FloatComplex> data_float;
+    MultidimArray<HalfComplex> data_half;
+
+    // data_half holds the values divided by this factor, to keep them within the range of half precision
+    RFLOAT half_scale;
+
 public:
 
     /** Empty constructor
@@ -104,6 +154,10 @@ public:
 
     	// Dimension of the projections
     	data_dim = _data_dim;
+
+    	// Keep the data in RFLOAT
+    	data_precision = PRECISION_RFLOAT;
+    	half_scale = 1.;
     }
 
     /** Copy constructor
@@ -139,6 +193,10 @@ public:
         	padding_factor = op.padding_factor;
         	ref_dim = op.ref_dim;
         	data_dim  = op.data_dim;
+        	data_precision = op.data_precision;
+        	data_float = op.data_float;
+        	data_half = op.data_half;
+        	half_scale = op.half_scale;
         }
         return *this;
     }
@@ -162,10 +220,37 @@ public:
     void clear()
     {
     	data.clear();
+    	data_float.clear();
+    	data_half.clear();
+    	data_precision = PRECISION_RFLOAT;
+    	half_scale = 1.;
     	r_max = r_min_nn = interpolator = ref_dim = data_dim = pad_size = 0;
     	padding_factor = 0.;
     }
 
+    /*
+     * Empty the data array (in any precision), but keep its settings
+     */
+    void clearData()
+    {
+    	data.clear();
+    	data_float.clear();
+    	data_half.clear();
+    	data_precision = PRECISION_RFLOAT;
+    }
+
+    /*
+     * Convert the data array to PRECISION_RFLOAT, PRECISION_FLOAT or PRECISION_HALF
+     * In lower precision the projections take less memory, but they are still interpolated in RFLOAT.
+     * The data array itself (e.g. for computeFourierTransformMap) can only be used in PRECISION_RFLOAT.
+     */
+    void setDataPrecision(int precision);
+
+    /*
+     * Number of bytes per element of the data array in the given precision
+     */
+    static size_t getElementSize(int precision);
+
     /*
      * Resize data array to the given size
      */
@@ -257,6 +342,19 @@ public:
 	*/
 	void rotate3D(MultidimArray<Complex > &img_out, Matrix2D<RFLOAT> &A, bool inv);
 
+private:
+
+	/*
+	 * The above, for the data array in any precision (values in data are multiplied by data_scale)
+	 */
+	template <typename T>
+	void project(const MultidimArray<T> &data, RFLOAT data_scale, MultidimArray<Complex > &img_out, Matrix2D<RFLOAT> &A, bool inv);
+	template <typename T>
+	void project2Dto1D(const MultidimArray<T> &data, RFLOAT data_scale, MultidimArray<Complex > &img_out, Matrix2D<RFLOAT> &A, bool inv);
+	template <typename T>
+	void rotate2D(const MultidimArray<T> &data, RFLOAT data_scale, MultidimArray<Complex > &img_out, Matrix2D<RFLOAT> &A, bool inv);
+	template <typename T>
+	void rotate3D(const MultidimArray<T> &data, RFLOAT data_scale, MultidimArray<Complex > &img_out, Matrix2D<RFLOAT> &A, bool inv);
 
 };
 
@@ -80,6 +80,8 @@ void Reconstructor::read(int argc, char **argv)
 	ctf_dim  = textToInteger(parser.getOption("--reconstruct_ctf", "Perform a 3D reconstruction from 2D CTF-images, with the given size in pixels", "-1"));
 	do_reconstruct_ctf2 = parser.checkOption("--ctf2", "Reconstruct CTF^2 and then take the sqrt of that");
 	skip_gridding = parser.checkOption("--skip_gridding", "Skip gridding part of the reconstruction");
+	ooc_dir = parser.getOption("--ooc_dir", "Keep the Fourier-space arrays of a 3D reconstruction in memory-mapped files in this directory, to reconstruct large boxes with less RAM", "");
+	ooc_max_ram = textToFloat(parser.getOption("--ooc_max_ram", "Maximum amount of RAM (in Gb) for the parts of the arrays in --ooc_dir that are processed at a time (with --ooc_dir, the data and weight arrays of the back-projection are kept in --ooc_dir as well)", "1"));
 	fn_debug = parser.getOption("--debug", "Rootname for debug reconstruction files", "");
 	debug_ori_size =  textToInteger(parser.getOption("--debug_ori_size", "Rootname for debug reconstruction files", "1"));
 	debug_size =  textToInteger(parser.getOption("--debug_size", "Rootname for debug reconstruction files", "1"));
@@ -209,6 +211,8 @@ void Reconstructor::readDebugArrays()
 	data_dim = (do_3d_rot) ? 3 : 2;
 
 	backprojector = BackProjector(debug_ori_size, 3, fn_sym, interpolator, padding_factor, r_min_nn, blob_order, blob_radius, blob_alpha, data_dim, skip_gridding);
+	backprojector.ooc_dir = ooc_dir;
+	backprojector.ooc_max_ram = ooc_max_ram;
 
 	backprojector.initialiseDataAndWeight(debug_size);
 	if (verb > 0)
@@ -264,6 +268,11 @@ void Reconstructor::backproject(int rank, int size)
 					padding_factor, r_min_nn, blob_order,
 					blob_radius, blob_alpha, data_dim, skip_gridding);
 	backprojector.initZeros(2 * r_max);
+	backprojector.ooc_dir = ooc_dir;
+	backprojector.ooc_max_ram = ooc_max_ram;
+	// Nothing backprojects concurrently here, so the data and weight arrays can be kept on disc as well
+	if (ooc_dir != "" && ref_dim == 3)
+		backprojector.mapDataAndWeight(data_file, weight_file);
 
 	long int nr_parts = DF.numberOfObjects();
 	long int barstep = XMIPP_MAX(1, nr_parts/(size*120));
@@ -36,7 +36,7 @@ public:
 	// I/O Parser
 	IOParser parser;
 
-	FileName fn_out, fn_sel, fn_img, fn_sym, fn_sub, fn_fsc, fn_debug, fn_noise, image_path;
+	FileName fn_out, fn_sel, fn_img, fn_sym, fn_sub, fn_fsc, fn_debug, fn_noise, image_path, ooc_dir;
 
 	MetaDataTable DF;
 	MlModel model;
@@ -48,7 +48,7 @@ public:
 
 	RFLOAT blob_radius, blob_alpha, angular_error, shift_error, angpix, maxres,
 	       beamtilt_x, beamtilt_y,
-	       helical_rise, helical_twist;
+	       helical_rise, helical_twist, ooc_max_ram;
 
 	bool do_ctf, ctf_phase_flipped, only_flip_phases, intact_ctf_first_peak, ctf_premultiplied,
 	     do_fom_weighting, do_3d_rot, do_reconstruct_ctf, do_beamtilt, cl_beamtilt, do_ewald, skip_weighting, skip_mask, do_debug;
@@ -60,6 +60,9 @@ public:
 	// All backprojectors needed for parallel reconstruction
 	BackProjector backprojector;
 
+	// Memory-mapped files with the data and weight arrays of the backprojector (with --ooc_dir)
+	MappedScratchFile data_file, weight_file;
+
 	// A single projector is needed for parallel reconstruction
 	Projector projector;
 
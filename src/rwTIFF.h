@@ -57,10 +57,10 @@ int readTIFF(TIFF* ftiff, long int img_select, bool readdata=false, bool isStack
     TIFFGetFieldDefaulted(ftiff, TIFFTAG_BITSPERSAMPLE, &bitsPerSample);
     TIFFGetFieldDefaulted(ftiff, TIFFTAG_SAMPLEFORMAT, &sampleFormat);
 
-    // Find the number of frames
-    while (TIFFSetDirectory(ftiff, _nDim) != 0) _nDim++;
-    //  and back to the start
-    TIFFSetDirectory(ftiff, 0);
+    // Find the number of frames.
+    // TIFFNumberOfDirectories walks the chain of directories once, while calling
+    // TIFFSetDirectory for every frame re-reads it from the start each time.
+    _nDim = TIFFNumberOfDirectories(ftiff);
 
 #ifdef DEBUG_TIFF
     printf("TIFF width %d, length %d, nDim %d, sample format %d, bits per sample %d\n", 
@@ -0,0 +1,574 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <algorithm>
+#include <fstream>
+#include <vector>
+#include "src/scratch_cache.h"
+#include "src/error.h"
+#include "src/macros.h"
+
+// Size of the samples of the contents that go into the hash, and of the chunks in which stacks are copied
+#define SCRATCH_CACHE_SAMPLE_SIZE 65536
+#define SCRATCH_CACHE_CHUNK_SIZE (8 * 1024 * 1024)
+
+	static ScratchCache *scratch_cache_instance = NULL;
+	static pthread_once_t scratch_cache_once = PTHREAD_ONCE_INIT;
+
+	static void shutDownScratchCache()
+	{
+		// Do not keep the program from ending: copies in progress are aborted, and left to the next run
+		if (scratch_cache_instance != NULL)
+			scratch_cache_instance->shutDown(true);
+	}
+
+	static void createScratchCache()
+	{
+		char *penv = getenv("RELION_SCRATCH_CACHE");
+		if (penv == NULL || penv[0] == '\0')
+			return;
+
+		double max_Gb = -1.;
+		char *penv_Gb = getenv("RELION_SCRATCH_CACHE_GB");
+		if (penv_Gb != NULL && penv_Gb[0] != '\0')
+			max_Gb = atof(penv_Gb);
+
+		try
+		{
+			scratch_cache_instance = new ScratchCache((std::string)penv, max_Gb);
+			atexit(shutDownScratchCache);
+		}
+		catch (RelionError XE)
+		{
+			// Without a usable cache, stacks are simply read from their original location
+			std::cerr << " WARNING: not using the scratch cache in " << penv << ": " << XE.msg << std::endl;
+			scratch_cache_instance = NULL;
+		}
+	}
+
+	// 64-bit FNV-1a
+	static void hashBytes(unsigned long long &hash, const unsigned char *data, size_t nr_bytes)
+	{
+		for (size_t i = 0; i < nr_bytes; i++)
+		{
+			hash ^= data[i];
+			hash *= 1099511628211ULL;
+		}
+	}
+
+	static bool isLockFree(const FileName &fn_lock)
+	{
+		int fd = open(fn_lock.c_str(), O_RDWR | O_CREAT, 0666);
+		if (fd < 0)
+			return false;
+		bool is_free = (flock(fd, LOCK_EX | LOCK_NB) == 0);
+		close(fd);
+		return is_free;
+	}
+
+ScratchCache* ScratchCache::getInstance()
+{
+	pthread_once(&scratch_cache_once, createScratchCache);
+	return scratch_cache_instance;
+}
+
+FileName ScratchCache::lookup(const FileName &fn_stack)
+{
+	ScratchCache *cache = getInstance();
+	return (cache == NULL) ? fn_stack : cache->lookupStack(fn_stack);
+}
+
+ScratchCache::ScratchCache(const FileName &_dir, double max_Gb)
+:	is_thread_running(false),
+	do_stop(false),
+	do_abort(false)
+{
+	dir = _dir;
+	if (dir[dir.length()-1] != '/')
+		dir += "/";
+	dir_stacks = dir + "stacks/";
+	dir_locks = dir + "locks/";
+
+	// Other users on the same node may share the cache
+	mode_t old_umask = umask(0);
+	mktree(dir_stacks, 0777);
+	mktree(dir_locks, 0777);
+	umask(old_umask);
+	if (access(dir_stacks.c_str(), W_OK) != 0 || access(dir_locks.c_str(), W_OK) != 0)
+		REPORT_ERROR("ScratchCache ERROR: cannot create or write to " + dir);
+
+	if (max_Gb > 0.)
+		max_bytes = max_Gb * 1024. * 1024. * 1024.;
+	else
+	{
+		struct statvfs vfs;
+		if (statvfs(dir.c_str(), &vfs) != 0)
+			REPORT_ERROR("ScratchCache ERROR: cannot determine the free space in " + dir);
+		long int nr_entries;
+		max_bytes = (double)vfs.f_bavail * vfs.f_frsize + getSize(nr_entries) - 10. * 1024. * 1024. * 1024.;
+		if (max_bytes <= 0.)
+			REPORT_ERROR("ScratchCache ERROR: less than 10 Gb of free space in " + dir);
+	}
+
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond, NULL);
+}
+
+ScratchCache::~ScratchCache()
+{
+	shutDown(true);
+
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&mutex);
+}
+
+FileName ScratchCache::lookupStack(const FileName &fn_stack)
+{
+	// Only particle stacks, and not the copies in the cache itself
+	if (fn_stack.getExtension() != "mrcs" || fn_stack.compare(0, dir_stacks.length(), dir_stacks) == 0)
+		return fn_stack;
+
+	struct stat st;
+	if (stat(fn_stack.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+		return fn_stack;
+
+	// The key of a new (version of a) stack is calculated without holding the lock, as it reads from the stack
+	std::string key = "";
+	pthread_mutex_lock(&mutex);
+	std::map<std::string, Stack>::iterator it = stacks.find(fn_stack);
+	if (it != stacks.end() && it->second.size == st.st_size && it->second.mtime == st.st_mtime)
+		key = it->second.key;
+	pthread_mutex_unlock(&mutex);
+
+	if (key == "")
+		key = makeKey(fn_stack, st.st_size, st.st_mtime);
+	if (key == "")
+		return fn_stack;
+
+	FileName fn_cached = dir_stacks + key + ".mrcs";
+	bool is_cached = exists(fn_cached);
+
+	pthread_mutex_lock(&mutex);
+
+	Stack &stack = stacks[fn_stack];
+	if (stack.key != key || stack.size != st.st_size || stack.mtime != st.st_mtime)
+	{
+		stack.size = st.st_size;
+		stack.mtime = st.st_mtime;
+		stack.key = key;
+		stack.is_touched = stack.is_queued = false;
+	}
+
+	if (is_cached)
+	{
+		// Mark the entry as recently used (once per process is enough for LRU eviction)
+		bool do_touch = !stack.is_touched;
+		stack.is_touched = true;
+		stats.nr_hits++;
+		pthread_mutex_unlock(&mutex);
+		if (do_touch)
+			utime(fn_cached.c_str(), NULL);
+		return fn_cached;
+	}
+
+	stats.nr_misses++;
+	if (!stack.is_queued && !do_stop && stack.size <= max_bytes)
+	{
+		stack.is_queued = true;
+
+		Copy copy;
+		copy.fn_stack = fn_stack;
+		copy.fn_cached = fn_cached;
+		copy.size = stack.size;
+		copy.mtime = stack.mtime;
+		copies.push_back(copy);
+
+		if (!is_thread_running)
+		{
+			if (pthread_create(&thread, NULL, threadMain, (void*)this) == 0)
+				is_thread_running = true;
+			else
+				copies.clear();
+		}
+		pthread_cond_signal(&cond);
+	}
+
+	pthread_mutex_unlock(&mutex);
+
+	return fn_stack;
+}
+
+void ScratchCache::shutDown(bool do_abort_copies)
+{
+	pthread_mutex_lock(&mutex);
+	if (do_stop)
+	{
+		pthread_mutex_unlock(&mutex);
+		return;
+	}
+	do_stop = true;
+	do_abort = do_abort_copies;
+	pthread_cond_signal(&cond);
+	bool do_join = is_thread_running;
+	pthread_mutex_unlock(&mutex);
+
+	if (do_join)
+		pthread_join(thread, NULL);
+
+	// Add the counters of this process to the statistics file
+	if (stats.nr_hits + stats.nr_misses + stats.nr_copies + stats.nr_evictions > 0)
+	{
+		int fd = lockCache();
+		if (fd >= 0)
+		{
+			Statistics total = readStatistics();
+			total.nr_hits += stats.nr_hits;
+			total.nr_misses += stats.nr_misses;
+			total.nr_copies += stats.nr_copies;
+			total.nr_evictions += stats.nr_evictions;
+			total.bytes_copied += stats.bytes_copied;
+			total.bytes_evicted += stats.bytes_evicted;
+
+			FileName fn_tmp = dir + "statistics.tmp";
+			std::ofstream fh(fn_tmp.c_str());
+			fh << "hits " << total.nr_hits << std::endl;
+			fh << "misses " << total.nr_misses << std::endl;
+			fh << "copies " << total.nr_copies << std::endl;
+			fh << "evictions " << total.nr_evictions << std::endl;
+			fh.precision(15);
+			fh << "bytes_copied " << total.bytes_copied << std::endl;
+			fh << "bytes_evicted " << total.bytes_evicted << std::endl;
+			fh.close();
+			if (fh.good())
+				rename(fn_tmp.c_str(), (dir + "statistics").c_str());
+
+			unlockCache(fd);
+		}
+		stats = Statistics();
+	}
+}
+
+void ScratchCache::evict(double max_size)
+{
+	int fd = lockCache();
+	if (fd < 0)
+		REPORT_ERROR("ScratchCache ERROR: cannot lock " + dir);
+	evictLocked(max_size);
+	unlockCache(fd);
+}
+
+double ScratchCache::getSize(long int &nr_entries)
+{
+	double size = 0.;
+	nr_entries = 0;
+
+	DIR *dp = opendir(dir_stacks.c_str());
+	if (dp == NULL)
+		return 0.;
+
+	struct dirent *ep;
+	while ((ep = readdir(dp)) != NULL)
+	{
+		if (ep->d_name[0] == '.')
+			continue;
+		FileName fn = dir_stacks + ep->d_name;
+		struct stat st;
+		if (stat(fn.c_str(), &st) != 0)
+			continue;
+		size += st.st_size;
+		if (fn.getExtension() == "mrcs")
+			nr_entries++;
+	}
+	closedir(dp);
+
+	return size;
+}
+
+ScratchCache::Statistics ScratchCache::readStatistics()
+{
+	Statistics result;
+
+	FileName fn_stats = dir + "statistics";
+	std::ifstream fh(fn_stats.c_str());
+	std::string name;
+	double value;
+	while (fh >> name >> value)
+	{
+		if (name == "hits")
+			result.nr_hits = (long int)value;
+		else if (name == "misses")
+			result.nr_misses = (long int)value;
+		else if (name == "copies")
+			result.nr_copies = (long int)value;
+		else if (name == "evictions")
+			result.nr_evictions = (long int)value;
+		else if (name == "bytes_copied")
+			result.bytes_copied = value;
+		else if (name == "bytes_evicted")
+			result.bytes_evicted = value;
+	}
+
+	return result;
+}
+
+void ScratchCache::resetStatistics()
+{
+	int fd = lockCache();
+	if (fd < 0)
+		REPORT_ERROR("ScratchCache ERROR: cannot lock " + dir);
+	remove((dir + "statistics").c_str());
+	unlockCache(fd);
+}
+
+void* ScratchCache::threadMain(void *data)
+{
+	((ScratchCache*)data)->copyStacks();
+	return NULL;
+}
+
+void ScratchCache::copyStacks()
+{
+	pthread_mutex_lock(&mutex);
+
+	while (true)
+	{
+		if (do_abort || (do_stop && copies.size() == 0))
+			break;
+		if (copies.size() == 0)
+		{
+			pthread_cond_wait(&cond, &mutex);
+			continue;
+		}
+
+		Copy copy = copies.front();
+		copies.pop_front();
+		pthread_mutex_unlock(&mutex);
+
+		copyStack(copy);
+
+		pthread_mutex_lock(&mutex);
+	}
+
+	pthread_mutex_unlock(&mutex);
+}
+
+void ScratchCache::copyStack(const Copy &copy)
+{
+	if (exists(copy.fn_cached))
+		return;
+
+	// Only one process copies a stack, the others keep reading the original until the copy is there
+	FileName fn_lock = dir_locks + copy.fn_cached.getBaseName() + ".lock";
+	int fd_lock = open(fn_lock.c_str(), O_RDWR | O_CREAT, 0666);
+	if (fd_lock < 0)
+		return;
+	fchmod(fd_lock, 0666);
+	if (flock(fd_lock, LOCK_EX | LOCK_NB) != 0 || exists(copy.fn_cached))
+	{
+		close(fd_lock);
+		return;
+	}
+
+	// Make room
+	int fd_cache = lockCache();
+	if (fd_cache >= 0)
+	{
+		evictLocked(max_bytes - copy.size);
+		unlockCache(fd_cache);
+	}
+
+	FileName fn_tmp = copy.fn_cached + ".tmp";
+	int fd_in = open(copy.fn_stack.c_str(), O_RDONLY);
+	int fd_out = open(fn_tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	bool is_ok = (fd_in >= 0 && fd_out >= 0);
+	if (fd_out >= 0)
+		fchmod(fd_out, 0666);
+
+	std::vector<char> buffer(SCRATCH_CACHE_CHUNK_SIZE);
+	off_t nr_copied = 0;
+	while (is_ok)
+	{
+		pthread_mutex_lock(&mutex);
+		bool is_aborted = do_abort;
+		pthread_mutex_unlock(&mutex);
+		if (is_aborted)
+		{
+			is_ok = false;
+			break;
+		}
+
+		ssize_t nr_read = read(fd_in, &buffer[0], buffer.size());
+		if (nr_read < 0 && errno == EINTR)
+			continue;
+		if (nr_read <= 0)
+		{
+			is_ok = (nr_read == 0);
+			break;
+		}
+
+		for (ssize_t done = 0; done < nr_read; )
+		{
+			ssize_t nr_written = write(fd_out, &buffer[done], nr_read - done);
+			if (nr_written < 0 && errno == EINTR)
+				continue;
+			if (nr_written <= 0)
+			{
+				is_ok = false;
+				break;
+			}
+			done += nr_written;
+		}
+		nr_copied += nr_read;
+	}
+
+	// Only keep the copy if the original did not change while it was being copied
+	struct stat st;
+	if (is_ok)
+		is_ok = (fstat(fd_in, &st) == 0 && st.st_size == copy.size && st.st_mtime == copy.mtime && nr_copied == copy.size);
+
+	if (fd_in >= 0)
+		close(fd_in);
+	if (fd_out >= 0 && close(fd_out) != 0)
+		is_ok = false;
+
+	if (is_ok && rename(fn_tmp.c_str(), copy.fn_cached.c_str()) == 0)
+	{
+		pthread_mutex_lock(&mutex);
+		stats.nr_copies++;
+		stats.bytes_copied += copy.size;
+		pthread_mutex_unlock(&mutex);
+	}
+	else
+		remove(fn_tmp.c_str());
+
+	flock(fd_lock, LOCK_UN);
+	close(fd_lock);
+}
+
+int ScratchCache::lockCache()
+{
+	FileName fn_lock = dir + "cache.lock";
+	int fd = open(fn_lock.c_str(), O_RDWR | O_CREAT, 0666);
+	if (fd < 0)
+		return -1;
+	fchmod(fd, 0666);
+
+	while (flock(fd, LOCK_EX) != 0)
+	{
+		if (errno != EINTR)
+		{
+			close(fd);
+			return -1;
+		}
+	}
+
+	return fd;
+}
+
+void ScratchCache::unlockCache(int fd)
+{
+	flock(fd, LOCK_UN);
+	close(fd);
+}
+
+void ScratchCache::evictLocked(double max_size)
+{
+	DIR *dp = opendir(dir_stacks.c_str());
+	if (dp == NULL)
+		return;
+
+	// Time of last use, size and name of every entry
+	std::vector<std::pair<time_t, std::pair<double, FileName> > > entries;
+	double total = 0.;
+	struct dirent *ep;
+	while ((ep = readdir(dp)) != NULL)
+	{
+		if (ep->d_name[0] == '.')
+			continue;
+		FileName fn = dir_stacks + ep->d_name;
+		struct stat st;
+		if (stat(fn.c_str(), &st) != 0)
+			continue;
+
+		if (fn.getExtension() == "tmp")
+		{
+			// Copies in progress count towards the total, copies left behind by a process that died are removed
+			if (isLockFree(dir_locks + fn.getBaseName() + ".lock"))
+				remove(fn.c_str());
+			else
+				total += st.st_size;
+			continue;
+		}
+
+		total += st.st_size;
+		entries.push_back(std::make_pair(st.st_mtime, std::make_pair((double)st.st_size, fn)));
+	}
+	closedir(dp);
+
+	std::sort(entries.begin(), entries.end());
+	for (int i = 0; i < entries.size() && total > max_size; i++)
+	{
+		// Processes that have the stack open can keep reading it
+		if (remove(entries[i].second.second.c_str()) == 0)
+		{
+			total -= entries[i].second.first;
+			pthread_mutex_lock(&mutex);
+			stats.nr_evictions++;
+			stats.bytes_evicted += entries[i].second.first;
+			pthread_mutex_unlock(&mutex);
+		}
+	}
+}
+
+std::string ScratchCache::makeKey(const FileName &fn_stack, off_t size, time_t mtime)
+{
+	FILE *fh = fopen(fn_stack.c_str(), "r");
+	if (fh == NULL)
+		return "";
+
+	// Hash the beginning (with the header), the middle and the end of the stack,
+	// reading all of it would take as long as copying it
+	unsigned long long hash = 14695981039346656037ULL;
+	std::vector<unsigned char> buffer(SCRATCH_CACHE_SAMPLE_SIZE);
+	off_t offsets[3] = {0, size / 2, size - SCRATCH_CACHE_SAMPLE_SIZE};
+	for (int i = 0; i < 3; i++)
+	{
+		off_t offset = XMIPP_MAX(0, offsets[i]);
+		if (fseeko(fh, offset, SEEK_SET) != 0)
+			break;
+		size_t nr_read = fread(&buffer[0], 1, buffer.size(), fh);
+		hashBytes(hash, &buffer[0], nr_read);
+	}
+	fclose(fh);
+
+	char key[64];
+	snprintf(key, sizeof(key), "%016llx_%llx_%llx", hash, (unsigned long long)size, (unsigned long long)mtime);
+
+	return (std::string)key;
+}
@@ -0,0 +1,144 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef SCRATCH_CACHE_H
+#define SCRATCH_CACHE_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <deque>
+#include <map>
+#include <string>
+#include "src/filename.h"
+
+/*	class ScratchCache:
+ *
+ *	- keeps copies of particle stacks (.mrcs) on a node-local scratch disc, shared
+ *	  by all RELION programs (and all MPI processes) that run on the node
+ *	- switched on by setting RELION_SCRATCH_CACHE to a directory on the scratch disc;
+ *	  RELION_SCRATCH_CACHE_GB sets its maximum size (by default all free space but 10 Gb)
+ *	- entries are named after the size, the modification time and a hash of the
+ *	  contents of a stack: the same stack is cached only once, whatever the path it
+ *	  is read through, and a stack that is overwritten is never served from an old copy
+ *	- fImageHandler::openFile() asks lookup() for every stack it opens for reading: a
+ *	  cached copy is used when there is one, otherwise the stack is copied on a
+ *	  background thread and read from its original location in the meantime
+ *	- a stack is copied by one process at a time (flock on a lock file per entry) and
+ *	  the least recently used entries are evicted to stay within the maximum size
+ *	- the numbers of hits, misses, copies and evictions of all processes are added up
+ *	  in a statistics file in the cache directory (see relion_scratch_cache)
+ */
+class ScratchCache
+{
+public:
+
+	struct Statistics
+	{
+		long int nr_hits, nr_misses, nr_copies, nr_evictions;
+		double bytes_copied, bytes_evicted;
+
+		Statistics(): nr_hits(0), nr_misses(0), nr_copies(0), nr_evictions(0), bytes_copied(0.), bytes_evicted(0.) {}
+	};
+
+	// The cache in RELION_SCRATCH_CACHE, or NULL if that variable is not set
+	static ScratchCache* getInstance();
+
+	// The name under which fn_stack should be opened for reading:
+	// its cached copy if there is one, fn_stack itself otherwise
+	static FileName lookup(const FileName &fn_stack);
+
+	// A negative max_Gb takes all free space on the disc but 10 Gb
+	ScratchCache(const FileName &dir, double max_Gb);
+	~ScratchCache();
+
+	FileName lookupStack(const FileName &fn_stack);
+
+	// Wait for the copies in progress to finish (or abort them), and add the statistics of this process to the statistics file
+	void shutDown(bool do_abort_copies);
+
+	// Remove least recently used entries until at most max_size bytes remain in the cache
+	void evict(double max_size);
+
+	// Total size (in bytes) and number of entries in the cache
+	double getSize(long int &nr_entries);
+
+	double getMaxSize() const
+	{
+		return max_bytes;
+	}
+
+	// Statistics of all processes that have used this cache
+	Statistics readStatistics();
+
+	// Set the statistics file to zero
+	void resetStatistics();
+
+private:
+
+	struct Stack
+	{
+		off_t size;
+		time_t mtime;
+		std::string key;
+		bool is_touched, is_queued;
+	};
+
+	struct Copy
+	{
+		FileName fn_stack, fn_cached;
+		off_t size;
+		time_t mtime;
+	};
+
+	// Not copyable
+	ScratchCache(const ScratchCache&);
+	ScratchCache& operator=(const ScratchCache&);
+
+	static void* threadMain(void *data);
+	void copyStacks();
+
+	// Copy one stack into the cache (unless another process does so already)
+	void copyStack(const Copy &copy);
+
+	// Lock and unlock the whole cache (for eviction and the statistics file)
+	int lockCache();
+	void unlockCache(int fd);
+
+	// Remove entries until at most max_size bytes remain (the cache must be locked)
+	void evictLocked(double max_size);
+
+	// The name of an entry, from the size, time stamp and a hash of samples of the contents
+	static std::string makeKey(const FileName &fn_stack, off_t size, time_t mtime);
+
+	FileName dir, dir_stacks, dir_locks;
+	double max_bytes;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t thread;
+	bool is_thread_running, do_stop, do_abort;
+
+	std::map<std::string, Stack> stacks;
+	std::deque<Copy> copies;
+
+	// Counters of this process, not yet added to the statistics file
+	Statistics stats;
+};
+
+#endif
@@ -308,3 +308,11 @@ add_test(NAME GPU-2Dc_tag_helix
         --sigma_psi 3.3333
         --gpu) 
 	
+
+#--------------------------------------------------------------------
+# Self-contained benchmark on synthetic particles (no reference data needed):
+# "make benchmark" writes the timings to test_output/benchmark/benchmark.json
+add_custom_target(benchmark
+        WORKING_DIRECTORY ${PROJECT_BINARY_DIR}/tests
+        COMMAND synthetic_benchmark --o test_output/benchmark/
+        DEPENDS synthetic_benchmark refine reconstruct postprocess)